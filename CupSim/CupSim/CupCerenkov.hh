@@ -0,0 +1,31 @@
+// Cerenkov process with culling and bunching of its photons.
+//
+// G4Cerenkov, except that with /cupscint/qePreCull on the mean number of
+// photons of a step is scaled by CupScintillation::GetPhotonKeepProbability()
+// before it is sampled, and with /cupscint/photonWeight W > 1 one track is
+// made per W photons, with the weight of the W photons it stands for (the
+// last one of the step takes the remainder), as CupScintillation does for
+// scintillation photons.  Photons that are not tracked are never made.
+//
+// In the record mode of CupOpticsReplay it makes no photons, but records
+// the steps above threshold.
+//
+#ifndef CupCerenkov_h
+#define CupCerenkov_h 1
+
+#include "G4Cerenkov.hh"
+#include "globals.hh"
+
+class CupCerenkov : public G4Cerenkov {
+  public:
+    CupCerenkov(const G4String &processName = "Cerenkov", G4ProcessType type = fElectromagnetic);
+    ~CupCerenkov();
+
+    G4VParticleChange *PostStepDoIt(const G4Track &aTrack, const G4Step &aStep);
+
+  private:
+    CupCerenkov(const CupCerenkov &right);
+    CupCerenkov &operator=(const CupCerenkov &right);
+};
+
+#endif
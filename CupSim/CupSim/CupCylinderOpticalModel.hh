@@ -0,0 +1,160 @@
+// CupCylinderOpticalModel.hh
+//
+// Analytic transport of optical photons in a nest of coaxial cylinders
+// (/cupcyl/), e.g. the LSC target in its buffer.
+//
+// The model is a fast simulation of the inner cylinder's region.  A photon
+// in the inner cylinder is taken over and propagated with closed-form
+// ray/cylinder intersections: attenuation, scattering and reemission in
+// each medium as CupOpAttenuation does them, and Fresnel reflection or
+// refraction at the smooth boundary between the inner cylinder and its
+// mother.  Photons leaving into the mother are followed up to a "fence", the
+// largest coaxial cylinder clear of the mother's other daughters (PMTs and
+// their envelopes), and handed back to Geant4 there, which brings them to
+// the PMTs (CupPMTOpticalModel) or the tank wall as before.  Photons
+// reaching the end of the event window are handed back for DeferTrackProc.
+//
+// Anything the model does not recognize is left to Geant4: an inner
+// cylinder or mother that is not a full G4Tubs on a common axis, optical
+// surfaces on the boundary, media without RINDEX, no room for a fence, or
+// optical photon processes other than CupOpAttenuation and the boundary
+// process (e.g. Rayleigh or WLS processes).
+//
+// For validation, /cupcyl/hitMap accumulates the pe per PMT and the total pe
+// of each event of the following runs under a name, and
+// /cupcyl/compareHitMaps compares two of them, e.g. one with and one without
+// /cupcyl/enable: the mean pe PMT by PMT, and the distributions of the total
+// pe per event by a Kolmogorov-Smirnov test.
+
+#ifndef CupCylinderOpticalModel_h
+#define CupCylinderOpticalModel_h 1
+
+#include "G4MaterialPropertyVector.hh"
+#include "G4UImessenger.hh"
+#include "G4VFastSimulationModel.hh"
+#include "globals.hh"
+
+#include <map>
+#include <vector>
+
+class CupHitPMTCollection;
+class CupOpAttenuation;
+class G4Material;
+class G4UIcommand;
+class G4UIcmdWithABool;
+class G4UIcmdWithAString;
+class G4UIdirectory;
+class G4VPhysicalVolume;
+
+class CupCylinderOpticalModel : public G4VFastSimulationModel {
+  public:
+    // inner_phys: the inner cylinder, whose logical volume must be the root
+    // of its own region
+    CupCylinderOpticalModel(const G4String &modelName, G4VPhysicalVolume *inner_phys);
+    ~CupCylinderOpticalModel();
+
+    G4bool IsApplicable(const G4ParticleDefinition &);
+    G4bool ModelTrigger(const G4FastTrack &);
+    void DoIt(const G4FastTrack &, G4FastStep &);
+
+    // creates the /cupcyl/ commands, once, on the master thread
+    static void CreateMessenger();
+
+    // from CupVEventAction: adds the pe of an event to the hit map recorded
+    static G4bool IsRecordingHitMap() { return !fgHitMapName.empty(); }
+    static void RecordHitMap(CupHitPMTCollection *hits);
+    // from CupRunAction: merges the threads' hit maps
+    static void EndOfRun();
+
+  private:
+    // a cylinder on the z axis of the inner cylinder's frame
+    struct Cylinder {
+        G4double radius;
+        G4double halfLength;
+        G4double z0; // of the center
+    };
+
+    // the optical properties of a medium, resolved once per run
+    struct Medium {
+        G4int materialIndex;
+        G4MaterialPropertyVector *rindex;
+        G4MaterialPropertyVector *groupVelocity; // GROUPVEL, or c/RINDEX if none
+        G4MaterialPropertyVector *absLength;
+        G4MaterialPropertyVector *scatFrac;
+        G4bool reemits; // has a WLSSPECTRUM
+        G4double reemissionProbability;
+        G4double reemissionTime;
+
+        G4double GetVelocity(G4double energy) const;
+    };
+
+    // pe per PMT ID, summed over events, and the total pe of each event
+    struct HitMap {
+        G4double events;
+        std::vector<G4double> pe;
+        std::vector<G4double> pe2; // sum of squares
+        std::vector<G4double> eventPe;
+
+        HitMap() : events(0.) {}
+        void Add(const HitMap &other);
+    };
+
+    G4bool RecognizeGeometry();
+    G4bool RecognizePhysics();
+    static G4bool MakeMedium(const G4Material *material, Medium &medium);
+
+    // the part pos + t dir, tIn <= t <= tOut, of a ray in the cylinder, and
+    // the sides it enters and leaves by (0 wall, +1 top, -1 bottom); false
+    // if the ray misses the cylinder
+    static G4bool Clip(const Cylinder &cylinder, const G4ThreeVector &pos,
+                       const G4ThreeVector &dir, G4double &tIn, G4double &tOut, G4int &sideIn,
+                       G4int &sideOut);
+    static G4ThreeVector GetNormal(const G4ThreeVector &point, G4int side);
+    // reflection or refraction at a smooth boundary between indices n1 and
+    // n2; true if the photon is transmitted
+    static G4bool Fresnel(G4double n1, G4double n2, G4ThreeVector normal, G4ThreeVector &dir,
+                          G4ThreeVector &pol);
+
+    static void CompareHitMaps(const G4String &nameA, const G4String &nameB);
+
+    // per model, on the thread that built it
+    G4VPhysicalVolume *fInnerPhys;
+    G4bool fGeometryRecognized;
+    G4bool fPhysicsRecognized;
+    G4bool fWarned;
+    G4int fRunID; // the physics was checked for
+    Cylinder fInner;
+    Cylinder fFence;
+    Medium fInnerMedium;
+    Medium fOuterMedium;
+    CupOpAttenuation *fAttenuation;
+    G4bool fTimeLimited; // DeferTrackProc is active
+    G4double fSurfaceTolerance;
+
+    static G4ThreadLocal HitMap *fgThreadHitMap;
+
+    // shared by all threads; only changed between runs
+    static G4bool fgEnabled;
+    static G4String fgHitMapName;
+    static std::map<G4String, HitMap> fgHitMaps;
+
+    class Messenger;
+    static Messenger *fgMessenger;
+};
+
+class CupCylinderOpticalModel::Messenger : public G4UImessenger {
+  public:
+    Messenger();
+    ~Messenger();
+
+    void SetNewValue(G4UIcommand *command, G4String newValue);
+    G4String GetCurrentValue(G4UIcommand *command);
+
+  private:
+    G4UIdirectory *fCylDir;
+    G4UIcmdWithABool *fEnableCmd;
+    G4UIcmdWithAString *fHitMapCmd;
+    G4UIcommand *fCompareCmd;
+};
+
+#endif
@@ -28,6 +28,8 @@ class CupDebugMessenger : public G4UImessenger {
     G4UIcommand *seedcmd;
     G4UIcommand *neutcmd;
     G4UIcommand *runIDcmd;
+    G4UIcommand *hitmergecmd;
+    G4UIcommand *scintgencmd;
 #ifdef G4DEBUG
     G4UIcommand *illucmd;
 #endif
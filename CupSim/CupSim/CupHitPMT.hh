@@ -17,21 +17,33 @@ class CupHitPMT {
     ~CupHitPMT();
 
     void Clear();
-    void DetectPhoton(CupHitPhoton *);
+    void DetectPhoton(const CupHitPhoton &);
     void SortTimeAscending();
 
     int GetID() const { return fID; }
-    int GetEntries() const { return fPhotons.size(); }
-    CupHitPhoton *GetPhoton(int i) const { return fPhotons[i]; }
+    int GetEntries() const { return fPhotons.size() + fPending.size(); }
+    // valid after SortTimeAscending(), which folds in pending photons
+    const CupHitPhoton *GetPhoton(int i) const { return &fPhotons[i]; }
 
     void Print(std::ostream &, bool fullDetailsMode = false);
 
     static const size_t kApproxMaxIndividualHitPhotonsPerPMT;
     static const double kMergeTime;
+    static const size_t kMaxPendingHitPhotons;
 
   private:
+    void FlushPending();
+
     int fID;
-    std::vector<CupHitPhoton *> fPhotons;
+    // stored by value: the vector's capacity is kept by Clear(), so after
+    // the first few events no memory is allocated or freed per hit
+    std::vector<CupHitPhoton> fPhotons;
+    // once merging has started, fPhotons is kept sorted by time and new
+    // (unmerged) HitPhotons collect in the small unsorted fPending buffer
+    // until it is folded into fPhotons in one linear merge
+    bool fMerging;
+    std::vector<CupHitPhoton> fPending;
+    std::vector<CupHitPhoton> fMergeBuffer;
 };
 
 /** comparison function for sorting CupHitPMT pointers
@@ -2,7 +2,6 @@
 #define __CupHitPMTCollection_hh__
 
 #include "CupHitPMT.hh"
-#include <map>
 #include <vector>
 
 #include "G4ThreeVector.hh"
@@ -14,7 +13,8 @@ class CupHitPMTCollection {
     virtual ~CupHitPMTCollection();
 
     void Clear();
-    void DetectPhoton(CupHitPhoton *);
+    void Reserve(int nID);
+    void DetectPhoton(const CupHitPhoton &);
     void SortTimeAscending();
     int GetEntries() const;
     CupHitPMT *GetPMT(int i) const;
@@ -23,8 +23,9 @@ class CupHitPMTCollection {
     void Print(std::ostream &) const;
 
   private:
-    std::vector<CupHitPMT *> fPMT;
-    std::map<short, CupHitPMT *> fHitmap;
+    std::vector<CupHitPMT *> fPMT;      // PMTs hit in this event, in order of first hit
+    std::vector<CupHitPMT *> fPMTByID;  // one HitPMT per PMT ID, kept across events
+
 };
 
 #endif // __CupHitPMTCollection_hh__
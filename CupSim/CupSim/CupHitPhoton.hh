@@ -74,4 +74,10 @@ inline bool Compare_HitPhotonPtr_TimeAscending(const CupHitPhoton *a, const CupH
     return a->GetTime() < b->GetTime();
 }
 
+/** comparison function for sorting CupHitPhotons stored by value
+ */
+inline bool Compare_HitPhoton_TimeAscending(const CupHitPhoton &a, const CupHitPhoton &b) {
+    return a.GetTime() < b.GetTime();
+}
+
 #endif // __CupHitPhoton_hh__
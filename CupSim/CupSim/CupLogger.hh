@@ -0,0 +1,64 @@
+// CupLogger.hh
+//
+// Leveled output for the event loop.  Per-event and per-hit prints use
+//   CUPLOG(CupLogger::kLogDetail, "edep= " << edep);
+// instead of writing to G4cout directly.  Levels:
+//   kLogEvent  (1): a line or two per event (event number, hit count)
+//   kLogDetail (2): per-event details (primaries, energies, PMT counts)
+//   kLogHit    (3): one line per hit photon
+// The runtime level is set with /cuplog/level (default kLogEvent).
+// Levels above CUPSIM_LOG_MAXLEVEL are compiled out entirely; release
+// (NDEBUG) builds default to 0, i.e. no event-loop output at all.
+
+#ifndef CupLogger_h
+#define CupLogger_h 1
+
+#include "G4UImessenger.hh"
+#include "G4ios.hh"
+#include "globals.hh"
+
+#ifndef CUPSIM_LOG_MAXLEVEL
+#ifdef NDEBUG
+#define CUPSIM_LOG_MAXLEVEL 0
+#else
+#define CUPSIM_LOG_MAXLEVEL 3
+#endif
+#endif
+
+class G4UIdirectory;
+class G4UIcmdWithAnInteger;
+
+class CupLogger : public G4UImessenger {
+  public:
+    enum { kLogSilent = 0, kLogEvent = 1, kLogDetail = 2, kLogHit = 3 };
+
+    static G4int GetLevel() { return fgLevel; }
+    static void SetLevel(G4int level) { fgLevel = level; }
+    static G4bool IsActive(G4int level) { return level <= fgLevel; }
+
+    // creates the /cuplog/ commands, once, on the master thread
+    static void CreateMessenger();
+
+    void SetNewValue(G4UIcommand *command, G4String newValue);
+    G4String GetCurrentValue(G4UIcommand *command);
+
+  private:
+    CupLogger();
+    ~CupLogger();
+
+    // shared by all threads; only changed between runs
+    static G4int fgLevel;
+    static CupLogger *fgMessenger;
+
+    G4UIdirectory *fLogDir;
+    G4UIcmdWithAnInteger *fLevelCmd;
+};
+
+#define CUPLOG(level, msg)                                                                         \
+    do {                                                                                           \
+        if ((level) <= CUPSIM_LOG_MAXLEVEL && CupLogger::IsActive(level)) {                        \
+            G4cout << msg << G4endl;                                                               \
+        }                                                                                          \
+    } while (0)
+
+#endif
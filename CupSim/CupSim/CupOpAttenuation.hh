@@ -13,7 +13,7 @@
 #include "globals.hh"
 #include "templates.hh"
 
-class G4VWLSTimeGeneratorProfile;
+#include <vector>
 
 class CupOpAttenuation : public G4VDiscreteProcess {
   public:
@@ -43,12 +43,54 @@ class CupOpAttenuation : public G4VDiscreteProcess {
     // Prints the WLS integral table.
     void DumpPhysicsTable() const;
 
-    // Selects the time profile generator
+    // Selects the time profile of the reemission, "delta" or "exponential"
     void UseTimeProfile(const G4String name);
 
+    // The pieces of PostStepDoIt, for models that track optical photons
+    // themselves (CupCylinderOpticalModel):
+    // direction and polarization after scattering (OPSCATFRAC)
+    static void SampleScattering(const G4ThreeVector &momentum, const G4ThreeVector &polarization,
+                                 G4ThreeVector &newMomentum, G4ThreeVector &newPolarization);
+    // energy of a photon reemitted in the material of this index, below
+    // primaryEnergy; false if none was found
+    G4bool SampleReemissionEnergy(G4int materialIndex, G4double primaryEnergy, G4double &energy);
+    // delay of the reemission, with the selected time profile
+    G4double SampleReemissionDelay(G4double timeConstant) const;
+    // isotropic direction and random polarization of a reemitted photon
+    static void SampleReemissionDirection(G4ThreeVector &momentum, G4ThreeVector &polarization);
+
   protected:
-    G4VWLSTimeGeneratorProfile *WLSTimeGeneratorProfile;
     G4PhysicsTable *theIntegralTable;
+
+  private:
+    enum { kTimeProfileDelta, kTimeProfileExponential };
+
+    // The optical properties of a material, resolved once instead of looked
+    // up by name for every photon
+    struct MaterialOptics {
+        G4bool hasProperties;
+        G4MaterialPropertyVector *absLength;
+        G4MaterialPropertyVector *scatFrac;
+        G4bool reemits;                 // has a WLSSPECTRUM
+        G4double reemissionProbability; // WLSPROBABILITY, 1 if not set
+        G4double reemissionTime;        // WLSTIMECONSTANT, 0 if not set
+        // alias table of the WLSSPECTRUM bins, sampled uniformly within a bin
+        // as the integral table is
+        std::vector<G4double> binEdges;
+        std::vector<G4double> aliasProbability;
+        std::vector<G4int> alias;
+    };
+
+    // resolves the properties of all materials again; the optical scan
+    // changes them between runs (CupOpticalScan::GetPropertyVersion)
+    void ResolveMaterials();
+    static void BuildAliasTable(const G4MaterialPropertyVector *spectrum,
+                                MaterialOptics &optics);
+    const MaterialOptics &GetMaterialOptics(G4int materialIndex);
+
+    std::vector<MaterialOptics> fMaterialOptics;
+    G4int fPropertyVersion;
+    G4int fTimeProfile;
 };
 
 inline G4bool CupOpAttenuation::IsApplicable(const G4ParticleDefinition &aParticleType) {
@@ -0,0 +1,170 @@
+// CupOpticalMap.hh
+//
+// Optical detection-probability map of a scintillator volume (/cupmap/).
+//
+// The volume's bounding box is divided into nx x ny x nz voxels.  For every
+// voxel and PMT the map holds the mean number of pe per photon emitted in
+// the voxel, and the distribution of the delay between emission and hit,
+// either as a histogram of nTimeBins bins or (nTimeBins 0) as its mean.
+//
+// Generator mode (/cupmap/generate file): events of optical photons from
+// one point, e.g. the gun with opticalphoton and a multiplicity, positioned
+// to fill the volume, are tracked in full.  At the end of each event the
+// PMT hits are added to the voxel of the vertex, in one set of sums shared
+// by all threads, and at the end of each run the sums are written to the
+// file.  Sums already in the file (of the same volume, grid, PMTs and time
+// binning) are added to, so a map can be filled by several runs or jobs.
+//
+// Fast-sim mode (/cupmap/load file): CupScintillation hands the photons of
+// every step in the volume to DetectPhotons instead of generating them.
+// The mean number of pe is interpolated trilinearly between the centres of
+// the voxels around the middle of the step, and each pe takes its PMT and
+// delay from one of the voxels around its own emission point, drawn with
+// the interpolation weights.  The pe are put on the PMT sensitive detector
+// like the hits of CupPMTOpticalModel, with the emission time profile and
+// energy spectrum of the scintillator, so no optical track is made.  The
+// map holds no hit position, direction or polarization, so these are zero
+// in the hits.  Voxels no photon was generated from are left out of the
+// interpolation; steps with none around them give no pe.
+
+#ifndef CupOpticalMap_h
+#define CupOpticalMap_h 1
+
+#include "CupSim/CupScintillation.hh"
+
+#include "G4ThreeVector.hh"
+#include "G4UImessenger.hh"
+#include "globals.hh"
+
+#include <vector>
+
+class CupHitPMTCollection;
+class CupPMTSD;
+class G4Event;
+class G4UIcommand;
+class G4UIcmdWithAString;
+class G4UIcmdWithoutParameter;
+class G4UIdirectory;
+class G4VPhysicalVolume;
+
+class CupOpticalMap {
+  public:
+    enum { kModeOff, kModeGenerate, kModeFastSim };
+    static G4int GetMode() { return fgMode; }
+
+    // the instance of the calling thread
+    static CupOpticalMap *GetInstance();
+
+    // creates the /cupmap/ commands, once, on the master thread
+    static void CreateMessenger();
+
+    // from CupRunAction: set up the sums of the generator mode, and merge
+    // and write them
+    static void BeginOfRun();
+    static void EndOfRun();
+
+    // generator mode: adds the hits of an event to the voxel of its vertex
+    void RecordEvent(const G4Event *anEvent, CupHitPMTCollection *hits);
+
+    // fast-sim mode: makes the pe of num photons of a step; false if the
+    // step is not in the map volume (the photons are then generated)
+    G4bool DetectPhotons(const CupScintillation::PhotonOrigin &origin, G4int num,
+                         const CupScintillation::SpectrumSampler &spectrum, G4double decayTime,
+                         G4double riseTime);
+
+  private:
+    CupOpticalMap();
+    ~CupOpticalMap();
+
+    // voxels, PMTs and time bins of a map
+    struct Layout {
+        G4String volume;
+        G4int nx, ny, nz;
+        G4ThreeVector lo, hi; // global bounding box of the volume
+        G4int nPMT, pmtOffset;
+        G4int nTimeBins;
+        G4double timeBinWidth;
+
+        G4int GetNumberOfVoxels() const { return nx * ny * nz; }
+        G4int GetVoxel(const G4ThreeVector &position) const; // -1 if outside
+        // the 8 voxels whose centres surround position and their trilinear
+        // weights, clamped to the grid; false if position is outside
+        G4bool GetNeighbours(const G4ThreeVector &position, G4int voxels[8],
+                             G4double weights[8]) const;
+        G4bool operator==(const Layout &other) const;
+    };
+
+    // what the generator mode accumulates, and the map file holds
+    struct Sums {
+        Layout layout;
+        std::vector<G4double> emitted; // photons, per voxel
+        std::vector<G4double> pe;      // per voxel and PMT
+        std::vector<G4double> delay;   // sum of pe * delay, per voxel and PMT
+        std::vector<G4double> time;    // pe per voxel, PMT and time bin
+
+        void Reset(const Layout &aLayout);
+        G4bool Read(const G4String &fileName);
+        G4bool Write(const G4String &fileName) const;
+    };
+
+    // the map, in the form the fast-sim mode samples it
+    struct Map {
+        Layout layout;
+        std::vector<G4bool> filled;        // per voxel
+        std::vector<G4double> pePerPhoton; // per voxel
+        std::vector<float> pmtCdf;         // per voxel and PMT
+        std::vector<float> meanDelay;      // per voxel and PMT
+        std::vector<float> timeCdf;        // per voxel, PMT and time bin
+
+        void Build(const Sums &sums);
+        // pe per photon at position, interpolated between the filled voxels
+        // around it, and the probability of each of them to give a pe
+        G4double GetPePerPhoton(const G4ThreeVector &position, G4int voxels[8],
+                                G4double probabilities[8]) const;
+    };
+
+    static G4bool MakeLayout(Layout &layout);
+    static void Load(const G4String &fileName);
+
+    // per thread
+    const G4VPhysicalVolume *fVolume; // fast-sim mode, resolved for fMapVersion
+    CupPMTSD *fPMTSD;
+    G4int fMapVersion;
+    G4int fEmptyVoxelSteps;
+    CupScintillation::PhotonBatch fPhotonBatch;
+
+    static G4ThreadLocal CupOpticalMap *fgInstance;
+
+    // shared by all threads; only changed between runs
+    static G4int fgMode;
+    static G4String fgFileName;
+    static Layout fgLayout; // volume, grid and time bins to use
+    static G4String fgPMTSDName;
+    static Sums *fgSums; // generator mode, filled by all threads under a lock
+    static Map *fgMap;   // fast-sim mode
+    static G4int fgMapVersion;
+
+    class Messenger;
+    static Messenger *fgMessenger;
+};
+
+class CupOpticalMap::Messenger : public G4UImessenger {
+  public:
+    Messenger();
+    ~Messenger();
+
+    void SetNewValue(G4UIcommand *command, G4String newValue);
+    G4String GetCurrentValue(G4UIcommand *command);
+
+  private:
+    G4UIdirectory *fMapDir;
+    G4UIcmdWithAString *fVolumeCmd;
+    G4UIcommand *fGridCmd;
+    G4UIcommand *fTimeBinsCmd;
+    G4UIcmdWithAString *fPMTSDCmd;
+    G4UIcmdWithAString *fGenerateCmd;
+    G4UIcmdWithAString *fLoadCmd;
+    G4UIcmdWithoutParameter *fOffCmd;
+};
+
+#endif
@@ -0,0 +1,111 @@
+// CupOpticalScan.hh
+//
+// Optical-parameter scan (/cupscan/): K optical configurations run against
+// the same energy deposits in one job, each to its own output file.
+//
+// A configuration is a name and a list of settings made before its run:
+// UI commands (e.g. /PMTOpticalModel/luxlevel 1, /PMTOpticalModel/qeScale
+// 0.9), scale factors of material property vectors (e.g. ABSLENGTH x 0.8)
+// and values of material constants (e.g. WLSPROBABILITY).  /cupscan/run
+// replays a file of steps recorded with /cupreplay/record once per
+// configuration, so the deposits are made once and only the optics is
+// tracked K times, with the physics tables of the first run.
+//
+// Property vectors are scaled in place and constants set in the material
+// properties table, from values saved the first time a scan touches them
+// and restored before every configuration and after the scan, so each
+// configuration starts from the detector as built.  Only the properties
+// the processes read as they track, or rebuild from when GetPropertyVersion
+// changes, can be scanned (see kScannableVectors and kScannableConstants:
+// attenuation and reemission, scintillation yields, spectra and times, and
+// the photocathode); others, e.g. RINDEX, which the Cerenkov tables and
+// GROUPVEL are made from, are refused.  The commands of /cupscan/apply are
+// undone the same way, by applying their current values from before the
+// scan again, so they must be commands that report one.
+
+#ifndef CupOpticalScan_h
+#define CupOpticalScan_h 1
+
+#include "G4MaterialPropertiesTable.hh"
+#include "G4UImessenger.hh"
+#include "globals.hh"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+class G4UIcommand;
+class G4UIcmdWithAString;
+class G4UIcmdWithoutParameter;
+class G4UIdirectory;
+
+class CupOpticalScan {
+  public:
+    // creates the /cupscan/ commands, once, on the master thread
+    static void CreateMessenger();
+
+    // changes whenever the scan changes material properties, for processes
+    // that resolve them once to know when to do it again
+    static G4int GetPropertyVersion() { return fgPropertyVersion; }
+
+  private:
+    enum { kCommand, kScaleProperty, kConstProperty };
+
+    // one setting of a configuration
+    struct Setting {
+        G4int kind;
+        G4String command;  // kCommand
+        G4String material; // kScaleProperty, kConstProperty
+        G4String property;
+        G4double value; // scale factor or constant
+    };
+
+    struct Configuration {
+        G4String name;
+        std::vector<Setting> settings;
+    };
+
+    // a material constant as it was before the scan
+    struct ConstBaseline {
+        G4bool exists;
+        G4double value;
+    };
+
+    static G4MaterialPropertiesTable *GetPropertiesTable(const G4String &material);
+    static G4bool IsScannable(const Setting &setting);
+    static G4bool SaveCommandBaselines();
+    static G4bool Apply(const Setting &setting);
+    static void Restore();
+    static void Run(const G4String &stepsFile, G4int nEvents, const G4String &outputBase);
+
+    // shared by all threads; only changed between runs
+    static std::vector<Configuration> fgConfigurations;
+    static std::map<G4MaterialPropertyVector *, std::vector<G4double>> fgVectorBaselines;
+    static std::map<std::pair<G4String, G4String>, ConstBaseline> fgConstBaselines;
+    // current value of each command path of /cupscan/apply, during a scan
+    static std::map<G4String, G4String> fgCommandBaselines;
+    static G4int fgPropertyVersion;
+
+    class Messenger;
+    static Messenger *fgMessenger;
+};
+
+class CupOpticalScan::Messenger : public G4UImessenger {
+  public:
+    Messenger();
+    ~Messenger();
+
+    void SetNewValue(G4UIcommand *command, G4String newValue);
+    G4String GetCurrentValue(G4UIcommand *command);
+
+  private:
+    G4UIdirectory *fScanDir;
+    G4UIcmdWithAString *fConfigCmd;
+    G4UIcmdWithAString *fApplyCmd;
+    G4UIcommand *fScalePropertyCmd;
+    G4UIcommand *fConstPropertyCmd;
+    G4UIcmdWithoutParameter *fClearCmd;
+    G4UIcommand *fRunCmd;
+};
+
+#endif
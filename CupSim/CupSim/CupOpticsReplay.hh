@@ -0,0 +1,168 @@
+// CupOpticsReplay.hh
+//
+// Two-stage simulation: record the energy deposits once, replay the optics
+// as often as the optical configuration changes (/cupreplay/).
+//
+// Record mode (/cupreplay/record file): the scintillation and Cerenkov
+// processes make no photons.  Instead each step they would have made
+// photons from is kept: every step with a deposit in a scintillator, and
+// every step of a charged particle in a material with a RINDEX, whatever
+// its speed, so the Cerenkov threshold is that of the replay run.  A step
+// is stored as its pre-step point, displacement, time, deposit, quenched
+// deposit, particle (PDG code, for the particle class and charge) and beta
+// at both ends.  The steps of an event are written to the file at its end,
+// under its run and event IDs.
+//
+// Replay mode (/cupreplay/replay file): the events of the file are taken
+// in the order of their run and event IDs, whatever order the threads
+// wrote them in, and event i of the replay runs (counted across them)
+// replays the i-th, so which thread replays an event does not matter.
+// The primary generator makes only a geantino standing for the event,
+// which CupStackingAction swaps for the optical photons the Scintillation
+// and Cerenkov processes of the current physics list make from the
+// recorded steps, so nothing but optical photons is tracked: no primary
+// generation, EM showers or radioactive decay.  The recorded quenched
+// deposit is used in place of the Birks quenching of the replayed step;
+// yields, spectra, time constants and everything the photons meet on
+// their way are those of the replay run.  The run is aborted when the file
+// runs out of events.
+
+#ifndef CupOpticsReplay_h
+#define CupOpticsReplay_h 1
+
+#include "G4Step.hh"
+#include "G4TrackVector.hh"
+#include "G4UImessenger.hh"
+#include "globals.hh"
+
+#include <fstream>
+#include <map>
+#include <vector>
+
+class G4Event;
+class G4Navigator;
+class G4ParticleDefinition;
+class G4Track;
+class G4UIcommand;
+class G4UIcmdWithAString;
+class G4UIcmdWithoutParameter;
+class G4UIdirectory;
+class G4VParticleChange;
+class G4VProcess;
+
+class CupOpticsReplay {
+  public:
+    enum { kModeOff, kModeRecord, kModeReplay };
+    static G4int GetMode() { return fgMode; }
+
+    // the instance of the calling thread
+    static CupOpticsReplay *GetInstance();
+
+    // creates the /cupreplay/ commands, once, on the master thread
+    static void CreateMessenger();
+
+    // from CupRunAction: flushes the file and prints the event count
+    static void EndOfRun();
+
+    // record mode, from the Scintillation process (with the quenched
+    // deposit) and the Cerenkov process (visibleEnergy < 0: not known) of
+    // each step; a step seen by both is stored once
+    void RecordStep(const G4Step &aStep, G4double visibleEnergy);
+    void RecordCerenkovStep(const G4Step &aStep);
+    // from CupVEventAction: writes the steps of the event
+    void EndOfEvent();
+
+    // replay mode, from CupPrimaryGeneratorAction: reads the next event of
+    // the file and adds its geantino to anEvent
+    void GeneratePrimaries(G4Event *anEvent);
+    // from CupStackingAction, for the geantino: stacks the optical photons
+    // of the next recorded steps as its secondaries, at least
+    // /cupscint/maxPhotonsPerStep of them if that is set, else of all
+    // steps; returns true if steps are left for the next stage
+    G4bool StackPhotons(const G4Track *carrier);
+
+  private:
+    CupOpticsReplay();
+    ~CupOpticsReplay();
+
+    // one recorded step, as it is in the file
+    struct StepRecord {
+        G4double time;      // of the pre-step point [ns]
+        float position[3];  // pre-step point [mm]
+        float delta[3];     // to the post-step point [mm]
+        float edep;         // [MeV]
+        float visibleEdep;  // quenched [MeV]
+        float beta0, beta1; // at the pre- and post-step point
+        G4int pdg;
+    };
+
+    // the processes of a particle to replay its steps with
+    struct Processes {
+        G4VProcess *scintillation;
+        G4VProcess *cerenkov;
+    };
+
+    const G4ParticleDefinition *GetParticle(G4int pdg);
+    const Processes &GetProcesses(const G4ParticleDefinition *pDef);
+    void ReplayStep(const StepRecord &record, const G4Track *carrier);
+    void TakePhotons(G4VProcess *process, G4VParticleChange *change, const G4Track *carrier);
+
+    static G4bool IsInRindexMaterial(const G4Step &aStep);
+    static G4bool IndexEvents();
+    static void Close();
+
+    // per thread
+    std::vector<StepRecord> fSteps; // of the current event
+    size_t fNextStep;               // replay mode: the first not replayed yet
+    const G4Track *fLastTrack;      // the step last recorded
+    G4int fLastTrackID;
+    G4int fLastStepNumber;
+    std::map<G4int, const G4ParticleDefinition *> fParticles;
+    std::map<const G4ParticleDefinition *, Processes> fProcesses;
+    G4Navigator *fNavigator;
+    G4Step fStep; // the replayed step
+    G4TrackVector fPhotons;
+
+    static G4ThreadLocal CupOpticsReplay *fgInstance;
+
+    // shared by all threads
+    static G4int fgMode;
+    static G4String fgFileName;
+    static std::ofstream fgOutput; // record mode
+    static std::ifstream fgInput;  // replay mode
+    static G4int fgEvents;         // written or read in this run
+    static G4double fgSteps;
+
+    // replay mode: the events of the file, in order of run and event ID
+    struct EventEntry {
+        G4int runID;
+        G4int eventID;
+        G4int nSteps;
+        std::streamoff offset; // of the first step
+        bool operator<(const EventEntry &other) const {
+            return runID < other.runID || (runID == other.runID && eventID < other.eventID);
+        }
+    };
+    static std::vector<EventEntry> fgEventIndex;
+    static size_t fgFirstEvent; // of the current run
+
+    class Messenger;
+    static Messenger *fgMessenger;
+};
+
+class CupOpticsReplay::Messenger : public G4UImessenger {
+  public:
+    Messenger();
+    ~Messenger();
+
+    void SetNewValue(G4UIcommand *command, G4String newValue);
+    G4String GetCurrentValue(G4UIcommand *command);
+
+  private:
+    G4UIdirectory *fReplayDir;
+    G4UIcmdWithAString *fRecordCmd;
+    G4UIcmdWithAString *fReplayCmd;
+    G4UIcmdWithoutParameter *fOffCmd;
+};
+
+#endif
@@ -7,8 +7,16 @@
 #include "G4VFastSimulationModel.hh"
 #include "G4VPhysicalVolume.hh"
 
+#include "CupSim/CupOpticalScan.hh"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
 class G4UIcommand;
 class G4UIdirectory;
+class G4VProcess;
 
 class CupPMTOpticalModel : public G4VFastSimulationModel, public G4UImessenger {
   public:
@@ -32,6 +40,23 @@ class CupPMTOpticalModel : public G4VFastSimulationModel, public G4UImessenger {
     void SetNewValue(G4UIcommand *command, G4String newValues);
     G4String GetCurrentValue(G4UIcommand *command);
 
+    // Number of pe made by an optical track of the given weight (number of
+    // photons) meeting the photocathode with absorption probability A; an
+    // absorbed photon makes a pe with probability collection_eff (at most 1).
+    // The absorbed photons are subtracted from weight; the rest of the track
+    // goes on as a whole.
+    static G4int SamplePhotoelectrons(G4int &weight, G4double A, G4double collection_eff);
+
+    // highest pe probability of a photon absorbed in the photocathode of the
+    // models built on this thread (0 if there are none), with
+    // /PMTOpticalModel/qeScale and the current luxlevel; see /cupscint/qePreCull
+    static G4double GetMaxCollectionEfficiency() {
+        if (_luxlevel == 1) return 1.0; // every absorbed photon makes a pe
+        UpdateProperties();
+        G4double maxEff = (_luxlevel <= 0) ? fgMaxEfficiency : fgMaxCollectionEff;
+        return std::min(1.0, maxEff * _qeScale);
+    }
+
   private:
     // material property vector pointers, initialized in constructor,
     // so we don't have to look them up every time DoIt is called.
@@ -47,27 +72,65 @@ class CupPMTOpticalModel : public G4VFastSimulationModel, public G4UImessenger {
     G4VSolid *_inner1_solid;
     G4VPhysicalVolume *_inner1_phys;
 
+    // per-model context, so DoIt() costs little more than the geometry:
+    G4double fSurfaceTolerance; // G4GeometryTolerance surface tolerance
+    G4int fEnvelopeDepth;       // touchable depth at which the envelope was last found
+    // creator process -> processTag, filled as processes are seen
+    std::vector<std::pair<const G4VProcess *, G4int>> fProcessTags;
+    // glass and photocathode properties at the union of their energy nodes
+    enum {
+        kGlassRindex,
+        kCathodeRindex,
+        kCathodeKindex,
+        kCathodeEfficiency,
+        kNSpectrum
+    };
+    std::vector<G4double> fSpectrumEnergy;
+    std::vector<G4double> fSpectrum; // kNSpectrum values per energy node
+
     // "luxury level" -- how fancy should the optical model be?
-    G4int _luxlevel;
+    // (one per thread, shared by the models of all PMT types, since the
+    // commands are only bound to the first model built on the thread)
+    static G4ThreadLocal G4int _luxlevel;
+
+    // factor on the photocathode efficiency, e.g. for a scan (/cupscan/)
+    static G4ThreadLocal G4double _qeScale;
 
     // verbose level -- how verbose to be (diagnostics and such)
-    G4int _verbosity;
+    static G4ThreadLocal G4int _verbosity;
+
+    // directory for commands (one per thread: each worker builds its own models)
+    static G4ThreadLocal G4UIdirectory *fgCmdDir;
 
-    // directory for commands
-    static G4UIdirectory *fgCmdDir;
+    // maximum of the EFFICIENCY of all models on this thread, and of the
+    // EFFICIENCY over the absorption at normal incidence (the pe probability
+    // of an absorbed photon in the thin-film model)
+    static G4ThreadLocal G4double fgMaxEfficiency;
+    static G4ThreadLocal G4double fgMaxCollectionEff;
+
+    // the models built on this thread, rebuilt (BuildSpectrum(), and the
+    // luxlevel 4 tables on demand) when CupOpticalScan changes the glass or
+    // photocathode properties
+    static void UpdateProperties() {
+        if (fgPropertyVersion != CupOpticalScan::GetPropertyVersion()) RebuildModels();
+    }
+    static void RebuildModels();
+    static G4ThreadLocal std::vector<CupPMTOpticalModel *> *fgModels;
+    static G4ThreadLocal G4int fgPropertyVersion;
 
     // "current values" of many parameters, for efficiency
     // [I claim it is quicker to access these than to
     // push them on the stack when calling CalculateCoefficients, Reflect, etc.]
     // The following are set by DoIt() prior to any CalculateCoefficients() call.
-    G4double _photon_energy; // energy of current photon
-    G4double _wavelength;    // wavelength of current photon
-    G4double _n1;            // index of refraction of curr. medium at wavelength
-    G4double _n2, _k2;       // index of refraction of photocathode at wavelength
-    G4double _n3;            // index of refraction of far side at wavelength
-    G4double _efficiency;    // efficiency of photocathode at wavelength (?)
-    G4double _thickness;     // thickness of photocathode at current position
-    G4double _cos_theta1;    // cosine of angle of incidence
+    G4double _photon_energy;    // energy of current photon
+    G4double _wavelength;       // wavelength of current photon
+    G4double _n1;               // index of refraction of curr. medium at wavelength
+    G4double _n2, _k2;          // index of refraction of photocathode at wavelength
+    G4double _n3;               // index of refraction of far side at wavelength
+    G4double _efficiency;       // efficiency of photocathode at wavelength (?)
+    G4double _efficiency_scale; // _qeScale that _efficiency was computed with
+    G4double _thickness;        // thickness of photocathode at current position
+    G4double _cos_theta1;       // cosine of angle of incidence
     // The following are set by CalculateCoefficients()
     // and used by DoIt(), Refract(), and Reflect():
     G4double _sin_theta1; // sine of angle of incidence
@@ -80,8 +143,52 @@ class CupPMTOpticalModel : public G4VFastSimulationModel, public G4UImessenger {
     G4double fR_n;        // reference for fR_s/p at normal incidence
     G4double fT_n;        // reference for fT_s/p at normal incidence
 
+    // luxlevel 4: fR_s, fT_s, fR_p, fT_p tabulated on a grid of photon energy,
+    // angle of incidence and photocathode thickness, and fR_n, fT_n on a grid
+    // of energy and thickness, for both directions (0: glass->vacuum,
+    // 1: vacuum->glass), and linearly interpolated.  The angle axis x runs
+    // over [-1,1] with cos(theta1) = cos_c*(1-x^2) below and
+    // cos_c+(1-cos_c)*x^2 above the critical angle cos_c, so the square-root
+    // behaviour at total internal reflection becomes linear between nodes.
+    // Built on first use; the grid is refined until the sum over the axes of
+    // the largest interpolation error at the cell midpoints is below
+    // kFresnelTableTolerance (absolute, on each of R_s, T_s, R_p, T_p, R_n, T_n),
+    // or until refining would take it above kFresnelTableMaxBytes.  The tables
+    // depend only on the glass and photocathode properties, so one read-only
+    // table per PMT type (and property version) is shared by all threads.
+    struct FresnelTable {
+        G4double eMin, eMax; // photon energy range
+        G4double tMin, tMax; // photocathode thickness range
+        G4int nE, nX, nT;    // number of nodes in energy, x, thickness
+        std::vector<float> coef;   // R_s, T_s, R_p, T_p per (dir, t, E, x) node
+        std::vector<float> normal; // R_n, T_n per (dir, t, E) node
+        G4double maxError;         // error estimate from the cell midpoints
+    };
+    const FresnelTable *fFresnelTable;
+    static const G4double kFresnelTableTolerance;
+    static const size_t kFresnelTableMaxBytes;
+    // glass RINDEX, photocathode RINDEX, KINDEX, THICKNESS; property version
+    typedef std::pair<std::vector<const G4MaterialPropertyVector *>, G4int> FresnelKey;
+    static std::map<FresnelKey, const FresnelTable *> fgFresnelTables;
+
     // private methods
+    G4int GetPMTNumber(const G4FastTrack &fastTrack);
+    G4int GetProcessTag(const G4VProcess *process);
+    void BuildSpectrum();
+    void LookupSpectrum(G4double energy, G4double value[kNSpectrum]) const;
     void CalculateCoefficients(); // calculate and set fR_s, etc.
+    static void ThinFilmCoefficients(G4double n1, G4double n3, G4complex n2comp,
+                                     G4double wavelength, G4double thickness,
+                                     G4double sin_theta1, G4double coef[6]);
+    void ExactCoefficients(G4int dir, G4double energy, G4double x, G4double thickness,
+                           G4double coef[6]) const;
+    void InterpolateFresnelTable(const FresnelTable &table, G4int dir, G4double energy,
+                                 G4double x, G4double thickness, G4double coef[6]) const;
+    void FillFresnelTable(FresnelTable &table) const;
+    G4double MidpointError(const FresnelTable &table, G4int axis) const;
+    static size_t FresnelTableBytes(G4int nE, G4int nX, G4int nT);
+    const FresnelTable *BuildFresnelTable();
+    void GetFresnelTable();
     void Reflect(G4ThreeVector &dir, G4ThreeVector &pol, G4ThreeVector &norm);
     void Refract(G4ThreeVector &dir, G4ThreeVector &pol, G4ThreeVector &norm);
 };
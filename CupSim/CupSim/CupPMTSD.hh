@@ -36,6 +36,9 @@ class CupPMTSD : public G4VSensitiveDetector {
     virtual void DrawAll();
     virtual void PrintAll();
 
+    int GetMaxPMTs() const { return max_pmts; }
+    int GetPMTNoOffset() const { return pmt_no_offset; }
+
     void SimpleHit(G4int ipmt, G4double time, G4double kineticEnergy, const G4ThreeVector &position,
                    const G4ThreeVector &momentum, const G4ThreeVector &polarization,
                    G4int iHitPhotonCount,
@@ -17,6 +17,7 @@ class CupParam : public std::map<G4String, G4double> {
     static CupParam *theCupParam;
     static CupParam *theMasterCupParam;
 #endif
+    static CupParam *CreateDBPtr();
 
   public:
     enum EOverride { kKeepExistingValue, kOverrideExistingValue };
@@ -32,14 +33,7 @@ class CupParam : public std::map<G4String, G4double> {
 CupParam *CupParam::GetDBPtr() {
     // Get (and possibly create) the pointer to the singleton
     //----------------
-    if (theCupParam == nullptr) {
-        if (theMasterCupParam == nullptr) {
-            theMasterCupParam = new CupParam();
-            theCupParam       = theMasterCupParam;
-        } else {
-            theCupParam = new CupParam(*theMasterCupParam);
-        }
-    }
+    if (theCupParam == nullptr) theCupParam = CreateDBPtr();
     return theCupParam;
 }
 
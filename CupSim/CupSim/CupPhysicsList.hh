@@ -4,10 +4,13 @@
 #include "G4VModularPhysicsList.hh"
 #include "globals.hh"
 
+#include <vector>
+
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
 
 // EJ
 class G4VPhysicsConstructor;
+class G4VFastSimulationModel;
 class CupPhysicsListMessenger;
 
 class CupPhysicsList : public G4VModularPhysicsList {
@@ -30,6 +33,13 @@ class CupPhysicsList : public G4VModularPhysicsList {
     static inline void SetEnableCrystalRegion(G4bool a) { enableCrystalRegion = a; }
     static inline G4bool GetEnableCrystalRegion() { return enableCrystalRegion; }
 
+    // Fast simulation models register themselves here when they are built
+    // (on each thread, by the detector construction, before the physics),
+    // so AddParameterisation() can attach the fast simulation process to
+    // just the particles some model is applicable to.
+    static void RegisterFastSimulationModel(G4VFastSimulationModel *model);
+    static void DeregisterFastSimulationModel(G4VFastSimulationModel *model);
+
   protected:
     // Construct particle and physics
     virtual void ConstructParticle();
@@ -73,6 +83,8 @@ class CupPhysicsList : public G4VModularPhysicsList {
     CupPhysicsListMessenger *pMessenger;
 
     static G4ProductionCuts *DetectorCuts;
+
+    static G4ThreadLocal std::vector<G4VFastSimulationModel *> *fastSimulationModels;
 };
 
 #endif
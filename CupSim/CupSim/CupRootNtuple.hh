@@ -14,6 +14,12 @@
 #include "CLHEP/Vector/ThreeVector.h"
 #include "TClonesArray.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "CupSim/CupRecorderBase.hh"
 #include "CupSim/CupVEventAction.hh"
 
@@ -55,6 +61,10 @@ class CupRootNtuple : public CupRecorderBase, public CupVEventAction {
     TTree *fROOTRunTree;
     TStopwatch *timer;
 
+    // output file name as given to /event/output_file (without the
+    // per-thread suffix), so a worker can reopen its file for each run
+    G4String fOutputFileName;
+
     G4SDManager *sdman;
 
     G4int TGSDHCID;
@@ -98,6 +108,68 @@ class CupRootNtuple : public CupRecorderBase, public CupVEventAction {
     Int_t nTrack;
     Int_t nStep;
 
+    // /ntuple/photon 2: photon hits written as flat typed columns
+    // (PHOTONHIT_pmt[PHOTONHIT_n], ...) instead of a TClonesArray of THit
+    struct PhotonHitColumns {
+        Int_t n;
+        std::vector<Short_t> pmt;
+        std::vector<Double_t> time;
+        std::vector<Int_t> count;
+        std::vector<Char_t> tag;
+        // kinematics, only with /event/output_mode full
+        std::vector<Float_t> wavelength;
+        std::vector<Float_t> x, y, z;
+        std::vector<Float_t> px, py, pz;
+        std::vector<Float_t> polx, poly, polz;
+
+        PhotonHitColumns();
+        void Resize(size_t size);
+        void Clear();
+    };
+    PhotonHitColumns *Cphotonhits;
+    G4bool fPhotonHitColumnsFull;
+
+    void AddPhotonHitColumns();
+    void BindPhotonHitColumns(PhotonHitColumns *cols);
+
+    // Asynchronous output: with a queue depth > 0 the filled event objects
+    // are queued for a writer thread doing Fill() (serialization, compression
+    // and basket writing); the tracking thread carries on with a free set.
+    struct EventObjects {
+        EvtInfo *evtinfo;
+        Primary *primary;
+        EvtTrack *track;
+        EvtStep *step;
+        Photon *photon;
+        PhotonHitColumns *photonhits;
+        TGSD *tgsd;
+        MuonSD *muon;
+        Scint *scint;
+        PMTSD *pmtInner;
+        PMTSD *pmtOuter;
+        PMTSD *pmtPlasScint;
+        MLCS *mlcs;
+    };
+    int AsyncQueueDepth;
+    std::thread *fWriterThread;
+    std::mutex fQueueMutex;
+    std::condition_variable fQueueCond;
+    std::mutex fFileMutex;              // guards TFile writes shared with the writer
+    std::deque<EventObjects> fFilledEvents;
+    std::vector<EventObjects> fFreeEvents;
+    EventObjects fWriterEvent;          // objects the event_tree branches read from
+    bool fStopWriter;
+
+    EventObjects GetEventObjects() const;
+    void SetEventObjects(const EventObjects &ev);
+    EventObjects NewEventObjects() const;
+    static void ClearEventObjects(const EventObjects &ev);
+    static void DeleteEventObjects(const EventObjects &ev);
+    void StartWriter();
+    void StopWriter();
+    void QueueEvent();
+    void WriterLoop();
+
     // target sensitive detector
     Double_t tgcellEdep[1000];
     Double_t tgcellEdepQuenched[1000];
@@ -123,6 +195,8 @@ class CupRootNtuple : public CupRecorderBase, public CupVEventAction {
     void SetPrimary(const G4Step *);
 
     void SetEventInfo(const G4Event *a_event);
+    void FillRunTree();
+    void MergeThreadFiles();
     void SetPrimary(const G4Event *a_event);
     void SetPhoton();
     void SetScintillation();
@@ -136,6 +210,10 @@ class CupRootNtuple : public CupRecorderBase, public CupVEventAction {
     void AddEventInfo();
     void AddPMTSD();
 
+    // copy the /ntuple/ selections (PreInit-only commands, so a worker
+    // thread cannot receive them itself) from the master's recorder
+    void CopyNtupleStatus(const CupRootNtuple *master);
+
     int GetNtuplePrimaryStatus(void) { return StatusPrimary; }
     virtual void SetNtuplePrimary(int val) { StatusPrimary = val; }
     int GetNtupleTrackStatus(void) { return StatusTrack; }
@@ -148,6 +226,8 @@ class CupRootNtuple : public CupRecorderBase, public CupVEventAction {
     virtual void SetNtupleScint(int val) { StatusScint = val; }
     int GetNtupleMuonStatus(void) { return StatusMuon; }
     virtual void SetNtupleMuon(int val) { StatusMuon = val; }
+    int GetNtupleAsyncQueueDepth(void) { return AsyncQueueDepth; }
+    virtual void SetNtupleAsyncQueueDepth(int val) { AsyncQueueDepth = val; }
 
     enum {
         max_primary_particles   = 16,
@@ -158,6 +238,7 @@ class CupRootNtuple : public CupRecorderBase, public CupVEventAction {
         max_nTrk                = 1000000,
         max_secondary_particles = 1000
     };
+    enum { kPhotonHitObjects = 1, kPhotonHitColumns = 2 }; // values of StatusPhoton
     enum { nLayer_vessel = 4, inout_muon = 2 };
     enum {
         max_muonSecondary           = 10000,
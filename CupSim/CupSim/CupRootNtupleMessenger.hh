@@ -26,6 +26,7 @@ class CupRootNtupleMessenger : public G4UImessenger {
     G4UIcommand *NtuplePhoton;
     G4UIcommand *NtupleScint;
     G4UIcommand *NtupleMuon;
+    G4UIcommand *NtupleAsyncQueueDepth;
 };
 
 #endif
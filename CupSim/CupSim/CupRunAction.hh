@@ -13,6 +13,7 @@
 #ifndef CupRunAction_h
 #define CupRunAction_h 1
 
+#include "G4Timer.hh"
 #include "G4UserRunAction.hh"
 #include "globals.hh"
 
@@ -23,7 +24,9 @@ class CupRunAction : public G4UserRunAction {
   public:
     // If the constructor is called with a RecordBase arguement,
     // then we'll perform some record keeping in the user action classes.
-    CupRunAction(CupRecorderBase *r = 0);
+    // With ownRecorder the recorder is deleted together with this action
+    // (used for the per-thread recorders of MT workers).
+    CupRunAction(CupRecorderBase *r = 0, G4bool ownRecorder = false);
     virtual ~CupRunAction();
 
   public:
@@ -35,6 +38,9 @@ class CupRunAction : public G4UserRunAction {
     // Save the CupRecorderBase object to be called at the beginning
     // and end of the run.
     CupRecorderBase *recorder;
+    G4bool fOwnRecorder;
+    // times the event loop, for comparing the cost of physics options
+    G4Timer fTimer;
 };
 
 #endif
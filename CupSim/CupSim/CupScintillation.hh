@@ -63,14 +63,18 @@
 #include "G4Material.hh"
 #include "G4MaterialPropertiesTable.hh"
 #include "G4OpticalPhoton.hh"
+#include "G4ParticleTypes.hh"
 #include "G4ParticleMomentum.hh"
 #include "G4PhysicsOrderedFreeVector.hh"
 #include "G4PhysicsTable.hh"
 #include "G4Poisson.hh"
 #include "G4Step.hh"
 #include "G4ThreeVector.hh"
+#include "G4TouchableHandle.hh"
 #include "G4VRestDiscreteProcess.hh"
 #include "Randomize.hh"
+
+#include "CupSim/CupOpticalScan.hh"
 #include "globals.hh"
 #include "templates.hh"
 #include "G4Version.hh"
@@ -78,6 +82,8 @@
 #include "G4EmSaturation.hh"
 #include "G4UImessenger.hh"
 
+#include <vector>
+
 // Class Description:
 // RestDiscrete Process - Generation of Scintillation Photons.
 // Class inherits publicly from G4VRestDiscreteProcess.
@@ -137,9 +143,21 @@ class CupScintillation : public G4VRestDiscreteProcess,
     // but sets the 'StronglyForced' condition for the DoIt to be
     // invoked at every step.
 
+    G4double PostStepGetPhysicalInteractionLength(const G4Track &aTrack, G4double previousStepSize,
+                                                  G4ForceCondition *condition);
+    // Returns 0 for a track with photons of an earlier step still to be
+    // emitted (see /cupscint/maxPhotonsPerStep), so that it takes a
+    // zero-length step in which the next chunk is emitted; otherwise as
+    // GetMeanFreePath.
+
     G4VParticleChange *PostStepDoIt(const G4Track &aTrack, const G4Step &aStep);
     G4VParticleChange *AtRestDoIt(const G4Track &aTrack, const G4Step &aStep);
 
+    G4int FlushPendingPhotons(const G4Track &aTrack, G4TrackVector *secondaries);
+    // Generates all the photons aTrack still has to emit in chunks and
+    // appends them to secondaries, for a track killed by the stepping
+    // action; returns the number of photons.
+
     // These are the methods implementing the scintillation process.
 
     void SetTrackSecondariesFirst(const G4bool state);
@@ -215,9 +233,109 @@ class CupScintillation : public G4VRestDiscreteProcess,
     static G4double GetTotEdepQuenched() { return totEdep_quenched; }
     static G4int GetNScintPhotons() { return nScintPhotons; }
     static G4bool GetDoScintillation() { return doScintillation; }
+    static G4int GetMaxPhotonsPerStep() { return maxPhotonsPerStep; }
+    static G4int GetPhotonWeight() { return photonWeight; }
+    static G4bool GetQEPreCull() { return qePreCull; }
+    // Probability to keep an optical photon at birth: with /cupscint/qePreCull
+    // on, the highest pe probability of an absorbed photon in the PMT models
+    // (CupPMTOpticalModel::GetMaxCollectionEfficiency()), by which the model
+    // then divides it for the photons culled at birth; 1 otherwise.
+    static G4double GetPhotonKeepProbability();
+    // True if the photons made by creator were culled at birth: those of
+    // CupScintillation and CupCerenkov, and reemitted ones (CupOpAttenuation,
+    // or a fast simulation model such as CupCylinderOpticalModel), since
+    // reemission culls a photon that was not.
+    static G4bool IsCulledAtBirth(const G4VProcess *creator);
+    // Optics replay (CupOpticsReplay): the quenched deposit recorded for
+    // aStep, used instead of quenching its deposit again; NULL to clear.
+    static void SetReplayVisibleEnergy(const G4Step *aStep, G4double visibleEnergy) {
+        fgReplayStep          = aStep;
+        fgReplayVisibleEnergy = visibleEnergy;
+    }
     static G4ThreeVector GetScintCentroid() { return scintCentroidSum * (1.0 / totEdep_quenched); }
     // EJ: end
 
+    // Scintillation properties of a material, resolved once from its
+    // properties table so the per-step code does no string-keyed lookups.
+    // Particle classes for the ...SCINTILLATIONYIELD vectors:
+    enum {
+        kScintProton,
+        kScintDeuteron,
+        kScintTriton,
+        kScintAlpha,
+        kScintIon, // nuclei, and neutrons (recoil ions below tracking cut)
+        kScintElectron, // e-, gamma and everything else
+        kNScintParticleClasses
+    };
+    struct ScintMaterial {
+        G4MaterialPropertiesTable *table; // NULL if the material has none
+        G4MaterialPropertyVector *fastIntensity;
+        G4MaterialPropertyVector *slowIntensity;
+        // yield vs. deposited energy per particle class; classes without
+        // their own vector fall back to ELECTRONSCINTILLATIONYIELD
+        G4MaterialPropertyVector *yieldVector[kNScintParticleClasses];
+        // constant properties (0 if not set)
+        G4double scintillationYield;
+        G4double resolutionScale;
+        G4double yieldRatio;
+        G4double fastTimeConstant;
+        G4double slowTimeConstant;
+        G4double fastRiseTime;
+        G4double slowRiseTime;
+    };
+    static const ScintMaterial &GetScintMaterial(const G4Material *aMaterial);
+    static G4int GetScintParticleClass(const G4ParticleDefinition *pDef);
+
+    // Photon energy from a scintillation integral: the same result as
+    // G4PhysicsOrderedFreeVector::GetEnergy, but a guide table on a uniform
+    // grid of integral values gives the bin to start a (short) linear
+    // search from, instead of a binary search per photon.
+    class SpectrumSampler {
+      public:
+        SpectrumSampler() : fMaxValue(0.), fGuideScale(0.) {}
+        void Build(G4PhysicsOrderedFreeVector *integral);
+        G4double GetMaxValue() const { return fMaxValue; }
+        G4double GetEnergy(G4double aValue) const;
+
+      private:
+        std::vector<G4double> fEnergy;
+        std::vector<G4double> fValue;
+        std::vector<size_t> fGuide;
+        G4double fMaxValue;
+        G4double fGuideScale;
+    };
+
+    // Kinematics of up to kSize photons, one array per quantity so that the
+    // loops filling them vectorize; the random numbers are drawn in blocks.
+    struct PhotonBatch {
+        enum { kSize = 256, kRandomsPerPhoton = 7 };
+        G4double random[kRandomsPerPhoton * kSize];
+        G4double energy[kSize];
+        G4double px[kSize], py[kSize], pz[kSize];
+        G4double polx[kSize], poly[kSize], polz[kSize];
+        G4double fraction[kSize]; // emission point, as a fraction of the step
+        G4double delay[kSize];    // emission time after the excitation
+    };
+    // Fills n <= kSize photons: energy from the spectrum, isotropic direction
+    // with a random transverse polarization, emission point uniform along the
+    // step (or at its end if !alongStep) and the emission time profile.
+    static void FillPhotonBatch(PhotonBatch &batch, G4int n, const SpectrumSampler &spectrum,
+                                G4double decayTime, G4double riseTime, G4bool alongStep);
+
+    // The step the photons of a step are emitted from, kept for the photons
+    // still to be emitted after the step is over.
+    struct PhotonOrigin {
+        G4ThreeVector position; // pre-step point
+        G4ThreeVector deltaPosition;
+        G4double time;
+        G4double stepLength;
+        G4double meanVelocity;
+        G4bool alongStep;
+        G4TouchableHandle touchable;
+        G4int parentID;
+        G4double weight; // of the parent
+    };
+
   protected:
     void BuildThePhysicsTable();
     // It builds either the fast or slow scintillation integral table;
@@ -230,6 +348,12 @@ class CupScintillation : public G4VRestDiscreteProcess,
     G4PhysicsTable *theSlowIntegralTable;
     G4PhysicsTable *theFastIntegralTable;
 
+    // per material, built with the integral tables
+    std::vector<SpectrumSampler> theSlowSamplers;
+    std::vector<SpectrumSampler> theFastSamplers;
+    // CupOpticalScan::GetPropertyVersion() the tables were built for
+    G4int fTablesVersion;
+
     G4bool fTrackSecondariesFirst;
     G4bool fFiniteRiseTime;
 
@@ -247,11 +371,75 @@ class CupScintillation : public G4VRestDiscreteProcess,
     // emission time distribution when there is a finite rise time
     G4double sample_time(G4double tau1, G4double tau2);
 
+    // adds num photons of one scintillation component to aParticleChange,
+    // generated PhotonBatch::kSize at a time, as tracks of photonWeight
+    // photons each (the last one takes the remainder)
+    void GeneratePhotons(const PhotonOrigin &origin, G4int num, const SpectrumSampler &spectrum,
+                         G4double decayTime, G4double riseTime);
+    PhotonBatch fPhotonBatch;
+
+    // Chunked emission.  With maxPhotonsPerStep > 0, a step of a track that
+    // stays alive emits at most that many photons; the rest are kept as
+    // pending and the track is suspended, so the photons are tracked before
+    // it takes a zero-length step emitting the next chunk, and so on.  The
+    // stack then never holds more than maxPhotonsPerStep photons of a step.
+    //
+    // PostStepDoIt calls EmitPendingPhotons first, which returns true if
+    // this was such a step, then EmitComponents, which calls
+    // BeginPhotonEmission with the number of photons of the step,
+    // EmitPhotons for each component and EndPhotonEmission, which suspends
+    // the track if it made photons to track first.
+    G4bool EmitPendingPhotons(const G4Track &aTrack);
+    // shared by the PostStepDoIt of CupScintillation and its subclasses
+    void EmitComponents(const G4Track &aTrack, const G4Step &aStep,
+                        const ScintMaterial &scintMaterial, G4int NumPhotons);
+    void BeginPhotonEmission(const G4Track &aTrack, G4int numPhotons);
+    void EndPhotonEmission(const G4Track &aTrack);
+    void EmitPhotons(const G4Track &aTrack, const G4Step &aStep, G4int num,
+                     const SpectrumSampler &spectrum, G4double decayTime, G4double riseTime);
+
+    struct PendingPhotons {
+        const G4Track *track;
+        G4int trackID;
+        G4int stepNumber; // of the step that last emitted some
+        PhotonOrigin origin;
+        G4int num;
+        const SpectrumSampler *spectrum;
+        G4double decayTime;
+        G4double riseTime;
+    };
+    G4bool IsPendingFor(const PendingPhotons &pending, const G4Track &aTrack) const;
+    std::vector<PendingPhotons> fPendingPhotons;
+    G4int fPhotonBudget; // photons the current step may still emit
+
     G4EmSaturation *emSaturation;
 
+    // true, with the recorded quenched deposit, if aStep is being replayed
+    static G4bool GetReplayVisibleEnergy(const G4Step &aStep, G4double &visibleEnergy) {
+        if (&aStep != fgReplayStep) return false;
+        visibleEnergy = fgReplayVisibleEnergy;
+        return true;
+    }
+    static G4ThreadLocal const G4Step *fgReplayStep;
+    static G4ThreadLocal G4double fgReplayVisibleEnergy;
+
+    // one ScintMaterial per entry of the material table (per thread, built
+    // on first use and rebuilt if materials are added or CupOpticalScan
+    // changes their properties)
+    static void BuildScintMaterials();
+    static G4ThreadLocal std::vector<ScintMaterial> *fgScintMaterials;
+    static G4ThreadLocal G4int fgScintMaterialsVersion;
+    static G4ThreadLocal const G4ParticleDefinition *fgLastParticle;
+    static G4ThreadLocal G4int fgLastParticleClass;
+    static G4ThreadLocal const G4VProcess *fgLastCreator;
+    static G4ThreadLocal G4bool fgLastCreatorCulled;
+
     // EJ: start
     static G4UIdirectory *CupScintDir;
     static G4bool doScintillation;
+    static G4int maxPhotonsPerStep; // 0: no limit
+    static G4int photonWeight;      // photons per optical track
+    static G4bool qePreCull;
 #if G4VERSION_NUMBER >= 1000
     static G4ThreadLocal G4double totEdep;
     static G4ThreadLocal G4double totEdep_quenched;
@@ -277,6 +465,36 @@ inline G4bool CupScintillation::IsApplicable(const G4ParticleDefinition &aPartic
     return true;
 }
 
+inline const CupScintillation::ScintMaterial &
+CupScintillation::GetScintMaterial(const G4Material *aMaterial) {
+    size_t index = aMaterial->GetIndex();
+    if (fgScintMaterials == NULL || index >= fgScintMaterials->size() ||
+        fgScintMaterialsVersion != CupOpticalScan::GetPropertyVersion())
+        BuildScintMaterials();
+    return (*fgScintMaterials)[index];
+}
+
+inline G4int CupScintillation::GetScintParticleClass(const G4ParticleDefinition *pDef) {
+    // steps come in runs of the same particle type
+    if (pDef == fgLastParticle) return fgLastParticleClass;
+    G4int particleClass;
+    if (pDef == G4Proton::ProtonDefinition())
+        particleClass = kScintProton;
+    else if (pDef == G4Deuteron::DeuteronDefinition())
+        particleClass = kScintDeuteron;
+    else if (pDef == G4Triton::TritonDefinition())
+        particleClass = kScintTriton;
+    else if (pDef == G4Alpha::AlphaDefinition())
+        particleClass = kScintAlpha;
+    else if (pDef->GetParticleType() == "nucleus" || pDef == G4Neutron::NeutronDefinition())
+        particleClass = kScintIon;
+    else
+        particleClass = kScintElectron;
+    fgLastParticle      = pDef;
+    fgLastParticleClass = particleClass;
+    return particleClass;
+}
+
 inline void CupScintillation::SetTrackSecondariesFirst(const G4bool state) {
     fTrackSecondariesFirst = state;
 }
@@ -331,6 +549,27 @@ inline void CupScintillation::DumpPhysicsTable() const {
     }
 }
 
+inline G4double CupScintillation::SpectrumSampler::GetEnergy(G4double aValue) const {
+    if (fEnergy.empty()) return 0.;
+    if (aValue <= fValue.front()) return fEnergy.front();
+    if (aValue >= fMaxValue) return fEnergy.back();
+    size_t bin = fGuide[size_t(aValue * fGuideScale)];
+    while (fValue[bin + 1] < aValue)
+        ++bin;
+    // linear interpolation as in G4PhysicsOrderedFreeVector
+    G4double res = fEnergy[bin];
+    G4double del = fValue[bin + 1] - fValue[bin];
+    if (del > 0.0) res += (aValue - fValue[bin]) * (fEnergy[bin + 1] - res) / del;
+    return res;
+}
+
+inline G4bool CupScintillation::IsPendingFor(const PendingPhotons &pending,
+                                             const G4Track &aTrack) const {
+    // the pending photons of the previous step of this track
+    return pending.track == &aTrack && pending.trackID == aTrack.GetTrackID() &&
+           pending.stepNumber + 1 == aTrack.GetCurrentStepNumber();
+}
+
 inline G4double CupScintillation::single_exp(G4double t, G4double tau2) {
     return std::exp(-1.0 * t / tau2) / tau2;
 }
@@ -0,0 +1,108 @@
+// CupStackingAction.hh
+//
+// Early-kill policies for optical photons, applied when a photon is
+// stacked, before it is tracked (/cupstack/ commands):
+//   - wavelength band: photons born outside [min, max] are killed
+//   - time window: photons born outside [tmin, tmax] (global time) are killed
+//   - kill list: photons born in the listed logical volumes, or in any
+//     volume of the listed regions (rock, cavern, ... with no path to a
+//     PMT), are killed
+//   - deferral: optical photons wait in a second stage until every other
+//     track of the event is done; if the energy then deposited in the
+//     CupScintSD targets is below a threshold, the waiting photons are
+//     dropped without being tracked.
+// In an optics replay (CupOpticsReplay) it also hands the photons of the
+// recorded steps to the stack, and the deferral is off.
+// All policies are off by default.  The commands set them on the master,
+// under a lock, and each thread takes a copy at the start of its events.
+
+#ifndef CupStackingAction_h
+#define CupStackingAction_h 1
+
+#include "G4UImessenger.hh"
+#include "G4UserStackingAction.hh"
+#include "globals.hh"
+
+#include <set>
+#include <vector>
+
+class G4LogicalVolume;
+class G4Navigator;
+class G4UIcommand;
+class G4UIdirectory;
+class G4UIcmdWithABool;
+class G4UIcmdWithADoubleAndUnit;
+class G4UIcmdWithAString;
+class G4UIcmdWithoutParameter;
+
+class CupStackingAction : public G4UserStackingAction {
+  public:
+    CupStackingAction();
+    virtual ~CupStackingAction();
+
+    virtual G4ClassificationOfNewTrack ClassifyNewTrack(const G4Track *aTrack);
+    virtual void NewStage();
+    virtual void PrepareNewEvent();
+
+    // creates the /cupstack/ commands, once, on the master thread
+    static void CreateMessenger();
+
+    // the deferral as last set by /cupstack/deferOptical
+    static G4bool GetDeferOptical();
+
+    // energy deposited so far in this event in all CupScintSD targets;
+    // returns false if the event has no CupScintSD hits collection
+    static G4bool GetTargetEdep(G4double &edep);
+
+  private:
+    struct Policies {
+        G4double minWavelength;
+        G4double maxWavelength;
+        G4double minTime;
+        G4double maxTime;
+        std::vector<G4String> killRegions;
+        std::vector<G4String> killVolumes;
+        G4bool deferOptical;
+        G4double minTargetEdep;
+    };
+
+    // true if an optical photon starting here is to be killed
+    G4bool IsKilled(const G4Track *aTrack);
+    const G4LogicalVolume *GetStartVolume(const G4Track *aTrack);
+    void UpdatePolicies();
+    void UpdateKillVolumes();
+
+    G4int fStage;                                   // 0: other tracks, 1: deferred photons
+    Policies fPolicies;                             // this thread's copy
+    G4int fPoliciesVersion;                         // of fPolicies
+    std::set<const G4LogicalVolume *> fKillVolumes; // resolved kill list
+    G4Navigator *fNavigator;                        // locates the photons' vertices
+
+    // set by the commands, read by the threads under the lock
+    static Policies fgPolicies;
+    static G4int fgPoliciesVersion;
+
+    class Messenger;
+    static Messenger *fgMessenger;
+};
+
+class CupStackingAction::Messenger : public G4UImessenger {
+  public:
+    Messenger();
+    ~Messenger();
+
+    void SetNewValue(G4UIcommand *command, G4String newValue);
+    G4String GetCurrentValue(G4UIcommand *command);
+
+  private:
+    G4UIdirectory *fStackDir;
+    G4UIcommand *fWavelengthCmd;
+    G4UIcommand *fTimeCmd;
+    G4UIcmdWithAString *fKillRegionCmd;
+    G4UIcmdWithAString *fKillVolumeCmd;
+    G4UIcmdWithoutParameter *fClearKillCmd;
+    G4UIcmdWithABool *fDeferCmd;
+    G4UIcmdWithADoubleAndUnit *fMinEdepCmd;
+};
+
+#endif
@@ -6,9 +6,14 @@
 
 #include "G4UserSteppingAction.hh"
 #include "globals.hh"
+#ifdef G4DEBUG
+#include "G4Timer.hh"
+#endif
 
 class CupPrimaryGeneratorAction;
 class CupRecorderBase; // EJ
+class CupScintillation;
+class G4ParticleDefinition;
 
 class CupSteppingAction : public G4UserSteppingAction {
   public:
@@ -22,6 +27,20 @@ class CupSteppingAction : public G4UserSteppingAction {
   protected:
     CupPrimaryGeneratorAction *myGenerator;
     CupRecorderBase *recorder; // EJ
+
+    // the CupScintillation process of a particle (NULL if none), looked up
+    // when the particle differs from the last one
+    CupScintillation *GetScintillation(const G4ParticleDefinition *particle);
+    const G4ParticleDefinition *fLastParticle;
+    CupScintillation *fScintillation;
+
+    // per stepping action, i.e. per thread
+    G4int fZeroStepsInARow;
+#ifdef G4DEBUG
+    G4int fDebugZeroStepsInARow;
+    G4Timer fTimer;
+    G4String fLastParticleName;
+#endif
 };
 
 #endif
@@ -17,6 +17,7 @@ class CupStrParam : public std::map<G4String, G4String> {
     static CupStrParam *theCupStrParam;
     static CupStrParam *theMasterCupStrParam;
 #endif
+    static CupStrParam *CreateDBPtr();
 
   public:
     enum EOverride { kKeepExistingValue, kOverrideExistingValue };
@@ -32,14 +33,7 @@ class CupStrParam : public std::map<G4String, G4String> {
 CupStrParam *CupStrParam::GetDBPtr() {
     // Get (and possibly create) the pointer to the singleton
     //----------------
-    if (theCupStrParam == nullptr) {
-        if (theMasterCupStrParam == nullptr) {
-            theMasterCupStrParam = new CupStrParam();
-            theCupStrParam       = theMasterCupStrParam;
-        } else {
-            theCupStrParam = new CupStrParam(*theMasterCupStrParam);
-        }
-    }
+    if (theCupStrParam == nullptr) theCupStrParam = CreateDBPtr();
     return theCupStrParam;
 }
 
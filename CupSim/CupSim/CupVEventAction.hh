@@ -48,7 +48,7 @@ class CupVEventAction : public G4UserEventAction, public G4UImessenger {
     G4String GetCurrentValue(G4UIcommand *command);
 
     //  static CupHitPhotonCollection*  GetTheHitPhotons() { return &theHitPhotons; }
-    static CupHitPMTCollection *GetTheHitPMTCollection() { return &theHitPMTCollection; }
+    static CupHitPMTCollection *GetTheHitPMTCollection();
     static G4bool GetDoParameterizedScintillation() { return fgDoParameterizedScintillation; }
 
   private: // EJ
@@ -57,7 +57,8 @@ class CupVEventAction : public G4UserEventAction, public G4UImessenger {
 
   protected:
     //  static CupHitPhotonCollection theHitPhotons;
-    static CupHitPMTCollection theHitPMTCollection;
+    // one collection per thread: filled by CupPMTSD on the worker tracking the event
+    static G4ThreadLocal CupHitPMTCollection *theHitPMTCollection;
 
     static G4bool flagFullOutputMode;
     G4String drawFlag;
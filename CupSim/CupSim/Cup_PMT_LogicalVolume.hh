@@ -6,6 +6,8 @@
 #include "G4LogicalVolume.hh"
 #include "G4ThreeVector.hh"
 
+#include <vector>
+
 class G4Material;
 class G4OpticalSurface;
 
@@ -23,9 +25,17 @@ class Cup_PMT_LogicalVolume : public G4LogicalVolume {
 
     G4double GetZEquator() { return z_equator; }
 
+    // attach the sensitive detector and the CupPMTOpticalModel on the calling
+    // thread; called from the constructor if a detector was given there,
+    // otherwise from the user's ConstructSDandField() (once per worker in MT)
+    void ConstructSDandField(G4VSensitiveDetector *detector);
+
   protected:
     G4double z_equator; // Z location of equator of tube
 
+    std::vector<G4LogicalVolume *> fSensitiveLogicals; // volumes given the SD hook
+    G4VPhysicalVolume *fOpticalModelEnvelope;          // envelope of the fast-sim model
+
     static G4OpticalSurface *our_Mirror_opsurf;
 
     void ConstructPMT_UsingTorusStack(
@@ -39,7 +49,7 @@ class Cup_PMT_LogicalVolume : public G4LogicalVolume {
         G4OpticalSurface *Photocathode_opsurf, // photocathode surface
         G4Material *PMT_Vac,                   // tube interior
         G4Material *Dynode_mat,                // dynode stack metal
-        G4VSensitiveDetector *detector         // sensitive detector hook
+        G4VSensitiveDetector *detector         // sensitive detector hook (may be NULL)
     );
 
     void ConstructPMT_UsingEllipsoid(
@@ -56,7 +66,7 @@ class Cup_PMT_LogicalVolume : public G4LogicalVolume {
         G4OpticalSurface *Photocathode_opsurf, // photocathode surface
         G4Material *PMT_Vac,                   // tube interior
         G4Material *Dynode_mat,                // dynode stack metal
-        G4VSensitiveDetector *detector         // sensitive detector hook
+        G4VSensitiveDetector *detector         // sensitive detector hook (may be NULL)
     );
 };
 
@@ -4,12 +4,14 @@
 #include "CupSim/CupActionInitialization.hh"
 #include "CupSim/CupPrimaryGeneratorAction.hh"
 #include "CupSim/CupRunAction.hh"
+#include "CupSim/CupStackingAction.hh"
 #include "CupSim/CupSteppingAction.hh"
 #include "CupSim/CupTrackingAction.hh"
 #include "CupSim/CupVEventAction.hh"
 
 void CupActionInitialization::BuildForMaster() const {
     SetUserAction(new CupRunAction(fRecorders));
+    CupStackingAction::CreateMessenger();
 }
 
 void CupActionInitialization::Build() const {
@@ -19,5 +21,6 @@ void CupActionInitialization::Build() const {
     SetUserAction(new CupVEventAction(fRecorders));
     SetUserAction(new CupTrackingAction(fRecorders));
     SetUserAction(new CupSteppingAction(fRecorders, p));
+    SetUserAction(new CupStackingAction);
 }
 #endif
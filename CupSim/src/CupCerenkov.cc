@@ -0,0 +1,154 @@
+#include "CupSim/CupCerenkov.hh"
+#include "CupSim/CupOpticsReplay.hh"
+#include "CupSim/CupScintillation.hh"
+
+#include "G4MaterialPropertiesTable.hh"
+#include "G4OpticalPhoton.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4Poisson.hh"
+#include "G4Track.hh"
+#include "G4VParticleChange.hh"
+#include "Randomize.hh"
+
+#include <algorithm>
+
+CupCerenkov::CupCerenkov(const G4String &processName, G4ProcessType type)
+    : G4Cerenkov(processName, type) {}
+
+CupCerenkov::~CupCerenkov() {}
+
+G4VParticleChange *CupCerenkov::PostStepDoIt(const G4Track &aTrack, const G4Step &aStep) {
+    // recording the steps for an optics replay: no photons now
+    if (CupOpticsReplay::GetMode() == CupOpticsReplay::kModeRecord) {
+        CupOpticsReplay::GetInstance()->RecordCerenkovStep(aStep);
+        aParticleChange.Initialize(aTrack);
+        return G4VDiscreteProcess::PostStepDoIt(aTrack, aStep);
+    }
+
+    G4int bunchSize = CupScintillation::GetPhotonWeight();
+    G4double keep   = CupScintillation::GetPhotonKeepProbability();
+    if (bunchSize <= 1 && keep >= 1.0) {
+        aParticleChange.SetSecondaryWeightByProcess(false);
+        return G4Cerenkov::PostStepDoIt(aTrack, aStep);
+    }
+
+    // G4Cerenkov::PostStepDoIt, with the mean number of photons scaled by
+    // keep and one track made per bunch, which carries the bunch's weight
+    aParticleChange.Initialize(aTrack);
+    aParticleChange.SetSecondaryWeightByProcess(true);
+
+    const G4DynamicParticle *aParticle = aTrack.GetDynamicParticle();
+    const G4Material *aMaterial        = aTrack.GetMaterial();
+
+    G4StepPoint *pPreStepPoint  = aStep.GetPreStepPoint();
+    G4StepPoint *pPostStepPoint = aStep.GetPostStepPoint();
+
+    G4ThreeVector x0 = pPreStepPoint->GetPosition();
+    G4ThreeVector p0 = aStep.GetDeltaPosition().unit();
+    G4double t0      = pPreStepPoint->GetGlobalTime();
+
+    G4MaterialPropertiesTable *aMaterialPropertiesTable = aMaterial->GetMaterialPropertiesTable();
+    if (!aMaterialPropertiesTable) return pParticleChange;
+
+    G4MaterialPropertyVector *Rindex = aMaterialPropertiesTable->GetProperty("RINDEX");
+    if (!Rindex) return pParticleChange;
+
+    G4double charge = aParticle->GetDefinition()->GetPDGCharge();
+    G4double beta   = (pPreStepPoint->GetBeta() + pPostStepPoint->GetBeta()) * 0.5;
+
+    G4double MeanNumberOfPhotons = GetAverageNumberOfPhotons(charge, beta, aMaterial, Rindex);
+    if (MeanNumberOfPhotons <= 0.0) {
+        aParticleChange.SetNumberOfSecondaries(0);
+        return pParticleChange;
+    }
+
+    // a Poisson number of photons each kept with probability keep is a
+    // Poisson number with the mean scaled by keep
+    MeanNumberOfPhotons *= keep * aStep.GetStepLength();
+    G4int numPhotons = (G4int)G4Poisson(MeanNumberOfPhotons);
+    if (numPhotons <= 0 || !GetStackPhotons()) {
+        aParticleChange.SetNumberOfSecondaries(0);
+        return pParticleChange;
+    }
+
+    // the photons are independent: a bunch of them is one photon with the
+    // weight of all (the last one of the step takes the remainder)
+    G4int numTracks = (numPhotons + bunchSize - 1) / bunchSize;
+    aParticleChange.SetNumberOfSecondaries(numTracks);
+
+    if (GetTrackSecondariesFirst() && aTrack.GetTrackStatus() == fAlive)
+        aParticleChange.ProposeTrackStatus(fSuspend);
+
+    G4double Pmin = Rindex->Energy(0);
+    G4double Pmax = Rindex->Energy(Rindex->GetVectorLength() - 1);
+    G4double dp   = Pmax - Pmin;
+
+    G4double nMax        = Rindex->GetMaxValue();
+    G4double BetaInverse = 1. / beta;
+
+    G4double maxCos  = BetaInverse / nMax;
+    G4double maxSin2 = (1.0 - maxCos) * (1.0 + maxCos);
+
+    G4double MeanNumberOfPhotons1 =
+        GetAverageNumberOfPhotons(charge, pPreStepPoint->GetBeta(), aMaterial, Rindex);
+    G4double MeanNumberOfPhotons2 =
+        GetAverageNumberOfPhotons(charge, pPostStepPoint->GetBeta(), aMaterial, Rindex);
+
+    for (G4int i = 0; i < numTracks; i++) {
+        // photon energy and emission angle
+        G4double rand, sampledEnergy, sampledRI, cosTheta, sin2Theta;
+        do {
+            rand          = G4UniformRand();
+            sampledEnergy = Pmin + rand * dp;
+            sampledRI     = Rindex->Value(sampledEnergy);
+            cosTheta      = BetaInverse / sampledRI;
+            sin2Theta     = (1.0 - cosTheta) * (1.0 + cosTheta);
+            rand          = G4UniformRand();
+        } while (rand * maxSin2 > sin2Theta);
+
+        // direction and polarization about the particle's direction
+        rand              = G4UniformRand();
+        G4double phi      = twopi * rand;
+        G4double sinPhi   = std::sin(phi);
+        G4double cosPhi   = std::cos(phi);
+        G4double sinTheta = std::sqrt(sin2Theta);
+        G4ParticleMomentum photonMomentum(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta);
+        photonMomentum.rotateUz(p0);
+        G4ThreeVector photonPolarization(cosTheta * cosPhi, cosTheta * sinPhi, -sinTheta);
+        photonPolarization.rotateUz(p0);
+
+        G4DynamicParticle *aCerenkovPhoton =
+            new G4DynamicParticle(G4OpticalPhoton::OpticalPhoton(), photonMomentum);
+        aCerenkovPhoton->SetPolarization(photonPolarization.x(), photonPolarization.y(),
+                                         photonPolarization.z());
+        aCerenkovPhoton->SetKineticEnergy(sampledEnergy);
+
+        // emission point along the step, following the photon yield
+        G4double NumberOfPhotons, N;
+        do {
+            rand            = G4UniformRand();
+            NumberOfPhotons = MeanNumberOfPhotons1 -
+                              rand * (MeanNumberOfPhotons1 - MeanNumberOfPhotons2);
+            N = G4UniformRand() * std::max(MeanNumberOfPhotons1, MeanNumberOfPhotons2);
+        } while (N > NumberOfPhotons);
+
+        G4double v0        = pPreStepPoint->GetVelocity();
+        G4double v1        = pPostStepPoint->GetVelocity();
+        G4double deltaTime = rand * aStep.GetStepLength() / (v0 + rand * (v1 - v0) * 0.5);
+
+        G4Track *aSecondaryTrack = new G4Track(aCerenkovPhoton, t0 + deltaTime,
+                                               x0 + rand * aStep.GetDeltaPosition());
+        aSecondaryTrack->SetTouchableHandle(pPreStepPoint->GetTouchableHandle());
+        aSecondaryTrack->SetParentID(aTrack.GetTrackID());
+        aSecondaryTrack->SetWeight(aTrack.GetWeight() *
+                                   std::min(bunchSize, numPhotons - i * bunchSize));
+        aParticleChange.AddSecondary(aSecondaryTrack);
+    }
+
+    if (verboseLevel > 0) {
+        G4cout << "\n Exiting from CupCerenkov::DoIt -- NumberOfSecondaries = "
+               << aParticleChange.GetNumberOfSecondaries() << G4endl;
+    }
+
+    return pParticleChange;
+}
@@ -0,0 +1,692 @@
+#include "CupSim/CupCylinderOpticalModel.hh"
+#include "CupSim/CupHitPMTCollection.hh"
+#include "CupSim/CupOpAttenuation.hh"
+#include "CupSim/CupOpBoundaryProcess.hh"
+#include "CupSim/CupPhysicsList.hh"
+#include "CupSim/CupPrimaryGeneratorAction.hh"
+#include "CupSim/CupScintillation.hh"
+
+#include "G4AutoLock.hh"
+#include "G4DynamicParticle.hh"
+#include "G4FastStep.hh"
+#include "G4FastTrack.hh"
+#include "G4GeometryTolerance.hh"
+#include "G4LogicalBorderSurface.hh"
+#include "G4LogicalSkinSurface.hh"
+#include "G4LogicalVolume.hh"
+#include "G4Material.hh"
+#include "G4OpBoundaryProcess.hh"
+#include "G4OpticalPhoton.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4PhysicalVolumeStore.hh"
+#include "G4ProcessManager.hh"
+#include "G4ProcessVector.hh"
+#include "G4Run.hh"
+#include "G4RunManager.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Threading.hh"
+#include "G4Tubs.hh"
+#include "G4UIcmdWithABool.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIdirectory.hh"
+#include "G4UIparameter.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4VSolid.hh"
+#include "G4VisExtent.hh"
+#include "Randomize.hh"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <sstream>
+
+namespace {
+G4Mutex CupCylinderOpticalModelMutex = G4MUTEX_INITIALIZER;
+
+const G4double kFenceMargin = 1. * mm; // between the fence and the other daughters
+const G4int kMaxLoops       = 100000;  // segments of one photon before it is killed
+const G4int kMaxPulls       = 5;       // PMTs listed by /cupcyl/compareHitMaps
+const G4double kMinKSProb   = 0.01;    // below it the pe distributions differ
+
+// mean and rms of a sample
+void GetMeanRms(const std::vector<G4double> &x, G4double &mean, G4double &rms) {
+    G4double sum = 0., sum2 = 0.;
+    for (size_t i = 0; i < x.size(); i++) {
+        sum += x[i];
+        sum2 += x[i] * x[i];
+    }
+    G4double n = std::max(G4double(x.size()), 1.);
+    mean       = sum / n;
+    rms        = std::sqrt(std::max(sum2 / n - mean * mean, 0.));
+}
+
+// two-sample Kolmogorov-Smirnov distance of a and b, and the asymptotic
+// probability of a larger one if both come from the same distribution
+G4double KolmogorovTest(std::vector<G4double> a, std::vector<G4double> b, G4double &distance) {
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    distance = 0.;
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        G4double x = std::min(a[i], b[j]);
+        while (i < a.size() && a[i] <= x)
+            i++;
+        while (j < b.size() && b[j] <= x)
+            j++;
+        distance = std::max(distance, std::fabs(G4double(i) / a.size() - G4double(j) / b.size()));
+    }
+    G4double ne     = G4double(a.size()) * b.size() / (a.size() + b.size());
+    G4double lambda = (std::sqrt(ne) + 0.12 + 0.11 / std::sqrt(ne)) * distance;
+    G4double prob   = 0., sign = 1.;
+    for (G4int k = 1; k <= 100; k++) {
+        G4double term = sign * std::exp(-2. * k * k * lambda * lambda);
+        prob += 2. * term;
+        if (std::fabs(term) < 1e-10) break;
+        sign = -sign;
+    }
+    return (lambda < 0.2) ? 1. : std::min(std::max(prob, 0.), 1.);
+}
+
+G4bool IsFullTubs(const G4VSolid *solid) {
+    const G4Tubs *tubs = dynamic_cast<const G4Tubs *>(solid);
+    return tubs && tubs->GetInnerRadius() <= 0. && tubs->GetDeltaPhiAngle() >= twopi - 1e-9;
+}
+} // namespace
+
+G4ThreadLocal CupCylinderOpticalModel::HitMap *CupCylinderOpticalModel::fgThreadHitMap = nullptr;
+G4bool CupCylinderOpticalModel::fgEnabled                                            = false;
+G4String CupCylinderOpticalModel::fgHitMapName;
+std::map<G4String, CupCylinderOpticalModel::HitMap> CupCylinderOpticalModel::fgHitMaps;
+CupCylinderOpticalModel::Messenger *CupCylinderOpticalModel::fgMessenger = nullptr;
+
+CupCylinderOpticalModel::CupCylinderOpticalModel(const G4String &modelName,
+                                                 G4VPhysicalVolume *inner_phys)
+    : G4VFastSimulationModel(modelName, inner_phys->GetLogicalVolume()->GetRegion()),
+      fInnerPhys(inner_phys), fGeometryRecognized(false), fPhysicsRecognized(false),
+      fWarned(false), fRunID(-1), fAttenuation(nullptr), fTimeLimited(false) {
+    fSurfaceTolerance   = G4GeometryTolerance::GetInstance()->GetSurfaceTolerance();
+    fGeometryRecognized = RecognizeGeometry();
+    if (!fGeometryRecognized) {
+        G4Exception("CupCylinderOpticalModel", "Cyl001", JustWarning,
+                    ("geometry around " + inner_phys->GetName() +
+                     " not recognized, its photons are tracked by Geant4")
+                        .c_str());
+    }
+    CupPhysicsList::RegisterFastSimulationModel(this);
+}
+
+CupCylinderOpticalModel::~CupCylinderOpticalModel() {
+    CupPhysicsList::DeregisterFastSimulationModel(this);
+}
+
+G4bool CupCylinderOpticalModel::IsApplicable(const G4ParticleDefinition &type) {
+    return (&type == G4OpticalPhoton::OpticalPhotonDefinition());
+}
+
+G4bool CupCylinderOpticalModel::ModelTrigger(const G4FastTrack &fastTrack) {
+    if (!fgEnabled || !fGeometryRecognized) return false;
+
+    // /cupscan/ and /process/ commands may change the optics between runs
+    const G4Run *run = G4RunManager::GetRunManager()->GetCurrentRun();
+    G4int runID      = run ? run->GetRunID() : -1;
+    if (runID != fRunID) {
+        fRunID             = runID;
+        fPhysicsRecognized = RecognizePhysics();
+    }
+    if (!fPhysicsRecognized) return false;
+
+    // photons handed back at the end of the event window are left to
+    // DeferTrackProc
+    if (fTimeLimited) {
+        G4double window =
+            CupPrimaryGeneratorAction::GetTheCupPrimaryGeneratorAction()->GetEventWindow();
+        if (fastTrack.GetPrimaryTrack()->GetGlobalTime() >= window) return false;
+    }
+    return true;
+}
+
+// Checks the geometry is one the model can transport photons in, and finds
+// the fence
+G4bool CupCylinderOpticalModel::RecognizeGeometry() {
+    G4LogicalVolume *innerLog = fInnerPhys->GetLogicalVolume();
+    G4LogicalVolume *outerLog = fInnerPhys->GetMotherLogical();
+    if (!outerLog || !IsFullTubs(innerLog->GetSolid()) || !IsFullTubs(outerLog->GetSolid()))
+        return false;
+    if (innerLog->GetNoDaughters() > 0 || fInnerPhys->IsReplicated()) return false;
+
+    // coaxial, with the inner cylinder's frame only shifted along z
+    G4ThreeVector shift = fInnerPhys->GetObjectTranslation();
+    if (!fInnerPhys->GetObjectRotationValue().isIdentity() || std::fabs(shift.x()) > 1e-9 ||
+        std::fabs(shift.y()) > 1e-9)
+        return false;
+
+    // the mother must be placed once, for the boundary between the two to be
+    // a single pair of volumes
+    G4VPhysicalVolume *outerPhys = nullptr;
+    G4PhysicalVolumeStore *store = G4PhysicalVolumeStore::GetInstance();
+    for (size_t i = 0; i < store->size(); i++) {
+        if ((*store)[i]->GetLogicalVolume() != outerLog) continue;
+        if (outerPhys) return false;
+        outerPhys = (*store)[i];
+    }
+    if (!outerPhys) return false;
+
+    // a smooth boundary without optical surfaces
+    if (G4LogicalBorderSurface::GetSurface(fInnerPhys, outerPhys) ||
+        G4LogicalBorderSurface::GetSurface(outerPhys, fInnerPhys) ||
+        G4LogicalSkinSurface::GetSurface(innerLog) || G4LogicalSkinSurface::GetSurface(outerLog))
+        return false;
+    if (!MakeMedium(innerLog->GetMaterial(), fInnerMedium) ||
+        !MakeMedium(outerLog->GetMaterial(), fOuterMedium))
+        return false;
+
+    const G4Tubs *innerTubs = static_cast<const G4Tubs *>(innerLog->GetSolid());
+    const G4Tubs *outerTubs = static_cast<const G4Tubs *>(outerLog->GetSolid());
+    fInner.radius           = innerTubs->GetOuterRadius();
+    fInner.halfLength       = innerTubs->GetZHalfLength();
+    fInner.z0               = 0.;
+    fFence.radius           = outerTubs->GetOuterRadius() - kFenceMargin;
+    fFence.halfLength       = outerTubs->GetZHalfLength() - kFenceMargin;
+    fFence.z0               = -shift.z();
+
+    // shrink the fence clear of the bounding sphere of every other daughter,
+    // by the radius or the half length, whichever loses the smaller fraction
+    for (G4int i = 0; i < outerLog->GetNoDaughters(); i++) {
+        G4VPhysicalVolume *daughter = outerLog->GetDaughter(i);
+        if (daughter == fInnerPhys) continue;
+        if (daughter->IsReplicated()) return false;
+        G4VisExtent extent = daughter->GetLogicalVolume()->GetSolid()->GetExtent();
+        G4ThreeVector center =
+            daughter->GetObjectRotationValue() * G4ThreeVector(extent.GetExtentCentre()) +
+            daughter->GetObjectTranslation() - shift;
+        G4double r    = extent.GetExtentRadius() + kFenceMargin;
+        G4double rMax = center.perp() - r;
+        G4double hMax = std::fabs(center.z() - fFence.z0) - r;
+        if (rMax >= fFence.radius || hMax >= fFence.halfLength) continue;
+        if (rMax <= 0. && hMax <= 0.) return false;
+        G4double lossR = (rMax > 0.) ? 1. - rMax / fFence.radius : DBL_MAX;
+        G4double lossH = (hMax > 0.) ? 1. - hMax / fFence.halfLength : DBL_MAX;
+        if (lossR <= lossH)
+            fFence.radius = rMax;
+        else
+            fFence.halfLength = hMax;
+    }
+
+    // the photons must be able to leave the inner cylinder into the fence
+    return fFence.radius > fInner.radius &&
+           fFence.z0 - fFence.halfLength < fInner.z0 - fInner.halfLength &&
+           fFence.z0 + fFence.halfLength > fInner.z0 + fInner.halfLength;
+}
+
+// Checks the optical photon processes are ones the model does, and resolves
+// the media again
+G4bool CupCylinderOpticalModel::RecognizePhysics() {
+    fAttenuation          = nullptr;
+    fTimeLimited          = false;
+    G4bool boundary       = false;
+    G4String unknown;
+    G4ProcessManager *pm  = G4OpticalPhoton::OpticalPhotonDefinition()->GetProcessManager();
+    G4ProcessVector *list = pm->GetProcessList();
+    for (G4int i = 0; i < list->entries(); i++) {
+        G4VProcess *process = (*list)[i];
+        if (!pm->GetProcessActivation(process)) continue;
+        if (dynamic_cast<CupOpAttenuation *>(process))
+            fAttenuation = static_cast<CupOpAttenuation *>(process);
+        else if (dynamic_cast<CupOpBoundaryProcess *>(process) ||
+                 dynamic_cast<G4OpBoundaryProcess *>(process))
+            boundary = true;
+        else if (process->GetProcessName() == "DeferTrackProc")
+            fTimeLimited = true;
+        else if (process->GetProcessType() == fOptical)
+            unknown = process->GetProcessName();
+    }
+
+    G4bool recognized = fAttenuation && boundary && unknown.empty() &&
+                        MakeMedium(fInnerPhys->GetLogicalVolume()->GetMaterial(), fInnerMedium) &&
+                        MakeMedium(fInnerPhys->GetMotherLogical()->GetMaterial(), fOuterMedium);
+    if (!recognized && fgEnabled && !fWarned) {
+        fWarned = true;
+        G4Exception("CupCylinderOpticalModel", "Cyl002", JustWarning,
+                    unknown.empty() ? "optical processes not recognized, photons are tracked by "
+                                      "Geant4"
+                                    : ("optical process " + unknown +
+                                       " not modelled, photons are tracked by Geant4")
+                                          .c_str());
+    }
+    return recognized;
+}
+
+G4bool CupCylinderOpticalModel::MakeMedium(const G4Material *material, Medium &medium) {
+    G4MaterialPropertiesTable *mpt = material->GetMaterialPropertiesTable();
+    if (!mpt || !mpt->GetProperty("RINDEX")) return false;
+
+    medium.materialIndex = material->GetIndex();
+    medium.rindex        = mpt->GetProperty("RINDEX");
+    medium.groupVelocity = mpt->GetProperty("GROUPVEL");
+    medium.absLength     = mpt->GetProperty("ABSLENGTH");
+    medium.scatFrac      = mpt->GetProperty("OPSCATFRAC");
+    medium.reemits       = (mpt->GetProperty("WLSSPECTRUM") != nullptr);
+    medium.reemissionProbability =
+        mpt->ConstPropertyExists("WLSPROBABILITY") ? mpt->GetConstProperty("WLSPROBABILITY") : 1.;
+    medium.reemissionTime =
+        mpt->ConstPropertyExists("WLSTIMECONSTANT") ? mpt->GetConstProperty("WLSTIMECONSTANT") : 0.;
+    return true;
+}
+
+G4double CupCylinderOpticalModel::Medium::GetVelocity(G4double energy) const {
+    if (groupVelocity) return groupVelocity->Value(energy);
+    return c_light / rindex->Value(energy);
+}
+
+void CupCylinderOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep) {
+    const G4Track *track = fastTrack.GetPrimaryTrack();
+    G4ThreeVector pos    = fastTrack.GetPrimaryTrackLocalPosition();
+    G4ThreeVector dir    = fastTrack.GetPrimaryTrackLocalDirection();
+    G4ThreeVector pol    = fastTrack.GetPrimaryTrackLocalPolarization();
+    G4double time        = track->GetGlobalTime();
+    G4double energy      = track->GetKineticEnergy();
+    G4double window      = DBL_MAX;
+    if (fTimeLimited)
+        window = CupPrimaryGeneratorAction::GetTheCupPrimaryGeneratorAction()->GetEventWindow();
+
+    G4bool inInner = true;
+    G4int iloop;
+    for (iloop = 0; iloop < kMaxLoops; iloop++) {
+        const Medium &medium = inInner ? fInnerMedium : fOuterMedium;
+
+        // the next boundary: the surface of the inner cylinder, or the fence
+        G4double tIn, tOut, dist;
+        G4int sideIn, sideOut, side = 0;
+        G4bool atFence = false;
+        if (inInner) {
+            // a photon just outside by rounding leaves at once
+            if (!Clip(fInner, pos, dir, tIn, tOut, sideIn, sideOut)) break;
+            dist = std::max(tOut, 0.);
+            side = sideOut;
+        } else {
+            if (!Clip(fFence, pos, dir, tIn, tOut, sideIn, sideOut)) break;
+            dist    = std::max(tOut, 0.);
+            atFence = true;
+            if (Clip(fInner, pos, dir, tIn, tOut, sideIn, sideOut) && tIn > fSurfaceTolerance &&
+                tIn < dist) {
+                dist    = tIn;
+                side    = sideIn;
+                atFence = false;
+            }
+        }
+
+        // the next interaction, as CupOpAttenuation samples it
+        G4bool interacts = false;
+        if (medium.absLength) {
+            G4double length = -medium.absLength->Value(energy) * std::log(G4UniformRand());
+            if (length < dist) {
+                dist      = length;
+                interacts = true;
+            }
+        }
+
+        G4double velocity = medium.GetVelocity(energy);
+        if (time + dist / velocity >= window) {
+            // handed back at the end of the event window
+            pos += std::max((window - time) * velocity, 0.) * dir;
+            time = std::max(time, window);
+            break;
+        }
+        pos += dist * dir;
+        time += dist / velocity;
+
+        if (interacts) {
+            G4double scatFrac = medium.scatFrac ? medium.scatFrac->Value(energy) : 0.;
+            if (scatFrac > 0. && G4UniformRand() < scatFrac) {
+                G4ThreeVector newDir, newPol;
+                CupOpAttenuation::SampleScattering(dir, pol, newDir, newPol);
+                dir = newDir;
+                pol = newPol;
+                continue;
+            }
+
+            // absorbed, and perhaps reemitted as a secondary, as in
+            // CupOpAttenuation::PostStepDoIt
+            fastStep.ProposeTrackStatus(fStopAndKill);
+            if (!medium.scatFrac || !medium.reemits) break;
+            G4double qe = medium.reemissionProbability;
+            if (!CupScintillation::IsCulledAtBirth(track->GetCreatorProcess()))
+                qe *= CupScintillation::GetPhotonKeepProbability();
+            if (G4UniformRand() > qe) break;
+
+            G4double newEnergy;
+            if (!fAttenuation->SampleReemissionEnergy(medium.materialIndex, energy, newEnergy))
+                break;
+            G4ThreeVector newDir, newPol;
+            CupOpAttenuation::SampleReemissionDirection(newDir, newPol);
+            G4double delay = fAttenuation->SampleReemissionDelay(medium.reemissionTime);
+
+            G4DynamicParticle photon(G4OpticalPhoton::OpticalPhoton(), newDir, newEnergy);
+            photon.SetPolarization(newPol.x(), newPol.y(), newPol.z());
+            fastStep.SetNumberOfSecondaryTracks(1);
+            fastStep.CreateSecondaryTrack(photon, pos, time + delay);
+            break;
+        }
+
+        // handed back to Geant4 in the outer medium, short of the PMTs
+        if (atFence) break;
+
+        // at the surface of the inner cylinder
+        const Medium &other = inInner ? fOuterMedium : fInnerMedium;
+        if (Fresnel(medium.rindex->Value(energy), other.rindex->Value(energy),
+                    GetNormal(pos, side), dir, pol))
+            inInner = !inInner;
+    }
+
+    fastStep.SetPrimaryTrackFinalPosition(pos);
+    fastStep.SetPrimaryTrackFinalTime(time);
+    fastStep.SetPrimaryTrackFinalMomentum(dir);
+    fastStep.SetPrimaryTrackFinalPolarization(pol);
+    if (iloop >= kMaxLoops) {
+        G4cerr << "CupCylinderOpticalModel::DoIt(): Too many loops, particle trapped!"
+               << " Killing it." << G4endl;
+        fastStep.ProposeTrackStatus(fStopAndKill);
+    }
+}
+
+G4bool CupCylinderOpticalModel::Clip(const Cylinder &cylinder, const G4ThreeVector &pos,
+                                     const G4ThreeVector &dir, G4double &tIn, G4double &tOut,
+                                     G4int &sideIn, G4int &sideOut) {
+    tIn     = -DBL_MAX;
+    tOut    = DBL_MAX;
+    sideIn  = 0;
+    sideOut = 0;
+
+    // the wall
+    G4double a = dir.x() * dir.x() + dir.y() * dir.y();
+    G4double b = pos.x() * dir.x() + pos.y() * dir.y();
+    G4double c = pos.x() * pos.x() + pos.y() * pos.y() - cylinder.radius * cylinder.radius;
+    if (a > 0.) {
+        G4double disc = b * b - a * c;
+        if (disc <= 0.) return false;
+        G4double root = std::sqrt(disc);
+        tIn           = (-b - root) / a;
+        tOut          = (-b + root) / a;
+    } else if (c > 0.) {
+        return false;
+    }
+
+    // the ends
+    G4double z = pos.z() - cylinder.z0;
+    if (dir.z() != 0.) {
+        G4double t1 = (-cylinder.halfLength - z) / dir.z();
+        G4double t2 = (cylinder.halfLength - z) / dir.z();
+        G4int s1 = -1, s2 = 1;
+        if (t1 > t2) {
+            std::swap(t1, t2);
+            std::swap(s1, s2);
+        }
+        if (t1 > tIn) {
+            tIn    = t1;
+            sideIn = s1;
+        }
+        if (t2 < tOut) {
+            tOut    = t2;
+            sideOut = s2;
+        }
+    } else if (std::fabs(z) > cylinder.halfLength) {
+        return false;
+    }
+    return tIn < tOut;
+}
+
+G4ThreeVector CupCylinderOpticalModel::GetNormal(const G4ThreeVector &point, G4int side) {
+    if (side != 0) return G4ThreeVector(0., 0., side);
+    return G4ThreeVector(point.x(), point.y(), 0.).unit();
+}
+
+// As G4OpBoundaryProcess::DielectricDielectric for a polished surface
+G4bool CupCylinderOpticalModel::Fresnel(G4double n1, G4double n2, G4ThreeVector normal,
+                                        G4ThreeVector &dir, G4ThreeVector &pol) {
+    if (dir * normal > 0.) normal = -normal; // facing the photon
+    G4double cost1 = -(dir * normal);
+    G4double sint1 = (cost1 < 1.) ? std::sqrt(1. - cost1 * cost1) : 0.;
+    G4double sint2 = sint1 * n1 / n2;
+
+    if (sint2 >= 1.) {
+        // total internal reflection
+        dir += 2. * cost1 * normal;
+        pol = -pol + 2. * (pol * normal) * normal;
+        return false;
+    }
+
+    G4double cost2 = std::sqrt(1. - sint2 * sint2);
+    G4ThreeVector A_trans;
+    G4double E1_perp, E1_parl;
+    if (sint1 > 0.) {
+        A_trans = dir.cross(normal).unit();
+        E1_perp = pol * A_trans;
+        E1_parl = (pol - E1_perp * A_trans).mag();
+    } else {
+        // normal incidence
+        A_trans = pol;
+        E1_perp = 0.;
+        E1_parl = 1.;
+    }
+
+    G4double s1       = n1 * cost1;
+    G4double E2_perp  = 2. * s1 * E1_perp / (n1 * cost1 + n2 * cost2);
+    G4double E2_parl  = 2. * s1 * E1_parl / (n2 * cost1 + n1 * cost2);
+    G4double E2_total = E2_perp * E2_perp + E2_parl * E2_parl;
+    G4double s2       = n2 * cost2 * E2_total;
+
+    if (G4UniformRand() < s2 / s1) {
+        // refraction
+        if (sint1 > 0.) {
+            dir                   = (dir + (cost1 - cost2 * n2 / n1) * normal).unit();
+            G4ThreeVector A_paral = dir.cross(A_trans).unit();
+            G4double E2_abs       = std::sqrt(E2_total);
+            pol                   = (E2_parl / E2_abs) * A_paral + (E2_perp / E2_abs) * A_trans;
+        }
+        return true;
+    }
+
+    // reflection
+    dir += 2. * cost1 * normal;
+    if (sint1 > 0.) {
+        E2_parl               = n2 * E2_parl / n1 - E1_parl;
+        E2_perp               = E2_perp - E1_perp;
+        E2_total              = E2_perp * E2_perp + E2_parl * E2_parl;
+        G4ThreeVector A_paral = dir.cross(A_trans).unit();
+        G4double E2_abs       = std::sqrt(E2_total);
+        pol                   = (E2_parl / E2_abs) * A_paral + (E2_perp / E2_abs) * A_trans;
+    } else if (n2 > n1) {
+        pol = -pol;
+    }
+    return false;
+}
+
+// Hit maps ////////////////////////////////////////////////////////////////
+void CupCylinderOpticalModel::HitMap::Add(const HitMap &other) {
+    events += other.events;
+    if (pe.size() < other.pe.size()) {
+        pe.resize(other.pe.size(), 0.);
+        pe2.resize(other.pe.size(), 0.);
+    }
+    for (size_t i = 0; i < other.pe.size(); i++) {
+        pe[i] += other.pe[i];
+        pe2[i] += other.pe2[i];
+    }
+    eventPe.insert(eventPe.end(), other.eventPe.begin(), other.eventPe.end());
+}
+
+void CupCylinderOpticalModel::RecordHitMap(CupHitPMTCollection *hits) {
+    if (!fgThreadHitMap) fgThreadHitMap = new HitMap;
+    HitMap &map = *fgThreadHitMap;
+    map.events += 1.;
+
+    hits->SortTimeAscending(); // folds in the pending photons
+    G4double total = 0.;
+    for (G4int i = 0; i < hits->GetEntries(); i++) {
+        CupHitPMT *pmt = hits->GetPMT(i);
+        G4int id       = pmt->GetID();
+        if (id < 0) continue;
+        G4double count = 0.;
+        for (G4int j = 0; j < pmt->GetEntries(); j++)
+            count += pmt->GetPhoton(j)->GetCount();
+        if (size_t(id) >= map.pe.size()) {
+            map.pe.resize(id + 1, 0.);
+            map.pe2.resize(id + 1, 0.);
+        }
+        map.pe[id] += count;
+        map.pe2[id] += count * count;
+        total += count;
+    }
+    map.eventPe.push_back(total);
+}
+
+void CupCylinderOpticalModel::EndOfRun() {
+    if (fgHitMapName.empty()) return;
+
+    if (fgThreadHitMap) {
+        G4AutoLock lock(&CupCylinderOpticalModelMutex);
+        HitMap &map = fgHitMaps[fgHitMapName];
+        map.Add(*fgThreadHitMap);
+        delete fgThreadHitMap;
+        fgThreadHitMap = nullptr;
+    }
+    if (!G4Threading::IsMasterThread()) return;
+
+    // the workers are done by the time the master ends its run
+    const HitMap &map = fgHitMaps[fgHitMapName];
+    G4double mean, rms;
+    GetMeanRms(map.eventPe, mean, rms);
+    G4cout << "CupCylinderOpticalModel: hit map " << fgHitMapName << " has " << map.events
+           << " events, pe per event " << mean << " rms " << rms << G4endl;
+}
+
+void CupCylinderOpticalModel::CompareHitMaps(const G4String &nameA, const G4String &nameB) {
+    if (fgHitMaps.find(nameA) == fgHitMaps.end() || fgHitMaps.find(nameB) == fgHitMaps.end()) {
+        G4cerr << "/cupcyl/compareHitMaps: no hit map " << nameA << " or " << nameB << G4endl;
+        return;
+    }
+    const HitMap &a = fgHitMaps[nameA];
+    const HitMap &b = fgHitMaps[nameB];
+    if (a.events <= 0. || b.events <= 0.) {
+        G4cerr << "/cupcyl/compareHitMaps: no events in " << nameA << " or " << nameB << G4endl;
+        return;
+    }
+
+    // the mean pe of each PMT, and the variance of the mean
+    G4double totalA = 0., totalB = 0., chi2 = 0.;
+    G4int ndf = 0;
+    std::vector<std::pair<G4double, G4int>> pulls;
+    size_t n = std::max(a.pe.size(), b.pe.size());
+    for (size_t i = 0; i < n; i++) {
+        G4double meanA = 0., varA = 0., meanB = 0., varB = 0.;
+        if (i < a.pe.size()) {
+            meanA = a.pe[i] / a.events;
+            varA  = std::max(a.pe2[i] / a.events - meanA * meanA, 0.) / a.events;
+        }
+        if (i < b.pe.size()) {
+            meanB = b.pe[i] / b.events;
+            varB  = std::max(b.pe2[i] / b.events - meanB * meanB, 0.) / b.events;
+        }
+        totalA += meanA;
+        totalB += meanB;
+        if (varA + varB <= 0.) continue;
+        G4double pull = (meanB - meanA) / std::sqrt(varA + varB);
+        chi2 += pull * pull;
+        ndf++;
+        pulls.push_back(std::make_pair(-std::fabs(pull), G4int(i)));
+    }
+    std::sort(pulls.begin(), pulls.end());
+
+    G4cout << "CupCylinderOpticalModel: " << nameB << " vs " << nameA << G4endl;
+    G4cout << "  events       " << b.events << " vs " << a.events << G4endl;
+    G4cout << "  pe per event " << totalB << " vs " << totalA;
+    if (totalA > 0.) G4cout << ", ratio " << totalB / totalA;
+    G4cout << G4endl;
+    if (ndf > 0) G4cout << "  per-PMT chi2/ndf " << chi2 << "/" << ndf << G4endl;
+
+    // the distributions of the total pe per event
+    G4double meanA, rmsA, meanB, rmsB, distance;
+    GetMeanRms(a.eventPe, meanA, rmsA);
+    GetMeanRms(b.eventPe, meanB, rmsB);
+    G4double prob = KolmogorovTest(a.eventPe, b.eventPe, distance);
+    G4cout << "  pe rms       " << rmsB << " vs " << rmsA << " (+- "
+           << std::sqrt(rmsA * rmsA / (2. * a.events) + rmsB * rmsB / (2. * b.events)) << ")"
+           << G4endl;
+    G4cout << "  pe per event KS distance " << distance << ", probability " << prob
+           << ((prob < kMinKSProb) ? ": distributions DIFFER" : ": distributions agree")
+           << G4endl;
+    for (size_t k = 0; k < pulls.size() && k < size_t(kMaxPulls); k++) {
+        G4int i = pulls[k].second;
+        G4cout << "  PMT " << i << ": "
+               << (size_t(i) < b.pe.size() ? b.pe[i] / b.events : 0.) << " vs "
+               << (size_t(i) < a.pe.size() ? a.pe[i] / a.events : 0.) << " pe, pull "
+               << -pulls[k].first << G4endl;
+    }
+}
+
+// Messenger ///////////////////////////////////////////////////////////////
+void CupCylinderOpticalModel::CreateMessenger() {
+    // the settings are process wide, so workers don't need their own commands
+    if (fgMessenger != nullptr || !G4Threading::IsMasterThread()) return;
+    fgMessenger = new Messenger();
+}
+
+CupCylinderOpticalModel::Messenger::Messenger() {
+    fCylDir = new G4UIdirectory("/cupcyl/");
+    fCylDir->SetGuidance("Analytic optical photon transport in coaxial cylinders.");
+
+    fEnableCmd = new G4UIcmdWithABool("/cupcyl/enable", this);
+    fEnableCmd->SetGuidance("Transport the photons of the inner cylinder (e.g. the LSC target)");
+    fEnableCmd->SetGuidance("and its mother analytically, up to short of the PMTs (default");
+    fEnableCmd->SetGuidance("false).  Unrecognized geometry or optics is left to Geant4.");
+    fEnableCmd->SetParameterName("enable", true);
+    fEnableCmd->SetDefaultValue(true);
+
+    fHitMapCmd = new G4UIcmdWithAString("/cupcyl/hitMap", this);
+    fHitMapCmd->SetGuidance("Add the pe per PMT and the total pe of each event of the");
+    fHitMapCmd->SetGuidance("following runs to the hit map of this name; no name stops");
+    fHitMapCmd->SetGuidance("recording.  The mean and rms pe per event are printed at the");
+    fHitMapCmd->SetGuidance("end of each run.");
+    fHitMapCmd->SetParameterName("name", true);
+    fHitMapCmd->SetDefaultValue("");
+
+    fCompareCmd = new G4UIcommand("/cupcyl/compareHitMaps", this);
+    fCompareCmd->SetGuidance("Compare the mean pe per PMT of hit map b with that of a: the");
+    fCompareCmd->SetGuidance("total, chi2/ndf and the largest pulls; and the distributions");
+    fCompareCmd->SetGuidance("of the total pe per event: rms, and a Kolmogorov-Smirnov test");
+    fCompareCmd->SetGuidance("that reports DIFFER below a probability of 0.01.");
+    fCompareCmd->SetParameter(new G4UIparameter("a", 's', false));
+    fCompareCmd->SetParameter(new G4UIparameter("b", 's', false));
+
+    G4UIcommand *commands[] = {fEnableCmd, fHitMapCmd, fCompareCmd};
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        commands[i]->SetToBeBroadcasted(false);
+        commands[i]->AvailableForStates(G4State_PreInit, G4State_Idle);
+    }
+}
+
+CupCylinderOpticalModel::Messenger::~Messenger() {
+    delete fEnableCmd;
+    delete fHitMapCmd;
+    delete fCompareCmd;
+    delete fCylDir;
+}
+
+void CupCylinderOpticalModel::Messenger::SetNewValue(G4UIcommand *command, G4String newValue) {
+    if (command == fEnableCmd) {
+        fgEnabled = fEnableCmd->GetNewBoolValue(newValue);
+    } else if (command == fHitMapCmd) {
+        fgHitMapName = newValue;
+    } else if (command == fCompareCmd) {
+        std::istringstream iss(newValue.c_str());
+        std::string nameA, nameB;
+        iss >> nameA >> nameB;
+        CompareHitMaps(nameA, nameB);
+    }
+}
+
+G4String CupCylinderOpticalModel::Messenger::GetCurrentValue(G4UIcommand *command) {
+    if (command == fEnableCmd) return fEnableCmd->ConvertToString(fgEnabled);
+    if (command == fHitMapCmd) return fgHitMapName;
+    return G4String("invalid CupCylinderOpticalModel \"get\" command");
+}
@@ -5,6 +5,8 @@
 #include "G4LogicalVolume.hh"
 #include "G4Material.hh"
 #include "G4MaterialPropertiesTable.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4SystemOfUnits.hh"
 #include "G4Timer.hh"
 #include "G4UIcmdWithAString.hh"
 #include "G4UIdirectory.hh"
@@ -26,12 +28,18 @@
 
 #include "G4RunManager.hh"
 
+#include "CupSim/CupHitPMT.hh"
 #include "CupSim/CupParam.hh"
+#include "CupSim/CupScintillation.hh"
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>  // for file streams
 #include <iomanip>  // for setw(), etc..
+#include <random>   // for the hit merging benchmark
 #include <sstream>  // for string streams
 #include <stdlib.h> // for strtol
+#include <vector>
 
 using namespace std;
 
@@ -105,6 +113,34 @@ CupDebugMessenger::CupDebugMessenger(CupDetectorConstruction *mydetector) : myDe
     runIDcmd->SetGuidance("Set Geant4 run number for next run");
     runIDcmd->SetParameter(new G4UIparameter("number", 'i', false));
 
+    // the benchHitMerge command
+    hitmergecmd = new G4UIcommand("/cupdebug/benchHitMerge", this);
+    hitmergecmd->SetGuidance("Time CupHitPMT photon merging on a synthetic bright PMT, against\n"
+                             "the old re-sort-per-photon method, and check the results agree.");
+    hitmergecmd->SetGuidance("Photon times are exponential with the given decay time (ns);\n"
+                             "the simulation's random engine is not used.");
+    hitmergecmd->SetParameter(new G4UIparameter("nPhotons", 'i', true));
+    hitmergecmd->GetParameter(0)->SetDefaultValue(100000);
+    hitmergecmd->SetParameter(new G4UIparameter("decayTime", 'd', true));
+    hitmergecmd->GetParameter(1)->SetDefaultValue(30.0);
+
+    // the benchScintGen command
+    scintgencmd = new G4UIcommand("/cupdebug/benchScintGen", this);
+    scintgencmd->SetGuidance("Time scintillation photon kinematics (energy, direction,\n"
+                             "polarization, emission point and time) from the batched\n"
+                             "CupScintillation generator against the previous photon-by-photon\n"
+                             "loop, and compare the moments of the two samples.");
+    scintgencmd->SetGuidance("The two draw their random numbers in a different order, so only\n"
+                             "the distributions can agree, not the photons one by one.");
+    scintgencmd->SetGuidance("Uses a synthetic 2.5-3.5 eV spectrum and the given rise and decay\n"
+                             "times (ns; rise time 0 for a pure exponential).");
+    scintgencmd->SetParameter(new G4UIparameter("nPhotons", 'i', true));
+    scintgencmd->GetParameter(0)->SetDefaultValue(1000000);
+    scintgencmd->SetParameter(new G4UIparameter("riseTime", 'd', true));
+    scintgencmd->GetParameter(1)->SetDefaultValue(1.0);
+    scintgencmd->SetParameter(new G4UIparameter("decayTime", 'd', true));
+    scintgencmd->GetParameter(2)->SetDefaultValue(30.0);
+
 #ifdef G4DEBUG
     // illuminationMap
     illucmd = new G4UIcommand("/cupdebug/dump_illumination_map", this);
@@ -124,6 +160,8 @@ CupDebugMessenger::~CupDebugMessenger() {
     delete seedcmd;
     delete neutcmd;
     delete runIDcmd;
+    delete hitmergecmd;
+    delete scintgencmd;
 #ifdef G4DEBUG
     delete illucmd;
 #endif
@@ -250,6 +288,202 @@ static void DumpNeutronCrossSections(G4Element *elem, double e1, double e2, doub
     }
 }
 
+// the CupHitPMT::DetectPhoton merging as it was before the sorted list
+// and pending buffer: re-sort everything for every photon
+static void DetectPhotonResort(std::vector<CupHitPhoton> &photons, const CupHitPhoton &new_photon) {
+    if (photons.size() < CupHitPMT::kApproxMaxIndividualHitPhotonsPerPMT) {
+        photons.push_back(new_photon);
+        return;
+    }
+    std::sort(photons.begin(), photons.end(), Compare_HitPhoton_TimeAscending);
+    std::vector<CupHitPhoton>::iterator it2 = lower_bound(
+        photons.begin(), photons.end(), new_photon, Compare_HitPhoton_TimeAscending);
+    std::vector<CupHitPhoton>::iterator it1 = it2;
+    if (it1 == photons.begin()) {
+        photons.insert(it1, new_photon);
+        return;
+    }
+    it1--;
+    if (new_photon.GetTime() - it1->GetTime() < CupHitPMT::kMergeTime) {
+        it1->AddCount(new_photon.GetCount());
+    } else if (it2 != photons.end() &&
+               it2->GetTime() - new_photon.GetTime() < CupHitPMT::kMergeTime) {
+        it2->AddCount(new_photon.GetCount());
+        it2->SetTime(new_photon.GetTime());
+    } else {
+        photons.insert(it2, new_photon);
+    }
+}
+
+// both merging methods on the same photons: times, and whether the merged
+// lists are identical
+static void BenchHitMerge(int nPhotons, double decayTime) {
+    std::mt19937 engine(12345);
+    std::exponential_distribution<double> decay(1.0 / decayTime);
+    std::vector<CupHitPhoton> input(nPhotons);
+    for (int i = 0; i < nPhotons; i++) {
+        input[i].SetPMTID(0);
+        input[i].SetTime(decay(engine));
+        input[i].SetCount(1);
+    }
+
+    G4Timer timer;
+    timer.Start();
+    std::vector<CupHitPhoton> resorted;
+    for (int i = 0; i < nPhotons; i++)
+        DetectPhotonResort(resorted, input[i]);
+    std::sort(resorted.begin(), resorted.end(), Compare_HitPhoton_TimeAscending);
+    timer.Stop();
+    G4double resortTime = timer.GetUserElapsed();
+
+    timer.Start();
+    CupHitPMT pmt(0);
+    for (int i = 0; i < nPhotons; i++)
+        pmt.DetectPhoton(input[i]);
+    pmt.SortTimeAscending();
+    timer.Stop();
+    G4double mergeTime = timer.GetUserElapsed();
+
+    G4bool same = (pmt.GetEntries() == (int)resorted.size());
+    for (int i = 0; same && i < pmt.GetEntries(); i++) {
+        same = (pmt.GetPhoton(i)->GetTime() == resorted[i].GetTime() &&
+                pmt.GetPhoton(i)->GetCount() == resorted[i].GetCount());
+    }
+
+    G4cout << "benchHitMerge: " << nPhotons << " photons, decay time " << decayTime << " ns -> "
+           << pmt.GetEntries() << " HitPhotons\n"
+           << "  re-sort per photon: " << resortTime << " s\n"
+           << "  CupHitPMT         : " << mergeTime << " s\n"
+           << "  results " << (same ? "agree" : "DIFFER") << G4endl;
+}
+
+// moments of a sample of scintillation photon kinematics
+struct ScintGenMoments {
+    enum { kE, kPz, kPdotPol, kPol2, kAlong, kT, kN };
+    G4double n, sum[kN], sum2[kN];
+    ScintGenMoments() : n(0) {
+        for (int k = 0; k < kN; k++)
+            sum[k] = sum2[k] = 0;
+    }
+    void Add(G4double energy, const G4ThreeVector &p, const G4ThreeVector &pol, G4double fraction,
+             G4double time) {
+        G4double x[kN] = {energy / eV, p.z(), p.dot(pol), pol.mag2(), fraction, time / ns};
+        n += 1;
+        for (int k = 0; k < kN; k++) {
+            sum[k] += x[k];
+            sum2[k] += x[k] * x[k];
+        }
+    }
+    G4double Mean(int k) const { return sum[k] / n; }
+    G4double Rms(int k) const { return std::sqrt(std::max(sum2[k] / n - Mean(k) * Mean(k), 0.)); }
+    void Print(const char *name) const {
+        G4cout << "  " << name << ": <E>= " << Mean(kE) << " eV, rms(E)= " << Rms(kE)
+               << " eV, <pz>= " << Mean(kPz) << ", rms(pz)= " << Rms(kPz)
+               << ", <p.pol>= " << Mean(kPdotPol) << ", <|pol|^2>= " << Mean(kPol2)
+               << ", <along>= " << Mean(kAlong) << ", rms(along)= " << Rms(kAlong)
+               << ", <t>= " << Mean(kT) << " ns, rms(t)= " << Rms(kT) << " ns" << G4endl;
+    }
+    // the means of the two samples, in standard errors of their difference
+    // (the constants p.pol and |pol|^2 by their absolute difference)
+    static G4bool Compare(const ScintGenMoments &a, const ScintGenMoments &b) {
+        static const char *names[kN] = {"E", "pz", "p.pol", "|pol|^2", "along", "t"};
+        G4bool agree = true;
+        for (int k = 0; k < kN; k++) {
+            G4double diff  = a.Mean(k) - b.Mean(k);
+            G4double error = std::sqrt(a.Rms(k) * a.Rms(k) / a.n + b.Rms(k) * b.Rms(k) / b.n);
+            G4bool ok      = (error > 1e-9) ? std::fabs(diff) < 5. * error : std::fabs(diff) < 1e-6;
+            if (!ok) {
+                G4cout << "  <" << names[k] << "> differs by " << diff << G4endl;
+                agree = false;
+            }
+        }
+        return agree;
+    }
+};
+
+// the CupScintillation photon loop as it was before the batched generator
+// (kinematics only; the G4Track construction is the same for both)
+static G4double SampleTimeRejection(G4double tau1, G4double tau2) {
+    while (1) {
+        G4double ran1 = G4UniformRand();
+        G4double ran2 = G4UniformRand();
+        G4double d    = (tau1 + tau2) / tau2;
+        G4double t    = -1.0 * tau2 * std::log(1 - ran1);
+        G4double gg   = d * std::exp(-1.0 * t / tau2) / tau2;
+        G4double bi   = std::exp(-1.0 * t / tau2) * (1 - std::exp(-1.0 * t / tau1)) / tau2 / tau2 *
+                      (tau1 + tau2);
+        if (ran2 <= bi / gg) return t;
+    }
+    return -1.0;
+}
+
+static void BenchScintGen(int nPhotons, double riseTime, double decayTime) {
+    // Gaussian emission spectrum and its integral, as BuildThePhysicsTable makes it
+    G4PhysicsOrderedFreeVector integral;
+    G4double cii = 0., prevE = 2.5 * eV, prevI = 0.;
+    for (int i = 0; i <= 50; i++) {
+        G4double energy    = 2.5 * eV + i * 0.02 * eV;
+        G4double x         = (energy - 3.0 * eV) / (0.15 * eV);
+        G4double intensity = std::exp(-0.5 * x * x);
+        if (i > 0) cii += (energy - prevE) * 0.5 * (prevI + intensity);
+        integral.InsertValues(energy, cii);
+        prevE = energy;
+        prevI = intensity;
+    }
+    CupScintillation::SpectrumSampler spectrum;
+    spectrum.Build(&integral);
+
+    G4Timer timer;
+    timer.Start();
+    ScintGenMoments loop;
+    G4double CIImax = integral.GetMaxValue();
+    for (int i = 0; i < nPhotons; i++) {
+        G4double sampledEnergy = integral.GetEnergy(G4UniformRand() * CIImax);
+        G4double cost          = 1. - 2. * G4UniformRand();
+        G4double sint          = std::sqrt((1. - cost) * (1. + cost));
+        G4double phi           = twopi * G4UniformRand();
+        G4double sinp          = std::sin(phi);
+        G4double cosp          = std::cos(phi);
+        G4ThreeVector photonMomentum(sint * cosp, sint * sinp, cost);
+        G4ThreeVector photonPolarization(cost * cosp, cost * sinp, -sint);
+        G4ThreeVector perp = photonMomentum.cross(photonPolarization);
+        phi                = twopi * G4UniformRand();
+        photonPolarization = std::cos(phi) * photonPolarization + std::sin(phi) * perp;
+        photonPolarization = photonPolarization.unit();
+        G4double rand      = G4UniformRand();
+        G4double deltaTime = (riseTime == 0.0) ? -decayTime * std::log(G4UniformRand())
+                                               : SampleTimeRejection(riseTime, decayTime);
+        loop.Add(sampledEnergy, photonMomentum, photonPolarization, rand, deltaTime);
+    }
+    timer.Stop();
+    G4double loopTime = timer.GetUserElapsed();
+
+    timer.Start();
+    ScintGenMoments batched;
+    CupScintillation::PhotonBatch *batch = new CupScintillation::PhotonBatch;
+    for (int first = 0; first < nPhotons; first += CupScintillation::PhotonBatch::kSize) {
+        int n = std::min(nPhotons - first, int(CupScintillation::PhotonBatch::kSize));
+        CupScintillation::FillPhotonBatch(*batch, n, spectrum, decayTime, riseTime, true);
+        for (int i = 0; i < n; i++) {
+            batched.Add(batch->energy[i], G4ThreeVector(batch->px[i], batch->py[i], batch->pz[i]),
+                        G4ThreeVector(batch->polx[i], batch->poly[i], batch->polz[i]),
+                        batch->fraction[i], batch->delay[i]);
+        }
+    }
+    delete batch;
+    timer.Stop();
+    G4double batchTime = timer.GetUserElapsed();
+
+    G4cout << "benchScintGen: " << nPhotons << " photons, rise time " << riseTime / ns
+           << " ns, decay time " << decayTime / ns << " ns\n"
+           << "  photon-by-photon loop: " << loopTime << " s\n"
+           << "  batched generator    : " << batchTime << " s" << G4endl;
+    loop.Print("loop   ");
+    batched.Print("batched");
+    G4cout << "  moments " << (ScintGenMoments::Compare(loop, batched) ? "agree" : "DIFFER")
+           << G4endl;
+}
+
 void CupDebugMessenger::SetNewValue(G4UIcommand *command, G4String newValues) {
     // DumpMaterialsCmd
     if (command == DumpMaterialsCmd) {
@@ -376,6 +610,28 @@ void CupDebugMessenger::SetNewValue(G4UIcommand *command, G4String newValues) {
         int i = atoi(newValues);
         G4RunManager::GetRunManager()->SetRunIDCounter(i);
         G4cout << "Set RunIDCounter to " << i << endl;
+    } else if (command == hitmergecmd) {
+        std::istringstream iss(newValues.c_str());
+        int nPhotons     = 100000;
+        double decayTime = 30.0;
+        iss >> nPhotons >> decayTime;
+        if (nPhotons < 0 || decayTime <= 0.0) {
+            G4cerr << "benchHitMerge: need nPhotons >= 0 and decayTime > 0" << G4endl;
+            return;
+        }
+        BenchHitMerge(nPhotons, decayTime);
+    } else if (command == scintgencmd) {
+        std::istringstream iss(newValues.c_str());
+        int nPhotons     = 1000000;
+        double riseTime  = 1.0;
+        double decayTime = 30.0;
+        iss >> nPhotons >> riseTime >> decayTime;
+        if (nPhotons <= 0 || riseTime < 0.0 || decayTime <= 0.0) {
+            G4cerr << "benchScintGen: need nPhotons > 0, riseTime >= 0 and decayTime > 0"
+                   << G4endl;
+            return;
+        }
+        BenchScintGen(nPhotons, riseTime * ns, decayTime * ns);
     }
 
 #ifdef G4DEBUG
@@ -15,16 +15,19 @@ const size_t CupHitPMT::kApproxMaxIndividualHitPhotonsPerPMT = 100;
 /// hit merging window in ns
 const double CupHitPMT::kMergeTime = 1.0;
 
-CupHitPMT::CupHitPMT(int ID) { fID = ID; }
+/// number of unmerged HitPhotons collected before folding them into the sorted list
+const size_t CupHitPMT::kMaxPendingHitPhotons = 32;
+
+CupHitPMT::CupHitPMT(int ID) : fID(ID), fMerging(false) {}
 
 CupHitPMT::~CupHitPMT() { Clear(); }
 
-/** clear out AND DELETE HitPhotons that were detected, resetting this
-    HitPMT to have no HitPhotons */
+/** clear out HitPhotons that were detected, resetting this HitPMT to
+    have no HitPhotons (the storage is kept for the next event) */
 void CupHitPMT::Clear() {
-    for (unsigned int i = 0; i < fPhotons.size(); i++)
-        delete fPhotons[i];
     fPhotons.clear();
+    fPending.clear();
+    fMerging = false;
 }
 
 /** Add HitPhoton, or try to merge with another HitPhoton when number
@@ -34,13 +37,13 @@ void CupHitPMT::Clear() {
     kApproxMaxIndividualHitPhotonsPerPMT, just add it to the list.
 
     If number of HitPhotons stored is greater than or equal to
-    kApproxMaxIndividualHitPhotonsPerPMT, sort the vector, then find
-    the HitPhoton that immediately preceeds it in sorted vector.  If
-    this HitPhoton's time is within kMergeTime of the preceeding
-    HitPhoton, then add this HitPhoton's count to that closest
-    preceeding HitPhoton.  Otherwise, look at following HitPhoton and
-    merge with it if time is is within kMergeTime.  Otherwise, insert
-    a new HitPhoton, allowing the size of the vector to grow beyond
+    kApproxMaxIndividualHitPhotonsPerPMT, find the HitPhoton that
+    immediately preceeds it in time.  If this HitPhoton's time is
+    within kMergeTime of the preceeding HitPhoton, then add this
+    HitPhoton's count to that closest preceeding HitPhoton.
+    Otherwise, look at following HitPhoton and merge with it if time
+    is is within kMergeTime.  Otherwise, insert a new HitPhoton,
+    allowing the size of the vector to grow beyond
     kApproxMaxIndividualHitPhotonsPerPMT.
 
     The time of "merged HitPhotons" is set to the time of the earliest
@@ -49,76 +52,104 @@ void CupHitPMT::Clear() {
     smallness of kMergeTime (1 ns), the effect is expected to be
     small.
 
-    Note that CupHitPMT immediately "owns" any HitPhoton passed to
-    DetectPhoton, and can delete the HitPhoton object at will.  In
-    particular, the CupHitPhoton pointed to by the new_photon
-    argument is deleted if merging with an existing HitPhoton occurs.
+    The list is sorted once, when merging starts, and kept sorted from
+    then on: the neighbours are found by a binary search in the sorted
+    list plus a scan of the few pending (not yet sorted in) HitPhotons,
+    so the merge decisions are the same as if the whole list were
+    re-sorted for every HitPhoton.
+
+    The HitPhoton is copied into this HitPMT's storage; on a merge
+    only its count (and possibly time) is taken over.
 
     @param new_photon  New HitPhoton to add (or merge).
 */
-void CupHitPMT::DetectPhoton(CupHitPhoton *new_photon) {
-    if (fPhotons.size() < kApproxMaxIndividualHitPhotonsPerPMT) {
+void CupHitPMT::DetectPhoton(const CupHitPhoton &new_photon) {
+    if (!fMerging) {
         fPhotons.push_back(new_photon);
-    } else {
-        SortTimeAscending();
-        std::vector<CupHitPhoton *>::iterator it2, it1;
-        it2 = lower_bound(fPhotons.begin(), fPhotons.end(), new_photon,
-                          Compare_HitPhotonPtr_TimeAscending);
-        it1 = it2;
-        if (it1 == fPhotons.begin()) {
-            // photon is earlier than any recorded so far -- always insert!
-            fPhotons.insert(it1, new_photon);
+        if (fPhotons.size() >= kApproxMaxIndividualHitPhotonsPerPMT) {
+            std::sort(fPhotons.begin(), fPhotons.end(), Compare_HitPhoton_TimeAscending);
+            fMerging = true;
+        }
+        return;
+    }
+
+    // it1: latest photon earlier than the new one, it2: earliest photon not earlier
+    std::vector<CupHitPhoton>::iterator it = lower_bound(
+        fPhotons.begin(), fPhotons.end(), new_photon, Compare_HitPhoton_TimeAscending);
+    CupHitPhoton *it1 = (it == fPhotons.begin()) ? nullptr : &*(it - 1);
+    CupHitPhoton *it2 = (it == fPhotons.end()) ? nullptr : &*it;
+    for (size_t i = 0; i < fPending.size(); i++) {
+        CupHitPhoton *p = &fPending[i];
+        if (p->GetTime() < new_photon.GetTime()) {
+            if (it1 == nullptr || p->GetTime() >= it1->GetTime()) it1 = p;
         } else {
-            it1--; // it1 photon should be earlier than photon to be added
-            if (new_photon->GetTime() - (*it1)->GetTime() < kMergeTime) {
-                // close to earlier photon -- merge with earlier photon
-                IFDEBUG(if (new_photon->GetTime() - (*it1)->GetTime() < 0.0) G4cerr
-                        << "CupSim/CupHitPMT STRANGE merge " << new_photon->GetTime()
-                        << " with non-earlier photon " << (*it1)->GetTime() << G4endl);
-                (*it1)->AddCount(new_photon->GetCount());
-                delete new_photon;
-                new_photon = 0;
-            } else if (it2 != fPhotons.end() &&
-                       (*it2)->GetTime() - new_photon->GetTime() < kMergeTime) {
-                // not after last photon, and close to later photon
-                IFDEBUG(if ((*it2)->GetTime() - new_photon->GetTime() < 0.0) G4cerr
-                        << "CupSim/CupHitPMT STRANGE merge " << new_photon->GetTime()
-                        << " with non-later photon " << (*it2)->GetTime() << G4endl);
-                (*it2)->AddCount(new_photon->GetCount());
-                (*it2)->SetTime(new_photon->GetTime());
-                delete new_photon;
-                new_photon = 0;
-            } else {
-                // after last photon or not close to any photon
-                fPhotons.insert(it2, new_photon);
-            }
+            if (it2 == nullptr || p->GetTime() < it2->GetTime()) it2 = p;
         }
     }
+
+    if (it1 == nullptr) {
+        // photon is earlier than any recorded so far -- always insert!
+        fPending.push_back(new_photon);
+    } else if (new_photon.GetTime() - it1->GetTime() < kMergeTime) {
+        // close to earlier photon -- merge with earlier photon
+        it1->AddCount(new_photon.GetCount());
+    } else if (it2 != nullptr && it2->GetTime() - new_photon.GetTime() < kMergeTime) {
+        // not after last photon, and close to later photon.  The new time
+        // is still later than it1, so the sorted list stays sorted.
+        IFDEBUG(if (it2->GetTime() - new_photon.GetTime() < 0.0) G4cerr
+                << "CupSim/CupHitPMT STRANGE merge " << new_photon.GetTime()
+                << " with non-later photon " << it2->GetTime() << G4endl);
+        it2->AddCount(new_photon.GetCount());
+        it2->SetTime(new_photon.GetTime());
+    } else {
+        // after last photon or not close to any photon
+        fPending.push_back(new_photon);
+    }
+
+    if (fPending.size() >= kMaxPendingHitPhotons) FlushPending();
+}
+
+/// fold the pending HitPhotons into the sorted list
+void CupHitPMT::FlushPending() {
+    if (fPending.empty()) return;
+    std::sort(fPending.begin(), fPending.end(), Compare_HitPhoton_TimeAscending);
+    fMergeBuffer.resize(fPhotons.size() + fPending.size());
+    std::merge(fPhotons.begin(), fPhotons.end(), fPending.begin(), fPending.end(),
+               fMergeBuffer.begin(), Compare_HitPhoton_TimeAscending);
+    fPhotons.swap(fMergeBuffer);
+    fPending.clear();
+    IFDEBUG(if (!std::is_sorted(fPhotons.begin(), fPhotons.end(),
+                                Compare_HitPhoton_TimeAscending)) G4cerr
+            << "CupSim/CupHitPMT photons of PMT " << fID << " out of time order" << G4endl);
 }
 
 /// sort HitPhotons so earliest are first
 void CupHitPMT::SortTimeAscending() {
-    std::sort(fPhotons.begin(), fPhotons.end(), Compare_HitPhotonPtr_TimeAscending);
+    if (fMerging)
+        FlushPending();
+    else
+        std::sort(fPhotons.begin(), fPhotons.end(), Compare_HitPhoton_TimeAscending);
 }
 
 /// print out HitPhotons.
 void CupHitPMT::Print(std::ostream &os, bool fullDetailsMode) {
+    FlushPending();
     os << " PMTID= " << fID << "  number of HitPhotons = " << fPhotons.size() << G4endl;
     if (fullDetailsMode == false) {
         for (size_t i = 0; i < fPhotons.size(); i++)
-            os << "  Hit time= " << fPhotons[i]->GetTime() << " count= " << fPhotons[i]->GetCount()
+            os << "  Hit time= " << fPhotons[i].GetTime() << " count= " << fPhotons[i].GetCount()
                << G4endl;
     } else {
         for (size_t i = 0; i < fPhotons.size(); i++) {
-            os << "  Hit time= " << fPhotons[i]->GetTime() << G4endl;
-            os << "      count= " << fPhotons[i]->GetCount() << G4endl;
-            os << "      wavelength= " << fPhotons[i]->GetWavelength() << G4endl;
+            os << "  Hit time= " << fPhotons[i].GetTime() << G4endl;
+            os << "      count= " << fPhotons[i].GetCount() << G4endl;
+            os << "      wavelength= " << fPhotons[i].GetWavelength() << G4endl;
             double x, y, z;
-            fPhotons[i]->GetPosition(x, y, z);
+            fPhotons[i].GetPosition(x, y, z);
             os << "      position= " << x << " " << y << " " << z << G4endl;
-            fPhotons[i]->GetMomentum(x, y, z);
+            fPhotons[i].GetMomentum(x, y, z);
             os << "      momentum= " << x << " " << y << " " << z << G4endl;
-            fPhotons[i]->GetPolarization(x, y, z);
+            fPhotons[i].GetPolarization(x, y, z);
             os << "      polarization= " << x << " " << y << " " << z << G4endl;
         }
     }
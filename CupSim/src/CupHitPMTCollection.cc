@@ -5,33 +5,45 @@
 
 CupHitPMTCollection::CupHitPMTCollection() {}
 
-CupHitPMTCollection::~CupHitPMTCollection() { Clear(); }
+CupHitPMTCollection::~CupHitPMTCollection() {
+    Clear();
+    for (size_t i = 0; i < fPMTByID.size(); i++)
+        delete fPMTByID[i];
+}
 
-/** clear out AND DELETE HitPMTs (and HitPhotons) that were detected,
-    resetting this HitPMTCollection to be empty */
+/** clear out the HitPhotons that were detected, resetting this
+    HitPMTCollection to be empty.  The HitPMTs themselves are kept
+    (indexed by ID) and reused in the next event. */
 void CupHitPMTCollection::Clear() {
-    for (size_t i = 0; i < fPMT.size(); i++) {
+    for (size_t i = 0; i < fPMT.size(); i++)
         fPMT[i]->Clear();
-        delete fPMT[i];
-    }
     fPMT.clear();
-    fHitmap.clear();
 }
 
-/** find or make appropriate HitPMT, and DetectPhoton in that HitPMT */
-void CupHitPMTCollection::DetectPhoton(CupHitPhoton *new_photon) {
-    CupHitPMT *hitpmtptr = GetPMT_ByID(new_photon->GetPMTID());
+/** make HitPMTs for all PMT IDs below nID up front, so that no
+    allocation happens during the event (the PMT SDs call this with
+    their offset + number of PMTs) */
+void CupHitPMTCollection::Reserve(int nID) {
+    if (nID <= (int)fPMTByID.size()) return;
+    fPMT.reserve(nID);
+    fPMTByID.reserve(nID);
+    for (int id = fPMTByID.size(); id < nID; id++)
+        fPMTByID.push_back(new CupHitPMT(id));
+}
 
-    if (hitpmtptr != NULL) {
-        // found a HitPMT with this ID
-        hitpmtptr->DetectPhoton(new_photon);
-    } else {
-        // make a HitPMT with this ID
-        fPMT.push_back(new CupHitPMT((short)new_photon->GetPMTID()));
-        fPMT[fPMT.size() - 1]->DetectPhoton(new_photon);
-        fHitmap.insert(
-            std::make_pair((short)new_photon->GetPMTID(), (CupHitPMT *)fPMT[fPMT.size() - 1]));
+/** find appropriate HitPMT by ID, and DetectPhoton in that HitPMT */
+void CupHitPMTCollection::DetectPhoton(const CupHitPhoton &new_photon) {
+    int id = new_photon.GetPMTID();
+    if (id < 0) {
+        G4cerr << "CupHitPMTCollection::DetectPhoton: invalid PMT ID " << id << G4endl;
+        return;
     }
+    if (id >= (int)fPMTByID.size()) Reserve(id + 1);
+
+    CupHitPMT *hitpmtptr = fPMTByID[id];
+    // a HitPMT without photons has not been hit yet in this event
+    if (hitpmtptr->GetEntries() == 0) fPMT.push_back(hitpmtptr);
+    hitpmtptr->DetectPhoton(new_photon);
 }
 
 void CupHitPMTCollection::SortTimeAscending() {
@@ -49,14 +61,8 @@ CupHitPMT *CupHitPMTCollection::GetPMT(int i) const { return fPMT[i]; }
 /** return pointer to HitPMT with given id if in collection,
     or NULL if no such HitPMT is in collection */
 CupHitPMT *CupHitPMTCollection::GetPMT_ByID(int id) const {
-    std::map<short, CupHitPMT *>::const_iterator p = fHitmap.find((short)id);
-    if (p != fHitmap.end()) {
-        // found a HitPMT with this ID
-        return p->second;
-    } else {
-        // no HitPMT
-        return NULL;
-    }
+    if (id < 0 || id >= (int)fPMTByID.size() || fPMTByID[id]->GetEntries() == 0) return NULL;
+    return fPMTByID[id];
 }
 
 /// print out HitPMTs
@@ -0,0 +1,51 @@
+#include "CupSim/CupLogger.hh"
+
+#include "G4Threading.hh"
+#include "G4UIcmdWithAnInteger.hh"
+#include "G4UIdirectory.hh"
+
+G4int CupLogger::fgLevel          = CupLogger::kLogEvent;
+CupLogger *CupLogger::fgMessenger = nullptr;
+
+void CupLogger::CreateMessenger() {
+    // the level is process wide, so workers don't need their own commands
+    if (fgMessenger != nullptr || !G4Threading::IsMasterThread()) return;
+    fgMessenger = new CupLogger();
+}
+
+CupLogger::CupLogger() {
+    fLogDir = new G4UIdirectory("/cuplog/");
+    fLogDir->SetGuidance("Event loop output control.");
+
+    fLevelCmd = new G4UIcmdWithAnInteger("/cuplog/level", this);
+    fLevelCmd->SetGuidance("Set the level of per-event output");
+    fLevelCmd->SetGuidance("  0 : none");
+    fLevelCmd->SetGuidance("  1 : event number and hit summary (default)");
+    fLevelCmd->SetGuidance("  2 : per-event details");
+    fLevelCmd->SetGuidance("  3 : one line per hit photon");
+    fLevelCmd->SetGuidance("Levels above the compiled-in maximum have no effect.");
+    fLevelCmd->SetParameterName("level", false);
+    fLevelCmd->SetRange("level>=0");
+    fLevelCmd->SetToBeBroadcasted(false);
+    fLevelCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+CupLogger::~CupLogger() {
+    delete fLevelCmd;
+    delete fLogDir;
+}
+
+void CupLogger::SetNewValue(G4UIcommand *command, G4String newValue) {
+    if (command == fLevelCmd) {
+        SetLevel(fLevelCmd->GetNewIntValue(newValue));
+        if (fgLevel > CUPSIM_LOG_MAXLEVEL) {
+            G4cout << "CupLogger: levels above " << CUPSIM_LOG_MAXLEVEL
+                   << " are not compiled in this build" << G4endl;
+        }
+    }
+}
+
+G4String CupLogger::GetCurrentValue(G4UIcommand *command) {
+    if (command == fLevelCmd) return fLevelCmd->ConvertToString(fgLevel);
+    return G4String("invalid CupLogger \"get\" command");
+}
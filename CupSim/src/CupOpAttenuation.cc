@@ -3,11 +3,14 @@
 #include "G4OpProcessSubType.hh"
 #include "G4PhysicalConstants.hh"
 #include "G4SystemOfUnits.hh"
-#include "G4WLSTimeGeneratorProfileDelta.hh"
-#include "G4WLSTimeGeneratorProfileExponential.hh"
 #include "G4ios.hh"
 
 #include "CupSim/CupOpAttenuation.hh"
+#include "CupSim/CupOpticalScan.hh"
+#include "CupSim/CupScintillation.hh"
+
+#include <algorithm>
+#include <cmath>
 
 static const int N_COSTHETA_ENTRIES = 129;
 
@@ -35,7 +38,8 @@ static void InitializeTable(void) {
 }
 
 CupOpAttenuation::CupOpAttenuation(const G4String &processName, G4ProcessType type)
-    : G4VDiscreteProcess(processName, type) {
+    : G4VDiscreteProcess(processName, type), fPropertyVersion(-1),
+      fTimeProfile(kTimeProfileDelta) {
     if (verboseLevel > 0) {
         G4cout << GetProcessName() << " is created " << G4endl;
     }
@@ -44,8 +48,6 @@ CupOpAttenuation::CupOpAttenuation(const G4String &processName, G4ProcessType ty
 
     if (!TableInitialized) InitializeTable();
 
-    WLSTimeGeneratorProfile = new G4WLSTimeGeneratorProfileDelta("WLSTimeGeneratorProfileDelta");
-
     theIntegralTable = 0;
     BuildThePhysicsTable();
 }
@@ -55,8 +57,6 @@ CupOpAttenuation::~CupOpAttenuation() {
         theIntegralTable->clearAndDestroy();
         delete theIntegralTable;
     }
-
-    delete WLSTimeGeneratorProfile;
 }
 
 G4VParticleChange *CupOpAttenuation::PostStepDoIt(const G4Track &aTrack, const G4Step &aStep) {
@@ -67,15 +67,13 @@ G4VParticleChange *CupOpAttenuation::PostStepDoIt(const G4Track &aTrack, const G
 
     G4double thePhotonMomentum = aParticle->GetTotalMomentum();
 
-    G4MaterialPropertiesTable *aMaterialPropertiesTable = aMaterial->GetMaterialPropertiesTable();
-    if (!aMaterialPropertiesTable) return G4VDiscreteProcess::PostStepDoIt(aTrack, aStep);
-
-    G4MaterialPropertyVector *OpScatFracVector =
-        aMaterialPropertiesTable->GetProperty("OPSCATFRAC");
+    G4int materialIndex          = aMaterial->GetIndex();
+    const MaterialOptics &optics = GetMaterialOptics(materialIndex);
+    if (!optics.hasProperties) return G4VDiscreteProcess::PostStepDoIt(aTrack, aStep);
 
     G4double OpScatFrac = 0.0;
-    if (OpScatFracVector)
-        OpScatFrac = OpScatFracVector->Value(thePhotonMomentum);
+    if (optics.scatFrac)
+        OpScatFrac = optics.scatFrac->Value(thePhotonMomentum);
     else {
         aParticleChange.ProposeTrackStatus(fStopAndKill);
         return G4VDiscreteProcess::PostStepDoIt(aTrack, aStep);
@@ -83,32 +81,9 @@ G4VParticleChange *CupOpAttenuation::PostStepDoIt(const G4Track &aTrack, const G
 
     // Scattering
     if (OpScatFrac > 0.0 && G4UniformRand() < OpScatFrac) {
-        G4double urand = G4UniformRand() - 0.5;
-        G4double Cos2Theta0 =
-            Cos2ThetaTable[(int)(fabs(urand) * 2.0 * (N_COSTHETA_ENTRIES - 1) + 0.5)];
-        G4double CosTheta = 4.0 * urand / (3.0 - Cos2Theta0);
-
-#ifdef G4DEBUG
-        if (fabs(CosTheta) > 1.0) {
-            cerr << "CupSim/CupOpAttenution: Warning, CosTheta=" << CosTheta << " urand=" << urand
-                 << endl;
-            CosTheta = CosTheta > 0.0 ? 1.0 : -1.0;
-        }
-#endif
-
-        G4double SinTheta = sqrt(1.0 - CosTheta * CosTheta);
-        G4double Phi      = (2.0 * G4UniformRand() - 1.0) * M_PI;
-        G4ThreeVector e2(aParticle->GetMomentumDirection().cross(aParticle->GetPolarization()));
-
-        G4ThreeVector NewMomentum =
-            (CosTheta * aParticle->GetPolarization() +
-             (SinTheta * cos(Phi)) * aParticle->GetMomentumDirection() + (SinTheta * sin(Phi)) * e2)
-                .unit();
-
-        // polarization is normal to new momentum and in same plane as
-        // old new momentum and old polarization
-        G4ThreeVector NewPolarization =
-            (aParticle->GetPolarization() - CosTheta * NewMomentum).unit();
+        G4ThreeVector NewMomentum, NewPolarization;
+        SampleScattering(aParticle->GetMomentumDirection(), aParticle->GetPolarization(),
+                         NewMomentum, NewPolarization);
 
         aParticleChange.ProposeMomentumDirection(NewMomentum);
         aParticleChange.ProposePolarization(NewPolarization);
@@ -122,17 +97,18 @@ G4VParticleChange *CupOpAttenuation::PostStepDoIt(const G4Track &aTrack, const G
 
         if (verboseLevel > 0) G4cout << "\n** Photon absorbed! **" << G4endl;
 
-        const G4MaterialPropertyVector *WLS_Intensity =
-            aMaterialPropertiesTable->GetProperty("WLSSPECTRUM");
         // No emission spectrum, just kill it (absorbed!)
-        if (!WLS_Intensity) return G4VDiscreteProcess::PostStepDoIt(aTrack, aStep);
+        if (!optics.reemits) return G4VDiscreteProcess::PostStepDoIt(aTrack, aStep);
 
         G4StepPoint *pPostStepPoint = aStep.GetPostStepPoint();
 
         G4int NumPhotons   = 1;
-        G4double QuntumEff = 1;
-        if (aMaterialPropertiesTable->ConstPropertyExists("WLSPROBABILITY"))
-            QuntumEff = aMaterialPropertiesTable->GetConstProperty("WLSPROBABILITY");
+        G4double QuntumEff = optics.reemissionProbability;
+        // a photon that was not culled at birth (/cupscint/qePreCull), e.g. an
+        // optical-photon primary, is culled at its re-emission, as the PMT
+        // model counts re-emitted photons as culled
+        if (!CupScintillation::IsCulledAtBirth(aTrack.GetCreatorProcess()))
+            QuntumEff *= CupScintillation::GetPhotonKeepProbability();
 
         if (G4UniformRand() > QuntumEff) {
             aParticleChange.SetNumberOfSecondaries(0);
@@ -142,74 +118,18 @@ G4VParticleChange *CupOpAttenuation::PostStepDoIt(const G4Track &aTrack, const G
         aParticleChange.SetNumberOfSecondaries(NumPhotons);
 
         G4double primaryEnergy = aTrack.GetDynamicParticle()->GetKineticEnergy();
+        G4double WLSTime       = optics.reemissionTime;
 
-        // Retrieve the WLS Integral for this material
-        // new G4PhysicsOrderedFreeVector allocated to hold CII's
-        G4int materialIndex = aMaterial->GetIndex();
-
-        G4double WLSTime                        = 0. * ns;
-        G4PhysicsOrderedFreeVector *WLSIntegral = 0;
-
-        if (aMaterialPropertiesTable->GetConstProperty("WLSTIMECONSTANT"))
-            WLSTime = aMaterialPropertiesTable->GetConstProperty("WLSTIMECONSTANT");
-        WLSIntegral = (G4PhysicsOrderedFreeVector *)((*theIntegralTable)(materialIndex));
-
-        // Max WLS Integral
-        G4double CIImax = WLSIntegral->GetMaxValue();
-
+        // If no energy below the primary's can be sampled, return
         G4double sampledEnergy;
-
-        // Make sure the energy of the secondary is less than that of the primary
-        for (G4int j = 1; j <= 100; j++) {
-            // Determine photon energy
-            G4double CIIvalue = G4UniformRand() * CIImax;
-            sampledEnergy     = WLSIntegral->GetEnergy(CIIvalue);
-            if (verboseLevel > 1) {
-                G4cout << "sampledEnergy = " << sampledEnergy << G4endl;
-                G4cout << "CIIvalue =      " << CIIvalue << G4endl;
-            }
-            if (sampledEnergy <= primaryEnergy) break;
-        }
-
-        // If no such energy can be sampled, return
-        if (sampledEnergy > primaryEnergy) {
-            if (verboseLevel > 1)
-                G4cout << " *** One less WLS photon will be returned ***" << G4endl;
+        if (!SampleReemissionEnergy(materialIndex, primaryEnergy, sampledEnergy)) {
             aParticleChange.SetNumberOfSecondaries(0);
             return G4VDiscreteProcess::PostStepDoIt(aTrack, aStep);
         }
 
-        // Generate random photon direction
-        G4double cost = 1. - 2. * G4UniformRand();
-        G4double sint = std::sqrt((1. - cost) * (1. + cost));
-
-        G4double phi  = twopi * G4UniformRand();
-        G4double sinp = std::sin(phi);
-        G4double cosp = std::cos(phi);
-
-        G4double px = sint * cosp;
-        G4double py = sint * sinp;
-        G4double pz = cost;
-
-        // Create photon momentum direction vector
-        G4ParticleMomentum photonMomentum(px, py, pz);
-
-        // Determine polarization of new photon
-        G4double sx = cost * cosp;
-        G4double sy = cost * sinp;
-        G4double sz = -sint;
-
-        G4ThreeVector photonPolarization(sx, sy, sz);
-
-        G4ThreeVector perp = photonMomentum.cross(photonPolarization);
-
-        phi  = twopi * G4UniformRand();
-        sinp = std::sin(phi);
-        cosp = std::cos(phi);
-
-        photonPolarization = cosp * photonPolarization + sinp * perp;
-
-        photonPolarization = photonPolarization.unit();
+        G4ParticleMomentum photonMomentum;
+        G4ThreeVector photonPolarization;
+        SampleReemissionDirection(photonMomentum, photonPolarization);
 
         // Generate a new photon:
         G4DynamicParticle *aWLSPhoton =
@@ -221,7 +141,7 @@ G4VParticleChange *CupOpAttenuation::PostStepDoIt(const G4Track &aTrack, const G
 
         // Generate new G4Track object:
         // Must give position of WLS optical photon
-        G4double TimeDelay      = WLSTimeGeneratorProfile->GenerateTime(WLSTime);
+        G4double TimeDelay      = SampleReemissionDelay(WLSTime);
         G4double aSecondaryTime = (pPostStepPoint->GetGlobalTime()) + TimeDelay;
 
         G4ThreeVector aSecondaryPosition = pPostStepPoint->GetPosition();
@@ -242,6 +162,94 @@ G4VParticleChange *CupOpAttenuation::PostStepDoIt(const G4Track &aTrack, const G
     return G4VDiscreteProcess::PostStepDoIt(aTrack, aStep);
 }
 
+void CupOpAttenuation::SampleScattering(const G4ThreeVector &momentum,
+                                        const G4ThreeVector &polarization,
+                                        G4ThreeVector &newMomentum,
+                                        G4ThreeVector &newPolarization) {
+    G4double urand      = G4UniformRand() - 0.5;
+    G4double Cos2Theta0 = Cos2ThetaTable[(int)(fabs(urand) * 2.0 * (N_COSTHETA_ENTRIES - 1) + 0.5)];
+    G4double CosTheta   = 4.0 * urand / (3.0 - Cos2Theta0);
+
+#ifdef G4DEBUG
+    if (fabs(CosTheta) > 1.0) {
+        cerr << "CupSim/CupOpAttenution: Warning, CosTheta=" << CosTheta << " urand=" << urand
+             << endl;
+        CosTheta = CosTheta > 0.0 ? 1.0 : -1.0;
+    }
+#endif
+
+    G4double SinTheta = sqrt(1.0 - CosTheta * CosTheta);
+    G4double Phi      = (2.0 * G4UniformRand() - 1.0) * M_PI;
+    G4ThreeVector e2(momentum.cross(polarization));
+
+    newMomentum = (CosTheta * polarization + (SinTheta * cos(Phi)) * momentum +
+                   (SinTheta * sin(Phi)) * e2)
+                      .unit();
+
+    // polarization is normal to new momentum and in same plane as
+    // old new momentum and old polarization
+    newPolarization = (polarization - CosTheta * newMomentum).unit();
+}
+
+G4bool CupOpAttenuation::SampleReemissionEnergy(G4int materialIndex, G4double primaryEnergy,
+                                                G4double &energy) {
+    const MaterialOptics &optics = GetMaterialOptics(materialIndex);
+    G4int nBins                  = optics.alias.size();
+    if (nBins == 0) return false;
+
+    // Make sure the energy of the secondary is less than that of the primary
+    for (G4int j = 1; j <= 100; j++) {
+        // One uniform picks the bin and, rescaled, the energy within it
+        G4double u = G4UniformRand() * nBins;
+        G4int bin  = std::min(G4int(u), nBins - 1);
+        G4double f = u - bin;
+        G4double p = optics.aliasProbability[bin];
+        if (f < p) {
+            f /= p;
+        } else {
+            f   = (f - p) / (1. - p);
+            bin = optics.alias[bin];
+        }
+        energy = optics.binEdges[bin] + f * (optics.binEdges[bin + 1] - optics.binEdges[bin]);
+        if (verboseLevel > 1) G4cout << "sampledEnergy = " << energy << G4endl;
+        if (energy <= primaryEnergy) return true;
+    }
+
+    if (verboseLevel > 1) G4cout << " *** One less WLS photon will be returned ***" << G4endl;
+    return false;
+}
+
+// As G4WLSTimeGeneratorProfileDelta and G4WLSTimeGeneratorProfileExponential,
+// without the virtual call
+G4double CupOpAttenuation::SampleReemissionDelay(G4double timeConstant) const {
+    if (fTimeProfile == kTimeProfileExponential) return -std::log(G4UniformRand()) * timeConstant;
+    return timeConstant;
+}
+
+void CupOpAttenuation::SampleReemissionDirection(G4ThreeVector &momentum,
+                                                 G4ThreeVector &polarization) {
+    // Generate random photon direction
+    G4double cost = 1. - 2. * G4UniformRand();
+    G4double sint = std::sqrt((1. - cost) * (1. + cost));
+
+    G4double phi  = twopi * G4UniformRand();
+    G4double sinp = std::sin(phi);
+    G4double cosp = std::cos(phi);
+
+    momentum = G4ThreeVector(sint * cosp, sint * sinp, cost);
+
+    // Determine polarization of new photon
+    polarization = G4ThreeVector(cost * cosp, cost * sinp, -sint);
+
+    G4ThreeVector perp = momentum.cross(polarization);
+
+    phi  = twopi * G4UniformRand();
+    sinp = std::sin(phi);
+    cosp = std::cos(phi);
+
+    polarization = (cosp * polarization + sinp * perp).unit();
+}
+
 void CupOpAttenuation::BuildThePhysicsTable() {
     if (theIntegralTable) return;
 
@@ -307,6 +315,92 @@ void CupOpAttenuation::BuildThePhysicsTable() {
 
         theIntegralTable->insertAt(i, aPhysicsOrderedFreeVector);
     }
+
+    ResolveMaterials();
+}
+
+void CupOpAttenuation::ResolveMaterials() {
+    const G4MaterialTable *theMaterialTable = G4Material::GetMaterialTable();
+    G4int numOfMaterials                    = G4Material::GetNumberOfMaterials();
+
+    fMaterialOptics.assign(numOfMaterials, MaterialOptics());
+    for (G4int i = 0; i < numOfMaterials; i++) {
+        MaterialOptics &optics             = fMaterialOptics[i];
+        G4MaterialPropertiesTable *mpt     = (*theMaterialTable)[i]->GetMaterialPropertiesTable();
+        optics.hasProperties               = (mpt != 0);
+        optics.absLength                   = mpt ? mpt->GetProperty("ABSLENGTH") : 0;
+        optics.scatFrac                    = mpt ? mpt->GetProperty("OPSCATFRAC") : 0;
+        G4MaterialPropertyVector *spectrum = mpt ? mpt->GetProperty("WLSSPECTRUM") : 0;
+        optics.reemits                     = (spectrum != 0);
+        optics.reemissionProbability       = 1.;
+        optics.reemissionTime              = 0. * ns;
+        if (!mpt) continue;
+        if (mpt->ConstPropertyExists("WLSPROBABILITY"))
+            optics.reemissionProbability = mpt->GetConstProperty("WLSPROBABILITY");
+        if (mpt->ConstPropertyExists("WLSTIMECONSTANT"))
+            optics.reemissionTime = mpt->GetConstProperty("WLSTIMECONSTANT");
+        if (spectrum) BuildAliasTable(spectrum, optics);
+    }
+    fPropertyVersion = CupOpticalScan::GetPropertyVersion();
+}
+
+// Vose's alias method over the bins of the spectrum, each weighted by its
+// trapezoid integral as in theIntegralTable
+void CupOpAttenuation::BuildAliasTable(const G4MaterialPropertyVector *spectrum,
+                                       MaterialOptics &optics) {
+    G4int nBins = G4int(spectrum->GetVectorLength()) - 1;
+    if (nBins < 1 || (*spectrum)[0] < 0.0) return;
+
+    std::vector<G4double> weight(nBins);
+    G4double total = 0.;
+    for (G4int j = 0; j < nBins; j++) {
+        weight[j] = 0.5 * ((*spectrum)[j] + (*spectrum)[j + 1]) *
+                    (spectrum->Energy(j + 1) - spectrum->Energy(j));
+        total += weight[j];
+    }
+    if (total <= 0.) return;
+
+    optics.binEdges.resize(nBins + 1);
+    for (G4int j = 0; j <= nBins; j++)
+        optics.binEdges[j] = spectrum->Energy(j);
+    optics.aliasProbability.resize(nBins);
+    optics.alias.resize(nBins);
+
+    std::vector<G4int> small, large;
+    for (G4int j = 0; j < nBins; j++) {
+        weight[j] *= nBins / total;
+        if (weight[j] < 1.)
+            small.push_back(j);
+        else
+            large.push_back(j);
+    }
+    while (!small.empty() && !large.empty()) {
+        G4int s = small.back(), l = large.back();
+        small.pop_back();
+        optics.aliasProbability[s] = weight[s];
+        optics.alias[s]            = l;
+        weight[l] -= 1. - weight[s];
+        if (weight[l] < 1.) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // what is left is 1 up to rounding
+    for (size_t k = 0; k < large.size(); k++) {
+        optics.aliasProbability[large[k]] = 1.;
+        optics.alias[large[k]]            = large[k];
+    }
+    for (size_t k = 0; k < small.size(); k++) {
+        optics.aliasProbability[small[k]] = 1.;
+        optics.alias[small[k]]            = small[k];
+    }
+}
+
+const CupOpAttenuation::MaterialOptics &CupOpAttenuation::GetMaterialOptics(G4int materialIndex) {
+    if (fPropertyVersion != CupOpticalScan::GetPropertyVersion() ||
+        materialIndex >= G4int(fMaterialOptics.size()))
+        ResolveMaterials();
+    return fMaterialOptics[materialIndex];
 }
 
 G4double CupOpAttenuation::GetMeanFreePath(const G4Track &aTrack, G4double, G4ForceCondition *) {
@@ -315,30 +409,20 @@ G4double CupOpAttenuation::GetMeanFreePath(const G4Track &aTrack, G4double, G4Fo
 
     G4double thePhotonMomentum = aParticle->GetTotalMomentum();
 
-    G4MaterialPropertiesTable *aMaterialPropertyTable;
-    G4MaterialPropertyVector *AttenuationLengthVector;
-
     G4double AttenuationLength = DBL_MAX;
 
-    aMaterialPropertyTable = aMaterial->GetMaterialPropertiesTable();
-    if (aMaterialPropertyTable) {
-        AttenuationLengthVector = aMaterialPropertyTable->GetProperty("ABSLENGTH");
-        if (AttenuationLengthVector) {
-            AttenuationLength = AttenuationLengthVector->Value(thePhotonMomentum);
-        }
-    }
+    const MaterialOptics &optics = GetMaterialOptics(aMaterial->GetIndex());
+    if (optics.absLength) AttenuationLength = optics.absLength->Value(thePhotonMomentum);
 
     return AttenuationLength;
 }
 
 void CupOpAttenuation::UseTimeProfile(const G4String name) {
-    if (name == "delta") {
-        delete WLSTimeGeneratorProfile;
-        WLSTimeGeneratorProfile = new G4WLSTimeGeneratorProfileDelta("delta");
-    } else if (name == "exponential") {
-        delete WLSTimeGeneratorProfile;
-        WLSTimeGeneratorProfile = new G4WLSTimeGeneratorProfileExponential("exponential");
-    } else
+    if (name == "delta")
+        fTimeProfile = kTimeProfileDelta;
+    else if (name == "exponential")
+        fTimeProfile = kTimeProfileExponential;
+    else
         G4Exception("CupSim/CupOpWLS::UseTimeProfile", "em0202", FatalException,
                     "generator does not exist");
 }
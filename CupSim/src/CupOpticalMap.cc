@@ -0,0 +1,643 @@
+#include "CupSim/CupOpticalMap.hh"
+#include "CupSim/CupHitPMTCollection.hh"
+#include "CupSim/CupPMTSD.hh"
+
+#include "G4AutoLock.hh"
+#include "G4Event.hh"
+#include "G4LogicalVolume.hh"
+#include "G4OpticalPhoton.hh"
+#include "G4PhysicalVolumeStore.hh"
+#include "G4Point3D.hh"
+#include "G4Poisson.hh"
+#include "G4PrimaryParticle.hh"
+#include "G4PrimaryVertex.hh"
+#include "G4SDManager.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Threading.hh"
+#include "G4Transform3D.hh"
+#include "G4TransportationManager.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcmdWithoutParameter.hh"
+#include "G4UIdirectory.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4VSolid.hh"
+#include "G4VisExtent.hh"
+#include "Randomize.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace {
+G4Mutex CupOpticalMapMutex = G4MUTEX_INITIALIZER;
+
+const char kMagic[8]  = {'C', 'u', 'p', 'O', 'p', 'M', 'a', 'p'};
+const G4int kVersion  = 1;
+const G4int kScintTag = 2; // processTag of scintillation photons in CupPMTOpticalModel
+
+template <class T> void WriteValue(std::ostream &os, const T &value) {
+    os.write((const char *)&value, sizeof(T));
+}
+
+template <class T> void ReadValue(std::istream &is, T &value) {
+    is.read((char *)&value, sizeof(T));
+}
+
+void WriteVector(std::ostream &os, const std::vector<G4double> &v) {
+    if (!v.empty()) os.write((const char *)&v[0], v.size() * sizeof(G4double));
+}
+
+void ReadVector(std::istream &is, std::vector<G4double> &v) {
+    if (!v.empty()) is.read((char *)&v[0], v.size() * sizeof(G4double));
+}
+
+// the placement named name below mother, and its local-to-global transform
+const G4VPhysicalVolume *FindVolume(const G4VPhysicalVolume *mother, const G4String &name,
+                                    const G4Transform3D &motherToGlobal,
+                                    G4Transform3D &toGlobal) {
+    const G4LogicalVolume *logical = mother->GetLogicalVolume();
+    for (G4int i = 0; i < (G4int)logical->GetNoDaughters(); i++) {
+        const G4VPhysicalVolume *daughter = logical->GetDaughter(i);
+        G4Transform3D daughterToGlobal =
+            motherToGlobal *
+            G4Transform3D(daughter->GetObjectRotationValue(), daughter->GetObjectTranslation());
+        if (daughter->GetName() == name) {
+            toGlobal = daughterToGlobal;
+            return daughter;
+        }
+        const G4VPhysicalVolume *found = FindVolume(daughter, name, daughterToGlobal, toGlobal);
+        if (found) return found;
+    }
+    return NULL;
+}
+
+// cumulative sums of n values, normalized to end at exactly 1 (all 0 if
+// the values are)
+void BuildCdf(const G4double *value, G4int n, float *cdf) {
+    G4double total = 0.;
+    for (G4int i = 0; i < n; i++)
+        total += value[i];
+    G4double sum = 0.;
+    for (G4int i = 0; i < n; i++) {
+        sum += value[i];
+        cdf[i] = (total > 0.) ? float(sum / total) : 0.f;
+    }
+    if (total > 0.) cdf[n - 1] = 1.f;
+}
+
+// the bin of u in [0, 1) in a cdf built by BuildCdf
+G4int SampleCdf(const float *cdf, G4int n, G4double u) {
+    G4int bin = G4int(std::upper_bound(cdf, cdf + n, float(u)) - cdf);
+    return std::min(bin, n - 1);
+}
+} // namespace
+
+G4ThreadLocal CupOpticalMap *CupOpticalMap::fgInstance = NULL;
+
+G4int CupOpticalMap::fgMode = CupOpticalMap::kModeOff;
+G4String CupOpticalMap::fgFileName;
+CupOpticalMap::Layout CupOpticalMap::fgLayout = {
+    "physTarget", 20, 20, 20, G4ThreeVector(), G4ThreeVector(), 0, 0, 0, 2. * ns};
+G4String CupOpticalMap::fgPMTSDName                  = "/cupdet/pmt/inner";
+CupOpticalMap::Sums *CupOpticalMap::fgSums           = NULL;
+CupOpticalMap::Map *CupOpticalMap::fgMap             = NULL;
+G4int CupOpticalMap::fgMapVersion                    = 0;
+CupOpticalMap::Messenger *CupOpticalMap::fgMessenger = NULL;
+
+CupOpticalMap *CupOpticalMap::GetInstance() {
+    if (!fgInstance) fgInstance = new CupOpticalMap();
+    return fgInstance;
+}
+
+// Constructor /////////////////////////////////////////////////////////////
+CupOpticalMap::CupOpticalMap()
+    : fVolume(NULL), fPMTSD(NULL), fMapVersion(-1), fEmptyVoxelSteps(0) {}
+
+// Destructor //////////////////////////////////////////////////////////////
+CupOpticalMap::~CupOpticalMap() {}
+
+void CupOpticalMap::CreateMessenger() {
+    // the settings are process wide, so workers don't need their own commands
+    if (fgMessenger != NULL || !G4Threading::IsMasterThread()) return;
+    fgMessenger = new Messenger();
+}
+
+// Generator mode //////////////////////////////////////////////////////////
+void CupOpticalMap::BeginOfRun() {
+    if (fgMode != kModeGenerate) return;
+
+    // the master (or the only thread) starts from the sums in the file; the
+    // workers start their events after this and add to the same sums
+    if (!G4Threading::IsMasterThread()) return;
+    Layout layout = fgLayout;
+    if (!MakeLayout(layout)) {
+        G4cerr << "CupOpticalMap: cannot make a map of " << layout.volume
+               << ", generator mode off" << G4endl;
+        fgMode = kModeOff;
+        return;
+    }
+    if (!fgSums) fgSums = new Sums;
+    if (fgSums->Read(fgFileName) && fgSums->layout == layout) {
+        G4cout << "CupOpticalMap: adding to the map in " << fgFileName << G4endl;
+    } else {
+        G4cout << "CupOpticalMap: new map of " << layout.volume << " in " << fgFileName << G4endl;
+        fgSums->Reset(layout);
+    }
+}
+
+void CupOpticalMap::EndOfRun() {
+    if (fgInstance && fgInstance->fEmptyVoxelSteps > 0) {
+        G4cout << "CupOpticalMap: " << fgInstance->fEmptyVoxelSteps
+               << " scintillation steps in voxels without map entries made no pe" << G4endl;
+        fgInstance->fEmptyVoxelSteps = 0;
+    }
+    if (fgMode != kModeGenerate || !fgSums || !G4Threading::IsMasterThread()) return;
+
+    // the workers are done by the time the master ends its run
+    G4double emitted = 0.;
+    G4int filled     = 0;
+    for (size_t i = 0; i < fgSums->emitted.size(); i++) {
+        emitted += fgSums->emitted[i];
+        if (fgSums->emitted[i] > 0.) filled++;
+    }
+    if (fgSums->Write(fgFileName)) {
+        G4cout << "CupOpticalMap: " << emitted << " photons in " << filled << " of "
+               << fgSums->layout.GetNumberOfVoxels() << " voxels written to " << fgFileName
+               << G4endl;
+    } else {
+        G4cerr << "CupOpticalMap: could not write " << fgFileName << G4endl;
+    }
+}
+
+void CupOpticalMap::RecordEvent(const G4Event *anEvent, CupHitPMTCollection *hits) {
+    G4PrimaryVertex *vertex = anEvent->GetPrimaryVertex(0);
+    Sums *sums              = fgSums;
+    if (fgMode != kModeGenerate || !sums || !vertex) return;
+
+    // the photons of the event, all taken to start from the first vertex
+    G4double emitted = 0.;
+    for (G4int iv = 0; iv < anEvent->GetNumberOfPrimaryVertex(); iv++) {
+        G4PrimaryParticle *particle = anEvent->GetPrimaryVertex(iv)->GetPrimary();
+        for (; particle != NULL; particle = particle->GetNext()) {
+            if (particle->GetG4code() == G4OpticalPhoton::OpticalPhotonDefinition())
+                emitted += particle->GetWeight();
+        }
+    }
+    const Layout &layout = sums->layout;
+    G4int voxel          = layout.GetVoxel(vertex->GetPosition());
+    if (emitted <= 0. || voxel < 0) return;
+
+    G4double t0 = vertex->GetT0();
+    hits->SortTimeAscending(); // folds in the pending photons
+
+    // one event's worth of additions; the tracking of its photons takes far
+    // longer, so the threads rarely wait here
+    G4AutoLock lock(&CupOpticalMapMutex);
+    sums->emitted[voxel] += emitted;
+    for (G4int i = 0; i < hits->GetEntries(); i++) {
+        CupHitPMT *pmt = hits->GetPMT(i);
+        G4int ipmt     = pmt->GetID() - layout.pmtOffset;
+        if (ipmt < 0 || ipmt >= layout.nPMT) continue;
+        size_t k = size_t(voxel) * layout.nPMT + ipmt;
+        for (G4int j = 0; j < pmt->GetEntries(); j++) {
+            const CupHitPhoton *photon = pmt->GetPhoton(j);
+            G4double count             = photon->GetCount();
+            G4double delay             = photon->GetTime() - t0;
+            sums->pe[k] += count;
+            sums->delay[k] += count * delay;
+            if (layout.nTimeBins > 0) {
+                // the last bin also takes the later hits
+                G4int bin = std::max(G4int(delay / layout.timeBinWidth), 0);
+                bin       = std::min(bin, layout.nTimeBins - 1);
+                sums->time[k * layout.nTimeBins + bin] += count;
+            }
+        }
+    }
+}
+
+// Fast-sim mode ///////////////////////////////////////////////////////////
+G4bool CupOpticalMap::DetectPhotons(const CupScintillation::PhotonOrigin &origin, G4int num,
+                                    const CupScintillation::SpectrumSampler &spectrum,
+                                    G4double decayTime, G4double riseTime) {
+    const Map *map = fgMap;
+    if (!map) return false;
+    if (fMapVersion != fgMapVersion) {
+        fVolume = G4PhysicalVolumeStore::GetInstance()->GetVolume(map->layout.volume, false);
+        fPMTSD  = dynamic_cast<CupPMTSD *>(
+            G4SDManager::GetSDMpointer()->FindSensitiveDetector(fgPMTSDName, false));
+        if (!fVolume || !fPMTSD) {
+            G4cerr << "CupOpticalMap: no volume " << map->layout.volume << " or PMT SD "
+                   << fgPMTSDName << ", photons are tracked" << G4endl;
+        }
+        fMapVersion = fgMapVersion;
+    }
+    if (!fVolume || !fPMTSD || origin.touchable->GetVolume() != fVolume) return false;
+    if (num <= 0 || !fPMTSD->isActive()) return true;
+
+    // the photons are emitted at origin.position + fraction * deltaPosition,
+    // the fraction uniform along the step of a charged particle, 1 otherwise
+    const Layout &layout = map->layout;
+    G4int voxels[8];
+    G4double probabilities[8];
+    G4double meanFraction = origin.alongStep ? 0.5 : 1.;
+    G4ThreeVector middle  = origin.position + meanFraction * origin.deltaPosition;
+    G4double pePerPhoton  = map->GetPePerPhoton(middle, voxels, probabilities);
+    G4double mu           = origin.weight * num * pePerPhoton;
+    if (mu <= 0.) {
+        fEmptyVoxelSteps++;
+        return true;
+    }
+    G4int npe = G4int(G4Poisson(mu));
+
+    const G4int nPMT               = layout.nPMT;
+    const G4int nTimeBins          = layout.nTimeBins;
+    CLHEP::HepRandomEngine *engine = G4Random::getTheEngine();
+
+    CupScintillation::PhotonBatch &batch = fPhotonBatch;
+    for (G4int first = 0; first < npe; first += CupScintillation::PhotonBatch::kSize) {
+        G4int n = std::min(npe - first, G4int(CupScintillation::PhotonBatch::kSize));
+        CupScintillation::FillPhotonBatch(batch, n, spectrum, decayTime, riseTime,
+                                          origin.alongStep);
+        for (G4int i = 0; i < n; i++) {
+            // the voxel this pe is drawn from, around its emission point (or
+            // the middle of the step if there are no filled voxels there)
+            G4int peVoxels[8];
+            G4double peProbabilities[8];
+            G4ThreeVector point = origin.position + batch.fraction[i] * origin.deltaPosition;
+            if (!origin.alongStep || map->GetPePerPhoton(point, peVoxels, peProbabilities) <= 0.) {
+                std::copy(voxels, voxels + 8, peVoxels);
+                std::copy(probabilities, probabilities + 8, peProbabilities);
+            }
+            G4int corner = 0;
+            G4double u   = engine->flat();
+            for (G4int c = 0; c < 8; c++) {
+                if (peProbabilities[c] <= 0.) continue;
+                corner = c;
+                u -= peProbabilities[c];
+                if (u < 0.) break;
+            }
+            G4int voxel = peVoxels[corner];
+            G4int ipmt  = SampleCdf(&map->pmtCdf[size_t(voxel) * nPMT], nPMT, engine->flat());
+            size_t k    = size_t(voxel) * nPMT + ipmt;
+
+            // emission as CupScintillation would have made it, then the delay
+            G4double time = origin.time +
+                            batch.fraction[i] * origin.stepLength / origin.meanVelocity +
+                            batch.delay[i];
+            if (nTimeBins > 0) {
+                G4int bin = SampleCdf(&map->timeCdf[k * nTimeBins], nTimeBins, engine->flat());
+                time += (bin + engine->flat()) * layout.timeBinWidth;
+            } else {
+                time += map->meanDelay[k];
+            }
+            // the map has no hit position, direction or polarization
+            fPMTSD->SimpleHit(layout.pmtOffset + ipmt, time, batch.energy[i], G4ThreeVector(),
+                              G4ThreeVector(), G4ThreeVector(), 1, kScintTag);
+        }
+    }
+    return true;
+}
+
+void CupOpticalMap::Load(const G4String &fileName) {
+    Sums sums;
+    if (!sums.Read(fileName)) {
+        G4cerr << "CupOpticalMap: could not read a map from " << fileName << G4endl;
+        return;
+    }
+    Map *map = new Map;
+    map->Build(sums);
+    delete fgMap;
+    fgMap      = map;
+    fgFileName = fileName;
+    fgMapVersion++;
+    fgMode = kModeFastSim;
+
+    G4int filled = 0;
+    for (size_t i = 0; i < sums.emitted.size(); i++)
+        if (sums.emitted[i] > 0.) filled++;
+    G4cout << "CupOpticalMap: map of " << map->layout.volume << " from " << fileName << ", "
+           << filled << " of " << map->layout.GetNumberOfVoxels() << " voxels filled, "
+           << map->layout.nPMT << " PMTs" << G4endl;
+}
+
+G4bool CupOpticalMap::MakeLayout(Layout &layout) {
+    const G4VPhysicalVolume *world = G4TransportationManager::GetTransportationManager()
+                                         ->GetNavigatorForTracking()
+                                         ->GetWorldVolume();
+    G4Transform3D toGlobal;
+    const G4VPhysicalVolume *volume =
+        (world && world->GetName() == layout.volume)
+            ? world
+            : (world ? FindVolume(world, layout.volume, G4Transform3D(), toGlobal) : NULL);
+    CupPMTSD *pmtSD = dynamic_cast<CupPMTSD *>(
+        G4SDManager::GetSDMpointer()->FindSensitiveDetector(fgPMTSDName, false));
+    if (!volume || !pmtSD) return false;
+
+    // bounding box of the solid's extent, in global coordinates
+    G4VisExtent extent = volume->GetLogicalVolume()->GetSolid()->GetExtent();
+    for (G4int corner = 0; corner < 8; corner++) {
+        G4Point3D p = toGlobal * G4Point3D((corner & 1) ? extent.GetXmax() : extent.GetXmin(),
+                                           (corner & 2) ? extent.GetYmax() : extent.GetYmin(),
+                                           (corner & 4) ? extent.GetZmax() : extent.GetZmin());
+        G4ThreeVector v(p.x(), p.y(), p.z());
+        if (corner == 0) layout.lo = layout.hi = v;
+        layout.lo = G4ThreeVector(std::min(layout.lo.x(), v.x()), std::min(layout.lo.y(), v.y()),
+                                  std::min(layout.lo.z(), v.z()));
+        layout.hi = G4ThreeVector(std::max(layout.hi.x(), v.x()), std::max(layout.hi.y(), v.y()),
+                                  std::max(layout.hi.z(), v.z()));
+    }
+    layout.nPMT      = pmtSD->GetMaxPMTs();
+    layout.pmtOffset = pmtSD->GetPMTNoOffset();
+    return true;
+}
+
+// Layout //////////////////////////////////////////////////////////////////
+G4int CupOpticalMap::Layout::GetVoxel(const G4ThreeVector &position) const {
+    G4int ix = G4int(std::floor((position.x() - lo.x()) / (hi.x() - lo.x()) * nx));
+    G4int iy = G4int(std::floor((position.y() - lo.y()) / (hi.y() - lo.y()) * ny));
+    G4int iz = G4int(std::floor((position.z() - lo.z()) / (hi.z() - lo.z()) * nz));
+    if (ix < 0 || ix >= nx || iy < 0 || iy >= ny || iz < 0 || iz >= nz) return -1;
+    return (iz * ny + iy) * nx + ix;
+}
+
+G4bool CupOpticalMap::Layout::GetNeighbours(const G4ThreeVector &position, G4int voxels[8],
+                                            G4double weights[8]) const {
+    const G4int n[3] = {nx, ny, nz};
+    G4int i0[3], i1[3];
+    G4double f[3];
+    for (G4int d = 0; d < 3; d++) {
+        // in units of voxels, from the centre of the first one
+        G4double s = (position[d] - lo[d]) / (hi[d] - lo[d]) * n[d];
+        if (!(s >= 0. && s < n[d])) return false;
+        s -= 0.5;
+        G4int i = G4int(std::floor(s));
+        f[d]    = s - i;
+        i0[d]   = std::max(i, 0);
+        i1[d]   = std::min(i + 1, n[d] - 1);
+    }
+    for (G4int corner = 0; corner < 8; corner++) {
+        G4int ix        = (corner & 1) ? i1[0] : i0[0];
+        G4int iy        = (corner & 2) ? i1[1] : i0[1];
+        G4int iz        = (corner & 4) ? i1[2] : i0[2];
+        voxels[corner]  = (iz * ny + iy) * nx + ix;
+        weights[corner] = ((corner & 1) ? f[0] : 1. - f[0]) * ((corner & 2) ? f[1] : 1. - f[1]) *
+                          ((corner & 4) ? f[2] : 1. - f[2]);
+    }
+    return true;
+}
+
+G4bool CupOpticalMap::Layout::operator==(const Layout &other) const {
+    return volume == other.volume && nx == other.nx && ny == other.ny && nz == other.nz &&
+           (lo - other.lo).mag() < micrometer && (hi - other.hi).mag() < micrometer &&
+           nPMT == other.nPMT && pmtOffset == other.pmtOffset && nTimeBins == other.nTimeBins &&
+           (nTimeBins == 0 || std::fabs(timeBinWidth - other.timeBinWidth) < 1.e-6 * ns);
+}
+
+// Sums ////////////////////////////////////////////////////////////////////
+void CupOpticalMap::Sums::Reset(const Layout &aLayout) {
+    layout      = aLayout;
+    size_t nVox = layout.GetNumberOfVoxels();
+    size_t nPMT = layout.nPMT;
+    emitted.assign(nVox, 0.);
+    pe.assign(nVox * nPMT, 0.);
+    delay.assign(nVox * nPMT, 0.);
+    time.assign(nVox * nPMT * layout.nTimeBins, 0.);
+}
+
+G4bool CupOpticalMap::Sums::Read(const G4String &fileName) {
+    std::ifstream is(fileName.c_str(), std::ios::binary);
+    if (!is) return false;
+
+    char magic[8];
+    G4int version = 0;
+    is.read(magic, sizeof(magic));
+    ReadValue(is, version);
+    if (!is || !std::equal(magic, magic + 8, kMagic) || version != kVersion) return false;
+
+    Layout aLayout;
+    G4int length = 0;
+    ReadValue(is, length);
+    if (!is || length < 0 || length > 1024) return false;
+    std::string name(length, ' ');
+    if (length > 0) is.read(&name[0], length);
+    aLayout.volume = name;
+    G4double lo[3], hi[3];
+    ReadValue(is, aLayout.nx);
+    ReadValue(is, aLayout.ny);
+    ReadValue(is, aLayout.nz);
+    for (G4int i = 0; i < 3; i++)
+        ReadValue(is, lo[i]);
+    for (G4int i = 0; i < 3; i++)
+        ReadValue(is, hi[i]);
+    ReadValue(is, aLayout.nPMT);
+    ReadValue(is, aLayout.pmtOffset);
+    ReadValue(is, aLayout.nTimeBins);
+    ReadValue(is, aLayout.timeBinWidth);
+    if (!is || aLayout.nx <= 0 || aLayout.ny <= 0 || aLayout.nz <= 0 || aLayout.nPMT <= 0 ||
+        aLayout.nTimeBins < 0)
+        return false;
+    aLayout.lo = G4ThreeVector(lo[0], lo[1], lo[2]);
+    aLayout.hi = G4ThreeVector(hi[0], hi[1], hi[2]);
+
+    Reset(aLayout);
+    ReadVector(is, emitted);
+    ReadVector(is, pe);
+    ReadVector(is, delay);
+    ReadVector(is, time);
+    return bool(is);
+}
+
+G4bool CupOpticalMap::Sums::Write(const G4String &fileName) const {
+    std::ofstream os(fileName.c_str(), std::ios::binary | std::ios::trunc);
+    if (!os) return false;
+
+    os.write(kMagic, sizeof(kMagic));
+    WriteValue(os, kVersion);
+    G4int length = layout.volume.length();
+    WriteValue(os, length);
+    os.write(layout.volume.c_str(), length);
+    WriteValue(os, layout.nx);
+    WriteValue(os, layout.ny);
+    WriteValue(os, layout.nz);
+    G4double lo[3] = {layout.lo.x(), layout.lo.y(), layout.lo.z()};
+    G4double hi[3] = {layout.hi.x(), layout.hi.y(), layout.hi.z()};
+    for (G4int i = 0; i < 3; i++)
+        WriteValue(os, lo[i]);
+    for (G4int i = 0; i < 3; i++)
+        WriteValue(os, hi[i]);
+    WriteValue(os, layout.nPMT);
+    WriteValue(os, layout.pmtOffset);
+    WriteValue(os, layout.nTimeBins);
+    WriteValue(os, layout.timeBinWidth);
+
+    WriteVector(os, emitted);
+    WriteVector(os, pe);
+    WriteVector(os, delay);
+    WriteVector(os, time);
+    return bool(os);
+}
+
+// Map /////////////////////////////////////////////////////////////////////
+void CupOpticalMap::Map::Build(const Sums &sums) {
+    layout      = sums.layout;
+    size_t nVox = layout.GetNumberOfVoxels();
+    G4int nPMT  = layout.nPMT;
+    G4int nT    = layout.nTimeBins;
+    filled.assign(nVox, false);
+    pePerPhoton.assign(nVox, 0.);
+    pmtCdf.assign(nVox * nPMT, 0.f);
+    meanDelay.assign(nVox * nPMT, 0.f);
+    timeCdf.assign(nVox * nPMT * nT, 0.f);
+
+    for (size_t v = 0; v < nVox; v++) {
+        if (sums.emitted[v] <= 0.) continue;
+        filled[v]          = true;
+        const G4double *pe = &sums.pe[v * nPMT];
+        G4double total     = 0.;
+        for (G4int p = 0; p < nPMT; p++) {
+            total += pe[p];
+            size_t k = v * nPMT + p;
+            if (pe[p] > 0.) meanDelay[k] = float(sums.delay[k] / pe[p]);
+            if (nT > 0) BuildCdf(&sums.time[k * nT], nT, &timeCdf[k * nT]);
+        }
+        pePerPhoton[v] = total / sums.emitted[v];
+        BuildCdf(pe, nPMT, &pmtCdf[v * nPMT]);
+    }
+}
+
+G4double CupOpticalMap::Map::GetPePerPhoton(const G4ThreeVector &position, G4int voxels[8],
+                                            G4double probabilities[8]) const {
+    G4double weights[8];
+    if (!layout.GetNeighbours(position, voxels, weights)) return 0.;
+    G4double weightSum = 0.;
+    G4double peSum     = 0.;
+    for (G4int corner = 0; corner < 8; corner++) {
+        if (!filled[voxels[corner]]) weights[corner] = 0.;
+        probabilities[corner] = weights[corner] * pePerPhoton[voxels[corner]];
+        weightSum += weights[corner];
+        peSum += probabilities[corner];
+    }
+    if (weightSum <= 0. || peSum <= 0.) return 0.;
+    for (G4int corner = 0; corner < 8; corner++)
+        probabilities[corner] /= peSum;
+    return peSum / weightSum;
+}
+
+// Messenger ///////////////////////////////////////////////////////////////
+CupOpticalMap::Messenger::Messenger() {
+    fMapDir = new G4UIdirectory("/cupmap/");
+    fMapDir->SetGuidance("Optical detection-probability map of a scintillator volume.");
+
+    fVolumeCmd = new G4UIcmdWithAString("/cupmap/volume", this);
+    fVolumeCmd->SetGuidance("Physical volume the map is made for (default physTarget).");
+    fVolumeCmd->SetParameterName("volume", false);
+
+    fGridCmd = new G4UIcommand("/cupmap/grid", this);
+    fGridCmd->SetGuidance("Voxels of the map along x, y and z of the volume's bounding box.");
+    fGridCmd->SetParameter(new G4UIparameter("nx", 'i', false));
+    fGridCmd->SetParameter(new G4UIparameter("ny", 'i', false));
+    fGridCmd->SetParameter(new G4UIparameter("nz", 'i', false));
+
+    fTimeBinsCmd = new G4UIcommand("/cupmap/timeBins", this);
+    fTimeBinsCmd->SetGuidance("Histogram the hit delays of each voxel and PMT in n bins of the");
+    fTimeBinsCmd->SetGuidance("given width; n = 0 (default) keeps only the mean delay.");
+    fTimeBinsCmd->SetParameter(new G4UIparameter("n", 'i', false));
+    fTimeBinsCmd->SetParameter(new G4UIparameter("width", 'd', true));
+    fTimeBinsCmd->GetParameter(1)->SetDefaultValue(2.);
+    fTimeBinsCmd->SetParameter(new G4UIparameter("unit", 's', true));
+    fTimeBinsCmd->GetParameter(2)->SetDefaultValue("ns");
+
+    fPMTSDCmd = new G4UIcmdWithAString("/cupmap/pmtSD", this);
+    fPMTSDCmd->SetGuidance("CupPMTSD whose PMTs are mapped (default /cupdet/pmt/inner).");
+    fPMTSDCmd->SetParameterName("sd", false);
+
+    fGenerateCmd = new G4UIcmdWithAString("/cupmap/generate", this);
+    fGenerateCmd->SetGuidance("Generator mode: add the PMT hits of each event of optical photons");
+    fGenerateCmd->SetGuidance("to the voxel of its vertex, and write the map to this file at");
+    fGenerateCmd->SetGuidance("the end of each run.  A map already in the file with the same");
+    fGenerateCmd->SetGuidance("volume, grid, PMTs and time bins is added to.");
+    fGenerateCmd->SetParameterName("file", false);
+
+    fLoadCmd = new G4UIcmdWithAString("/cupmap/load", this);
+    fLoadCmd->SetGuidance("Fast-sim mode: scintillation steps in the map volume make pe drawn");
+    fLoadCmd->SetGuidance("from the map in this file instead of optical photons.");
+    fLoadCmd->SetParameterName("file", false);
+
+    fOffCmd = new G4UIcmdWithoutParameter("/cupmap/off", this);
+    fOffCmd->SetGuidance("Neither generate nor use a map.");
+
+    G4UIcommand *commands[] = {fVolumeCmd, fGridCmd,    fTimeBinsCmd, fPMTSDCmd,
+                               fGenerateCmd, fLoadCmd, fOffCmd};
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        commands[i]->SetToBeBroadcasted(false);
+        commands[i]->AvailableForStates(G4State_PreInit, G4State_Idle);
+    }
+}
+
+CupOpticalMap::Messenger::~Messenger() {
+    delete fVolumeCmd;
+    delete fGridCmd;
+    delete fTimeBinsCmd;
+    delete fPMTSDCmd;
+    delete fGenerateCmd;
+    delete fLoadCmd;
+    delete fOffCmd;
+    delete fMapDir;
+}
+
+void CupOpticalMap::Messenger::SetNewValue(G4UIcommand *command, G4String newValue) {
+    if (command == fVolumeCmd) {
+        fgLayout.volume = newValue;
+    } else if (command == fGridCmd) {
+        std::istringstream iss(newValue.c_str());
+        G4int nx = 0, ny = 0, nz = 0;
+        iss >> nx >> ny >> nz;
+        if (nx <= 0 || ny <= 0 || nz <= 0) {
+            G4cerr << "/cupmap/grid: need nx, ny, nz > 0" << G4endl;
+            return;
+        }
+        fgLayout.nx = nx;
+        fgLayout.ny = ny;
+        fgLayout.nz = nz;
+    } else if (command == fTimeBinsCmd) {
+        std::istringstream iss(newValue.c_str());
+        G4int n        = 0;
+        G4double width = 0.;
+        G4String unit;
+        iss >> n >> width >> unit;
+        if (n < 0 || (n > 0 && width <= 0.)) {
+            G4cerr << "/cupmap/timeBins: need n >= 0 and width > 0" << G4endl;
+            return;
+        }
+        fgLayout.nTimeBins    = n;
+        fgLayout.timeBinWidth = width * G4UIcommand::ValueOf(unit);
+    } else if (command == fPMTSDCmd) {
+        fgPMTSDName = newValue;
+    } else if (command == fGenerateCmd) {
+        fgFileName = newValue;
+        fgMode     = kModeGenerate;
+    } else if (command == fLoadCmd) {
+        Load(newValue);
+    } else if (command == fOffCmd) {
+        fgMode = kModeOff;
+    }
+}
+
+G4String CupOpticalMap::Messenger::GetCurrentValue(G4UIcommand *command) {
+    std::ostringstream os;
+    if (command == fVolumeCmd) {
+        os << fgLayout.volume;
+    } else if (command == fGridCmd) {
+        os << fgLayout.nx << " " << fgLayout.ny << " " << fgLayout.nz;
+    } else if (command == fTimeBinsCmd) {
+        os << fgLayout.nTimeBins << " " << fgLayout.timeBinWidth / ns << " ns";
+    } else if (command == fPMTSDCmd) {
+        os << fgPMTSDName;
+    } else if (command == fGenerateCmd || command == fLoadCmd) {
+        os << fgFileName;
+    } else {
+        return G4String("invalid CupOpticalMap \"get\" command");
+    }
+    return G4String(os.str());
+}
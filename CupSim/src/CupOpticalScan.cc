@@ -0,0 +1,330 @@
+#include "CupSim/CupOpticalScan.hh"
+
+#include "G4Material.hh"
+#include "G4Threading.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcmdWithoutParameter.hh"
+#include "G4UIdirectory.hh"
+#include "G4UImanager.hh"
+#include "G4UIparameter.hh"
+
+#include <sstream>
+
+std::vector<CupOpticalScan::Configuration> CupOpticalScan::fgConfigurations;
+std::map<G4MaterialPropertyVector *, std::vector<G4double>> CupOpticalScan::fgVectorBaselines;
+std::map<std::pair<G4String, G4String>, CupOpticalScan::ConstBaseline>
+    CupOpticalScan::fgConstBaselines;
+std::map<G4String, G4String> CupOpticalScan::fgCommandBaselines;
+G4int CupOpticalScan::fgPropertyVersion                = 0;
+CupOpticalScan::Messenger *CupOpticalScan::fgMessenger = nullptr;
+
+void CupOpticalScan::CreateMessenger() {
+    // the settings are process wide, so workers don't need their own commands
+    if (fgMessenger != nullptr || !G4Threading::IsMasterThread()) return;
+    fgMessenger = new Messenger();
+}
+
+G4MaterialPropertiesTable *CupOpticalScan::GetPropertiesTable(const G4String &material) {
+    G4Material *aMaterial = G4Material::GetMaterial(material, false);
+    if (aMaterial == nullptr) {
+        G4cerr << "CupOpticalScan: no material " << material << G4endl;
+        return nullptr;
+    }
+    G4MaterialPropertiesTable *mpt = aMaterial->GetMaterialPropertiesTable();
+    if (mpt == nullptr) G4cerr << "CupOpticalScan: " << material << " has no properties" << G4endl;
+    return mpt;
+}
+
+// the properties whose users follow GetPropertyVersion (CupOpAttenuation,
+// CupScintillation, CupPMTOpticalModel) or read them as they track
+// (CupOpBoundaryProcess)
+static const char *kScannableVectors[] = {"ABSLENGTH",
+                                          "OPSCATFRAC",
+                                          "WLSSPECTRUM",
+                                          "FASTCOMPONENT",
+                                          "SLOWCOMPONENT",
+                                          "PROTONSCINTILLATIONYIELD",
+                                          "DEUTERONSCINTILLATIONYIELD",
+                                          "TRITONSCINTILLATIONYIELD",
+                                          "ALPHASCINTILLATIONYIELD",
+                                          "IONSCINTILLATIONYIELD",
+                                          "ELECTRONSCINTILLATIONYIELD",
+                                          "EFFICIENCY",
+                                          "KINDEX",
+                                          "THICKNESS",
+                                          "REFLECTIVITY",
+                                          "TRANSMITTANCE"};
+static const char *kScannableConstants[] = {"WLSPROBABILITY",
+                                            "WLSTIMECONSTANT",
+                                            "SCINTILLATIONYIELD",
+                                            "RESOLUTIONSCALE",
+                                            "YIELDRATIO",
+                                            "FASTTIMECONSTANT",
+                                            "SLOWTIMECONSTANT",
+                                            "FASTSCINTILLATIONRISETIME",
+                                            "SLOWSCINTILLATIONRISETIME"};
+
+G4bool CupOpticalScan::IsScannable(const Setting &setting) {
+    if (setting.kind == kCommand) return true;
+    const char **names = (setting.kind == kScaleProperty) ? kScannableVectors : kScannableConstants;
+    size_t n           = (setting.kind == kScaleProperty)
+                             ? sizeof(kScannableVectors) / sizeof(kScannableVectors[0])
+                             : sizeof(kScannableConstants) / sizeof(kScannableConstants[0]);
+    for (size_t i = 0; i < n; i++) {
+        if (setting.property == names[i]) return true;
+    }
+    return false;
+}
+
+// Saves the current value of every command the configurations apply, to
+// undo them between configurations; false if one does not report a value
+G4bool CupOpticalScan::SaveCommandBaselines() {
+    G4UImanager *UI = G4UImanager::GetUIpointer();
+    fgCommandBaselines.clear();
+    for (size_t k = 0; k < fgConfigurations.size(); k++) {
+        const std::vector<Setting> &settings = fgConfigurations[k].settings;
+        for (size_t i = 0; i < settings.size(); i++) {
+            if (settings[i].kind != kCommand) continue;
+            G4String path = settings[i].command.substr(0, settings[i].command.find(' '));
+            if (fgCommandBaselines.find(path) != fgCommandBaselines.end()) continue;
+            G4String value = UI->GetCurrentValues(path.c_str());
+            if (value.empty()) {
+                G4cerr << "/cupscan/run: " << path << " has no current value to restore "
+                       << "between configurations" << G4endl;
+                fgCommandBaselines.clear();
+                return false;
+            }
+            fgCommandBaselines[path] = value;
+        }
+    }
+    return true;
+}
+
+// Applies one setting, saving what it changes the first time; false if it
+// could not be made
+G4bool CupOpticalScan::Apply(const Setting &setting) {
+    if (setting.kind == kCommand) {
+        G4int status = G4UImanager::GetUIpointer()->ApplyCommand(setting.command);
+        if (status != fCommandSucceeded) {
+            G4cerr << "CupOpticalScan: \"" << setting.command << "\" failed (" << status << ")"
+                   << G4endl;
+            return false;
+        }
+        return true;
+    }
+
+    G4MaterialPropertiesTable *mpt = GetPropertiesTable(setting.material);
+    if (mpt == nullptr) return false;
+
+    if (setting.kind == kScaleProperty) {
+        G4MaterialPropertyVector *pv = mpt->GetProperty(setting.property);
+        if (pv == nullptr) {
+            G4cerr << "CupOpticalScan: " << setting.material << " has no " << setting.property
+                   << G4endl;
+            return false;
+        }
+        std::vector<G4double> &baseline = fgVectorBaselines[pv];
+        if (baseline.empty()) {
+            for (size_t i = 0; i < pv->GetVectorLength(); i++)
+                baseline.push_back((*pv)[i]);
+        }
+        // scaled from the saved values, so a scale is never applied twice
+        for (size_t i = 0; i < baseline.size(); i++)
+            pv->PutValue(i, baseline[i] * setting.value);
+    } else {
+        std::pair<G4String, G4String> key(setting.material, setting.property);
+        if (fgConstBaselines.find(key) == fgConstBaselines.end()) {
+            ConstBaseline &baseline = fgConstBaselines[key];
+            baseline.exists         = mpt->ConstPropertyExists(setting.property);
+            baseline.value = baseline.exists ? mpt->GetConstProperty(setting.property) : 0.;
+        }
+        mpt->AddConstProperty(setting.property, setting.value);
+    }
+    return true;
+}
+
+// Puts back the material properties and command values the scan changed
+void CupOpticalScan::Restore() {
+    std::map<G4String, G4String>::const_iterator bi;
+    for (bi = fgCommandBaselines.begin(); bi != fgCommandBaselines.end(); ++bi)
+        G4UImanager::GetUIpointer()->ApplyCommand(bi->first + " " + bi->second);
+
+    std::map<G4MaterialPropertyVector *, std::vector<G4double>>::const_iterator vi;
+    for (vi = fgVectorBaselines.begin(); vi != fgVectorBaselines.end(); ++vi) {
+        for (size_t i = 0; i < vi->second.size(); i++)
+            vi->first->PutValue(i, vi->second[i]);
+    }
+
+    std::map<std::pair<G4String, G4String>, ConstBaseline>::const_iterator ci;
+    for (ci = fgConstBaselines.begin(); ci != fgConstBaselines.end(); ++ci) {
+        G4MaterialPropertiesTable *mpt = GetPropertiesTable(ci->first.first);
+        if (mpt == nullptr) continue;
+        if (ci->second.exists)
+            mpt->AddConstProperty(ci->first.second, ci->second.value);
+        else
+            mpt->RemoveConstProperty(ci->first.second);
+    }
+    fgPropertyVersion++;
+}
+
+// One replay run of stepsFile per configuration, each written to
+// outputBase_<name>
+void CupOpticalScan::Run(const G4String &stepsFile, G4int nEvents, const G4String &outputBase) {
+    if (fgConfigurations.empty()) {
+        G4cerr << "/cupscan/run: no configurations, see /cupscan/config" << G4endl;
+        return;
+    }
+    if (!SaveCommandBaselines()) return;
+
+    G4UImanager *UI = G4UImanager::GetUIpointer();
+    for (size_t k = 0; k < fgConfigurations.size(); k++) {
+        const Configuration &config = fgConfigurations[k];
+        G4cout << "CupOpticalScan: configuration " << k + 1 << "/" << fgConfigurations.size()
+               << " \"" << config.name << "\"" << G4endl;
+
+        Restore();
+        G4bool ok = true;
+        for (size_t i = 0; i < config.settings.size() && ok; i++)
+            ok = Apply(config.settings[i]);
+        if (!ok) {
+            G4cerr << "CupOpticalScan: configuration \"" << config.name << "\" skipped" << G4endl;
+            continue;
+        }
+
+        // reopened for each run, which also rewinds the steps
+        UI->ApplyCommand("/event/output_file " + outputBase + "_" + config.name);
+        if (UI->ApplyCommand("/cupreplay/replay " + stepsFile) != fCommandSucceeded) break;
+        std::ostringstream beamOn;
+        beamOn << "/run/beamOn " << nEvents;
+        UI->ApplyCommand(beamOn.str());
+    }
+
+    Restore();
+    fgCommandBaselines.clear();
+    UI->ApplyCommand("/cupreplay/off");
+}
+
+// Messenger ///////////////////////////////////////////////////////////////
+CupOpticalScan::Messenger::Messenger() {
+    fScanDir = new G4UIdirectory("/cupscan/");
+    fScanDir->SetGuidance("Run optical configurations against the same recorded deposits.");
+
+    fConfigCmd = new G4UIcmdWithAString("/cupscan/config", this);
+    fConfigCmd->SetGuidance("Start a new configuration; the following /cupscan/apply,");
+    fConfigCmd->SetGuidance("scaleProperty and setConstProperty commands belong to it.");
+    fConfigCmd->SetGuidance("Its output goes to <outputBase>_<name> (see /cupscan/run).");
+    fConfigCmd->SetParameterName("name", false);
+
+    fApplyCmd = new G4UIcmdWithAString("/cupscan/apply", this);
+    fApplyCmd->SetGuidance("UI command to apply before the run of the configuration,");
+    fApplyCmd->SetGuidance("e.g. /cupscan/apply /PMTOpticalModel/luxlevel 1.  It is undone");
+    fApplyCmd->SetGuidance("after the run by applying the command's value from before the");
+    fApplyCmd->SetGuidance("scan, so it must be a command that reports its current value.");
+    fApplyCmd->SetParameterName("command", false);
+
+    fScalePropertyCmd = new G4UIcommand("/cupscan/scaleProperty", this);
+    fScalePropertyCmd->SetGuidance("Scale a material property vector, e.g. ABSLENGTH, by a");
+    fScalePropertyCmd->SetGuidance("factor, for the run of the configuration.  Only properties");
+    fScalePropertyCmd->SetGuidance("the optical processes rebuild from between runs are accepted");
+    fScalePropertyCmd->SetGuidance("(not RINDEX).");
+    fScalePropertyCmd->SetParameter(new G4UIparameter("material", 's', false));
+    fScalePropertyCmd->SetParameter(new G4UIparameter("property", 's', false));
+    G4UIparameter *factor = new G4UIparameter("factor", 'd', false);
+    factor->SetParameterRange("factor >= 0.");
+    fScalePropertyCmd->SetParameter(factor);
+
+    fConstPropertyCmd = new G4UIcommand("/cupscan/setConstProperty", this);
+    fConstPropertyCmd->SetGuidance("Set a material constant, e.g. WLSPROBABILITY, for the run of");
+    fConstPropertyCmd->SetGuidance("the configuration.  Only constants the optical processes");
+    fConstPropertyCmd->SetGuidance("rebuild from between runs are accepted.");
+    fConstPropertyCmd->SetParameter(new G4UIparameter("material", 's', false));
+    fConstPropertyCmd->SetParameter(new G4UIparameter("property", 's', false));
+    fConstPropertyCmd->SetParameter(new G4UIparameter("value", 'd', false));
+
+    fClearCmd = new G4UIcmdWithoutParameter("/cupscan/clear", this);
+    fClearCmd->SetGuidance("Forget all configurations.");
+
+    fRunCmd = new G4UIcommand("/cupscan/run", this);
+    fRunCmd->SetGuidance("For each configuration: restore the material properties, make its");
+    fRunCmd->SetGuidance("settings, and replay nEvents events of the steps in stepsFile");
+    fRunCmd->SetGuidance("(/cupreplay/record) to <outputBase>_<name>.  The properties are");
+    fRunCmd->SetGuidance("restored and replay is turned off at the end.");
+    fRunCmd->SetParameter(new G4UIparameter("stepsFile", 's', false));
+    G4UIparameter *nEvents = new G4UIparameter("nEvents", 'i', false);
+    nEvents->SetParameterRange("nEvents > 0");
+    fRunCmd->SetParameter(nEvents);
+    fRunCmd->SetParameter(new G4UIparameter("outputBase", 's', false));
+
+    G4UIcommand *commands[] = {fConfigCmd,       fApplyCmd, fScalePropertyCmd,
+                               fConstPropertyCmd, fClearCmd, fRunCmd};
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        commands[i]->SetToBeBroadcasted(false);
+        commands[i]->AvailableForStates(G4State_PreInit, G4State_Idle);
+    }
+    fRunCmd->AvailableForStates(G4State_Idle);
+}
+
+CupOpticalScan::Messenger::~Messenger() {
+    delete fConfigCmd;
+    delete fApplyCmd;
+    delete fScalePropertyCmd;
+    delete fConstPropertyCmd;
+    delete fClearCmd;
+    delete fRunCmd;
+    delete fScanDir;
+}
+
+void CupOpticalScan::Messenger::SetNewValue(G4UIcommand *command, G4String newValue) {
+    if (command == fConfigCmd) {
+        Configuration config;
+        config.name = newValue;
+        fgConfigurations.push_back(config);
+        return;
+    } else if (command == fClearCmd) {
+        fgConfigurations.clear();
+        return;
+    } else if (command == fRunCmd) {
+        std::istringstream iss(newValue.c_str());
+        std::string stepsFile, outputBase;
+        G4int nEvents = 0;
+        iss >> stepsFile >> nEvents >> outputBase;
+        Run(stepsFile, nEvents, outputBase);
+        return;
+    }
+
+    if (fgConfigurations.empty()) {
+        G4cerr << command->GetCommandPath() << ": no configuration, see /cupscan/config"
+               << G4endl;
+        return;
+    }
+    Setting setting;
+    setting.value = 0.;
+    if (command == fApplyCmd) {
+        setting.kind    = kCommand;
+        setting.command = newValue;
+    } else {
+        setting.kind = (command == fScalePropertyCmd) ? kScaleProperty : kConstProperty;
+        std::istringstream iss(newValue.c_str());
+        std::string material, property;
+        iss >> material >> property >> setting.value;
+        setting.material = material;
+        setting.property = property;
+        if (!IsScannable(setting)) {
+            G4cerr << command->GetCommandPath() << ": " << property
+                   << " cannot be scanned, its tables are not rebuilt between runs" << G4endl;
+            return;
+        }
+    }
+    fgConfigurations.back().settings.push_back(setting);
+}
+
+G4String CupOpticalScan::Messenger::GetCurrentValue(G4UIcommand *command) {
+    std::ostringstream os;
+    if (command == fConfigCmd) {
+        for (size_t k = 0; k < fgConfigurations.size(); k++)
+            os << (k > 0 ? " " : "") << fgConfigurations[k].name;
+    } else {
+        return G4String("invalid CupOpticalScan \"get\" command");
+    }
+    return G4String(os.str());
+}
@@ -0,0 +1,444 @@
+#include "CupSim/CupOpticsReplay.hh"
+#include "CupSim/CupScintillation.hh"
+
+#include "G4AutoLock.hh"
+#include "G4Event.hh"
+#include "G4EventManager.hh"
+#include "G4Geantino.hh"
+#include "G4IonTable.hh"
+#include "G4Material.hh"
+#include "G4MaterialPropertiesTable.hh"
+#include "G4Navigator.hh"
+#include "G4ParticleTable.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4PrimaryParticle.hh"
+#include "G4PrimaryVertex.hh"
+#include "G4ProcessManager.hh"
+#include "G4Run.hh"
+#include "G4RunManager.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Threading.hh"
+#include "G4TouchableHistory.hh"
+#include "G4Track.hh"
+#include "G4TransportationManager.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcmdWithoutParameter.hh"
+#include "G4UIdirectory.hh"
+#include "G4VParticleChange.hh"
+#include "G4VProcess.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace {
+G4Mutex CupOpticsReplayMutex = G4MUTEX_INITIALIZER;
+
+const char kMagic[8] = {'C', 'u', 'p', 'S', 't', 'e', 'p', 's'};
+const G4int kVersion = 2; // 2: events under their run and event IDs
+
+// beta is stored as a float, which is 1 for the fastest particles
+const G4double kMaxBeta = 1. - 1.e-7;
+
+template <class T> void WriteValue(std::ostream &os, const T &value) {
+    os.write((const char *)&value, sizeof(T));
+}
+
+template <class T> void ReadValue(std::istream &is, T &value) {
+    is.read((char *)&value, sizeof(T));
+}
+
+G4ThreeVector ToVector(const float *v) { return G4ThreeVector(v[0], v[1], v[2]) * mm; }
+
+G4double KineticEnergy(G4double mass, G4double beta) {
+    beta = std::min(beta, kMaxBeta);
+    return mass * (1. / std::sqrt(1. - beta * beta) - 1.);
+}
+} // namespace
+
+G4ThreadLocal CupOpticsReplay *CupOpticsReplay::fgInstance = nullptr;
+
+G4int CupOpticsReplay::fgMode = CupOpticsReplay::kModeOff;
+G4String CupOpticsReplay::fgFileName;
+std::ofstream CupOpticsReplay::fgOutput;
+std::ifstream CupOpticsReplay::fgInput;
+G4int CupOpticsReplay::fgEvents                          = 0;
+G4double CupOpticsReplay::fgSteps                        = 0.;
+std::vector<CupOpticsReplay::EventEntry> CupOpticsReplay::fgEventIndex;
+size_t CupOpticsReplay::fgFirstEvent                     = 0;
+CupOpticsReplay::Messenger *CupOpticsReplay::fgMessenger = nullptr;
+
+CupOpticsReplay *CupOpticsReplay::GetInstance() {
+    if (!fgInstance) fgInstance = new CupOpticsReplay();
+    return fgInstance;
+}
+
+// Constructor /////////////////////////////////////////////////////////////
+CupOpticsReplay::CupOpticsReplay()
+    : fNextStep(0), fLastTrack(nullptr), fLastTrackID(-1), fLastStepNumber(-1),
+      fNavigator(nullptr) {}
+
+// Destructor //////////////////////////////////////////////////////////////
+CupOpticsReplay::~CupOpticsReplay() { delete fNavigator; }
+
+void CupOpticsReplay::CreateMessenger() {
+    // the settings are process wide, so workers don't need their own commands
+    if (fgMessenger != nullptr || !G4Threading::IsMasterThread()) return;
+    fgMessenger = new Messenger();
+}
+
+void CupOpticsReplay::EndOfRun() {
+    if (fgMode == kModeOff || !G4Threading::IsMasterThread()) return;
+
+    // the workers are done by the time the master ends its run
+    G4AutoLock lock(&CupOpticsReplayMutex);
+    if (fgMode == kModeRecord) {
+        fgOutput.flush();
+        G4cout << "CupOpticsReplay: " << fgEvents << " events, " << fgSteps
+               << " steps recorded to " << fgFileName << G4endl;
+    } else {
+        G4cout << "CupOpticsReplay: " << fgEvents << " events, " << fgSteps
+               << " steps replayed from " << fgFileName << G4endl;
+        // an aborted run replayed the events up to the end of the file
+        fgFirstEvent += fgEvents;
+    }
+    fgEvents = 0;
+    fgSteps  = 0.;
+}
+
+void CupOpticsReplay::Close() {
+    if (fgOutput.is_open()) fgOutput.close();
+    if (fgInput.is_open()) fgInput.close();
+    fgInput.clear();
+    fgEventIndex.clear();
+    fgFirstEvent = 0;
+    fgMode       = kModeOff;
+}
+
+// Record mode /////////////////////////////////////////////////////////////
+void CupOpticsReplay::RecordStep(const G4Step &aStep, G4double visibleEnergy) {
+    const G4Track *aTrack = aStep.GetTrack();
+    if (!fSteps.empty() && aTrack == fLastTrack && aTrack->GetTrackID() == fLastTrackID &&
+        aTrack->GetCurrentStepNumber() == fLastStepNumber) {
+        if (visibleEnergy >= 0.) fSteps.back().visibleEdep = visibleEnergy / MeV;
+        return;
+    }
+    fLastTrack      = aTrack;
+    fLastTrackID    = aTrack->GetTrackID();
+    fLastStepNumber = aTrack->GetCurrentStepNumber();
+
+    const G4StepPoint *pPreStepPoint  = aStep.GetPreStepPoint();
+    const G4StepPoint *pPostStepPoint = aStep.GetPostStepPoint();
+    G4ThreeVector position            = pPreStepPoint->GetPosition();
+    G4ThreeVector delta               = aStep.GetDeltaPosition();
+
+    StepRecord record = StepRecord(); // no stray bytes in the file
+    record.time       = pPreStepPoint->GetGlobalTime() / ns;
+    for (G4int i = 0; i < 3; i++) {
+        record.position[i] = position[i] / mm;
+        record.delta[i]    = delta[i] / mm;
+    }
+    record.edep        = aStep.GetTotalEnergyDeposit() / MeV;
+    record.visibleEdep = std::max(visibleEnergy, 0.) / MeV;
+    record.beta0       = pPreStepPoint->GetBeta();
+    record.beta1       = pPostStepPoint->GetBeta();
+    record.pdg         = aTrack->GetDefinition()->GetPDGEncoding();
+    fSteps.push_back(record);
+}
+
+void CupOpticsReplay::RecordCerenkovStep(const G4Step &aStep) {
+    // the threshold is left to the Cerenkov process of the replay, whose
+    // RINDEX may be larger than the recording run's
+    if (IsInRindexMaterial(aStep)) RecordStep(aStep, -1.);
+}
+
+G4bool CupOpticsReplay::IsInRindexMaterial(const G4Step &aStep) {
+    const G4Track *aTrack = aStep.GetTrack();
+    if (aTrack->GetDefinition()->GetPDGCharge() == 0.) return false;
+    G4MaterialPropertiesTable *table = aTrack->GetMaterial()->GetMaterialPropertiesTable();
+    return table && table->GetProperty("RINDEX");
+}
+
+void CupOpticsReplay::EndOfEvent() {
+    fLastTrack = nullptr;
+    if (fgMode != kModeRecord) return;
+
+    const G4Event *event = G4EventManager::GetEventManager()->GetConstCurrentEvent();
+    const G4Run *run     = G4RunManager::GetRunManager()->GetCurrentRun();
+    G4int runID          = run ? run->GetRunID() : 0;
+    G4int eventID        = event ? event->GetEventID() : 0;
+    G4int n              = G4int(fSteps.size());
+    {
+        G4AutoLock lock(&CupOpticsReplayMutex);
+        WriteValue(fgOutput, runID);
+        WriteValue(fgOutput, eventID);
+        WriteValue(fgOutput, n);
+        if (n > 0) fgOutput.write((const char *)&fSteps[0], n * sizeof(StepRecord));
+        fgEvents++;
+        fgSteps += n;
+    }
+    fSteps.clear();
+}
+
+// Replay mode /////////////////////////////////////////////////////////////
+void CupOpticsReplay::GeneratePrimaries(G4Event *anEvent) {
+    G4int n = -1;
+    {
+        G4AutoLock lock(&CupOpticsReplayMutex);
+        size_t index = fgFirstEvent + anEvent->GetEventID();
+        if (index < fgEventIndex.size()) {
+            n = fgEventIndex[index].nSteps;
+            fSteps.resize(n);
+            fgInput.clear();
+            fgInput.seekg(fgEventIndex[index].offset);
+            if (n > 0) fgInput.read((char *)&fSteps[0], n * sizeof(StepRecord));
+        }
+        if (fgInput && n >= 0) {
+            fgEvents++;
+            fgSteps += n;
+        } else {
+            n = -1;
+        }
+    }
+    fNextStep = 0;
+    if (n < 0) {
+        G4cout << "CupOpticsReplay: no more events in " << fgFileName << ", run aborted"
+               << G4endl;
+        fSteps.clear();
+        G4RunManager::GetRunManager()->AbortRun(true);
+        return;
+    }
+
+    // the geantino never moves, see StackPhotons
+    G4ThreeVector position;
+    if (n > 0) position = ToVector(fSteps[0].position);
+    G4PrimaryVertex *vertex = new G4PrimaryVertex(position, 0.);
+    vertex->SetPrimary(new G4PrimaryParticle(G4Geantino::Geantino(), 0., 0., 1. * eV));
+    anEvent->AddPrimaryVertex(vertex);
+}
+
+G4bool CupOpticsReplay::StackPhotons(const G4Track *carrier) {
+    G4int maxPhotons = CupScintillation::GetMaxPhotonsPerStep();
+    fPhotons.clear();
+    while (fNextStep < fSteps.size() && (maxPhotons <= 0 || G4int(fPhotons.size()) < maxPhotons))
+        ReplayStep(fSteps[fNextStep++], carrier);
+
+    // numbered and classified as any new track
+    G4EventManager::GetEventManager()->StackTracks(&fPhotons);
+    return fNextStep < fSteps.size();
+}
+
+void CupOpticsReplay::ReplayStep(const StepRecord &record, const G4Track *carrier) {
+    const G4ParticleDefinition *pDef = GetParticle(record.pdg);
+    if (!pDef) return;
+    const Processes &processes = GetProcesses(pDef);
+    G4ProcessManager *manager  = pDef->GetProcessManager();
+    G4VProcess *scintillation  = processes.scintillation;
+    G4VProcess *cerenkov       = processes.cerenkov;
+    if (scintillation && !manager->GetProcessActivation(scintillation)) scintillation = nullptr;
+    if (cerenkov && !manager->GetProcessActivation(cerenkov)) cerenkov = nullptr;
+    if (!scintillation && !cerenkov) return;
+
+    G4ThreeVector position  = ToVector(record.position);
+    G4ThreeVector delta     = ToVector(record.delta);
+    G4double length         = delta.mag();
+    G4ThreeVector direction = (length > 0.) ? delta / length : G4ThreeVector(0., 0., 1.);
+    G4double time           = record.time * ns;
+
+    // the volume of the step, from its middle, which is not on a boundary
+    if (!fNavigator) {
+        fNavigator = new G4Navigator();
+        fNavigator->SetWorldVolume(G4TransportationManager::GetTransportationManager()
+                                       ->GetNavigatorForTracking()
+                                       ->GetWorldVolume());
+    }
+    if (!fNavigator->LocateGlobalPointAndSetup(position + 0.5 * delta, nullptr, false, true))
+        return;
+    G4TouchableHandle touchable = fNavigator->CreateTouchableHistory();
+
+    // the track as it was at the end of the step; it does not go on, so the
+    // processes emit all photons of the step at once
+    G4double mass = pDef->GetPDGMass();
+    G4Track track(new G4DynamicParticle(pDef, direction, KineticEnergy(mass, record.beta0)),
+                  time, position);
+    track.SetTrackID(carrier->GetTrackID());
+    track.SetTouchableHandle(touchable);
+    track.SetNextTouchableHandle(touchable);
+    track.SetStep(&fStep);
+    fStep.InitializeStep(&track);
+    track.SetTrackStatus(fStopAndKill);
+
+    G4StepPoint *pPreStepPoint  = fStep.GetPreStepPoint();
+    G4StepPoint *pPostStepPoint = fStep.GetPostStepPoint();
+    G4double meanVelocity       = 0.5 * (record.beta0 + record.beta1) * c_light;
+    pPreStepPoint->SetVelocity(record.beta0 * c_light);
+    pPostStepPoint->SetPosition(position + delta);
+    pPostStepPoint->SetGlobalTime(time + ((meanVelocity > 0.) ? length / meanVelocity : 0.));
+    pPostStepPoint->SetKineticEnergy(KineticEnergy(mass, record.beta1));
+    pPostStepPoint->SetVelocity(record.beta1 * c_light);
+    fStep.SetStepLength(length);
+    fStep.SetTotalEnergyDeposit(record.edep * MeV);
+    track.SetStepLength(length);
+
+    if (scintillation) {
+        CupScintillation::SetReplayVisibleEnergy(&fStep, record.visibleEdep * MeV);
+        TakePhotons(scintillation, scintillation->PostStepDoIt(track, fStep), carrier);
+        CupScintillation::SetReplayVisibleEnergy(nullptr, 0.);
+    }
+    if (cerenkov) TakePhotons(cerenkov, cerenkov->PostStepDoIt(track, fStep), carrier);
+}
+
+void CupOpticsReplay::TakePhotons(G4VProcess *process, G4VParticleChange *change,
+                                  const G4Track *carrier) {
+    // what the stepping manager does with the secondaries of a step
+    for (G4int i = 0; i < change->GetNumberOfSecondaries(); i++) {
+        G4Track *photon = change->GetSecondary(i);
+        photon->SetParentID(carrier->GetTrackID());
+        photon->SetCreatorProcess(process);
+        fPhotons.push_back(photon);
+    }
+    change->Clear();
+}
+
+const G4ParticleDefinition *CupOpticsReplay::GetParticle(G4int pdg) {
+    std::map<G4int, const G4ParticleDefinition *>::const_iterator it = fParticles.find(pdg);
+    if (it != fParticles.end()) return it->second;
+
+    const G4ParticleDefinition *pDef = G4ParticleTable::GetParticleTable()->FindParticle(pdg);
+    if (!pDef && pdg > 1000000000) pDef = G4IonTable::GetIonTable()->GetIon(pdg);
+    if (!pDef) {
+        G4cerr << "CupOpticsReplay: unknown particle " << pdg << ", its steps are skipped"
+               << G4endl;
+    }
+    fParticles[pdg] = pDef;
+    return pDef;
+}
+
+const CupOpticsReplay::Processes &
+CupOpticsReplay::GetProcesses(const G4ParticleDefinition *pDef) {
+    std::map<const G4ParticleDefinition *, Processes>::iterator it = fProcesses.find(pDef);
+    if (it != fProcesses.end()) return it->second;
+
+    Processes processes       = {nullptr, nullptr};
+    G4ProcessManager *manager = pDef->GetProcessManager();
+    if (manager) {
+        processes.scintillation = manager->GetProcess("Scintillation");
+        processes.cerenkov      = manager->GetProcess("Cerenkov");
+    }
+    return fProcesses[pDef] = processes;
+}
+
+// Reads the run and event IDs and the steps of every event of the input
+// file; false if the file ends inside an event
+G4bool CupOpticsReplay::IndexEvents() {
+    fgEventIndex.clear();
+    fgFirstEvent = 0;
+    for (;;) {
+        EventEntry entry;
+        ReadValue(fgInput, entry.runID);
+        if (!fgInput) break; // at the end
+        ReadValue(fgInput, entry.eventID);
+        ReadValue(fgInput, entry.nSteps);
+        entry.offset = fgInput.tellg();
+        fgInput.seekg(std::streamoff(entry.nSteps) * sizeof(StepRecord), std::ios::cur);
+        if (!fgInput || entry.nSteps < 0) return false;
+        fgEventIndex.push_back(entry);
+    }
+    fgInput.clear();
+    // the last event must be complete
+    if (!fgEventIndex.empty()) {
+        const EventEntry &last = fgEventIndex.back();
+        fgInput.seekg(0, std::ios::end);
+        if (fgInput.tellg() <
+            last.offset + std::streamoff(last.nSteps) * std::streamoff(sizeof(StepRecord)))
+            return false;
+    }
+    std::stable_sort(fgEventIndex.begin(), fgEventIndex.end());
+    return true;
+}
+
+// Messenger ///////////////////////////////////////////////////////////////
+CupOpticsReplay::Messenger::Messenger() {
+    fReplayDir = new G4UIdirectory("/cupreplay/");
+    fReplayDir->SetGuidance("Record energy deposits once, replay the optics later.");
+
+    fRecordCmd = new G4UIcmdWithAString("/cupreplay/record", this);
+    fRecordCmd->SetGuidance("Record mode: make no scintillation or Cerenkov photons, but write");
+    fRecordCmd->SetGuidance("the steps they would be made from to this file (overwritten),");
+    fRecordCmd->SetGuidance("one event of steps per event, for all following runs.");
+    fRecordCmd->SetParameterName("file", false);
+
+    fReplayCmd = new G4UIcmdWithAString("/cupreplay/replay", this);
+    fReplayCmd->SetGuidance("Replay mode: each event tracks only the optical photons made from");
+    fReplayCmd->SetGuidance("the steps of the next event of this file, in the order of their");
+    fReplayCmd->SetGuidance("run and event IDs; event i of the replay takes the i-th.");
+    fReplayCmd->SetParameterName("file", false);
+
+    fOffCmd = new G4UIcmdWithoutParameter("/cupreplay/off", this);
+    fOffCmd->SetGuidance("Close the file; neither record nor replay.");
+
+    G4UIcommand *commands[] = {fRecordCmd, fReplayCmd, fOffCmd};
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        commands[i]->SetToBeBroadcasted(false);
+        commands[i]->AvailableForStates(G4State_PreInit, G4State_Idle);
+    }
+}
+
+CupOpticsReplay::Messenger::~Messenger() {
+    delete fRecordCmd;
+    delete fReplayCmd;
+    delete fOffCmd;
+    delete fReplayDir;
+}
+
+void CupOpticsReplay::Messenger::SetNewValue(G4UIcommand *command, G4String newValue) {
+    if (command == fRecordCmd) {
+        Close();
+        fgOutput.open(newValue.c_str(), std::ios::binary | std::ios::trunc);
+        G4int recordSize = sizeof(StepRecord);
+        fgOutput.write(kMagic, sizeof(kMagic));
+        WriteValue(fgOutput, kVersion);
+        WriteValue(fgOutput, recordSize);
+        if (!fgOutput) {
+            G4cerr << "/cupreplay/record: cannot write " << newValue << G4endl;
+            Close();
+            return;
+        }
+        fgFileName = newValue;
+        fgMode     = kModeRecord;
+    } else if (command == fReplayCmd) {
+        Close();
+        fgInput.open(newValue.c_str(), std::ios::binary);
+        char magic[8];
+        G4int version = 0, recordSize = 0;
+        fgInput.read(magic, sizeof(magic));
+        ReadValue(fgInput, version);
+        ReadValue(fgInput, recordSize);
+        if (!fgInput || !std::equal(magic, magic + 8, kMagic) || version != kVersion ||
+            recordSize != G4int(sizeof(StepRecord))) {
+            G4cerr << "/cupreplay/replay: " << newValue << " is not a file of recorded steps"
+                   << G4endl;
+            Close();
+            return;
+        }
+        if (!IndexEvents()) {
+            G4cerr << "/cupreplay/replay: " << newValue << " is truncated" << G4endl;
+            Close();
+            return;
+        }
+        fgFileName = newValue;
+        fgMode     = kModeReplay;
+    } else if (command == fOffCmd) {
+        Close();
+    }
+}
+
+G4String CupOpticsReplay::Messenger::GetCurrentValue(G4UIcommand *command) {
+    std::ostringstream os;
+    if (command == fRecordCmd || command == fReplayCmd) {
+        os << fgFileName;
+    } else {
+        return G4String("invalid CupOpticsReplay \"get\" command");
+    }
+    return G4String(os.str());
+}
@@ -1,25 +1,50 @@
 #include "CupSim/CupPMTOpticalModel.hh"
 #include "CupSim/CupPMTSD.hh"
+#include "CupSim/CupPhysicsList.hh"
+#include "CupSim/CupScintillation.hh"
 
 #include "G4Version.hh"
+#include "G4AutoLock.hh"
 #include "G4LogicalBorderSurface.hh"
 #include "G4MaterialPropertiesTable.hh"
 #include "G4OpticalPhoton.hh"
 #include "G4OpticalSurface.hh"
+#include "G4Threading.hh"
 #include "G4TransportationManager.hh"
 #include "G4UIcommand.hh"
 #include "G4UIdirectory.hh"
 
+#include "CLHEP/Random/RandBinomial.h"
 #include "Randomize.hh"
 #include <CLHEP/Units/SystemOfUnits.h>
 
+#include <algorithm>
 #include <complex.h>
 
 #include "G4VProcess.hh" 
 
 #include "G4GeometryTolerance.hh" // for kCarTolerance
 
-G4UIdirectory *CupPMTOpticalModel::fgCmdDir = NULL;
+G4ThreadLocal G4UIdirectory *CupPMTOpticalModel::fgCmdDir    = NULL;
+G4ThreadLocal G4int CupPMTOpticalModel::_luxlevel             = 3;
+G4ThreadLocal G4double CupPMTOpticalModel::_qeScale           = 1.0;
+G4ThreadLocal G4int CupPMTOpticalModel::_verbosity            = 0;
+G4ThreadLocal G4double CupPMTOpticalModel::fgMaxEfficiency    = 0.0;
+G4ThreadLocal G4double CupPMTOpticalModel::fgMaxCollectionEff = 0.0;
+G4ThreadLocal std::vector<CupPMTOpticalModel *> *CupPMTOpticalModel::fgModels = NULL;
+G4ThreadLocal G4int CupPMTOpticalModel::fgPropertyVersion                    = 0;
+
+// largest interpolation error accepted for the luxlevel 4 tables, and the
+// size they may grow to while refining
+const G4double CupPMTOpticalModel::kFresnelTableTolerance = 1.0e-3;
+const size_t CupPMTOpticalModel::kFresnelTableMaxBytes    = 4 * 1024 * 1024;
+// shared by all threads, built under FresnelTablesMutex
+std::map<CupPMTOpticalModel::FresnelKey, const CupPMTOpticalModel::FresnelTable *>
+    CupPMTOpticalModel::fgFresnelTables;
+
+namespace {
+G4Mutex FresnelTablesMutex = G4MUTEX_INITIALIZER;
+} // namespace
 
 // constructor -- also handles all initialization
 // CupPMTOpticalModel::CupPMTOpticalModel (G4String modelName,
@@ -108,7 +133,22 @@ CupPMTOpticalModel::CupPMTOpticalModel(G4String modelName, G4VPhysicalVolume *en
 
     // initialize _photon_energy to a nonsense value to indicate that the other
     // values are not initialized
-    _photon_energy = -1.0;
+    _photon_energy    = -1.0;
+    _efficiency_scale = 1.0;
+
+    // luxlevel 4 tables are built on the first photon that needs them
+    fFresnelTable = nullptr;
+
+    // per-model context for DoIt(): the geometry tolerance, the optical
+    // properties merged onto one energy grid, and lookups filled as we go
+    fSurfaceTolerance = G4GeometryTolerance::GetInstance()->GetSurfaceTolerance();
+    fEnvelopeDepth    = 0;
+    BuildSpectrum();
+    if (fgModels == NULL) fgModels = new std::vector<CupPMTOpticalModel *>;
+    fgModels->push_back(this);
+
+    // so the physics list gives the fast simulation process to optical photons only
+    CupPhysicsList::RegisterFastSimulationModel(this);
 
     // add UI commands
     if (fgCmdDir == NULL) {
@@ -129,16 +169,28 @@ CupPMTOpticalModel::CupPMTOpticalModel(G4String modelName, G4VPhysicalVolume *en
                          " 0 == standard \"black bucket\": photons stop in PC, maybe make pe, \n"
                          " 1 == shiny translucent brown film: photons only stop if they make a PE, "
                          "otherwise 50/50 chance of reflecting/transmitting\n"
-                         " 2 or greater == full model\n"
+                         " 2 or 3 == full model\n"
+                         " 4 == full model, with the thin-film coefficients interpolated from\n"
+                         "      tables built on first use (error < 1e-3 on each coefficient)\n"
                          "The default value is 3.");
         cmd->SetParameter(new G4UIparameter("level", 'i', false));
+
+        cmd = new G4UIcommand("/PMTOpticalModel/qeScale", this);
+        cmd->SetGuidance("Scale the photocathode EFFICIENCY of all PMTs by this factor\n"
+                         "(the scaled efficiency is at most 1).  The default value is 1.");
+        G4UIparameter *scale = new G4UIparameter("scale", 'd', false);
+        scale->SetParameterRange("scale >= 0.");
+        cmd->SetParameter(scale);
     }
 }
 
 // destructor
 CupPMTOpticalModel::~CupPMTOpticalModel() {
-    // nothing to delete
-    // Note: The "MaterialPropertyVector"s are owned by the material, not us.
+    // Note: The "MaterialPropertyVector"s are owned by the material, not us,
+    // and fFresnelTable by fgFresnelTables.
+    CupPhysicsList::DeregisterFastSimulationModel(this);
+    if (fgModels != NULL)
+        fgModels->erase(std::remove(fgModels->begin(), fgModels->end(), this), fgModels->end());
 }
 
 // IsApplicable() method overriding virtual function of G4VFastSimulationModel
@@ -155,13 +207,10 @@ G4bool CupPMTOpticalModel::ModelTrigger(const G4FastTrack &fastTrack) {
     // we trigger if the track position is above the equator
     // or if it is on the equator and heading up
     // if ( fastTrack.GetPrimaryTrackLocalPosition().z() >  kCarTolerance )
-    if (fastTrack.GetPrimaryTrackLocalPosition().z() >
-        G4GeometryTolerance::GetInstance()->GetSurfaceTolerance())
-        return true;
+    G4double z = fastTrack.GetPrimaryTrackLocalPosition().z();
+    if (z > fSurfaceTolerance) return true;
     // if ( fastTrack.GetPrimaryTrackLocalPosition().z() > -kCarTolerance
-    if (fastTrack.GetPrimaryTrackLocalPosition().z() >
-            -(G4GeometryTolerance::GetInstance()->GetSurfaceTolerance()) &&
-        fastTrack.GetPrimaryTrackLocalDirection().z() > 0.0)
+    if (z > -fSurfaceTolerance && fastTrack.GetPrimaryTrackLocalDirection().z() > 0.0)
         return true;
     return false;
 }
@@ -204,6 +253,9 @@ void CupPMTOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep
     // but for this simple case, we can be more efficient with this custom
     // coding.  -GHS.
 
+    // the properties a scan (/cupscan/) changed
+    UpdateProperties();
+
     G4double dist, dist1;
     G4ThreeVector pos;
     G4ThreeVector dir;
@@ -225,35 +277,15 @@ void CupPMTOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep
     int ipmt = -1;
 
     // find which pmt we are in
-    // The following doesn't work anymore (due to new geometry optimization?)
-    //  ipmt=fastTrack.GetEnvelopePhysicalVolume()->GetMother()->GetCopyNo();
-    // so we do this:
-    {
-        const G4VTouchable *touch = fastTrack.GetPrimaryTrack()->GetTouchable();
-        int nd                    = touch->GetHistoryDepth();
-        int id;
-        for (id = 0; id < nd; id++) {
-            if (touch->GetVolume(id) == fastTrack.GetEnvelopePhysicalVolume()) {
-                ipmt = touch->GetReplicaNumber(id + 1);
-                break;
-            }
-        }
-        if (ipmt < 0) {
-            // G4Exception("CupSim/CupPMTOpticalModel: could not find envelope -- where am I !?!");
-            G4Exception(" ", " ", JustWarning,
-                        "CupSim/CupPMTOpticalModel: could not find envelope -- where am I !?!");
-        }
+    ipmt = GetPMTNumber(fastTrack);
+    if (ipmt < 0) {
+        // G4Exception("CupSim/CupPMTOpticalModel: could not find envelope -- where am I !?!");
+        G4Exception(" ", " ", JustWarning,
+                    "CupSim/CupPMTOpticalModel: could not find envelope -- where am I !?!");
     }
 
     // processTag: EJ: 2007-11-06 (2016-0914)
-    const G4VProcess *tProc = fastTrack.GetPrimaryTrack()->GetCreatorProcess();
-    G4int processTag        = -1;
-    if (tProc != NULL) {
-        G4String procname = tProc->GetProcessName();
-        if ((!strcmp(procname, "Cerenkov"))) processTag = 1;
-        if ((!strcmp(procname, "Scintillation"))) processTag = 2;
-        if ((!strcmp(procname, "Reemission"))) processTag = 3;
-    }
+    G4int processTag = GetProcessTag(fastTrack.GetPrimaryTrack()->GetCreatorProcess());
 
     // get position and direction in local coordinates
     pos = fastTrack.GetPrimaryTrackLocalPosition();
@@ -262,11 +294,18 @@ void CupPMTOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep
 
     // get weight and time
     time   = fastTrack.GetPrimaryTrack()->GetGlobalTime(); // "global" is correct
-    weight = (G4int)(fastTrack.GetPrimaryTrack()->GetWeight());
+    weight = (G4int)(fastTrack.GetPrimaryTrack()->GetWeight() + 0.5); // photons in the track
+
+    // a photon that survived the culling at birth (/cupscint/qePreCull)
+    // stands for 1/keep photons
+    G4double keep =
+        CupScintillation::IsCulledAtBirth(fastTrack.GetPrimaryTrack()->GetCreatorProcess())
+            ? CupScintillation::GetPhotonKeepProbability()
+            : 1.0;
 
     // get n_glass, _n2, _k2, etc., for this wavelength
     energy = fastTrack.GetPrimaryTrack()->GetKineticEnergy();
-    if (energy == _photon_energy) // equal to last energy?
+    if (energy == _photon_energy && _efficiency_scale == _qeScale) // as for the last photon?
     {
         // use old values
         if (_n1 == 1.0)
@@ -276,16 +315,15 @@ void CupPMTOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep
     } else {
         _photon_energy = energy;
         _wavelength    = twopi * hbarc / energy;
-        // n_glass= _rindex_glass->GetProperty( energy );
-        n_glass = _rindex_glass->Value(energy);
-        _n1     = n_glass; // just in case we exit before setting _n1
-        //_n2= _rindex_photocathode->GetProperty( energy );
-        _n2 = _rindex_photocathode->Value(energy);
-        //_k2= _kindex_photocathode->GetProperty( energy );
-        _k2 = _kindex_photocathode->Value(energy);
-        _n3 = 1.0; // just in case we exit before setting _n3
-        //_efficiency= _efficiency_photocathode->GetProperty( energy );
-        _efficiency = _efficiency_photocathode->Value(energy);
+        G4double spectrum[kNSpectrum];
+        LookupSpectrum(energy, spectrum);
+        n_glass           = spectrum[kGlassRindex];
+        _n1               = n_glass; // just in case we exit before setting _n1
+        _n2               = spectrum[kCathodeRindex];
+        _k2               = spectrum[kCathodeKindex];
+        _n3               = 1.0; // just in case we exit before setting _n3
+        _efficiency       = std::min(1.0, spectrum[kCathodeEfficiency] * _qeScale);
+        _efficiency_scale = _qeScale;
     }
 
     // initialize "whereAmI"
@@ -341,8 +379,7 @@ void CupPMTOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep
             pos += dist * dir;
             time += dist / c_light;
             // if ( pos.z() < kCarTolerance ) // we're passing through the equator
-            if (pos.z() < G4GeometryTolerance::GetInstance()
-                              ->GetSurfaceTolerance()) // we're passing through the equator
+            if (pos.z() < fSurfaceTolerance) // we're passing through the equator
                 break;
             _n1 = 1.0;
             _n3 = n_glass;
@@ -389,9 +426,10 @@ void CupPMTOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep
         A              = 1.0 - (T + R);
         An             = 1.0 - (fT_n + fR_n); // The absorption at normal incidence
         collection_eff = _efficiency / An;    // net QE = _efficiency for normal inc.
+        collection_eff /= keep;               // for the photons culled at birth
 
 #ifdef G4DEBUG
-        if (A < 0.0 || A > 1.0 || collection_eff < 0.0 || collection_eff > 1.0) {
+        if (A < 0.0 || A > 1.0 || collection_eff < 0.0 || collection_eff > 1.0 + 1e-3) {
             G4cerr << "CupSim/CupPMTOpticalModel::DoIt(): Strange coefficients!\n";
             G4cout << "T, R, A, An, weight: " << T << " " << R << " " << A << " " << An << " "
                    << weight << G4endl;
@@ -401,27 +439,13 @@ void CupPMTOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep
         }
 #endif
 
-        // Now decide how many pe we make.
-        // When weight == 1, probability of a pe is A*collection_eff.
-        // There is a certain correlation between "a pe is made" and
-        // "the track is absorbed", which is implemented correctly below for
-        // the weight == 1 case, and as good as can be done for weight>1 case.
+        // Now decide how many pe we make, and how much of the track is absorbed.
         if (_verbosity > 0) {
             G4cout << "EJ: weight= " << weight << ", A= " << A
                    << ", collection_eff= " << collection_eff << ", qefficiency= " << _efficiency
                    << G4endl;
         }
-/*
-        //    G4double mean_N_pe= weight*A*collection_eff;
-        G4double ranno_absorb = G4UniformRand();
-        //    G4int N_pe= (G4int)( mean_N_pe + (1.0-ranno_absorb) );
-        //    G4int N_pe= (G4int)( mean_N_pe + (1.0-ranno_absorb) );
-        G4int N_pe;
-        if (ranno_absorb < _efficiency) N_pe = 1;
-*/
-        G4double mean_N_pe= weight*A*collection_eff;
-        G4double ranno_absorb= G4UniformRand();
-        G4int N_pe= (G4int)( mean_N_pe + (1.0-ranno_absorb) );
+        G4int N_pe = SamplePhotoelectrons(weight, A, collection_eff);
         if (N_pe > 0) {
             if (detector != NULL && detector->isActive())
                 ((CupPMTSD *)detector)
@@ -431,22 +455,7 @@ void CupPMTOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep
                 G4cout << "CupSim/CupPMTOpticalModel made " << N_pe << " pe\n";
             }
         }
-
-        // Now maybe absorb the track.
-        // The probability is independent of weight, and the entire
-        // track is either absorbed or not as a whole.
-        // This is consistent with how the track is treated in other
-        // processes (absorption, G4OpBoundary, etc.), and the statistics
-        // for the final number of pe detected overall is made consistent
-        // by the poissonian statistics of number of tracks implemented in
-        // CupScint.  (Actually, for weights > 1, the correlation between
-        // number absorbed and number transmitted/reflected and subsequently
-        // absorbed cannot be made as big as it should be, so the width of
-        // the distribution of the total number of pe per event will be slightly
-        // too large.  Only the weight=1 case is "guaranteed" to get everything
-        // correct, assuming there are no bugs in the code.)
-        if (ranno_absorb < A) {
-            weight = 0;
+        if (weight == 0) {
             if (_verbosity >= 2) G4cout << "CupSim/CupPMTOpticalModel absorbed track\n";
             break;
         }
@@ -499,6 +508,183 @@ void CupPMTOpticalModel::DoIt(const G4FastTrack &fastTrack, G4FastStep &fastStep
     return;
 }
 
+// SamplePhotoelectrons() decides the fate of the photons of a track at the
+// photocathode.  A photon is absorbed with probability A, and an absorbed
+// photon makes a pe with probability collection_eff, so a photon makes at
+// most one pe and a pe implies absorption.  The photons of a bunch
+// (weight > 1, see /cupscint/photonWeight) are absorbed and converted
+// independently of each other, so the pe count at each photocathode crossing
+// has the same binomial statistics as for unbunched photons; the photons not
+// absorbed are then reflected or refracted together.  (What bunching does
+// change is that a bunch is absorbed or scattered as a whole everywhere
+// else, which widens the pe distribution of an event.)  With culling at
+// birth (/cupscint/qePreCull) collection_eff is divided by the keep
+// probability, which GetMaxCollectionEfficiency() chooses so that it stays
+// at most 1 (up to the luxlevel 4 table error; the excess is cut).
+G4int CupPMTOpticalModel::SamplePhotoelectrons(G4int &weight, G4double A,
+                                               G4double collection_eff) {
+    A              = std::min(std::max(A, 0.0), 1.0);
+    collection_eff = std::min(std::max(collection_eff, 0.0), 1.0);
+    if (weight == 1) {
+        G4double ranno_absorb = G4UniformRand();
+        if (ranno_absorb >= A) return 0;
+        weight = 0;
+        return (ranno_absorb < A * collection_eff) ? 1 : 0;
+    }
+    G4int n_absorbed = CLHEP::RandBinomial::shoot(G4Random::getTheEngine(), weight, A);
+    weight -= n_absorbed;
+    if (n_absorbed == 0) return 0;
+    return CLHEP::RandBinomial::shoot(G4Random::getTheEngine(), n_absorbed, collection_eff);
+}
+
+// GetPMTNumber() returns the copy number of the PMT the track is in,
+// i.e. of the mother of the envelope in the track's touchable history.
+// The envelope sits at the same depth for all PMTs of a type, so the depth
+// found on the first track is tried first.
+G4int CupPMTOpticalModel::GetPMTNumber(const G4FastTrack &fastTrack) {
+    // The following doesn't work anymore (due to new geometry optimization?)
+    //  ipmt=fastTrack.GetEnvelopePhysicalVolume()->GetMother()->GetCopyNo();
+    // so we do this:
+    const G4VTouchable *touch          = fastTrack.GetPrimaryTrack()->GetTouchable();
+    const G4VPhysicalVolume *envelope = fastTrack.GetEnvelopePhysicalVolume();
+    int nd                            = touch->GetHistoryDepth();
+    if (fEnvelopeDepth < nd && touch->GetVolume(fEnvelopeDepth) == envelope)
+        return touch->GetReplicaNumber(fEnvelopeDepth + 1);
+    for (int id = 0; id < nd; id++) {
+        if (touch->GetVolume(id) == envelope) {
+            fEnvelopeDepth = id;
+            return touch->GetReplicaNumber(id + 1);
+        }
+    }
+    return -1;
+}
+
+// GetProcessTag() returns the processTag for a creator process:
+// 1=Cerenkov, 2=Scintillation, 3=Reemission, -1 otherwise or if none.
+// The name is only looked at the first time a process is seen.
+G4int CupPMTOpticalModel::GetProcessTag(const G4VProcess *process) {
+    if (process == NULL) return -1;
+    for (size_t i = 0; i < fProcessTags.size(); i++) {
+        if (fProcessTags[i].first == process) return fProcessTags[i].second;
+    }
+    const G4String &procname = process->GetProcessName();
+    G4int processTag         = -1;
+    if (procname == "Cerenkov") processTag = 1;
+    if (procname == "Scintillation") processTag = 2;
+    if (procname == "Reemission") processTag = 3;
+    fProcessTags.push_back(std::make_pair(process, processTag));
+    return processTag;
+}
+
+// BuildSpectrum() samples the glass and photocathode properties at the
+// union of their energy nodes.  All four are linear between neighbouring
+// nodes, so one search and interpolation in LookupSpectrum() reproduces
+// the four separate G4MaterialPropertyVector::Value() calls.
+void CupPMTOpticalModel::BuildSpectrum() {
+    G4MaterialPropertyVector *pv[kNSpectrum];
+    pv[kGlassRindex]       = _rindex_glass;
+    pv[kCathodeRindex]     = _rindex_photocathode;
+    pv[kCathodeKindex]     = _kindex_photocathode;
+    pv[kCathodeEfficiency] = _efficiency_photocathode;
+
+    fSpectrumEnergy.clear();
+    fSpectrum.clear();
+    for (int k = 0; k < kNSpectrum; k++) {
+        if (pv[k] == nullptr) return; // already warned about in the constructor
+        for (size_t i = 0; i < pv[k]->GetVectorLength(); i++)
+            fSpectrumEnergy.push_back(pv[k]->Energy(i));
+    }
+    std::sort(fSpectrumEnergy.begin(), fSpectrumEnergy.end());
+    fSpectrumEnergy.erase(std::unique(fSpectrumEnergy.begin(), fSpectrumEnergy.end()),
+                          fSpectrumEnergy.end());
+    fSpectrum.resize(kNSpectrum * fSpectrumEnergy.size());
+    for (size_t i = 0; i < fSpectrumEnergy.size(); i++) {
+        for (int k = 0; k < kNSpectrum; k++)
+            fSpectrum[kNSpectrum * i + k] = pv[k]->Value(fSpectrumEnergy[i]);
+        // the efficiency is linear between nodes, so its maximum is at one
+        fgMaxEfficiency = std::max(fgMaxEfficiency, fSpectrum[kNSpectrum * i + kCathodeEfficiency]);
+    }
+    if (_thickness_photocathode == nullptr) return;
+
+    // the pe probability of an absorbed photon, EFFICIENCY/An, at the energy
+    // nodes and at the photocathode thicknesses of the THICKNESS nodes and
+    // midway between them, from both sides
+    std::vector<G4double> thickness;
+    for (size_t i = 0; i < _thickness_photocathode->GetVectorLength(); i++)
+        thickness.push_back((*_thickness_photocathode)[i]);
+    std::sort(thickness.begin(), thickness.end());
+    thickness.erase(std::unique(thickness.begin(), thickness.end()), thickness.end());
+    for (size_t it = thickness.size(); it-- > 1;)
+        thickness.push_back(0.5 * (thickness[it - 1] + thickness[it]));
+    for (size_t i = 0; i < fSpectrumEnergy.size(); i++) {
+        G4double efficiency = fSpectrum[kNSpectrum * i + kCathodeEfficiency];
+        if (efficiency <= 0.0) continue;
+        for (size_t it = 0; it < thickness.size(); it++) {
+            for (G4int dir = 0; dir < 2; dir++) {
+                G4double coef[6];
+                ExactCoefficients(dir, fSpectrumEnergy[i], 1.0, thickness[it], coef);
+                G4double An = 1.0 - (coef[4] + coef[5]);
+                fgMaxCollectionEff =
+                    (An > efficiency) ? std::max(fgMaxCollectionEff, efficiency / An) : 1.0;
+            }
+        }
+    }
+}
+
+void CupPMTOpticalModel::LookupSpectrum(G4double energy, G4double value[kNSpectrum]) const {
+    size_t n = fSpectrumEnergy.size();
+    if (n == 0 || energy <= fSpectrumEnergy[0]) {
+        for (int k = 0; k < kNSpectrum; k++)
+            value[k] = (n == 0) ? 0.0 : fSpectrum[k];
+        return;
+    }
+    if (energy >= fSpectrumEnergy[n - 1]) {
+        for (int k = 0; k < kNSpectrum; k++)
+            value[k] = fSpectrum[kNSpectrum * (n - 1) + k];
+        return;
+    }
+    size_t i = std::upper_bound(fSpectrumEnergy.begin(), fSpectrumEnergy.end(), energy) -
+               fSpectrumEnergy.begin() - 1;
+    G4double f       = (energy - fSpectrumEnergy[i]) / (fSpectrumEnergy[i + 1] - fSpectrumEnergy[i]);
+    const G4double *a = &fSpectrum[kNSpectrum * i];
+    const G4double *b = a + kNSpectrum;
+    for (int k = 0; k < kNSpectrum; k++)
+        value[k] = a[k] + f * (b[k] - a[k]);
+}
+
+// cosine of the critical angle going from index n1 to n3 (0 if there is none)
+static G4double CriticalCos(G4double n1, G4double n3) {
+    return (n1 > n3) ? sqrt(1.0 - (n3 / n1) * (n3 / n1)) : 0.0;
+}
+
+// angle coordinate of the luxlevel 4 tables, see CupPMTOpticalModel.hh
+static G4double CosFromTableX(G4double x, G4double cos_c) {
+    if (x < 0.0) return cos_c * (1.0 - x * x);
+    return cos_c + (1.0 - cos_c) * x * x;
+}
+
+static G4double TableXFromCos(G4double cos_theta1, G4double cos_c) {
+    if (cos_theta1 < cos_c) return -sqrt((cos_c - cos_theta1) / cos_c);
+    return sqrt(std::min((cos_theta1 - cos_c) / (1.0 - cos_c), 1.0));
+}
+
+// coordinate of (possibly fractional) node i of an n-node axis over [x0,x1]
+static G4double TableNode(G4double x0, G4double x1, G4int n, G4double i) {
+    return (n > 1) ? x0 + (x1 - x0) * i / (n - 1) : x0;
+}
+
+// lower node index i and fraction f of the cell containing x
+static void TableCell(G4double x, G4double x0, G4double x1, G4int n, G4int &i, G4double &f) {
+    if (n <= 1) {
+        i = 0;
+        f = 0.0;
+        return;
+    }
+    G4double u = (x - x0) / (x1 - x0) * (n - 1);
+    i          = std::max(0, std::min((G4int)u, n - 2));
+    f          = std::max(0.0, std::min(u - i, 1.0));
+}
+
 // CalculateCoefficients() method used by DoIt() above.
 // *** THE PHYSICS, AT LAST!!! :-) ***
 // Correct formalism implemented by Dario Motta (CEA-Saclay) 23 Feb 2005
@@ -537,6 +723,54 @@ void CupPMTOpticalModel::CalculateCoefficients()
     }
     // else...
 
+    // first set sines and cosines
+    _sin_theta1 = sqrt(1.0 - _cos_theta1 * _cos_theta1);
+    _sin_theta3 = _n1 / _n3 * _sin_theta1;
+    if (_sin_theta3 > 1.0) {
+        // total non-transmission -- what to do???
+        // these variables only used to decide refracted track direction,
+        // so doing the following should be okay:
+        _sin_theta3 = 1.0;
+    }
+    _cos_theta3 = sqrt(1.0 - _sin_theta3 * _sin_theta3);
+
+    G4double coef[6];
+    if (_luxlevel >= 4 && fFresnelTable == nullptr) GetFresnelTable();
+    if (_luxlevel >= 4 && _photon_energy >= fFresnelTable->eMin &&
+        _photon_energy <= fFresnelTable->eMax && _thickness >= fFresnelTable->tMin &&
+        _thickness <= fFresnelTable->tMax) {
+        G4int dir = (_n1 == 1.0) ? 1 : 0;
+        InterpolateFresnelTable(*fFresnelTable, dir, _photon_energy,
+                                TableXFromCos(_cos_theta1, CriticalCos(_n1, _n3)), _thickness,
+                                coef);
+    } else {
+        ThinFilmCoefficients(_n1, _n3, G4complex(_n2, -_k2), _wavelength, _thickness,
+                             _sin_theta1, coef);
+    }
+    fR_s = coef[0];
+    fT_s = coef[1];
+    fR_p = coef[2];
+    fT_p = coef[3];
+    fR_n = coef[4];
+    fT_n = coef[5];
+
+#ifdef G4DEBUG
+    if (_verbosity >= 10) {
+        G4cout << "=> lam, n1, n2: " << _wavelength / nm << " " << _n1 << " "
+               << G4complex(_n2, -_k2) << G4endl;
+        G4cout << "Rper, Rpar, Tper, Tpar: " << fR_s << " " << fR_p << " " << fT_s << " " << fT_p;
+        G4cout << "\nRn, Tn : " << fR_n << " " << fT_n;
+        G4cout << "\n-------------------------------------------------------" << G4endl;
+    }
+#endif
+}
+
+// ThinFilmCoefficients() does the actual thin-film calculation for
+// CalculateCoefficients() and the luxlevel 4 tables.
+// Sets coef[] = { R_s, T_s, R_p, T_p, R_n, T_n }.
+void CupPMTOpticalModel::ThinFilmCoefficients(G4double n1, G4double n3, G4complex n2comp,
+                                              G4double wavelength, G4double thickness,
+                                              G4double sin_theta1, G4double coef[6]) {
     // declare the prototypes of some useful functions
     G4complex carcsin(G4complex theta); // complex sin^-1
     G4complex gfunc(G4complex ni, G4complex nj, G4complex ti, G4complex tj);
@@ -544,8 +778,7 @@ void CupPMTOpticalModel::CalculateCoefficients()
     G4complex trfunc(G4complex ni, G4complex nj, G4complex ti, G4complex tj, G4complex tk);
 
     // declare some useful constants
-    G4complex _n2comp(_n2, -_k2); // complex photocathode refractive index
-    G4complex eta = twopi * _n2comp * _thickness / _wavelength;
+    G4complex eta = twopi * n2comp * thickness / wavelength;
     G4complex zi(0., 1.); // imaginary unit
 
     // declare local variables
@@ -554,87 +787,282 @@ void CupPMTOpticalModel::CalculateCoefficients()
     G4complex r12, r23, t12, t21, t23;       // reflection- and transmission-related terms
     G4complex ampr, ampt;                    // relfection and transmission amplitudes
 
-    // first set sines and cosines
-    _sin_theta1 = sqrt(1.0 - _cos_theta1 * _cos_theta1);
-    _sin_theta3 = _n1 / _n3 * _sin_theta1;
-    if (_sin_theta3 > 1.0) {
-        // total non-transmission -- what to do???
-        // these variables only used to decide refracted track direction,
-        // so doing the following should be okay:
-        _sin_theta3 = 1.0;
-    }
-    _cos_theta3 = sqrt(1.0 - _sin_theta3 * _sin_theta3);
-
     // Determine all angles
-    theta1 = asin(_sin_theta1);                      // incidence angle
-    theta2 = carcsin((_n1 / _n2comp) * _sin_theta1); // complex angle in the photocathode
-    theta3 = carcsin((_n2comp / _n3) * sin(theta2)); // angle of refraction into vacuum
-    if (imag(theta3) < 0.) theta3 = conj(theta3);    // needed! (sign ambiguity arcsin)
+    theta1 = asin(sin_theta1);                     // incidence angle
+    theta2 = carcsin((n1 / n2comp) * sin_theta1);  // complex angle in the photocathode
+    theta3 = carcsin((n2comp / n3) * sin(theta2)); // angle of refraction into vacuum
+    if (imag(theta3) < 0.) theta3 = conj(theta3);  // needed! (sign ambiguity arcsin)
 
     delta = eta * cos(theta2);
 
     // Calculation for the s-polarization
 
-    r12 = rfunc(_n1, _n2comp, theta1, theta2);
-    r23 = rfunc(_n2comp, _n3, theta2, theta3);
-    t12 = trfunc(_n1, _n2comp, theta1, theta1, theta2);
-    t21 = trfunc(_n2comp, _n1, theta2, theta2, theta1);
-    t23 = trfunc(_n2comp, _n3, theta2, theta2, theta3);
+    r12 = rfunc(n1, n2comp, theta1, theta2);
+    r23 = rfunc(n2comp, n3, theta2, theta3);
+    t12 = trfunc(n1, n2comp, theta1, theta1, theta2);
+    t21 = trfunc(n2comp, n1, theta2, theta2, theta1);
+    t23 = trfunc(n2comp, n3, theta2, theta2, theta3);
 
     ampr =
         r12 + (t12 * t21 * r23 * exp(-2. * zi * delta)) / (1. + r12 * r23 * exp(-2. * zi * delta));
     ampt = (t12 * t23 * exp(-zi * delta)) / (1. + r12 * r23 * exp(-2. * zi * delta));
 
     // And finally...!
-    fR_s = real(ampr * conj(ampr));
-    fT_s = real(gfunc(_n3, _n1, theta3, theta1) * ampt * conj(ampt));
+    coef[0] = real(ampr * conj(ampr));
+    coef[1] = real(gfunc(n3, n1, theta3, theta1) * ampt * conj(ampt));
 
     // Calculation for the p-polarization
 
-    r12 = rfunc(_n1, _n2comp, theta2, theta1);
-    r23 = rfunc(_n2comp, _n3, theta3, theta2);
-    t12 = trfunc(_n1, _n2comp, theta1, theta2, theta1);
-    t21 = trfunc(_n2comp, _n1, theta2, theta1, theta2);
-    t23 = trfunc(_n2comp, _n3, theta2, theta3, theta2);
+    r12 = rfunc(n1, n2comp, theta2, theta1);
+    r23 = rfunc(n2comp, n3, theta3, theta2);
+    t12 = trfunc(n1, n2comp, theta1, theta2, theta1);
+    t21 = trfunc(n2comp, n1, theta2, theta1, theta2);
+    t23 = trfunc(n2comp, n3, theta2, theta3, theta2);
 
     ampr =
         r12 + (t12 * t21 * r23 * exp(-2. * zi * delta)) / (1. + r12 * r23 * exp(-2. * zi * delta));
     ampt = (t12 * t23 * exp(-zi * delta)) / (1. + r12 * r23 * exp(-2. * zi * delta));
 
     // And finally...!
-    fR_p = real(ampr * conj(ampr));
-    fT_p = real(gfunc(_n3, _n1, theta3, theta1) * ampt * conj(ampt));
+    coef[2] = real(ampr * conj(ampr));
+    coef[3] = real(gfunc(n3, n1, theta3, theta1) * ampt * conj(ampt));
 
     // Now calculate the reference values at normal incidence (to scale QE)
 
     delta = eta;
     // Calculation for both polarization (the same at normal incidence)
-    r12 = rfunc(_n1, _n2comp, 0., 0.);
-    r23 = rfunc(_n2comp, _n3, 0., 0.);
-    t12 = trfunc(_n1, _n2comp, 0., 0., 0.);
-    t21 = trfunc(_n2comp, _n1, 0., 0., 0.);
-    t23 = trfunc(_n2comp, _n3, 0., 0., 0.);
+    r12 = rfunc(n1, n2comp, 0., 0.);
+    r23 = rfunc(n2comp, n3, 0., 0.);
+    t12 = trfunc(n1, n2comp, 0., 0., 0.);
+    t21 = trfunc(n2comp, n1, 0., 0., 0.);
+    t23 = trfunc(n2comp, n3, 0., 0., 0.);
 
     ampr =
         r12 + (t12 * t21 * r23 * exp(-2. * zi * delta)) / (1. + r12 * r23 * exp(-2. * zi * delta));
     ampt = (t12 * t23 * exp(-zi * delta)) / (1. + r12 * r23 * exp(-2. * zi * delta));
 
     // And finally...!
-    fR_n = real(ampr * conj(ampr));
-    fT_n = real(gfunc(_n3, _n1, 0., 0.) * ampt * conj(ampt));
+    coef[4] = real(ampr * conj(ampr));
+    coef[5] = real(gfunc(n3, n1, 0., 0.) * ampt * conj(ampt));
 
 #ifdef G4DEBUG
     if (_verbosity >= 10) {
-        G4cout << "=> lam, n1, n2: " << _wavelength / nm << " " << _n1 << " " << _n2comp << G4endl;
         G4cout << "=> Angles: " << real(theta1) / degree << " " << theta2 / degree << " "
                << theta3 / degree << G4endl;
-        G4cout << "Rper, Rpar, Tper, Tpar: " << fR_s << " " << fR_p << " " << fT_s << " " << fT_p;
-        G4cout << "\nRn, Tn : " << fR_n << " " << fT_n;
-        G4cout << "\n-------------------------------------------------------" << G4endl;
     }
 #endif
 }
 
+// exact coefficients for direction dir at a table coordinate
+void CupPMTOpticalModel::ExactCoefficients(G4int dir, G4double energy, G4double x,
+                                           G4double thickness, G4double coef[6]) const {
+    G4double n_glass = _rindex_glass->Value(energy);
+    G4double n1      = (dir == 0) ? n_glass : 1.0;
+    G4double n3      = (dir == 0) ? 1.0 : n_glass;
+    G4double cos1    = CosFromTableX(x, CriticalCos(n1, n3));
+    G4complex n2comp(_rindex_photocathode->Value(energy), -_kindex_photocathode->Value(energy));
+    ThinFilmCoefficients(n1, n3, n2comp, twopi * hbarc / energy, thickness,
+                         sqrt(1.0 - cos1 * cos1), coef);
+}
+
+void CupPMTOpticalModel::InterpolateFresnelTable(const FresnelTable &table, G4int dir,
+                                                 G4double energy, G4double x,
+                                                 G4double thickness, G4double coef[6]) const {
+    G4int ie, ix, it;
+    G4double fe, fx, ft;
+    TableCell(energy, table.eMin, table.eMax, table.nE, ie, fe);
+    TableCell(x, -1.0, 1.0, table.nX, ix, fx);
+    TableCell(thickness, table.tMin, table.tMax, table.nT, it, ft);
+
+    for (int k = 0; k < 6; k++)
+        coef[k] = 0.0;
+    for (int jt = 0; jt < 2; jt++) {
+        G4double wt = jt ? ft : 1.0 - ft;
+        if (wt == 0.0) continue;
+        for (int je = 0; je < 2; je++) {
+            G4double we = wt * (je ? fe : 1.0 - fe);
+            if (we == 0.0) continue;
+            size_t n = (size_t)(dir * table.nT + it + jt) * table.nE + ie + je;
+            coef[4] += we * table.normal[2 * n];
+            coef[5] += we * table.normal[2 * n + 1];
+            for (int jx = 0; jx < 2; jx++) {
+                G4double w = we * (jx ? fx : 1.0 - fx);
+                if (w == 0.0) continue;
+                const float *c = &table.coef[4 * (n * table.nX + ix + jx)];
+                for (int k = 0; k < 4; k++)
+                    coef[k] += w * c[k];
+            }
+        }
+    }
+}
+
+void CupPMTOpticalModel::FillFresnelTable(FresnelTable &table) const {
+    table.coef.resize(4 * (size_t)2 * table.nT * table.nE * table.nX);
+    table.normal.resize(2 * (size_t)2 * table.nT * table.nE);
+    G4double coef[6];
+    for (int dir = 0; dir < 2; dir++) {
+        for (int it = 0; it < table.nT; it++) {
+            G4double thickness = TableNode(table.tMin, table.tMax, table.nT, it);
+            for (int ie = 0; ie < table.nE; ie++) {
+                G4double energy = TableNode(table.eMin, table.eMax, table.nE, ie);
+                size_t n        = (size_t)(dir * table.nT + it) * table.nE + ie;
+                for (int ix = 0; ix < table.nX; ix++) {
+                    ExactCoefficients(dir, energy, TableNode(-1.0, 1.0, table.nX, ix), thickness,
+                                      coef);
+                    float *c = &table.coef[4 * (n * table.nX + ix)];
+                    for (int k = 0; k < 4; k++)
+                        c[k] = coef[k];
+                }
+                table.normal[2 * n]     = coef[4];
+                table.normal[2 * n + 1] = coef[5];
+            }
+        }
+    }
+}
+
+// largest |interpolated - exact| coefficient at the cell midpoints of one
+// axis (0: energy, 1: x, 2: thickness), with the others at the nodes (at
+// most about 64 of them per axis, to keep the check cheap on fine grids)
+G4double CupPMTOpticalModel::MidpointError(const FresnelTable &table, G4int axis) const {
+    G4int nE = (axis == 0) ? table.nE - 1 : table.nE;
+    G4int nX = (axis == 1) ? table.nX - 1 : table.nX;
+    G4int nT = (axis == 2) ? table.nT - 1 : table.nT;
+    G4int sE = (axis == 0) ? 1 : std::max(1, nE / 64);
+    G4int sX = (axis == 1) ? 1 : std::max(1, nX / 64);
+    G4int sT = (axis == 2) ? 1 : std::max(1, nT / 64);
+    G4double exact[6], interpolated[6];
+    G4double maxError = 0.0;
+    for (int dir = 0; dir < 2; dir++) {
+        for (int it = 0; it < nT; it += sT) {
+            G4double thickness =
+                TableNode(table.tMin, table.tMax, table.nT, it + (axis == 2 ? 0.5 : 0.0));
+            for (int ie = 0; ie < nE; ie += sE) {
+                G4double energy =
+                    TableNode(table.eMin, table.eMax, table.nE, ie + (axis == 0 ? 0.5 : 0.0));
+                for (int ix = 0; ix < nX; ix += sX) {
+                    G4double x = TableNode(-1.0, 1.0, table.nX, ix + (axis == 1 ? 0.5 : 0.0));
+                    ExactCoefficients(dir, energy, x, thickness, exact);
+                    InterpolateFresnelTable(table, dir, energy, x, thickness, interpolated);
+                    for (int k = 0; k < 6; k++)
+                        maxError = std::max(maxError, fabs(interpolated[k] - exact[k]));
+                }
+            }
+        }
+    }
+    return maxError;
+}
+
+// RebuildModels() redoes what the models of this thread derived from the
+// glass and photocathode properties, which CupOpticalScan has changed.
+void CupPMTOpticalModel::RebuildModels() {
+    fgPropertyVersion  = CupOpticalScan::GetPropertyVersion();
+    fgMaxEfficiency    = 0.0;
+    fgMaxCollectionEff = 0.0;
+    if (fgModels == NULL) return;
+    for (size_t i = 0; i < fgModels->size(); i++) {
+        CupPMTOpticalModel *model = (*fgModels)[i];
+        model->BuildSpectrum();
+        model->fFresnelTable  = nullptr; // look up the table of the new version
+        model->_photon_energy = -1.0; // no "last photon" values
+    }
+}
+
+size_t CupPMTOpticalModel::FresnelTableBytes(G4int nE, G4int nX, G4int nT) {
+    return sizeof(float) * (size_t)2 * nT * nE * (4 * (size_t)nX + 2);
+}
+
+// GetFresnelTable() points fFresnelTable at the table of this PMT type and
+// the current property version, building it if no thread has yet.  Tables
+// of older versions are dropped: the properties only change between runs,
+// and every model looks its table up again after that.
+void CupPMTOpticalModel::GetFresnelTable() {
+    FresnelKey key;
+    key.first.push_back(_rindex_glass);
+    key.first.push_back(_rindex_photocathode);
+    key.first.push_back(_kindex_photocathode);
+    key.first.push_back(_thickness_photocathode);
+    key.second = CupOpticalScan::GetPropertyVersion();
+
+    G4AutoLock lock(&FresnelTablesMutex);
+    std::map<FresnelKey, const FresnelTable *>::iterator it = fgFresnelTables.find(key);
+    if (it != fgFresnelTables.end()) {
+        fFresnelTable = it->second;
+        return;
+    }
+    for (it = fgFresnelTables.begin(); it != fgFresnelTables.end();) {
+        if (it->first.second < key.second) {
+            delete it->second;
+            fgFresnelTables.erase(it++);
+        } else
+            ++it;
+    }
+    fFresnelTable        = BuildFresnelTable();
+    fgFresnelTables[key] = fFresnelTable;
+}
+
+// BuildFresnelTable() makes the luxlevel 4 tables for this PMT type, over
+// the energy range of the optical properties and the photocathode
+// thickness range, refining the grid until it meets kFresnelTableTolerance
+// or reaches kFresnelTableMaxBytes.
+const CupPMTOpticalModel::FresnelTable *CupPMTOpticalModel::BuildFresnelTable() {
+    FresnelTable *table = new FresnelTable;
+    G4MaterialPropertyVector *pv[3] = {_rindex_glass, _rindex_photocathode, _kindex_photocathode};
+    table->eMin = pv[0]->Energy(0);
+    table->eMax = pv[0]->Energy(pv[0]->GetVectorLength() - 1);
+    for (int i = 1; i < 3; i++) {
+        table->eMin = std::min(table->eMin, pv[i]->Energy(0));
+        table->eMax = std::max(table->eMax, pv[i]->Energy(pv[i]->GetVectorLength() - 1));
+    }
+    table->tMin = _thickness_photocathode->GetMinValue();
+    table->tMax = _thickness_photocathode->GetMaxValue();
+    table->nE   = 33;
+    table->nX   = 129;
+    table->nT   = (table->tMax > table->tMin) ? 3 : 1;
+
+    // (no per-node printout while building)
+    G4int verbosity = _verbosity;
+    _verbosity      = 0;
+    for (;;) {
+        FillFresnelTable(*table);
+        // the errors along the axes add up (roughly) inside a cell, so their
+        // sum is the error estimate; refine the worst axis until it is met
+        G4double errE   = MidpointError(*table, 0);
+        G4double errX   = MidpointError(*table, 1);
+        G4double errT   = (table->nT > 1) ? MidpointError(*table, 2) : 0.0;
+        table->maxError = errE + errX + errT;
+        if (table->maxError <= kFresnelTableTolerance) break;
+
+        G4int nE    = table->nE, nX = table->nX, nT = table->nT;
+        G4bool canE = FresnelTableBytes(2 * nE - 1, nX, nT) <= kFresnelTableMaxBytes;
+        G4bool canX = FresnelTableBytes(nE, 2 * nX - 1, nT) <= kFresnelTableMaxBytes;
+        G4bool canT = nT > 1 && FresnelTableBytes(nE, nX, 2 * nT - 1) <= kFresnelTableMaxBytes;
+        if (canE && (errE >= errX || !canX) && (errE >= errT || !canT))
+            table->nE = 2 * table->nE - 1;
+        else if (canX && (errX >= errT || !canT))
+            table->nX = 2 * table->nX - 1;
+        else if (canT)
+            table->nT = 2 * table->nT - 1;
+        else
+            break;
+    }
+    _verbosity = verbosity;
+
+    if (table->maxError > kFresnelTableTolerance) {
+        G4ExceptionDescription ed;
+        ed << "CupSim/CupPMTOpticalModel: Fresnel table of " << GetName()
+           << " does not reach its tolerance " << kFresnelTableTolerance << " within "
+           << kFresnelTableMaxBytes / 1024 << " kB (max error " << table->maxError << ")!";
+        G4Exception(" ", " ", JustWarning, ed);
+    }
+    if (_verbosity > 0 || table->maxError > kFresnelTableTolerance) {
+        G4cout << "CupPMTOpticalModel " << GetName() << ": Fresnel table " << table->nE
+               << " energies x " << table->nX << " angles x " << table->nT
+               << " thicknesses (" << FresnelTableBytes(table->nE, table->nX, table->nT) / 1024
+               << " kB), max error " << table->maxError << G4endl;
+    }
+    return table;
+}
+
 G4complex carcsin(G4complex theta) // complex sin^-1
 {
     G4complex zi(0., 1.);
@@ -676,6 +1104,8 @@ void CupPMTOpticalModel::SetNewValue(G4UIcommand *command, G4String newValues) {
         _verbosity = strtol((const char *)newValues, NULL, 0);
     } else if (commandName == "luxlevel") {
         _luxlevel = strtol((const char *)newValues, NULL, 0);
+    } else if (commandName == "qeScale") {
+        _qeScale = strtod((const char *)newValues, NULL);
     } else {
         G4cerr << "No PMTOpticalModel command named " << commandName << G4endl;
     }
@@ -692,6 +1122,10 @@ G4String CupPMTOpticalModel::GetCurrentValue(G4UIcommand *command) {
         char outbuff[64];
         sprintf(outbuff, "%d", _luxlevel);
         return G4String(outbuff);
+    } else if (commandName == "qeScale") {
+        char outbuff[64];
+        sprintf(outbuff, "%g", _qeScale);
+        return G4String(outbuff);
     } else {
         return (commandName + " is not a valid PMTOpticalModel command");
     }
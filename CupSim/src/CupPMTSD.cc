@@ -23,6 +23,9 @@ CupPMTSD::CupPMTSD(G4String name, int arg_max_pmts, int arg_pmt_no_offset, int a
     my_id_pmt_size = arg_my_id_pmt_size;
 
     hit_sum = new G4int[max_pmts];
+
+    // preallocate the (per-thread) hit store for this SD's PMT IDs
+    CupVEventAction::GetTheHitPMTCollection()->Reserve(pmt_no_offset + max_pmts);
 }
 
 CupPMTSD::~CupPMTSD() {
@@ -61,19 +64,20 @@ void CupPMTSD::SimpleHit(G4int ipmt, G4double time, G4double kineticEnergy,
 
     hit_sum[pmt_index] += iHitPhotonCount;
 
-    // create new CupHitPhoton, the way of recording photo hits on PMTs
-    CupHitPhoton *hit_photon = new CupHitPhoton();
-    hit_photon->SetPMTID((int)ipmt);
-    hit_photon->SetTime((double)time);
-    hit_photon->SetKineticEnergy((double)kineticEnergy);
-    hit_photon->SetPosition((double)hit_position.x(), (double)hit_position.y(),
-                            (double)hit_position.z());
-    hit_photon->SetMomentum((double)hit_momentum.x(), (double)hit_momentum.y(),
-                            (double)hit_momentum.z());
-    hit_photon->SetPolarization((double)hit_polarization.x(), (double)hit_polarization.y(),
-                                (double)hit_polarization.z());
-    hit_photon->SetCount(iHitPhotonCount);
-    hit_photon->SetProcessTag(processTag); // EJ: 2007-11-06
+    // fill a CupHitPhoton, the way of recording photo hits on PMTs
+    // (copied into the HitPMT's own storage, no allocation here)
+    CupHitPhoton hit_photon;
+    hit_photon.SetPMTID((int)ipmt);
+    hit_photon.SetTime((double)time);
+    hit_photon.SetKineticEnergy((double)kineticEnergy);
+    hit_photon.SetPosition((double)hit_position.x(), (double)hit_position.y(),
+                           (double)hit_position.z());
+    hit_photon.SetMomentum((double)hit_momentum.x(), (double)hit_momentum.y(),
+                           (double)hit_momentum.z());
+    hit_photon.SetPolarization((double)hit_polarization.x(), (double)hit_polarization.y(),
+                               (double)hit_polarization.z());
+    hit_photon.SetCount(iHitPhotonCount);
+    hit_photon.SetProcessTag(processTag); // EJ: 2007-11-06
 
     CupVEventAction::GetTheHitPMTCollection()->DetectPhoton(hit_photon);
 }
@@ -6,6 +6,15 @@
 #include <fstream>
 #include <sstream>
 
+#if G4VERSION_NUMBER >= 1000
+#include "G4AutoLock.hh"
+#include "G4Threading.hh"
+
+namespace {
+G4Mutex CupParamMutex = G4MUTEX_INITIALIZER;
+}
+#endif
+
 #if G4VERSION_NUMBER >= 1000
 G4ThreadLocal CupParam *CupParam::theCupParam = nullptr;
 CupParam *CupParam::theMasterCupParam = nullptr;
@@ -17,6 +26,21 @@ CupParam *CupParam::theMasterCupParam = nullptr;
 // Constructor
 CupParam::CupParam() {}
 
+// Create the instance for the calling thread.  The master instance is the
+// one filled by ReadFile() in main(); each worker thread gets its own copy
+// of it, so that GetWithDefault() on a worker never writes to the shared map.
+CupParam *CupParam::CreateDBPtr() {
+#if G4VERSION_NUMBER >= 1000
+    G4AutoLock lock(&CupParamMutex);
+    if (theMasterCupParam == nullptr) theMasterCupParam = new CupParam();
+    if (G4Threading::IsMasterThread()) return theMasterCupParam;
+    return new CupParam(*theMasterCupParam);
+#else
+    if (theMasterCupParam == nullptr) theMasterCupParam = new CupParam();
+    return theMasterCupParam;
+#endif
+}
+
 // ReadFile
 void CupParam::ReadFile(std::istream &is, EOverride oflag) {
     while (is.good()) {
@@ -43,6 +43,9 @@ G4bool CupPhysicsList::omitNeutHP              = 0;
 G4int CupPhysicsList::VerboseLevel             = 0;
 G4int CupPhysicsList::OpVerbLevel              = 0;
 
+G4ThreadLocal std::vector<G4VFastSimulationModel *> *CupPhysicsList::fastSimulationModels =
+    nullptr;
+
 // Constructor /////////////////////////////////////////////////////////////
 CupPhysicsList::CupPhysicsList() : G4VModularPhysicsList() {
     defaultCutValue = 1. * mm; //
@@ -176,16 +179,50 @@ void CupPhysicsList::ConstructProcess() {
 
 // G4FastSimulation Processes //////////////////////////////////////////////////////
 #include "G4FastSimulationManagerProcess.hh"
+#include "G4VFastSimulationModel.hh"
+
+void CupPhysicsList::RegisterFastSimulationModel(G4VFastSimulationModel *model) {
+    if (fastSimulationModels == nullptr)
+        fastSimulationModels = new std::vector<G4VFastSimulationModel *>;
+    fastSimulationModels->push_back(model);
+}
+
+void CupPhysicsList::DeregisterFastSimulationModel(G4VFastSimulationModel *model) {
+    if (fastSimulationModels == nullptr) return;
+    for (size_t i = 0; i < fastSimulationModels->size(); i++) {
+        if ((*fastSimulationModels)[i] == model) {
+            fastSimulationModels->erase(fastSimulationModels->begin() + i);
+            break;
+        }
+    }
+}
 
 void CupPhysicsList::AddParameterisation() {
     auto theParticleIterator = GetParticleIterator();
 
+    // Every step of a particle carrying the fast simulation process pays for
+    // its trigger check, so only give it to particles some model applies to
+    // (for CupSim, the PMT optical model: optical photons only).  With no
+    // model registered on this thread, e.g. on the master of a
+    // multithreaded run, fall back to all particles.  The cupparam
+    // fastsim_all_particles restores the old behaviour for timing comparisons.
+    G4bool allParticles = (CupParam::GetDB()["fastsim_all_particles"] != 0.0);
+    G4bool anyModel     = (!allParticles && fastSimulationModels != nullptr &&
+                           !fastSimulationModels->empty());
+
     G4FastSimulationManagerProcess *theFastSimulationManagerProcess =
         new G4FastSimulationManagerProcess();
+    G4int nAttached = 0;
     theParticleIterator->reset();
     while ((*theParticleIterator)()) {
         G4ParticleDefinition *particle = theParticleIterator->value();
-        G4ProcessManager *pmanager     = particle->GetProcessManager();
+        if (anyModel) {
+            G4bool applicable = false;
+            for (size_t i = 0; i < fastSimulationModels->size() && !applicable; i++)
+                applicable = (*fastSimulationModels)[i]->IsApplicable(*particle);
+            if (!applicable) continue;
+        }
+        G4ProcessManager *pmanager = particle->GetProcessManager();
         // both postStep and alongStep action are required if the detector
         // makes use of ghost volumes. If no ghost, the postStep
         // is sufficient (and faster?).
@@ -195,6 +232,16 @@ void CupPhysicsList::AddParameterisation() {
 #else
         pmanager->AddProcess(theFastSimulationManagerProcess, -1, -1, 1);
 #endif
+        nAttached++;
+    }
+    if (nAttached == 0) delete theFastSimulationManagerProcess;
+    if (VerboseLevel > 1) {
+        G4cout << "CupPhysicsList: fast simulation process attached to " << nAttached
+               << " particle types"
+               << (allParticles ? " (fastsim_all_particles)"
+                   : anyModel   ? ""
+                                : " (no models registered)")
+               << G4endl;
     }
 }
 
@@ -392,9 +439,9 @@ void CupPhysicsList::ConstructEM() {
 
 // Optical Processes ////////////////////////////////////////////////////////
 // EJ: start
+#include "CupSim/CupCerenkov.hh"
 #include "CupSim/CupOpAttenuation.hh"
 #include "CupSim/CupScintillation.hh"
-#include "G4Cerenkov.hh"
 #include "G4EmSaturation.hh"
 #include "G4OpBoundaryProcess.hh"
 // EJ: end
@@ -441,7 +488,7 @@ void CupPhysicsList::ConstructOp() {
     theBoundaryProcess->SetVerboseLevel(OpVerbLevel);
 
     // Cerenkov
-    G4Cerenkov *theCerenkovProcess = new G4Cerenkov();
+    CupCerenkov *theCerenkovProcess = new CupCerenkov();
     theCerenkovProcess->SetTrackSecondariesFirst(true);
 
     auto theParticleIterator = GetParticleIterator();
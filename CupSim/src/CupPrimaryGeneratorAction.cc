@@ -11,10 +11,11 @@
 #include "Randomize.hh"
 #include "globals.hh"
 
-#include "CupSim/CupParam.hh"     // for CupParam
-#include "CupSim/CupPosGen.hh"    // for global position generator
-#include "CupSim/CupVertexGen.hh" // for vertex generator
-#include <stdio.h>                // for sprintf
+#include "CupSim/CupOpticsReplay.hh" // for the optics replay mode
+#include "CupSim/CupParam.hh"        // for CupParam
+#include "CupSim/CupPosGen.hh"       // for global position generator
+#include "CupSim/CupVertexGen.hh"    // for vertex generator
+#include <stdio.h>                   // for sprintf
 
 // here are the static constants and variables (boring)
 const char *CupPrimaryGeneratorAction::thePositionCodeNames[theNumPosGenCodes] = {
@@ -232,6 +233,12 @@ void CupPrimaryGeneratorAction::SetChainClip(double argChainClip) {
 
 // GeneratePrimaries (this is the interesting part!)
 void CupPrimaryGeneratorAction::GeneratePrimaries(G4Event *argEvent) {
+    // an optics replay has its events from the file of recorded steps
+    if (CupOpticsReplay::GetMode() == CupOpticsReplay::kModeReplay) {
+        CupOpticsReplay::GetInstance()->GeneratePrimaries(argEvent);
+        return;
+    }
+
     int next_event_type             = -1;
     G4double min_time_to_next_event = DBL_MAX;
 
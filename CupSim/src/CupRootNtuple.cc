@@ -1,6 +1,7 @@
 
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "G4RunManager.hh"
 #include "G4UImanager.hh"
@@ -9,6 +10,7 @@
 
 #include "CupSim/CupDebugMessenger.hh"
 #include "CupSim/CupDetectorConstruction.hh"
+#include "CupSim/CupLogger.hh"
 #include "CupSim/CupPMTSD.hh"
 #include "CupSim/CupParam.hh"
 #include "CupSim/CupPrimaryGeneratorAction.hh"
@@ -29,15 +31,18 @@
 #include "TFile.h"
 #include "TROOT.h"
 #include "TStopwatch.h"
+#include "TSystem.h"
 #include "TTree.h"
 
 // Include files for the G4 classes
+#include "G4AutoLock.hh"
 #include "G4Event.hh"
 #include "G4IonTable.hh"
 #include "G4Run.hh"
 #include "G4SDManager.hh"
 #include "G4Step.hh"
 #include "G4SteppingManager.hh"
+#include "G4Threading.hh"
 #include "G4Track.hh"
 #include "G4Trajectory.hh"
 #include "G4VHitsCollection.hh"
@@ -48,11 +53,22 @@
 
 TROOT theROOT("CupSim/Cupsim", "Cup Geant4 simulation output tree");
 
+namespace {
+// per-thread output files finished by the workers, waiting to be merged
+// into the master's output file at the end of the run
+G4Mutex CupRootNtupleMergeMutex = G4MUTEX_INITIALIZER;
+std::vector<G4String> threadOutputFiles;
+} // namespace
+
 CupRootNtuple::CupRootNtuple()
-    : CupRecorderBase(), myMessenger(nullptr), fROOTOutputFile(nullptr), fROOTOutputTree(nullptr) {
+    : CupRecorderBase(), myMessenger(nullptr), fROOTOutputFile(nullptr), fROOTOutputTree(nullptr),
+      fROOTRunTree(nullptr), Cprimary(nullptr), Ctrack(nullptr), Cstep(nullptr), Cphoton(nullptr),
+      Ctgsd(nullptr), CMuSD(nullptr), pmtsd_inner(nullptr), pmtsd_outer(nullptr),
+      pmtsd_plasScint(nullptr), Cmlcs(nullptr), Cscint(nullptr), Cevtinfo(nullptr) {
     fFileCmd->SetGuidance("This will be a ROOT Format File;");
     timer         = new TStopwatch();
     myMessenger   = new CupRootNtupleMessenger(this);
+    CupLogger::CreateMessenger();
     StatusPrimary = 0;
     StatusTrack   = 0;
     StatusStep    = 0;
@@ -60,22 +76,34 @@ CupRootNtuple::CupRootNtuple()
     StatusScint   = 0;
     StatusMuon    = 0;
     nsrc          = 0;
+
+    Cphotonhits           = nullptr;
+    fPhotonHitColumnsFull = false;
+
+    AsyncQueueDepth = 0;
+    fWriterThread   = nullptr;
+    fStopWriter     = false;
 }
 
 CupRootNtuple::~CupRootNtuple() {
     CloseFile();
-    delete Cprimary;
-    delete Ctrack;
-    delete Cstep;
-    delete Cphoton;
-    delete Ctgsd;
-    delete CMuSD;
-    delete Cscint;
+    DeleteEventObjects(GetEventObjects());
     delete timer;
 
     delete myMessenger;
 }
 
+void CupRootNtuple::CopyNtupleStatus(const CupRootNtuple *master) {
+    if (master == nullptr) return;
+    SetNtuplePrimary(master->StatusPrimary);
+    SetNtupleTrack(master->StatusTrack);
+    SetNtupleStep(master->StatusStep);
+    SetNtuplePhoton(master->StatusPhoton);
+    SetNtupleScint(master->StatusScint);
+    SetNtupleMuon(master->StatusMuon);
+    SetNtupleAsyncQueueDepth(master->AsyncQueueDepth);
+}
+
 void CupRootNtuple::SetNewValue(G4UIcommand *command, G4String newValue) {
     if (command->GetCommandName() == "drawTracks")
         drawFlag = newValue;
@@ -92,6 +120,7 @@ void CupRootNtuple::SetNewValue(G4UIcommand *command, G4String newValue) {
         // always call CloseFile() here, in case file is open
         // (user code should ignore CloseFile() if file is not open)
         CloseFile();
+        fOutputFileName = newValue;
         // open new file, if new filename given
         // (it is okay not to give a name, in case user just wants to close file)
         if (newValue.length() <= 0) {
@@ -115,17 +144,23 @@ void CupRootNtuple::OpenFile(const G4String filename, G4bool outputMode) {
     if (fROOTOutputFile != nullptr) CloseFile();
 
     flagFullOutputMode = outputMode;
-    fROOTOutputFile =
-        new TFile((filename + ".root").c_str(), "RECREATE", "Cup Geant4 simulation output file");
+    // every worker thread has its own recorder, so give each one its own file
+    G4String threadFileName = filename;
+    if (G4Threading::IsWorkerThread())
+        threadFileName += "_t" + std::to_string(G4Threading::G4GetThreadId());
+    fROOTOutputFile = new TFile((threadFileName + ".root").c_str(), "RECREATE",
+                                "Cup Geant4 simulation output file");
     if (fROOTOutputFile == nullptr) {
         G4cerr << "Could not open ROOT output file " << filename << G4endl;
         return;
     }
     CreateTree();
+    if (AsyncQueueDepth > 0) StartWriter();
 }
 
 void CupRootNtuple::CloseFile() {
     if (fROOTOutputFile != nullptr) {
+        StopWriter(); // drains the queued events first
         fROOTOutputFile = fROOTOutputTree->GetCurrentFile();
         G4cout << "Closing " << fROOTOutputFile->GetName() << G4endl;
         fROOTOutputFile->Write();
@@ -142,12 +177,20 @@ void CupRootNtuple::CreateTree() {
     //  TTree::SetMaxTreeSize(1000*Long64_t(2000000000));
     TTree::SetMaxTreeSize(2147483647);
 
+    // a worker makes a new tree for every run: drop the previous run's objects
+    DeleteEventObjects(GetEventObjects());
+    pmtsd_inner     = nullptr;
+    pmtsd_outer     = nullptr;
+    pmtsd_plasScint = nullptr;
+    Cmlcs           = nullptr;
+
     Cprimary = new Primary();
     tclvrtx  = Cprimary->GetVertex();
-    Ctrack   = new EvtTrack();
-    tcltr    = Ctrack->GetTrack();
-    Cstep    = new EvtStep();
-    tclst    = Cstep->GetStep();
+    // the track and step lists are large: only made when they are written
+    Ctrack   = StatusTrack ? new EvtTrack() : nullptr;
+    tcltr    = Ctrack ? Ctrack->GetTrack() : nullptr;
+    Cstep    = StatusStep ? new EvtStep() : nullptr;
+    tclst    = Cstep ? Cstep->GetStep() : nullptr;
     Cphoton  = new Photon();
     tclhit   = Cphoton->GetHit();
     Ctgsd    = new TGSD();
@@ -156,6 +199,8 @@ void CupRootNtuple::CreateTree() {
     tclmuon  = CMuSD->GetCell();
     Cscint   = new Scint();
 
+    Cphotonhits = new PhotonHitColumns();
+
     fROOTRunTree = new TTree("run_tree", "CupSim/Cupsim run data tree");
     fROOTRunTree->Branch("runID", &runID, "runID/I");
 
@@ -166,6 +211,7 @@ void CupRootNtuple::CreateTree() {
     if (StatusTrack) fROOTOutputTree->Branch("TRACK", &(Ctrack), 256000, 2);
     if (StatusStep) fROOTOutputTree->Branch("STEP", &(Cstep), 256000, 2);
     if (StatusPhoton) fROOTOutputTree->Branch("PHOTONHIT", &(Cphoton), 256000, 2);
+    if (StatusPhoton == kPhotonHitColumns) AddPhotonHitColumns();
     if (StatusScint) fROOTOutputTree->Branch("SCINT", &(Cscint), 256000, 2);
 
     sdman = G4SDManager::GetSDMpointer();
@@ -224,9 +270,153 @@ void CupRootNtuple::AddPMTSD() {
     }
 }
 
-void CupRootNtuple::RecordBeginOfRun(const G4Run *a_run) {}
+CupRootNtuple::PhotonHitColumns::PhotonHitColumns() : n(0) {
+    // keep the buffers allocated so the branch addresses are always valid
+    Resize(1024);
+    Clear();
+}
+
+void CupRootNtuple::PhotonHitColumns::Resize(size_t size) {
+    pmt.resize(size);
+    time.resize(size);
+    count.resize(size);
+    tag.resize(size);
+    wavelength.resize(size);
+    x.resize(size);
+    y.resize(size);
+    z.resize(size);
+    px.resize(size);
+    py.resize(size);
+    pz.resize(size);
+    polx.resize(size);
+    poly.resize(size);
+    polz.resize(size);
+}
+
+void CupRootNtuple::PhotonHitColumns::Clear() {
+    n = 0;
+    pmt.clear();
+    time.clear();
+    count.clear();
+    tag.clear();
+    wavelength.clear();
+    x.clear();
+    y.clear();
+    z.clear();
+    px.clear();
+    py.clear();
+    pz.clear();
+    polx.clear();
+    poly.clear();
+    polz.clear();
+}
+
+void CupRootNtuple::AddPhotonHitColumns() {
+    // plain leaves, one array per quantity; no per-hit TObject streaming.
+    // The buffer addresses are set by BindPhotonHitColumns() before each Fill().
+    fPhotonHitColumnsFull = flagFullOutputMode;
+    fROOTOutputTree->Branch("PHOTONHIT_n", &Cphotonhits->n, "PHOTONHIT_n/I");
+    fROOTOutputTree->Branch("PHOTONHIT_pmt", (void *)nullptr, "PHOTONHIT_pmt[PHOTONHIT_n]/S");
+    fROOTOutputTree->Branch("PHOTONHIT_time", (void *)nullptr, "PHOTONHIT_time[PHOTONHIT_n]/D");
+    fROOTOutputTree->Branch("PHOTONHIT_count", (void *)nullptr, "PHOTONHIT_count[PHOTONHIT_n]/I");
+    fROOTOutputTree->Branch("PHOTONHIT_tag", (void *)nullptr, "PHOTONHIT_tag[PHOTONHIT_n]/B");
+    if (fPhotonHitColumnsFull) {
+        const char *names[] = {"wl", "x", "y", "z", "px", "py", "pz", "polx", "poly", "polz"};
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            G4String branchName = G4String("PHOTONHIT_") + names[i];
+            fROOTOutputTree->Branch(branchName.c_str(), (void *)nullptr,
+                                    (branchName + "[PHOTONHIT_n]/F").c_str());
+        }
+    }
+}
+
+void CupRootNtuple::BindPhotonHitColumns(PhotonHitColumns *cols) {
+    // the vectors may have been reallocated while filling, so rebind each event
+    TTree *tree = fROOTOutputTree;
+    tree->SetBranchAddress("PHOTONHIT_n", &cols->n);
+    tree->SetBranchAddress("PHOTONHIT_pmt", cols->pmt.data());
+    tree->SetBranchAddress("PHOTONHIT_time", cols->time.data());
+    tree->SetBranchAddress("PHOTONHIT_count", cols->count.data());
+    tree->SetBranchAddress("PHOTONHIT_tag", cols->tag.data());
+    if (fPhotonHitColumnsFull) {
+        tree->SetBranchAddress("PHOTONHIT_wl", cols->wavelength.data());
+        tree->SetBranchAddress("PHOTONHIT_x", cols->x.data());
+        tree->SetBranchAddress("PHOTONHIT_y", cols->y.data());
+        tree->SetBranchAddress("PHOTONHIT_z", cols->z.data());
+        tree->SetBranchAddress("PHOTONHIT_px", cols->px.data());
+        tree->SetBranchAddress("PHOTONHIT_py", cols->py.data());
+        tree->SetBranchAddress("PHOTONHIT_pz", cols->pz.data());
+        tree->SetBranchAddress("PHOTONHIT_polx", cols->polx.data());
+        tree->SetBranchAddress("PHOTONHIT_poly", cols->poly.data());
+        tree->SetBranchAddress("PHOTONHIT_polz", cols->polz.data());
+    }
+}
+
+void CupRootNtuple::RecordBeginOfRun(const G4Run *a_run) {
+    // a worker hands its file to the master at the end of every run;
+    // start a fresh one for this run
+    if (G4Threading::IsWorkerThread() && fROOTOutputFile == nullptr &&
+        fOutputFileName.length() > 0)
+        OpenFile(fOutputFileName, flagFullOutputMode);
+}
+
+void CupRootNtuple::RecordEndOfRun(const G4Run *a_run) {
+    G4cout << "NSource= " << nsrc << G4endl;
+
+    if (G4Threading::IsWorkerThread()) {
+        if (fROOTOutputFile == nullptr) return;
+        G4String threadFileName = fROOTOutputTree->GetCurrentFile()->GetName();
+        CloseFile();
+        G4AutoLock lock(&CupRootNtupleMergeMutex);
+        threadOutputFiles.push_back(threadFileName);
+    } else if (G4Threading::IsMultithreadedApplication()) {
+        // the master runs no events: fill its run tree here and collect
+        // the workers' event trees, so the output looks like a sequential run
+        if (fROOTOutputFile == nullptr) return;
+        runID = a_run->GetRunID();
+        if (a_run->GetNumberOfEvent() > 0) FillRunTree();
+        MergeThreadFiles();
+    }
+}
 
-void CupRootNtuple::RecordEndOfRun(const G4Run *a_run) { G4cout << "NSource= " << nsrc << G4endl; }
+void CupRootNtuple::MergeThreadFiles() {
+    std::vector<G4String> fileNames;
+    {
+        G4AutoLock lock(&CupRootNtupleMergeMutex);
+        fileNames.swap(threadOutputFiles);
+    }
+
+    std::lock_guard<std::mutex> fileLock(fFileMutex);
+    for (size_t i = 0; i < fileNames.size(); i++) {
+        TFile *threadFile = TFile::Open(fileNames[i].c_str(), "READ");
+        if (threadFile == nullptr || threadFile->IsZombie()) {
+            G4cerr << "Could not reopen thread output file " << fileNames[i] << G4endl;
+            delete threadFile;
+            continue;
+        }
+        TTree *threadTree = (TTree *)threadFile->Get("event_tree");
+        if (threadTree != nullptr) {
+            if (StatusPhoton == kPhotonHitColumns) {
+                // a slow copy reads into the column buffers: make room for the
+                // largest event of this file
+                size_t maxHits = (size_t)threadTree->GetMaximum("PHOTONHIT_n");
+                if (maxHits > Cphotonhits->pmt.size()) Cphotonhits->Resize(maxHits);
+                BindPhotonHitColumns(Cphotonhits);
+            }
+            // the workers' trees have our layout: copy the baskets as they are.
+            // ROOT falls back to reading entry by entry into our branch objects
+            // if it cannot.
+            fROOTOutputTree->CopyAddresses(threadTree);
+            Long64_t nEntries = threadTree->GetEntries();
+            fROOTOutputTree->CopyEntries(threadTree, -1, "fast");
+            G4cout << "Merged " << nEntries << " events from " << fileNames[i] << G4endl;
+        }
+        threadFile->Close();
+        delete threadFile;
+        gSystem->Unlink(fileNames[i].c_str());
+    }
+    ClearEvent();
+}
 
 void CupRootNtuple::RecordBeginOfEvent(const G4Event *a_event) {}
 
@@ -257,13 +447,17 @@ void CupRootNtuple::RecordEndOfEvent(const G4Event *a_event) {
     }
 
     // put to tree
-    fROOTOutputTree->Fill();
+    if (fWriterThread != nullptr)
+        QueueEvent();
+    else {
+        if (StatusPhoton == kPhotonHitColumns) BindPhotonHitColumns(Cphotonhits);
+        fROOTOutputTree->Fill();
+    }
 
     ClearEvent();
 
-    G4cout << "///////////////////////////////// End of Event "
-              "/////////////////////////////////////////"
-           << G4endl;
+    CUPLOG(CupLogger::kLogEvent, "///////////////////////////////// End of Event "
+                                 "/////////////////////////////////////////");
 }
 
 void CupRootNtuple::RecordTrack(const G4Track *a_track) {
@@ -416,7 +610,7 @@ void CupRootNtuple::SetEventInfo(const G4Event *a_event) {
     // fill event ID and run ID
     eventID = a_event->GetEventID();
     runID   = G4RunManager::GetRunManager()->GetCurrentRun()->GetRunID();
-    G4cout << "Event= " << eventID << G4endl;
+    CUPLOG(CupLogger::kLogEvent, "Event= " << eventID);
 
     if (fROOTOutputTree == 0) {
         G4cout << "Event " << eventID << " of run " << runID << " finished, no output file open!"
@@ -427,33 +621,9 @@ void CupRootNtuple::SetEventInfo(const G4Event *a_event) {
     Cevtinfo->SetEventID(eventID);
     Cevtinfo->SetRunID(runID);
 
-    // on first event, set run data, checking for existence of each branch
-    if (eventID == 0) {
-        CupParam &db(CupParam::GetDB());
-        CupParam::iterator i;
-        for (i = db.begin(); i != db.end(); i++) {
-            G4String key((*i).first);
-            char branchName[80];
-            sprintf(branchName, "database.%s", key.c_str());
-            TBranch *b = fROOTRunTree->GetBranch(branchName);
-            if (b == NULL) {
-                double dummy = 0.0;
-                char leafFormat[80];
-                sprintf(leafFormat, "%s/D", key.c_str());
-                b                = fROOTRunTree->Branch(branchName, &dummy, leafFormat);
-                int nTreeEntries = (int)(fROOTRunTree->GetEntries());
-                if (nTreeEntries > 0) {
-                    G4cerr << "Note: new database parameter detected on run " << runID << " with "
-                           << nTreeEntries << " run tree entries already filled." << G4endl;
-                    // need to fill in dummy entries to keep all branches in sync.
-                    for (int ii = 0; ii < nTreeEntries; ii++)
-                        b->Fill();
-                }
-            }
-            b->SetAddress(&((*i).second));
-        }
-        fROOTRunTree->Fill();
-    }
+    // on first event, set run data (in MT runs the master does this for
+    // the merged file, see RecordEndOfRun)
+    if (eventID == 0 && !G4Threading::IsWorkerThread()) FillRunTree();
 
     // fill simulated universal time info
     CupPrimaryGeneratorAction *theCupPGA =
@@ -463,7 +633,7 @@ void CupRootNtuple::SetEventInfo(const G4Event *a_event) {
 
     Cevtinfo->SetUT(UT);
     Cevtinfo->SetDeltaUT(delta_UT);
-    G4cout << "GLOBAL TIME Info.: UT= " << UT << ", delta_UT= " << delta_UT << G4endl;
+    CUPLOG(CupLogger::kLogDetail, "GLOBAL TIME Info.: UT= " << UT << ", delta_UT= " << delta_UT);
 
     // fill primary generator action "event type" info
     eventType = theCupPGA->GetTypeOfCurrentEvent();
@@ -472,6 +642,35 @@ void CupRootNtuple::SetEventInfo(const G4Event *a_event) {
     Cevtinfo->SetNSource(nsrc);
 }
 
+void CupRootNtuple::FillRunTree() {
+    std::lock_guard<std::mutex> fileLock(fFileMutex);
+    // set run data, checking for existence of each branch
+    CupParam &db(CupParam::GetDB());
+    CupParam::iterator i;
+    for (i = db.begin(); i != db.end(); i++) {
+        G4String key((*i).first);
+        char branchName[80];
+        sprintf(branchName, "database.%s", key.c_str());
+        TBranch *b = fROOTRunTree->GetBranch(branchName);
+        if (b == NULL) {
+            double dummy = 0.0;
+            char leafFormat[80];
+            sprintf(leafFormat, "%s/D", key.c_str());
+            b                = fROOTRunTree->Branch(branchName, &dummy, leafFormat);
+            int nTreeEntries = (int)(fROOTRunTree->GetEntries());
+            if (nTreeEntries > 0) {
+                G4cerr << "Note: new database parameter detected on run " << runID << " with "
+                       << nTreeEntries << " run tree entries already filled." << G4endl;
+                // need to fill in dummy entries to keep all branches in sync.
+                for (int ii = 0; ii < nTreeEntries; ii++)
+                    b->Fill();
+            }
+        }
+        b->SetAddress(&((*i).second));
+    }
+    fROOTRunTree->Fill();
+}
+
 void CupRootNtuple::SetPrimary(const G4Event *a_event) {
     Double_t ke;
     Vertex vrtx;
@@ -525,8 +724,8 @@ void CupRootNtuple::SetPrimary(const G4Event *a_event) {
                 vketot += ke;
                 vcentroid += ke * pv->GetPosition();
             }
-            G4cout << "EJ: iprim= " << iprim << ", pname= " << tName << ", pdgcode= " << cuppdgcode
-                   << G4endl;
+            CUPLOG(CupLogger::kLogDetail, "EJ: iprim= " << iprim << ", pname= " << tName
+                                                        << ", pdgcode= " << cuppdgcode);
         }
     }
     //  vertex_info.n_particles= iprim;
@@ -551,21 +750,19 @@ void CupRootNtuple::SetPhoton() {
     Int_t nhitInner = 0, nhitOuter = 0;
     Int_t nhitPmtInner = 0, nhitPmtOuter = 0;
     Int_t prePmtInnerId = -1, prePmtOuterId = -1;
-    Int_t nhitPmt = theHitPMTCollection.GetEntries();
-    G4cout << "nhitPMT= " << theHitPMTCollection.GetEntries() << G4endl;
-    for (int ipmt = 0; ipmt < theHitPMTCollection.GetEntries(); ipmt++) {
-        CupHitPMT *a_pmt = theHitPMTCollection.GetPMT(ipmt);
+    CupHitPMTCollection *hitPMTCollection = GetTheHitPMTCollection();
+    Int_t nhitPmt = hitPMTCollection->GetEntries();
+    CUPLOG(CupLogger::kLogDetail, "nhitPMT= " << nhitPmt);
+    // at most max_hits_for_ROOT hits in all, which MergeThreadFiles relies on
+    for (int ipmt = 0; ipmt < nhitPmt && n_photon_hits < max_hits_for_ROOT; ipmt++) {
+        CupHitPMT *a_pmt = hitPMTCollection->GetPMT(ipmt);
         a_pmt->SortTimeAscending(); // Sort the photons in time order
         // G4cout << "ipmt= " << ipmt << ", nPMThit= " << a_pmt->GetEntries() << G4endl;
-        for (int i = 0; i < a_pmt->GetEntries(); i++) {
+        for (int i = 0; i < a_pmt->GetEntries() && n_photon_hits < max_hits_for_ROOT; i++) {
             const CupHitPhoton *photon = a_pmt->GetPhoton(i);
-            phit.SetHitPMT(photon->GetPMTID());
-            phit.SetHitTime(photon->GetTime());
-            phit.SetHitCount(photon->GetCount());
-            tag = photon->GetProcessTag();
-            phit.SetProcessTag(tag);
-            G4cout << "iphoton= " << i << ", pmt id= " << photon->GetPMTID()
-                   << ", process tag= " << tag << G4endl;
+            tag                        = photon->GetProcessTag();
+            CUPLOG(CupLogger::kLogHit, "iphoton= " << i << ", pmt id= " << photon->GetPMTID()
+                                                   << ", process tag= " << tag);
             if (photon->GetPMTID() < ndetPmt) {
                 if (prePmtInnerId != photon->GetPMTID()) nhitPmtInner++;
                 prePmtInnerId = photon->GetPMTID();
@@ -578,31 +775,58 @@ void CupRootNtuple::SetPhoton() {
             if (tag == 1) n_op_cerenkov++;
             if (tag == 2) n_op_scint++;
             if (tag == 3) n_op_reem++;
-            if (flagFullOutputMode) {
-                phit.SetWaveLength(photon->GetWavelength());
-                photon->GetPosition(xx, yy, zz);
-                phit.SetX(xx);
-                phit.SetY(yy);
-                phit.SetZ(zz);
-                photon->GetMomentum(xx, yy, zz);
-                phit.SetPX(xx);
-                phit.SetPY(yy);
-                phit.SetPZ(zz);
-                photon->GetPolarization(xx, yy, zz);
-                phit.SetPolX(xx);
-                phit.SetPolY(yy);
-                phit.SetPolZ(zz);
+            if (StatusPhoton == kPhotonHitColumns) {
+                PhotonHitColumns &cols = *Cphotonhits;
+                cols.pmt.push_back(photon->GetPMTID());
+                cols.time.push_back(photon->GetTime());
+                cols.count.push_back(photon->GetCount());
+                cols.tag.push_back(tag);
+                if (fPhotonHitColumnsFull) {
+                    cols.wavelength.push_back(photon->GetWavelength());
+                    photon->GetPosition(xx, yy, zz);
+                    cols.x.push_back(xx);
+                    cols.y.push_back(yy);
+                    cols.z.push_back(zz);
+                    photon->GetMomentum(xx, yy, zz);
+                    cols.px.push_back(xx);
+                    cols.py.push_back(yy);
+                    cols.pz.push_back(zz);
+                    photon->GetPolarization(xx, yy, zz);
+                    cols.polx.push_back(xx);
+                    cols.poly.push_back(yy);
+                    cols.polz.push_back(zz);
+                }
+            } else {
+                phit.SetHitPMT(photon->GetPMTID());
+                phit.SetHitTime(photon->GetTime());
+                phit.SetHitCount(photon->GetCount());
+                phit.SetProcessTag(tag);
+                if (flagFullOutputMode) {
+                    phit.SetWaveLength(photon->GetWavelength());
+                    photon->GetPosition(xx, yy, zz);
+                    phit.SetX(xx);
+                    phit.SetY(yy);
+                    phit.SetZ(zz);
+                    photon->GetMomentum(xx, yy, zz);
+                    phit.SetPX(xx);
+                    phit.SetPY(yy);
+                    phit.SetPZ(zz);
+                    photon->GetPolarization(xx, yy, zz);
+                    phit.SetPolX(xx);
+                    phit.SetPolY(yy);
+                    phit.SetPolZ(zz);
+                }
+                new ((*tclhit)[n_photon_hits]) THit(phit);
             }
-            new ((*tclhit)[n_photon_hits]) THit(phit);
             n_photon_hits++;
 
             n_photoelectrons += photon->GetCount(); // for the number of photoelectrons
-
-            if (n_photon_hits >= max_hits_for_ROOT) break;
         }
     }
+    if (n_photon_hits >= max_hits_for_ROOT)
+        CUPLOG(CupLogger::kLogEvent, "photon hits truncated at " << max_hits_for_ROOT);
     if (pmtsd_inner) {
-	G4cout << "nhitPMTInner= " << nhitPmtInner << G4endl;
+        CUPLOG(CupLogger::kLogDetail, "nhitPMTInner= " << nhitPmtInner);
         pmtsd_inner->SetNhitPmts(nhitPmtInner);
         pmtsd_inner->SetNhits(nhitInner);
     }
@@ -614,15 +838,16 @@ void CupRootNtuple::SetPhoton() {
         Cmlcs->SetNhitPmts(nhitPmt);
         Cmlcs->SetNhits(n_photon_hits);
     }
+    Cphotonhits->n = (Int_t)Cphotonhits->pmt.size();
     Cphoton->SetNhitPmts(nhitPmt);
     Cphoton->SetNhits(n_photon_hits);
     Cphoton->SetNcerenkov(n_op_cerenkov);
     Cphoton->SetNscint(n_op_scint);
     Cphoton->SetNreem(n_op_reem);
-    G4cout << "n_photon_hits= " << n_photon_hits << ", n_photoelectrons= " << n_photoelectrons
-           << G4endl;
-    G4cout << "n_op_cerenkov= " << n_op_cerenkov << ", n_op_scint= " << n_op_scint
-           << ", n_op_reem= " << n_op_reem << G4endl;
+    CUPLOG(CupLogger::kLogEvent,
+           "n_photon_hits= " << n_photon_hits << ", n_photoelectrons= " << n_photoelectrons);
+    CUPLOG(CupLogger::kLogDetail, "n_op_cerenkov= " << n_op_cerenkov << ", n_op_scint= "
+                                                    << n_op_scint << ", n_op_reem= " << n_op_reem);
 }
 
 void CupRootNtuple::SetScintillation() {
@@ -639,8 +864,9 @@ void CupRootNtuple::SetScintillation() {
     //  Cscint->SetCentroidX(scint_centroid.x());
     //  Cscint->SetCentroidY(scint_centroid.y());
     //  Cscint->SetCentroidZ(scint_centroid.z());
-    G4cout << "totScintEdep= " << totScintEdep << ", totScintEdepQuenched= " << totScintEdepQuenched
-           << ", totScintPhotons= " << totScintPhotons << G4endl;
+    CUPLOG(CupLogger::kLogDetail, "totScintEdep= " << totScintEdep << ", totScintEdepQuenched= "
+                                                   << totScintEdepQuenched
+                                                   << ", totScintPhotons= " << totScintPhotons);
 }
 
 void CupRootNtuple::SetMuonSD(const G4Event *a_event) {
@@ -705,10 +931,10 @@ void CupRootNtuple::SetTGSD(const G4Event *a_event) {
 
     Int_t DetectorType;                                          // EJ
     DetectorType = CupDetectorConstruction::GetDetectorType();   // EJ
-    G4cout << "Ntuple DetectorType= " << DetectorType << G4endl; // EJ
+    CUPLOG(CupLogger::kLogDetail, "Ntuple DetectorType= " << DetectorType); // EJ
     switch (DetectorType) {
         case kDetector_TestBench: // for TestBench
-            G4cout << "###  TestBench  " << G4endl;
+            CUPLOG(CupLogger::kLogDetail, "###  TestBench  ");
             for (int i = 0; i < nTotCell; i++) {
                 tgcellEdep[i]         = 0.;
                 tgcellEdepQuenched[i] = 0.;
@@ -741,19 +967,181 @@ void CupRootNtuple::SetTGSD(const G4Event *a_event) {
 }
 
 void CupRootNtuple::ClearEvent() {
-    Cprimary->Clear();
-    Ctrack->Clear();
-    Cstep->Clear();
-    Cphoton->Clear();
-    Ctgsd->Clear();
-    if (pmtsd_inner) pmtsd_inner->Clear();
-    if (pmtsd_outer) pmtsd_outer->Clear();
-    if (pmtsd_plasScint) pmtsd_plasScint->Clear();
-    if (Cmlcs) Cmlcs->Clear();
-    Cscint->Clear();
+    ClearEventObjects(GetEventObjects());
 
     nTrack        = 0;
     nStep         = 0;
     volumeName[0] = '\0';
     copyNo        = 99999;
 }
+
+CupRootNtuple::EventObjects CupRootNtuple::GetEventObjects() const {
+    EventObjects ev;
+    ev.evtinfo      = Cevtinfo;
+    ev.primary      = Cprimary;
+    ev.track        = Ctrack;
+    ev.step         = Cstep;
+    ev.photon       = Cphoton;
+    ev.photonhits   = Cphotonhits;
+    ev.tgsd         = Ctgsd;
+    ev.muon         = CMuSD;
+    ev.scint        = Cscint;
+    ev.pmtInner     = pmtsd_inner;
+    ev.pmtOuter     = pmtsd_outer;
+    ev.pmtPlasScint = pmtsd_plasScint;
+    ev.mlcs         = Cmlcs;
+    return ev;
+}
+
+void CupRootNtuple::SetEventObjects(const EventObjects &ev) {
+    Cevtinfo        = ev.evtinfo;
+    Cprimary        = ev.primary;
+    tclvrtx         = Cprimary->GetVertex();
+    Ctrack          = ev.track;
+    tcltr           = Ctrack ? Ctrack->GetTrack() : nullptr;
+    Cstep           = ev.step;
+    tclst           = Cstep ? Cstep->GetStep() : nullptr;
+    Cphoton         = ev.photon;
+    tclhit          = Cphoton->GetHit();
+    Cphotonhits     = ev.photonhits;
+    Ctgsd           = ev.tgsd;
+    tclcell         = Ctgsd->GetCell();
+    CMuSD           = ev.muon;
+    tclmuon         = CMuSD->GetCell();
+    Cscint          = ev.scint;
+    pmtsd_inner     = ev.pmtInner;
+    pmtsd_outer     = ev.pmtOuter;
+    pmtsd_plasScint = ev.pmtPlasScint;
+    Cmlcs           = ev.mlcs;
+}
+
+CupRootNtuple::EventObjects CupRootNtuple::NewEventObjects() const {
+    // the same set of objects CreateTree() and AddPMTSD() made for this tree
+    EventObjects ev;
+    ev.evtinfo      = new EvtInfo();
+    ev.primary      = new Primary();
+    ev.track        = Ctrack ? new EvtTrack() : nullptr;
+    ev.step         = Cstep ? new EvtStep() : nullptr;
+    ev.photon       = new Photon();
+    ev.photonhits   = new PhotonHitColumns();
+    ev.tgsd         = new TGSD();
+    ev.muon         = new MuonSD();
+    ev.scint        = new Scint();
+    ev.pmtInner     = pmtsd_inner ? new PMTSD() : nullptr;
+    ev.pmtOuter     = pmtsd_outer ? new PMTSD() : nullptr;
+    ev.pmtPlasScint = pmtsd_plasScint ? new PMTSD() : nullptr;
+    ev.mlcs         = Cmlcs ? new MLCS() : nullptr;
+    return ev;
+}
+
+void CupRootNtuple::ClearEventObjects(const EventObjects &ev) {
+    ev.primary->Clear();
+    if (ev.track) ev.track->Clear();
+    if (ev.step) ev.step->Clear();
+    ev.photon->Clear();
+    ev.photonhits->Clear();
+    ev.tgsd->Clear();
+    if (ev.pmtInner) ev.pmtInner->Clear();
+    if (ev.pmtOuter) ev.pmtOuter->Clear();
+    if (ev.pmtPlasScint) ev.pmtPlasScint->Clear();
+    if (ev.mlcs) ev.mlcs->Clear();
+    ev.scint->Clear();
+}
+
+void CupRootNtuple::DeleteEventObjects(const EventObjects &ev) {
+    delete ev.evtinfo;
+    delete ev.primary;
+    delete ev.track;
+    delete ev.step;
+    delete ev.photon;
+    delete ev.photonhits;
+    delete ev.tgsd;
+    delete ev.muon;
+    delete ev.scint;
+    delete ev.pmtInner;
+    delete ev.pmtOuter;
+    delete ev.pmtPlasScint;
+    delete ev.mlcs;
+}
+
+void CupRootNtuple::StartWriter() {
+    ROOT::EnableThreadSafety();
+
+    for (int i = 0; i < AsyncQueueDepth; i++)
+        fFreeEvents.push_back(NewEventObjects());
+
+    // the branches read from the writer's set, which the writer thread
+    // switches to each queued event before Fill()
+    fWriterEvent = GetEventObjects();
+    TTree *tree  = fROOTOutputTree;
+    if (tree->GetBranch("EVENTINFO")) tree->SetBranchAddress("EVENTINFO", &fWriterEvent.evtinfo);
+    if (tree->GetBranch("PRIMARY")) tree->SetBranchAddress("PRIMARY", &fWriterEvent.primary);
+    if (tree->GetBranch("TRACK")) tree->SetBranchAddress("TRACK", &fWriterEvent.track);
+    if (tree->GetBranch("STEP")) tree->SetBranchAddress("STEP", &fWriterEvent.step);
+    if (tree->GetBranch("PHOTONHIT")) tree->SetBranchAddress("PHOTONHIT", &fWriterEvent.photon);
+    if (tree->GetBranch("SCINT")) tree->SetBranchAddress("SCINT", &fWriterEvent.scint);
+    if (tree->GetBranch("MuonSD")) tree->SetBranchAddress("MuonSD", &fWriterEvent.muon);
+    if (tree->GetBranch("TGSD")) tree->SetBranchAddress("TGSD", &fWriterEvent.tgsd);
+    if (tree->GetBranch("PMT_Inner")) tree->SetBranchAddress("PMT_Inner", &fWriterEvent.pmtInner);
+    if (tree->GetBranch("PMT_Outer")) tree->SetBranchAddress("PMT_Outer", &fWriterEvent.pmtOuter);
+    if (tree->GetBranch("PMT_PlasScint"))
+        tree->SetBranchAddress("PMT_PlasScint", &fWriterEvent.pmtPlasScint);
+    if (tree->GetBranch("PMT_MLCS")) tree->SetBranchAddress("PMT_MLCS", &fWriterEvent.mlcs);
+
+    fStopWriter   = false;
+    fWriterThread = new std::thread(&CupRootNtuple::WriterLoop, this);
+    G4cout << "CupRootNtuple: asynchronous writer started, queue depth " << AsyncQueueDepth
+           << G4endl;
+}
+
+void CupRootNtuple::StopWriter() {
+    if (fWriterThread == nullptr) return;
+    {
+        std::lock_guard<std::mutex> lock(fQueueMutex);
+        fStopWriter = true;
+    }
+    fQueueCond.notify_all();
+    fWriterThread->join();
+    delete fWriterThread;
+    fWriterThread = nullptr;
+
+    for (size_t i = 0; i < fFreeEvents.size(); i++)
+        DeleteEventObjects(fFreeEvents[i]);
+    fFreeEvents.clear();
+}
+
+void CupRootNtuple::QueueEvent() {
+    std::unique_lock<std::mutex> lock(fQueueMutex);
+    // back-pressure: when every buffered event is still waiting to be
+    // written, the tracking thread waits for the writer
+    fQueueCond.wait(lock, [this] { return !fFreeEvents.empty(); });
+    fFilledEvents.push_back(GetEventObjects());
+    SetEventObjects(fFreeEvents.back());
+    fFreeEvents.pop_back();
+    lock.unlock();
+    fQueueCond.notify_all();
+}
+
+void CupRootNtuple::WriterLoop() {
+    for (;;) {
+        std::unique_lock<std::mutex> lock(fQueueMutex);
+        fQueueCond.wait(lock, [this] { return fStopWriter || !fFilledEvents.empty(); });
+        if (fFilledEvents.empty()) return; // stop requested and queue drained
+        EventObjects ev = fFilledEvents.front();
+        fFilledEvents.pop_front();
+        lock.unlock();
+
+        {
+            std::lock_guard<std::mutex> fileLock(fFileMutex);
+            fWriterEvent = ev;
+            if (StatusPhoton == kPhotonHitColumns) BindPhotonHitColumns(ev.photonhits);
+            fROOTOutputTree->Fill();
+        }
+        ClearEventObjects(ev);
+
+        lock.lock();
+        fFreeEvents.push_back(ev);
+        lock.unlock();
+        fQueueCond.notify_all();
+    }
+}
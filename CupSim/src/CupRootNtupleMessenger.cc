@@ -41,6 +41,8 @@ CupRootNtupleMessenger::CupRootNtupleMessenger(CupRootNtuple *myntuple) : myNtup
     // select Photon
     NtuplePhoton = new G4UIcommand("/ntuple/photon", this);
     NtuplePhoton->SetGuidance("Select on/off for track to be included in the ntuples");
+    NtuplePhoton->SetGuidance("  1: hits as THit objects in PHOTONHIT");
+    NtuplePhoton->SetGuidance("  2: hits as flat columns PHOTONHIT_pmt[PHOTONHIT_n], PHOTONHIT_time, ...");
 
     NtuplePhoton->AvailableForStates(G4State_PreInit);
     NtuplePhoton->SetParameter(new G4UIparameter("photon", 'd', true));
@@ -57,6 +59,15 @@ CupRootNtupleMessenger::CupRootNtupleMessenger(CupRootNtuple *myntuple) : myNtup
         "Select on/off for muon scintillator information to be included in the ntuples");
     NtupleMuon->AvailableForStates(G4State_PreInit);
     NtupleMuon->SetParameter(new G4UIparameter("muon", 's', true));
+
+    // asynchronous writer
+    NtupleAsyncQueueDepth = new G4UIcommand("/ntuple/asyncQueueDepth", this);
+    NtupleAsyncQueueDepth->SetGuidance(
+        "Number of finished events buffered for a separate ROOT writer thread.");
+    NtupleAsyncQueueDepth->SetGuidance(
+        "The event loop waits when the buffer is full; 0 (default) fills the tree inline.");
+    NtupleAsyncQueueDepth->AvailableForStates(G4State_PreInit);
+    NtupleAsyncQueueDepth->SetParameter(new G4UIparameter("depth", 'i', true));
 }
 
 CupRootNtupleMessenger::~CupRootNtupleMessenger() {
@@ -66,6 +77,7 @@ CupRootNtupleMessenger::~CupRootNtupleMessenger() {
     delete NtuplePhoton;
     delete NtupleScint;
     delete NtupleMuon;
+    delete NtupleAsyncQueueDepth;
 
     delete RootNtupleDir;
 }
@@ -152,6 +164,16 @@ void CupRootNtupleMessenger::SetNewValue(G4UIcommand *command, G4String newValue
             return;
         }
         myNtuple->SetNtupleMuon(index);
+    } else if (command == NtupleAsyncQueueDepth) {
+        std::istringstream is((const char *)newValues);
+        int depth = -1;
+        is >> depth;
+        if (is.fail() || depth < 0) {
+            G4cerr << "/ntuple/asyncQueueDepth: invalid value: arguments are \"" << newValues
+                   << "\"" << G4endl;
+            return;
+        }
+        myNtuple->SetNtupleAsyncQueueDepth(depth);
     }
     // invalid command
     else {
@@ -171,6 +193,8 @@ G4String CupRootNtupleMessenger::GetCurrentValue(G4UIcommand *command) {
         return myNtuple->GetNtupleScintStatus();
     } else if (command == NtupleMuon) {
         return myNtuple->GetNtupleMuonStatus();
+    } else if (command == NtupleAsyncQueueDepth) {
+        return G4UIcommand::ConvertToString(myNtuple->GetNtupleAsyncQueueDepth());
     }
     // invalid command
     else {
@@ -1,5 +1,9 @@
 
 #include "CupSim/CupRunAction.hh"
+#include "CupSim/CupCylinderOpticalModel.hh"
+#include "CupSim/CupOpticalMap.hh"
+#include "CupSim/CupOpticalScan.hh"
+#include "CupSim/CupOpticsReplay.hh"
 #include "CupSim/CupRecorderBase.hh"
 
 #include "G4Run.hh"
@@ -7,9 +11,18 @@
 #include "G4VVisManager.hh"
 #include "G4ios.hh"
 
-CupRunAction::CupRunAction(CupRecorderBase *r) : recorder(r) { runIDcounter = 0; }
+CupRunAction::CupRunAction(CupRecorderBase *r, G4bool ownRecorder)
+    : recorder(r), fOwnRecorder(ownRecorder) {
+    runIDcounter = 0;
+    CupOpticalMap::CreateMessenger();
+    CupOpticsReplay::CreateMessenger();
+    CupOpticalScan::CreateMessenger();
+    CupCylinderOpticalModel::CreateMessenger();
+}
 
-CupRunAction::~CupRunAction() {}
+CupRunAction::~CupRunAction() {
+    if (fOwnRecorder) delete recorder;
+}
 
 void CupRunAction::BeginOfRunAction(const G4Run *aRun) {
     ((G4Run *)(aRun))->SetRunID(runIDcounter++);
@@ -26,15 +39,27 @@ void CupRunAction::BeginOfRunAction(const G4Run *aRun) {
         UI->ApplyCommand("/vis~/draw/current");
     }
     // Do any necessary record-keeping.
+    CupOpticalMap::BeginOfRun();
     if (recorder != 0) recorder->RecordBeginOfRun(aRun);
+    fTimer.Start();
 }
 
 void CupRunAction::EndOfRunAction(const G4Run *aRun) {
+    fTimer.Stop();
+    G4int nEvents = aRun->GetNumberOfEvent();
+    G4cout << "### Run " << aRun->GetRunID() << " end: " << nEvents << " events, "
+           << fTimer.GetRealElapsed() << " s real, " << fTimer.GetUserElapsed() << " s user";
+    if (nEvents > 0) G4cout << ", " << 1000. * fTimer.GetRealElapsed() / nEvents << " ms/event";
+    G4cout << G4endl;
+
     G4VVisManager *pVVisManager = G4VVisManager::GetConcreteInstance();
 
     if (pVVisManager) {
         G4UImanager::GetUIpointer()->ApplyCommand("/vis/show/view");
     }
     // Do any necessary record-keeping.
+    CupOpticalMap::EndOfRun();
+    CupOpticsReplay::EndOfRun();
+    CupCylinderOpticalModel::EndOfRun();
     if (recorder != 0) recorder->RecordEndOfRun(aRun);
 }
@@ -1,5 +1,6 @@
 
 #include "G4EmProcessSubType.hh"
+#include "G4FastSimulationManagerProcess.hh"
 #include "G4ParticleTypes.hh"
 #include "G4PhysicalConstants.hh"
 #include "G4SystemOfUnits.hh"
@@ -9,8 +10,16 @@
 #include "G4ios.hh"
 #include "globals.hh"
 
+#include "CupSim/CupCerenkov.hh"
+#include "CupSim/CupOpAttenuation.hh"
+#include "CupSim/CupOpticalMap.hh"
+#include "CupSim/CupOpticsReplay.hh"
+#include "CupSim/CupPMTOpticalModel.hh"
+#include "CupSim/CupStackingAction.hh"
 #include "CupSim/CupScintillation.hh"
 
+#include "CLHEP/Random/RandBinomial.h"
+
 /////////////////////////
 // Class Implementation
 /////////////////////////
@@ -24,6 +33,12 @@
 G4UIdirectory *CupScintillation::CupScintDir = 0;
 // universal on/off flag
 G4bool CupScintillation::doScintillation = true;
+// photons emitted per step at most, the rest in later zero-length steps
+G4int CupScintillation::maxPhotonsPerStep = 0;
+// photons per optical track (also used by CupCerenkov)
+G4int CupScintillation::photonWeight = 1;
+// photons culled at birth by the highest photocathode efficiency
+G4bool CupScintillation::qePreCull = false;
 // energy deposition
 #if G4VERSION_NUMBER >= 1000
 G4ThreadLocal G4double CupScintillation::totEdep          = 0.0;
@@ -37,6 +52,16 @@ G4int CupScintillation::nScintPhotons       = 0;
 
 // EJ: end
 
+G4ThreadLocal std::vector<CupScintillation::ScintMaterial> *CupScintillation::fgScintMaterials =
+    NULL;
+G4ThreadLocal G4int CupScintillation::fgScintMaterialsVersion              = 0;
+G4ThreadLocal const G4ParticleDefinition *CupScintillation::fgLastParticle = NULL;
+G4ThreadLocal G4int CupScintillation::fgLastParticleClass                  = 0;
+G4ThreadLocal const G4VProcess *CupScintillation::fgLastCreator            = NULL;
+G4ThreadLocal G4bool CupScintillation::fgLastCreatorCulled                 = false;
+G4ThreadLocal const G4Step *CupScintillation::fgReplayStep                 = NULL;
+G4ThreadLocal G4double CupScintillation::fgReplayVisibleEnergy             = 0.;
+
 /////////////////
 // Constructors
 /////////////////
@@ -53,8 +78,14 @@ CupScintillation::CupScintillation(const G4String &processName, G4ProcessType ty
 
     scintillationByParticleType = false;
 
+    fPhotonBudget = 0;
+
+    // the photon tracks carry the weight of their bunch, not the parent's
+    aParticleChange.SetSecondaryWeightByProcess(true);
+
     theFastIntegralTable = NULL;
     theSlowIntegralTable = NULL;
+    fTablesVersion       = 0;
 
     if (verboseLevel > 0) {
         G4cout << GetProcessName() << " is created " << G4endl;
@@ -78,6 +109,31 @@ CupScintillation::CupScintillation(const G4String &processName, G4ProcessType ty
         cmd = new G4UIcommand("/cupscint/verbose", this);
         cmd->SetGuidance("Set verbose level");
         cmd->SetParameter(new G4UIparameter("level", 'i', false));
+        cmd = new G4UIcommand("/cupscint/maxPhotonsPerStep", this);
+        cmd->SetGuidance("Emit at most this many photons per step (0: no limit, the default).");
+        cmd->SetGuidance("The remaining photons of a step are emitted in further chunks,");
+        cmd->SetGuidance("each after the previous one has been tracked, which bounds the");
+        cmd->SetGuidance("number of optical photons on the stack at a time.  Not with");
+        cmd->SetGuidance("/cupstack/deferOptical, which stacks all of them anyway.");
+        cmd->SetParameter(new G4UIparameter("nPhotons", 'i', false));
+        cmd->GetParameter(0)->SetParameterRange("nPhotons>=0");
+        cmd = new G4UIcommand("/cupscint/photonWeight", this);
+        cmd->SetGuidance("Emit scintillation and Cerenkov photons in bunches of this many");
+        cmd->SetGuidance("photons (1: one track per photon, the default).  Each bunch is");
+        cmd->SetGuidance("one optical track of that weight, which is absorbed, scattered or");
+        cmd->SetGuidance("reflected as a whole; the PMT model converts it to pe photon by");
+        cmd->SetGuidance("photon.  The mean pe count is unchanged but its width grows with");
+        cmd->SetGuidance("the weight; see mac/validate_photon_weight.mac.");
+        cmd->SetParameter(new G4UIparameter("weight", 'i', false));
+        cmd->GetParameter(0)->SetParameterRange("weight>=1");
+        cmd = new G4UIcommand("/cupscint/qePreCull", this);
+        cmd->SetGuidance("Keep scintillation and Cerenkov photons at birth with a probability");
+        cmd->SetGuidance("equal to the highest pe probability of a photon absorbed in a PMT");
+        cmd->SetGuidance("photocathode, and have the PMT optical model divide that probability");
+        cmd->SetGuidance("by the same factor.  The pe statistics are unchanged; photons that");
+        cmd->SetGuidance("could never make a pe are not tracked.  Off by default; see");
+        cmd->SetGuidance("mac/validate_qe_precull.mac.");
+        cmd->SetParameter(new G4UIparameter("flag", 'b', false));
     }
     // EJ: end
 }
@@ -110,6 +166,18 @@ void CupScintillation::SetNewValue(G4UIcommand *command, G4String newValues) {
         doScintillation = false;
     } else if (commandName == "verbose") {
         verboseLevel = strtol((const char *)newValues, NULL, 0);
+    } else if (commandName == "maxPhotonsPerStep") {
+        G4int value = strtol((const char *)newValues, NULL, 0);
+        if (value > 0 && CupStackingAction::GetDeferOptical()) {
+            G4cerr << "/cupscint/maxPhotonsPerStep: not with /cupstack/deferOptical, which "
+                   << "stacks all the photons of an event anyway" << G4endl;
+            return;
+        }
+        maxPhotonsPerStep = value;
+    } else if (commandName == "photonWeight") {
+        photonWeight = std::max(G4int(strtol((const char *)newValues, NULL, 0)), 1);
+    } else if (commandName == "qePreCull") {
+        qePreCull = G4UIcommand::ConvertToBool(newValues);
     } else {
         G4cerr << "No CupScintillation command named " << commandName << G4endl;
     }
@@ -142,32 +210,22 @@ G4VParticleChange *CupScintillation::PostStepDoIt(const G4Track &aTrack, const G
 {
     aParticleChange.Initialize(aTrack);
 
+    if (EmitPendingPhotons(aTrack)) return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
+
     const G4DynamicParticle *aParticle = aTrack.GetDynamicParticle();
     const G4Material *aMaterial        = aTrack.GetMaterial();
 
-    G4StepPoint *pPreStepPoint  = aStep.GetPreStepPoint();
-    G4StepPoint *pPostStepPoint = aStep.GetPostStepPoint();
-
-    G4ThreeVector x0 = pPreStepPoint->GetPosition();
-    G4ThreeVector p0 = aStep.GetDeltaPosition().unit();
-    G4double t0      = pPreStepPoint->GetGlobalTime();
-
     G4double TotalEnergyDeposit = aStep.GetTotalEnergyDeposit();
 
-    G4MaterialPropertiesTable *aMaterialPropertiesTable = aMaterial->GetMaterialPropertiesTable();
-    if (!aMaterialPropertiesTable) return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
+    const ScintMaterial &scintMaterial = GetScintMaterial(aMaterial);
+    if (!scintMaterial.table) return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
 
-    G4MaterialPropertyVector *Fast_Intensity =
-        aMaterialPropertiesTable->GetProperty("FASTCOMPONENT");
-    G4MaterialPropertyVector *Slow_Intensity =
-        aMaterialPropertiesTable->GetProperty("SLOWCOMPONENT");
+    G4MaterialPropertyVector *Fast_Intensity = scintMaterial.fastIntensity;
+    G4MaterialPropertyVector *Slow_Intensity = scintMaterial.slowIntensity;
 
     if (!Fast_Intensity && !Slow_Intensity)
         return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
 
-    G4int nscnt = 1;
-    if (Fast_Intensity && Slow_Intensity) nscnt = 2;
-
     G4double ScintillationYield = 0.;
 
     if (scintillationByParticleType) {
@@ -175,53 +233,14 @@ G4VParticleChange *CupScintillation::PostStepDoIt(const G4Track &aTrack, const G
         // deposited by particle types.
 
         // Get the definition of the current particle
-        G4ParticleDefinition *pDef                   = aParticle->GetDefinition();
-        G4MaterialPropertyVector *Scint_Yield_Vector = NULL;
-
-        // Obtain the G4MaterialPropertyVectory containing the
-        // scintillation light yield as a function of the deposited
-        // energy for the current particle type
-
-        // Protons
-        if (pDef == G4Proton::ProtonDefinition())
-            Scint_Yield_Vector = aMaterialPropertiesTable->GetProperty("PROTONSCINTILLATIONYIELD");
-
-        // Deuterons
-        else if (pDef == G4Deuteron::DeuteronDefinition())
-            Scint_Yield_Vector =
-                aMaterialPropertiesTable->GetProperty("DEUTERONSCINTILLATIONYIELD");
-
-        // Tritons
-        else if (pDef == G4Triton::TritonDefinition())
-            Scint_Yield_Vector = aMaterialPropertiesTable->GetProperty("TRITONSCINTILLATIONYIELD");
-
-        // Alphas
-        else if (pDef == G4Alpha::AlphaDefinition())
-            Scint_Yield_Vector = aMaterialPropertiesTable->GetProperty("ALPHASCINTILLATIONYIELD");
-
-        // Ions (particles derived from G4VIon and G4Ions)
-        // and recoil ions below tracking cut from neutrons after hElastic
-        else if (pDef->GetParticleType() == "nucleus" || pDef == G4Neutron::NeutronDefinition())
-            Scint_Yield_Vector = aMaterialPropertiesTable->GetProperty("IONSCINTILLATIONYIELD");
-
-        // Electrons (must also account for shell-binding energy
-        // attributed to gamma from standard PhotoElectricEffect)
-        else if (pDef == G4Electron::ElectronDefinition() || pDef == G4Gamma::GammaDefinition())
-            Scint_Yield_Vector =
-                aMaterialPropertiesTable->GetProperty("ELECTRONSCINTILLATIONYIELD");
-
-        // Default for particles not enumerated/listed above
-        else
-            Scint_Yield_Vector =
-                aMaterialPropertiesTable->GetProperty("ELECTRONSCINTILLATIONYIELD");
+        G4ParticleDefinition *pDef = aParticle->GetDefinition();
 
-        // If the user has not specified yields for (p,d,t,a,carbon)
-        // then these unspecified particles will default to the
-        // electron's scintillation yield
-        if (!Scint_Yield_Vector) {
-            Scint_Yield_Vector =
-                aMaterialPropertiesTable->GetProperty("ELECTRONSCINTILLATIONYIELD");
-        }
+        // The G4MaterialPropertyVector containing the scintillation light
+        // yield as a function of the deposited energy for the current
+        // particle type; particles without their own entry use the
+        // electron's scintillation yield (see BuildScintMaterials)
+        G4MaterialPropertyVector *Scint_Yield_Vector =
+            scintMaterial.yieldVector[GetScintParticleClass(pDef)];
 
         // Throw an exception if no scintillation yield is found
         if (!Scint_Yield_Vector) {
@@ -254,7 +273,7 @@ G4VParticleChange *CupScintillation::PostStepDoIt(const G4Track &aTrack, const G
         ScintillationYield = Scint_Yield_Vector->Value(TotalEnergyDeposit);
     } else {
         // The default linear scintillation process
-        ScintillationYield = aMaterialPropertiesTable->GetConstProperty("SCINTILLATIONYIELD");
+        ScintillationYield = scintMaterial.scintillationYield;
 
         // Units: [# scintillation photons / MeV]
         ScintillationYield *= YieldFactor;
@@ -271,7 +290,7 @@ G4VParticleChange *CupScintillation::PostStepDoIt(const G4Track &aTrack, const G
         // EJ: end
     }
 
-    G4double ResolutionScale = aMaterialPropertiesTable->GetConstProperty("RESOLUTIONSCALE");
+    G4double ResolutionScale = scintMaterial.resolutionScale;
 
     // Birks law saturation:
 
@@ -282,11 +301,13 @@ G4VParticleChange *CupScintillation::PostStepDoIt(const G4Track &aTrack, const G
     if (scintillationByParticleType)
         MeanNumberOfPhotons = ScintillationYield;
     else if (emSaturation) {
+        if (!GetReplayVisibleEnergy(aStep, TotalEnergyDepositQuenched)) {
 #if G4VERSION_NUMBER <= 1020
-        TotalEnergyDepositQuenched = emSaturation->VisibleEnergyDeposition(&aStep);
+            TotalEnergyDepositQuenched = emSaturation->VisibleEnergyDeposition(&aStep);
 #else
-        TotalEnergyDepositQuenched = emSaturation->VisibleEnergyDepositionAtAStep(&aStep);
+            TotalEnergyDepositQuenched = emSaturation->VisibleEnergyDepositionAtAStep(&aStep);
 #endif
+        }
         MeanNumberOfPhotons = ScintillationYield * TotalEnergyDepositQuenched;
     } else {
         MeanNumberOfPhotons = ScintillationYield * TotalEnergyDeposit;
@@ -316,6 +337,13 @@ G4VParticleChange *CupScintillation::PostStepDoIt(const G4Track &aTrack, const G
     }
     // EJ: end
 
+    // recording the steps for an optics replay: no photons now
+    if (CupOpticsReplay::GetMode() == CupOpticsReplay::kModeRecord) {
+        if (TotalEnergyDeposit > 0.)
+            CupOpticsReplay::GetInstance()->RecordStep(aStep, TotalEnergyDepositQuenched);
+        return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
+    }
+
     if (NumPhotons <= 0) {
         // return unchanged particle and no secondaries
 
@@ -334,15 +362,34 @@ G4VParticleChange *CupScintillation::PostStepDoIt(const G4Track &aTrack, const G
 
     ////////////////////////////////////////////////////////////////
 
-    aParticleChange.SetNumberOfSecondaries(NumPhotons);
+    EmitComponents(aTrack, aStep, scintMaterial, NumPhotons);
 
-    if (fTrackSecondariesFirst) {
-        if (aTrack.GetTrackStatus() == fAlive) aParticleChange.ProposeTrackStatus(fSuspend);
+    if (verboseLevel > 0) {
+        G4cout << "\n Exiting from CupScintillation::DoIt -- NumberOfSecondaries = "
+               << aParticleChange.GetNumberOfSecondaries() << G4endl;
     }
 
-    ////////////////////////////////////////////////////////////////
+    return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
+}
+
+// Scintillation components
+// ------------------------
+//
+
+void CupScintillation::EmitComponents(const G4Track &aTrack, const G4Step &aStep,
+                                      const ScintMaterial &scintMaterial, G4int NumPhotons) {
+    BeginPhotonEmission(aTrack, NumPhotons);
+
+    // the spectra changed by CupOpticalScan
+    if (fTablesVersion != CupOpticalScan::GetPropertyVersion()) BuildThePhysicsTable();
+
+    G4MaterialPropertyVector *Fast_Intensity = scintMaterial.fastIntensity;
+    G4MaterialPropertyVector *Slow_Intensity = scintMaterial.slowIntensity;
 
-    G4int materialIndex = aMaterial->GetIndex();
+    G4int nscnt = 1;
+    if (Fast_Intensity && Slow_Intensity) nscnt = 2;
+
+    G4int materialIndex = aTrack.GetMaterial()->GetIndex();
 
     // Retrieve the Scintillation Integral for this material
     // new G4PhysicsOrderedFreeVector allocated to hold CII's
@@ -351,163 +398,340 @@ G4VParticleChange *CupScintillation::PostStepDoIt(const G4Track &aTrack, const G
 
     for (G4int scnt = 1; scnt <= nscnt; scnt++) {
 
-        G4double ScintillationTime                        = 0. * ns;
-        G4double ScintillationRiseTime                    = 0. * ns;
-        G4PhysicsOrderedFreeVector *ScintillationIntegral = NULL;
+        G4double ScintillationTime                  = 0. * ns;
+        G4double ScintillationRiseTime              = 0. * ns;
+        const SpectrumSampler *ScintillationIntegral = NULL;
 
         if (scnt == 1) {
             if (nscnt == 1) {
                 if (Fast_Intensity) {
-                    ScintillationTime =
-                        aMaterialPropertiesTable->GetConstProperty("FASTTIMECONSTANT");
+                    ScintillationTime = scintMaterial.fastTimeConstant;
                     if (fFiniteRiseTime) {
-                        ScintillationRiseTime =
-                            aMaterialPropertiesTable->GetConstProperty("FASTSCINTILLATIONRISETIME");
+                        ScintillationRiseTime = scintMaterial.fastRiseTime;
                     }
-                    ScintillationIntegral =
-                        (G4PhysicsOrderedFreeVector *)((*theFastIntegralTable)(materialIndex));
+                    ScintillationIntegral = &theFastSamplers[materialIndex];
                 }
                 if (Slow_Intensity) {
-                    ScintillationTime =
-                        aMaterialPropertiesTable->GetConstProperty("SLOWTIMECONSTANT");
+                    ScintillationTime = scintMaterial.slowTimeConstant;
                     if (fFiniteRiseTime) {
-                        ScintillationRiseTime =
-                            aMaterialPropertiesTable->GetConstProperty("SLOWSCINTILLATIONRISETIME");
+                        ScintillationRiseTime = scintMaterial.slowRiseTime;
                     }
-                    ScintillationIntegral =
-                        (G4PhysicsOrderedFreeVector *)((*theSlowIntegralTable)(materialIndex));
+                    ScintillationIntegral = &theSlowSamplers[materialIndex];
                 }
             } else {
-                G4double YieldRatio = aMaterialPropertiesTable->GetConstProperty("YIELDRATIO");
+                G4double YieldRatio = scintMaterial.yieldRatio;
                 if (ExcitationRatio == 1.0) {
                     Num = G4int(std::min(YieldRatio, 1.0) * NumPhotons);
                 } else {
                     Num = G4int(std::min(ExcitationRatio, 1.0) * NumPhotons);
                 }
-                ScintillationTime = aMaterialPropertiesTable->GetConstProperty("FASTTIMECONSTANT");
+                ScintillationTime = scintMaterial.fastTimeConstant;
                 if (fFiniteRiseTime) {
-                    ScintillationRiseTime =
-                        aMaterialPropertiesTable->GetConstProperty("FASTSCINTILLATIONRISETIME");
+                    ScintillationRiseTime = scintMaterial.fastRiseTime;
                 }
-                ScintillationIntegral =
-                    (G4PhysicsOrderedFreeVector *)((*theFastIntegralTable)(materialIndex));
+                ScintillationIntegral = &theFastSamplers[materialIndex];
             }
         } else {
             Num               = NumPhotons - Num;
-            ScintillationTime = aMaterialPropertiesTable->GetConstProperty("SLOWTIMECONSTANT");
+            ScintillationTime = scintMaterial.slowTimeConstant;
             if (fFiniteRiseTime) {
-                ScintillationRiseTime =
-                    aMaterialPropertiesTable->GetConstProperty("SLOWSCINTILLATIONRISETIME");
+                ScintillationRiseTime = scintMaterial.slowRiseTime;
             }
-            ScintillationIntegral =
-                (G4PhysicsOrderedFreeVector *)((*theSlowIntegralTable)(materialIndex));
+            ScintillationIntegral = &theSlowSamplers[materialIndex];
         }
 
         if (!ScintillationIntegral) continue;
 
-        // Max Scintillation Integral
-
-        G4double CIImax = ScintillationIntegral->GetMaxValue();
-
-        for (G4int i = 0; i < Num; i++) {
-
-            // Determine photon energy
-
-            G4double CIIvalue      = G4UniformRand() * CIImax;
-            G4double sampledEnergy = ScintillationIntegral->GetEnergy(CIIvalue);
-
-            if (verboseLevel > 1) {
-                G4cout << "sampledEnergy = " << sampledEnergy << G4endl;
-                G4cout << "CIIvalue =        " << CIIvalue << G4endl;
-            }
-
-            // Generate random photon direction
-
-            G4double cost = 1. - 2. * G4UniformRand();
-            G4double sint = std::sqrt((1. - cost) * (1. + cost));
-
-            G4double phi  = twopi * G4UniformRand();
-            G4double sinp = std::sin(phi);
-            G4double cosp = std::cos(phi);
-
-            G4double px = sint * cosp;
-            G4double py = sint * sinp;
-            G4double pz = cost;
+        EmitPhotons(aTrack, aStep, Num, *ScintillationIntegral, ScintillationTime,
+                    ScintillationRiseTime);
+    }
 
-            // Create photon momentum direction vector
+    EndPhotonEmission(aTrack);
+}
 
-            G4ParticleMomentum photonMomentum(px, py, pz);
+// Photon generation
+// -----------------
+//
 
-            // Determine polarization of new photon
+void CupScintillation::FillPhotonBatch(PhotonBatch &batch, G4int n,
+                                       const SpectrumSampler &spectrum, G4double decayTime,
+                                       G4double riseTime, G4bool alongStep) {
+    // random numbers, one block of n per quantity
+    const G4int kSize = PhotonBatch::kSize;
+    G4double *uEnergy = batch.random;
+    G4double *uCost   = batch.random + 1 * kSize;
+    G4double *uPhi    = batch.random + 2 * kSize;
+    G4double *uPol    = batch.random + 3 * kSize;
+    G4double *uAlong  = batch.random + 4 * kSize;
+    G4double *uDecay  = batch.random + 5 * kSize;
+    G4double *uRise   = batch.random + 6 * kSize;
+    CLHEP::HepRandomEngine *engine = G4Random::getTheEngine();
+    engine->flatArray(n, uEnergy);
+    engine->flatArray(n, uCost);
+    engine->flatArray(n, uPhi);
+    engine->flatArray(n, uPol);
+    if (alongStep) engine->flatArray(n, uAlong);
+    engine->flatArray(n, uDecay);
+    if (riseTime != 0.0) engine->flatArray(n, uRise);
+
+    // photon energy
+    G4double CIImax = spectrum.GetMaxValue();
+    for (G4int i = 0; i < n; i++)
+        batch.energy[i] = spectrum.GetEnergy(uEnergy[i] * CIImax);
+
+    // isotropic direction p, and polarization rotated by a random angle
+    // about p from s = (cost cosp, cost sinp, -sint); p x s = (-sinp, cosp, 0)
+    for (G4int i = 0; i < n; i++) {
+        G4double cost = 1. - 2. * uCost[i];
+        G4double sint = std::sqrt((1. - cost) * (1. + cost));
+        G4double phi  = twopi * uPhi[i];
+        G4double sinp = std::sin(phi);
+        G4double cosp = std::cos(phi);
+        G4double psi  = twopi * uPol[i];
+        G4double sins = std::sin(psi);
+        G4double coss = std::cos(psi);
+
+        batch.px[i]   = sint * cosp;
+        batch.py[i]   = sint * sinp;
+        batch.pz[i]   = cost;
+        batch.polx[i] = coss * cost * cosp - sins * sinp;
+        batch.poly[i] = coss * cost * sinp + sins * cosp;
+        batch.polz[i] = -coss * sint;
+    }
 
-            G4double sx = cost * cosp;
-            G4double sy = cost * sinp;
-            G4double sz = -sint;
+    // emission point along the step
+    for (G4int i = 0; i < n; i++)
+        batch.fraction[i] = alongStep ? uAlong[i] : 1.0;
 
-            G4ThreeVector photonPolarization(sx, sy, sz);
+    // emission time: exponential decay, or the bi-exponential profile as
+    // the sum of two exponential times (see sample_time)
+    if (riseTime == 0.0) {
+        for (G4int i = 0; i < n; i++)
+            batch.delay[i] = -decayTime * std::log(uDecay[i]);
+    } else {
+        G4double tau = riseTime * decayTime / (riseTime + decayTime);
+        for (G4int i = 0; i < n; i++)
+            batch.delay[i] = -decayTime * std::log(uDecay[i]) - tau * std::log(uRise[i]);
+    }
+}
 
-            G4ThreeVector perp = photonMomentum.cross(photonPolarization);
+void CupScintillation::GeneratePhotons(const PhotonOrigin &origin, G4int num,
+                                       const SpectrumSampler &spectrum, G4double decayTime,
+                                       G4double riseTime) {
+    G4ParticleDefinition *op = G4OpticalPhoton::OpticalPhoton();
 
-            phi  = twopi * G4UniformRand();
-            sinp = std::sin(phi);
-            cosp = std::cos(phi);
+    G4int bunchSize = photonWeight;
+    G4int numTracks = (num + bunchSize - 1) / bunchSize;
 
-            photonPolarization = cosp * photonPolarization + sinp * perp;
+    PhotonBatch &batch = fPhotonBatch;
+    for (G4int first = 0; first < numTracks; first += PhotonBatch::kSize) {
+        G4int n = std::min(numTracks - first, G4int(PhotonBatch::kSize));
+        FillPhotonBatch(batch, n, spectrum, decayTime, riseTime, origin.alongStep);
 
-            photonPolarization = photonPolarization.unit();
+        for (G4int i = 0; i < n; i++) {
+            if (verboseLevel > 1) G4cout << "sampledEnergy = " << batch.energy[i] << G4endl;
 
             // Generate a new photon:
 
-            G4DynamicParticle *aScintillationPhoton =
-                new G4DynamicParticle(G4OpticalPhoton::OpticalPhoton(), photonMomentum);
-            aScintillationPhoton->SetPolarization(photonPolarization.x(), photonPolarization.y(),
-                                                  photonPolarization.z());
-
-            aScintillationPhoton->SetKineticEnergy(sampledEnergy);
+            G4ParticleMomentum photonMomentum(batch.px[i], batch.py[i], batch.pz[i]);
+            G4DynamicParticle *aScintillationPhoton = new G4DynamicParticle(op, photonMomentum);
+            aScintillationPhoton->SetPolarization(batch.polx[i], batch.poly[i], batch.polz[i]);
+            aScintillationPhoton->SetKineticEnergy(batch.energy[i]);
 
             // Generate new G4Track object:
 
-            G4double rand;
-
-            if (aParticle->GetDefinition()->GetPDGCharge() != 0) {
-                rand = G4UniformRand();
-            } else {
-                rand = 1.0;
-            }
-
-            G4double delta = rand * aStep.GetStepLength();
             G4double deltaTime =
-                delta / ((pPreStepPoint->GetVelocity() + pPostStepPoint->GetVelocity()) / 2.);
-
-            // emission time distribution
-            if (ScintillationRiseTime == 0.0) {
-                deltaTime = deltaTime - ScintillationTime * std::log(G4UniformRand());
-            } else {
-                deltaTime = deltaTime + sample_time(ScintillationRiseTime, ScintillationTime);
-            }
+                batch.fraction[i] * origin.stepLength / origin.meanVelocity + batch.delay[i];
 
-            G4double aSecondaryTime = t0 + deltaTime;
+            G4double aSecondaryTime = origin.time + deltaTime;
 
-            G4ThreeVector aSecondaryPosition = x0 + rand * aStep.GetDeltaPosition();
+            G4ThreeVector aSecondaryPosition =
+                origin.position + batch.fraction[i] * origin.deltaPosition;
 
             G4Track *aSecondaryTrack =
                 new G4Track(aScintillationPhoton, aSecondaryTime, aSecondaryPosition);
 
-            aSecondaryTrack->SetTouchableHandle(aStep.GetPreStepPoint()->GetTouchableHandle());
+            aSecondaryTrack->SetTouchableHandle(origin.touchable);
             // aSecondaryTrack->SetTouchableHandle((G4VTouchable*)0);
 
-            aSecondaryTrack->SetParentID(aTrack.GetTrackID());
+            aSecondaryTrack->SetParentID(origin.parentID);
+            aSecondaryTrack->SetWeight(origin.weight *
+                                       std::min(bunchSize, num - (first + i) * bunchSize));
 
             aParticleChange.AddSecondary(aSecondaryTrack);
         }
     }
+}
+
+// Chunked emission
+// ----------------
+//
+
+G4bool CupScintillation::EmitPendingPhotons(const G4Track &aTrack) {
+    if (fPendingPhotons.empty()) return false;
+
+    G4int numPending = 0;
+    std::vector<PendingPhotons>::iterator it = fPendingPhotons.begin();
+    while (it != fPendingPhotons.end()) {
+        if (IsPendingFor(*it, aTrack)) {
+            numPending += it->num;
+            ++it;
+        } else if (it->track == &aTrack) {
+            // left over from a track that was killed before emitting them all,
+            // and whose G4Track has been reused
+            it = fPendingPhotons.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (numPending == 0) return false;
+
+    // this is the zero-length step PostStepGetPhysicalInteractionLength asked
+    // for; emit the next chunk, or everything if the track does not go on
+    G4bool alive  = (aTrack.GetTrackStatus() == fAlive);
+    fPhotonBudget = numPending;
+    if (alive && maxPhotonsPerStep > 0) fPhotonBudget = std::min(numPending, maxPhotonsPerStep);
+    aParticleChange.SetNumberOfSecondaries(fPhotonBudget);
+    G4bool more = (fPhotonBudget < numPending);
+
+    it = fPendingPhotons.begin();
+    while (it != fPendingPhotons.end()) {
+        if (!IsPendingFor(*it, aTrack)) {
+            ++it;
+            continue;
+        }
+        G4int n = std::min(it->num, fPhotonBudget);
+        GeneratePhotons(it->origin, n, *it->spectrum, it->decayTime, it->riseTime);
+        fPhotonBudget -= n;
+        it->num -= n;
+        it->stepNumber = aTrack.GetCurrentStepNumber();
+        if (it->num == 0)
+            it = fPendingPhotons.erase(it);
+        else
+            ++it;
+    }
+
+    if (alive && (more || fTrackSecondariesFirst)) aParticleChange.ProposeTrackStatus(fSuspend);
 
     if (verboseLevel > 0) {
-        G4cout << "\n Exiting from CupScintillation::DoIt -- NumberOfSecondaries = "
-               << aParticleChange.GetNumberOfSecondaries() << G4endl;
+        G4cout << "\n Exiting from " << GetProcessName() << "::DoIt -- pending photons emitted = "
+               << aParticleChange.GetNumberOfSecondaries() << ", left = "
+               << numPending - aParticleChange.GetNumberOfSecondaries() << G4endl;
     }
+    return true;
+}
 
-    return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
+void CupScintillation::BeginPhotonEmission(const G4Track &aTrack, G4int numPhotons) {
+    // a track that does not go on emits all its photons now
+    G4bool alive  = (aTrack.GetTrackStatus() == fAlive);
+    fPhotonBudget = numPhotons;
+    if (alive && maxPhotonsPerStep > 0) fPhotonBudget = std::min(numPhotons, maxPhotonsPerStep);
+
+    aParticleChange.SetNumberOfSecondaries(fPhotonBudget);
+}
+
+void CupScintillation::EndPhotonEmission(const G4Track &aTrack) {
+    // nothing to track first if an optical map (/cupmap/) made pe of all the
+    // photons; otherwise there is a photon whenever some are left pending
+    if (aTrack.GetTrackStatus() != fAlive || aParticleChange.GetNumberOfSecondaries() == 0) return;
+    G4bool pending = false;
+    for (size_t i = 0; i < fPendingPhotons.size() && !pending; i++)
+        pending = IsPendingFor(fPendingPhotons[i], aTrack);
+    if (fTrackSecondariesFirst || pending) aParticleChange.ProposeTrackStatus(fSuspend);
+}
+
+G4int CupScintillation::FlushPendingPhotons(const G4Track &aTrack, G4TrackVector *secondaries) {
+    G4int numPending = 0;
+    for (size_t i = 0; i < fPendingPhotons.size(); i++) {
+        if (IsPendingFor(fPendingPhotons[i], aTrack)) numPending += fPendingPhotons[i].num;
+    }
+    if (numPending == 0) return 0;
+
+    // generated into the particle change as in a step, then handed over
+    aParticleChange.Initialize(aTrack);
+    aParticleChange.SetNumberOfSecondaries(numPending);
+    std::vector<PendingPhotons>::iterator it = fPendingPhotons.begin();
+    while (it != fPendingPhotons.end()) {
+        if (IsPendingFor(*it, aTrack)) {
+            GeneratePhotons(it->origin, it->num, *it->spectrum, it->decayTime, it->riseTime);
+            it = fPendingPhotons.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    G4int numTracks = aParticleChange.GetNumberOfSecondaries();
+    for (G4int i = 0; i < numTracks; i++) {
+        G4Track *secondary = aParticleChange.GetSecondary(i);
+        secondary->SetCreatorProcess(this);
+        secondaries->push_back(secondary);
+    }
+    aParticleChange.Clear();
+    return numPending;
+}
+
+void CupScintillation::EmitPhotons(const G4Track &aTrack, const G4Step &aStep, G4int num,
+                                   const SpectrumSampler &spectrum, G4double decayTime,
+                                   G4double riseTime) {
+    G4StepPoint *pPreStepPoint  = aStep.GetPreStepPoint();
+    G4StepPoint *pPostStepPoint = aStep.GetPostStepPoint();
+
+    PhotonOrigin origin;
+    origin.position      = pPreStepPoint->GetPosition();
+    origin.deltaPosition = aStep.GetDeltaPosition();
+    origin.time          = pPreStepPoint->GetGlobalTime();
+    origin.stepLength    = aStep.GetStepLength();
+    origin.meanVelocity  = (pPreStepPoint->GetVelocity() + pPostStepPoint->GetVelocity()) / 2.;
+    origin.alongStep     = (aTrack.GetDefinition()->GetPDGCharge() != 0);
+    origin.touchable     = pPreStepPoint->GetTouchableHandle();
+    origin.parentID      = aTrack.GetTrackID();
+    origin.weight        = aTrack.GetWeight();
+
+    // in a volume with an optical map (/cupmap/load) the photons make pe
+    // directly
+    if (CupOpticalMap::GetMode() == CupOpticalMap::kModeFastSim &&
+        CupOpticalMap::GetInstance()->DetectPhotons(origin, num, spectrum, decayTime, riseTime))
+        return;
+
+    // photons culled at birth are never generated
+    G4double keep = GetPhotonKeepProbability();
+    if (keep < 1.0 && num > 0)
+        num = CLHEP::RandBinomial::shoot(G4Random::getTheEngine(), num, keep);
+
+    G4int n = std::min(num, fPhotonBudget);
+    GeneratePhotons(origin, n, spectrum, decayTime, riseTime);
+    fPhotonBudget -= n;
+    if (n == num) return;
+
+    PendingPhotons pending;
+    pending.track      = &aTrack;
+    pending.trackID    = aTrack.GetTrackID();
+    pending.stepNumber = aTrack.GetCurrentStepNumber();
+    pending.origin     = origin;
+    pending.num        = num - n;
+    pending.spectrum   = &spectrum;
+    pending.decayTime  = decayTime;
+    pending.riseTime   = riseTime;
+    fPendingPhotons.push_back(pending);
+}
+
+G4double CupScintillation::GetPhotonKeepProbability() {
+    if (!qePreCull) return 1.0;
+    G4double maxEfficiency = CupPMTOpticalModel::GetMaxCollectionEfficiency();
+    // no PMT model (yet): nothing would be rescaled, so keep everything
+    if (maxEfficiency <= 0.0 || maxEfficiency >= 1.0) return 1.0;
+    return maxEfficiency;
+}
+
+G4bool CupScintillation::IsCulledAtBirth(const G4VProcess *creator) {
+    if (creator == NULL) return false;
+    // photons come in runs from the same process
+    if (creator == fgLastCreator) return fgLastCreatorCulled;
+    fgLastCreator       = creator;
+    fgLastCreatorCulled = dynamic_cast<const CupScintillation *>(creator) != NULL ||
+                          dynamic_cast<const CupCerenkov *>(creator) != NULL ||
+                          dynamic_cast<const CupOpAttenuation *>(creator) != NULL ||
+                          dynamic_cast<const G4FastSimulationManagerProcess *>(creator) != NULL;
+    return fgLastCreatorCulled;
 }
 
 // BuildThePhysicsTable for the scintillation process
@@ -515,7 +739,26 @@ G4VParticleChange *CupScintillation::PostStepDoIt(const G4Track &aTrack, const G
 //
 
 void CupScintillation::BuildThePhysicsTable() {
-    if (theFastIntegralTable && theSlowIntegralTable) return;
+    // (kept if current: EmitComponents() holds one of them)
+    if (!fgScintMaterials || fgScintMaterials->size() != G4Material::GetNumberOfMaterials() ||
+        fgScintMaterialsVersion != CupOpticalScan::GetPropertyVersion())
+        BuildScintMaterials();
+
+    if (theFastIntegralTable && theSlowIntegralTable &&
+        fTablesVersion == CupOpticalScan::GetPropertyVersion())
+        return;
+    // rebuilt from scratch when CupOpticalScan has changed the spectra
+    if (theFastIntegralTable) {
+        theFastIntegralTable->clearAndDestroy();
+        delete theFastIntegralTable;
+        theFastIntegralTable = NULL;
+    }
+    if (theSlowIntegralTable) {
+        theSlowIntegralTable->clearAndDestroy();
+        delete theSlowIntegralTable;
+        theSlowIntegralTable = NULL;
+    }
+    fTablesVersion = CupOpticalScan::GetPropertyVersion();
 
     const G4MaterialTable *theMaterialTable = G4Material::GetMaterialTable();
     G4int numOfMaterials                    = G4Material::GetNumberOfMaterials();
@@ -643,6 +886,40 @@ void CupScintillation::BuildThePhysicsTable() {
         theFastIntegralTable->insertAt(i, aPhysicsOrderedFreeVector);
         theSlowIntegralTable->insertAt(i, bPhysicsOrderedFreeVector);
     }
+
+    theFastSamplers.assign(numOfMaterials, SpectrumSampler());
+    theSlowSamplers.assign(numOfMaterials, SpectrumSampler());
+    for (G4int i = 0; i < numOfMaterials; i++) {
+        theFastSamplers[i].Build((G4PhysicsOrderedFreeVector *)((*theFastIntegralTable)(i)));
+        theSlowSamplers[i].Build((G4PhysicsOrderedFreeVector *)((*theSlowIntegralTable)(i)));
+    }
+}
+
+void CupScintillation::SpectrumSampler::Build(G4PhysicsOrderedFreeVector *integral) {
+    size_t numberOfNodes = integral->GetVectorLength();
+    fEnergy.resize(numberOfNodes);
+    fValue.resize(numberOfNodes);
+    for (size_t i = 0; i < numberOfNodes; i++) {
+        fEnergy[i] = integral->Energy(i);
+        fValue[i]  = (*integral)[i];
+    }
+    fGuide.clear();
+    fMaxValue   = 0.;
+    fGuideScale = 0.;
+    if (numberOfNodes < 2 || fValue.back() <= fValue.front()) return;
+
+    // fGuide[k]: last bin starting below the integral value k / fGuideScale
+    size_t numberOfGuides = 2 * numberOfNodes;
+    fMaxValue             = fValue.back();
+    fGuideScale           = numberOfGuides / fMaxValue;
+    fGuide.resize(numberOfGuides + 1);
+    size_t bin = 0;
+    for (size_t k = 0; k <= numberOfGuides; k++) {
+        G4double value = k / fGuideScale;
+        while (bin + 2 < numberOfNodes && fValue[bin + 1] < value)
+            ++bin;
+        fGuide[k] = bin;
+    }
 }
 
 // Called by the user to set the scintillation yield as a function
@@ -662,6 +939,80 @@ void CupScintillation::SetScintillationByParticleType(const G4bool scintType) {
 // ---------------
 //
 
+// Resolve the scintillation properties of every material once, so that
+// PostStepDoIt (and the quenching in the sensitive detectors) index an
+// array instead of searching the properties tables on every step.
+
+static G4double ConstPropertyOrZero(G4MaterialPropertiesTable *mpt, const char *key) {
+    return mpt->ConstPropertyExists(key) ? mpt->GetConstProperty(key) : 0.;
+}
+
+// a constant a scintillating material must define; missing, it is fatal here
+// rather than a silent zero on the first step in the material
+static G4double RequiredConstProperty(G4MaterialPropertiesTable *mpt, const G4Material *aMaterial,
+                                      const char *key) {
+    if (!mpt->ConstPropertyExists(key)) {
+        G4ExceptionDescription ed;
+        ed << "\nCupScintillation::BuildScintMaterials(): material " << aMaterial->GetName()
+           << " has FASTCOMPONENT or SLOWCOMPONENT but no " << key << G4endl;
+        G4String comments = "Missing MaterialPropertiesTable entry";
+        G4Exception("CupSim/CupScintillation::BuildScintMaterials", "Scint03", FatalException,
+                    ed, comments);
+        return 0.;
+    }
+    return mpt->GetConstProperty(key);
+}
+
+void CupScintillation::BuildScintMaterials() {
+    static const char *yieldKeys[kNScintParticleClasses] = {
+        "PROTONSCINTILLATIONYIELD", "DEUTERONSCINTILLATIONYIELD", "TRITONSCINTILLATIONYIELD",
+        "ALPHASCINTILLATIONYIELD",  "IONSCINTILLATIONYIELD",      "ELECTRONSCINTILLATIONYIELD"};
+
+    const G4MaterialTable *theMaterialTable = G4Material::GetMaterialTable();
+    size_t numOfMaterials                   = G4Material::GetNumberOfMaterials();
+
+    if (!fgScintMaterials) fgScintMaterials = new std::vector<ScintMaterial>;
+    fgScintMaterials->assign(numOfMaterials, ScintMaterial());
+    fgScintMaterialsVersion = CupOpticalScan::GetPropertyVersion();
+
+    for (size_t i = 0; i < numOfMaterials; i++) {
+        // value-initialized: NULL vectors and zero constants
+        ScintMaterial &sm              = (*fgScintMaterials)[i];
+        G4MaterialPropertiesTable *mpt = (*theMaterialTable)[i]->GetMaterialPropertiesTable();
+        sm.table                       = mpt;
+        if (!mpt) continue;
+
+        sm.fastIntensity = mpt->GetProperty("FASTCOMPONENT");
+        sm.slowIntensity = mpt->GetProperty("SLOWCOMPONENT");
+
+        // unspecified particle types default to the electron's yield
+        G4MaterialPropertyVector *electronYield = mpt->GetProperty(yieldKeys[kScintElectron]);
+        for (G4int j = 0; j < kNScintParticleClasses; j++) {
+            sm.yieldVector[j] = mpt->GetProperty(yieldKeys[j]);
+            if (!sm.yieldVector[j]) sm.yieldVector[j] = electronYield;
+        }
+
+        // only the rise times are optional; the rest of what PostStepDoIt
+        // reads is required of a scintillating material.  SCINTILLATIONYIELD
+        // may be replaced by ELECTRONSCINTILLATIONYIELD, for scintillation by
+        // particle type.
+        sm.fastRiseTime = ConstPropertyOrZero(mpt, "FASTSCINTILLATIONRISETIME");
+        sm.slowRiseTime = ConstPropertyOrZero(mpt, "SLOWSCINTILLATIONRISETIME");
+        if (!sm.fastIntensity && !sm.slowIntensity) continue;
+
+        const G4Material *aMaterial = (*theMaterialTable)[i];
+        sm.resolutionScale          = RequiredConstProperty(mpt, aMaterial, "RESOLUTIONSCALE");
+        if (!electronYield || mpt->ConstPropertyExists("SCINTILLATIONYIELD"))
+            sm.scintillationYield = RequiredConstProperty(mpt, aMaterial, "SCINTILLATIONYIELD");
+        if (sm.fastIntensity)
+            sm.fastTimeConstant = RequiredConstProperty(mpt, aMaterial, "FASTTIMECONSTANT");
+        if (sm.slowIntensity)
+            sm.slowTimeConstant = RequiredConstProperty(mpt, aMaterial, "SLOWTIMECONSTANT");
+        if (sm.fastIntensity && sm.slowIntensity)
+            sm.yieldRatio = RequiredConstProperty(mpt, aMaterial, "YIELDRATIO");
+    }
+}
+
 G4double CupScintillation::GetMeanFreePath(const G4Track &, G4double, G4ForceCondition *condition) {
     *condition = StronglyForced;
 
@@ -672,6 +1023,19 @@ G4double CupScintillation::GetMeanFreePath(const G4Track &, G4double, G4ForceCon
 // ---------------
 //
 
+G4double CupScintillation::PostStepGetPhysicalInteractionLength(const G4Track &aTrack,
+                                                               G4double previousStepSize,
+                                                               G4ForceCondition *condition) {
+    for (size_t i = 0; i < fPendingPhotons.size(); i++) {
+        if (IsPendingFor(fPendingPhotons[i], aTrack)) {
+            *condition = NotForced;
+            return 0.;
+        }
+    }
+    return G4VRestDiscreteProcess::PostStepGetPhysicalInteractionLength(aTrack, previousStepSize,
+                                                                        condition);
+}
+
 G4double CupScintillation::GetMeanLifeTime(const G4Track &, G4ForceCondition *condition) {
     *condition = Forced;
 
@@ -680,20 +1044,10 @@ G4double CupScintillation::GetMeanLifeTime(const G4Track &, G4ForceCondition *co
 
 G4double CupScintillation::sample_time(G4double tau1, G4double tau2) {
     // tau1: rise time and tau2: decay time
-
-    while (1) {
-        // two random numbers
-        G4double ran1 = G4UniformRand();
-        G4double ran2 = G4UniformRand();
-        //
-        // exponential distribution as envelope function: very efficient
-        //
-        G4double d = (tau1 + tau2) / tau2;
-        // make sure the envelope function is
-        // always larger than the bi-exponential
-        G4double t  = -1.0 * tau2 * std::log(1 - ran1);
-        G4double gg = d * single_exp(t, tau2);
-        if (ran2 <= bi_exp(t, tau1, tau2) / gg) return t;
-    }
-    return -1.0;
+    //
+    // bi_exp(t) is proportional to exp(-t/tau2) - exp(-t/tau) with
+    // 1/tau = 1/tau1 + 1/tau2, the density of the sum of two exponential
+    // times of means tau2 and tau, so it is sampled directly (no rejection)
+    G4double tau = tau1 * tau2 / (tau1 + tau2);
+    return -tau2 * std::log(G4UniformRand()) - tau * std::log(G4UniformRand());
 }
@@ -0,0 +1,316 @@
+#include "CupSim/CupStackingAction.hh"
+#include "CupSim/CupLogger.hh"
+#include "CupSim/CupOpticsReplay.hh"
+#include "CupSim/CupScintHit.hh"
+#include "CupSim/CupScintillation.hh"
+
+#include "G4AutoLock.hh"
+#include "G4Event.hh"
+#include "G4EventManager.hh"
+#include "G4Geantino.hh"
+#include "G4HCofThisEvent.hh"
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4Navigator.hh"
+#include "G4OpticalPhoton.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4Region.hh"
+#include "G4StackManager.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4Threading.hh"
+#include "G4Track.hh"
+#include "G4TransportationManager.hh"
+#include "G4UIcmdWithABool.hh"
+#include "G4UIcmdWithADoubleAndUnit.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcmdWithoutParameter.hh"
+#include "G4UIdirectory.hh"
+#include "G4VPhysicalVolume.hh"
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+G4Mutex CupStackingActionMutex = G4MUTEX_INITIALIZER;
+} // namespace
+
+CupStackingAction::Policies CupStackingAction::fgPolicies = {
+    0., 0., 0., 0., std::vector<G4String>(), std::vector<G4String>(), false, 0.};
+
+G4int CupStackingAction::fgPoliciesVersion                   = 0;
+CupStackingAction::Messenger *CupStackingAction::fgMessenger = nullptr;
+
+CupStackingAction::CupStackingAction()
+    : fStage(0), fPolicies(), fPoliciesVersion(-1), fNavigator(nullptr) {
+    CreateMessenger();
+}
+
+CupStackingAction::~CupStackingAction() { delete fNavigator; }
+
+void CupStackingAction::CreateMessenger() {
+    // the policies are process wide, so workers don't need their own commands
+    if (fgMessenger != nullptr || !G4Threading::IsMasterThread()) return;
+    fgMessenger = new Messenger();
+}
+
+G4bool CupStackingAction::GetDeferOptical() {
+    G4AutoLock lock(&CupStackingActionMutex);
+    return fgPolicies.deferOptical;
+}
+
+G4ClassificationOfNewTrack CupStackingAction::ClassifyNewTrack(const G4Track *aTrack) {
+    // in an optics replay the geantino of the event brings the photons of
+    // the recorded steps, a stage at a time
+    G4bool replay = (CupOpticsReplay::GetMode() == CupOpticsReplay::kModeReplay);
+    if (replay && aTrack->GetDefinition() == G4Geantino::Geantino())
+        return CupOpticsReplay::GetInstance()->StackPhotons(aTrack) ? fWaiting : fKill;
+
+    if (aTrack->GetDefinition() != G4OpticalPhoton::OpticalPhotonDefinition()) return fUrgent;
+    if (IsKilled(aTrack)) return fKill;
+    // a replay has no deposits to decide on
+    return (fPolicies.deferOptical && fStage == 0 && !replay) ? fWaiting : fUrgent;
+}
+
+void CupStackingAction::NewStage() {
+    // the geantino of an optics replay, for its next photons
+    if (CupOpticsReplay::GetMode() == CupOpticsReplay::kModeReplay) {
+        stackManager->ReClassify();
+        return;
+    }
+
+    // only the deferred optical photons are waiting
+    if (!fPolicies.deferOptical || fStage != 0) return;
+    fStage = 1;
+
+    G4double edep = 0.;
+    if (!GetTargetEdep(edep)) {
+        static G4ThreadLocal G4bool warned = false;
+        if (!warned) {
+            G4cout << "CupStackingAction: no CupScintSD hits, deferred photons are all tracked"
+                   << G4endl;
+            warned = true;
+        }
+    } else if (edep < fPolicies.minTargetEdep) {
+        CUPLOG(CupLogger::kLogDetail, "CupStackingAction: target edep "
+                                          << edep / keV << " keV, optical photons dropped");
+        stackManager->ClearWaitingStack();
+        return;
+    }
+    stackManager->ReClassify();
+}
+
+void CupStackingAction::PrepareNewEvent() {
+    fStage = 0;
+    UpdatePolicies();
+}
+
+void CupStackingAction::UpdatePolicies() {
+    G4AutoLock lock(&CupStackingActionMutex);
+    if (fPoliciesVersion == fgPoliciesVersion) return;
+    G4bool killListChanged = (fPolicies.killRegions != fgPolicies.killRegions ||
+                              fPolicies.killVolumes != fgPolicies.killVolumes);
+    fPolicies              = fgPolicies;
+    fPoliciesVersion       = fgPoliciesVersion;
+    lock.unlock();
+    if (killListChanged) UpdateKillVolumes();
+}
+
+G4bool CupStackingAction::GetTargetEdep(G4double &edep) {
+    const G4Event *event = G4EventManager::GetEventManager()->GetConstCurrentEvent();
+    G4HCofThisEvent *HCE = event ? event->GetHCofThisEvent() : nullptr;
+    G4bool found         = false;
+    edep                 = 0.;
+    if (!HCE) return found;
+    for (G4int i = 0; i < HCE->GetNumberOfCollections(); i++) {
+        CupScintHitsCollection *hits = dynamic_cast<CupScintHitsCollection *>(HCE->GetHC(i));
+        if (!hits) continue;
+        found = true;
+        for (size_t j = 0; j < hits->GetSize(); j++)
+            edep += (*hits)[j]->GetEdep();
+    }
+    return found;
+}
+
+G4bool CupStackingAction::IsKilled(const G4Track *aTrack) {
+    const Policies &policies = fPolicies;
+    if (policies.maxWavelength > policies.minWavelength) {
+        G4double wavelength = h_Planck * c_light / aTrack->GetTotalEnergy();
+        if (wavelength < policies.minWavelength || wavelength > policies.maxWavelength)
+            return true;
+    }
+    if (policies.maxTime > policies.minTime) {
+        G4double time = aTrack->GetGlobalTime();
+        if (time < policies.minTime || time > policies.maxTime) return true;
+    }
+    if (!fKillVolumes.empty() && fKillVolumes.count(GetStartVolume(aTrack))) return true;
+    return false;
+}
+
+const G4LogicalVolume *CupStackingAction::GetStartVolume(const G4Track *aTrack) {
+    // the touchable a process gives its secondaries is the pre-step point's,
+    // while photons are made all along the step; so the volume is located
+    // from the vertex, which is the track's position until it is tracked.
+    // Consecutive photons are close, so the search starts from the last.
+    if (!fNavigator) {
+        fNavigator = new G4Navigator();
+        fNavigator->SetWorldVolume(G4TransportationManager::GetTransportationManager()
+                                       ->GetNavigatorForTracking()
+                                       ->GetWorldVolume());
+    }
+    const G4VPhysicalVolume *volume =
+        fNavigator->LocateGlobalPointAndSetup(aTrack->GetPosition(), nullptr, true, true);
+    return volume ? volume->GetLogicalVolume() : nullptr;
+}
+
+void CupStackingAction::UpdateKillVolumes() {
+    fKillVolumes.clear();
+    G4LogicalVolumeStore *store = G4LogicalVolumeStore::GetInstance();
+    for (size_t i = 0; i < store->size(); i++) {
+        const G4LogicalVolume *lv = (*store)[i];
+        const G4Region *region    = lv->GetRegion();
+        const std::vector<G4String> &regions = fPolicies.killRegions;
+        const std::vector<G4String> &volumes = fPolicies.killVolumes;
+        if (std::find(volumes.begin(), volumes.end(), lv->GetName()) != volumes.end() ||
+            (region &&
+             std::find(regions.begin(), regions.end(), region->GetName()) != regions.end()))
+            fKillVolumes.insert(lv);
+    }
+}
+
+// Messenger ///////////////////////////////////////////////////////////////
+CupStackingAction::Messenger::Messenger() {
+    fStackDir = new G4UIdirectory("/cupstack/");
+    fStackDir->SetGuidance("Early kill of optical photons before tracking.");
+
+    fWavelengthCmd = new G4UIcommand("/cupstack/wavelengthBand", this);
+    fWavelengthCmd->SetGuidance("Kill optical photons born outside [min, max] in wavelength.");
+    fWavelengthCmd->SetGuidance("max <= min (default 0 0) disables the cut.");
+    fWavelengthCmd->SetParameter(new G4UIparameter("min", 'd', false));
+    fWavelengthCmd->SetParameter(new G4UIparameter("max", 'd', false));
+    G4UIparameter *unit = new G4UIparameter("unit", 's', true);
+    unit->SetDefaultValue("nm");
+    fWavelengthCmd->SetParameter(unit);
+    fWavelengthCmd->SetToBeBroadcasted(false);
+    fWavelengthCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+    fTimeCmd = new G4UIcommand("/cupstack/timeWindow", this);
+    fTimeCmd->SetGuidance("Kill optical photons born outside [tmin, tmax] in global time.");
+    fTimeCmd->SetGuidance("tmax <= tmin (default 0 0) disables the cut.");
+    fTimeCmd->SetParameter(new G4UIparameter("tmin", 'd', false));
+    fTimeCmd->SetParameter(new G4UIparameter("tmax", 'd', false));
+    unit = new G4UIparameter("unit", 's', true);
+    unit->SetDefaultValue("ns");
+    fTimeCmd->SetParameter(unit);
+    fTimeCmd->SetToBeBroadcasted(false);
+    fTimeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+    fKillRegionCmd = new G4UIcmdWithAString("/cupstack/killInRegion", this);
+    fKillRegionCmd->SetGuidance("Kill optical photons born in any volume of this G4Region.");
+    fKillRegionCmd->SetParameterName("region", false);
+    fKillRegionCmd->SetToBeBroadcasted(false);
+    fKillRegionCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+    fKillVolumeCmd = new G4UIcmdWithAString("/cupstack/killInVolume", this);
+    fKillVolumeCmd->SetGuidance("Kill optical photons born in this logical volume");
+    fKillVolumeCmd->SetGuidance("(not in its daughters), e.g. logiRock.");
+    fKillVolumeCmd->SetParameterName("volume", false);
+    fKillVolumeCmd->SetToBeBroadcasted(false);
+    fKillVolumeCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+    fClearKillCmd = new G4UIcmdWithoutParameter("/cupstack/clearKillList", this);
+    fClearKillCmd->SetGuidance("Forget the killInRegion and killInVolume lists.");
+    fClearKillCmd->SetToBeBroadcasted(false);
+    fClearKillCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+    fDeferCmd = new G4UIcmdWithABool("/cupstack/deferOptical", this);
+    fDeferCmd->SetGuidance("Track optical photons only after all other tracks of the event,");
+    fDeferCmd->SetGuidance("and only if the target deposit reaches /cupstack/minTargetEdep.");
+    fDeferCmd->SetGuidance("Not with /cupscint/maxPhotonsPerStep, whose chunks it would stack");
+    fDeferCmd->SetGuidance("all at once.");
+    fDeferCmd->SetParameterName("defer", true);
+    fDeferCmd->SetDefaultValue(true);
+    fDeferCmd->SetToBeBroadcasted(false);
+    fDeferCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+    fMinEdepCmd = new G4UIcmdWithADoubleAndUnit("/cupstack/minTargetEdep", this);
+    fMinEdepCmd->SetGuidance("With deferOptical, drop the optical photons of events whose");
+    fMinEdepCmd->SetGuidance("energy deposit in the CupScintSD targets is below this value.");
+    fMinEdepCmd->SetParameterName("edep", false);
+    fMinEdepCmd->SetRange("edep>=0");
+    fMinEdepCmd->SetDefaultUnit("keV");
+    fMinEdepCmd->SetToBeBroadcasted(false);
+    fMinEdepCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+}
+
+CupStackingAction::Messenger::~Messenger() {
+    delete fWavelengthCmd;
+    delete fTimeCmd;
+    delete fKillRegionCmd;
+    delete fKillVolumeCmd;
+    delete fClearKillCmd;
+    delete fDeferCmd;
+    delete fMinEdepCmd;
+    delete fStackDir;
+}
+
+void CupStackingAction::Messenger::SetNewValue(G4UIcommand *command, G4String newValue) {
+    G4bool defer = (command == fDeferCmd) ? fDeferCmd->GetNewBoolValue(newValue) : false;
+    if (defer && CupScintillation::GetMaxPhotonsPerStep() > 0) {
+        G4cerr << "/cupstack/deferOptical: not with /cupscint/maxPhotonsPerStep, whose "
+               << "chunks would all be stacked at once" << G4endl;
+        return;
+    }
+
+    G4AutoLock lock(&CupStackingActionMutex);
+    Policies &policies = fgPolicies;
+    if (command == fWavelengthCmd || command == fTimeCmd) {
+        std::istringstream iss(newValue.c_str());
+        G4double low = 0., high = 0.;
+        G4String unit;
+        iss >> low >> high >> unit;
+        G4double scale = G4UIcommand::ValueOf(unit);
+        if (command == fWavelengthCmd) {
+            policies.minWavelength = low * scale;
+            policies.maxWavelength = high * scale;
+        } else {
+            policies.minTime = low * scale;
+            policies.maxTime = high * scale;
+        }
+    } else if (command == fKillRegionCmd) {
+        policies.killRegions.push_back(newValue);
+    } else if (command == fKillVolumeCmd) {
+        policies.killVolumes.push_back(newValue);
+    } else if (command == fClearKillCmd) {
+        policies.killRegions.clear();
+        policies.killVolumes.clear();
+    } else if (command == fDeferCmd) {
+        policies.deferOptical = defer;
+    } else if (command == fMinEdepCmd) {
+        policies.minTargetEdep = fMinEdepCmd->GetNewDoubleValue(newValue);
+    }
+    fgPoliciesVersion++;
+}
+
+G4String CupStackingAction::Messenger::GetCurrentValue(G4UIcommand *command) {
+    G4AutoLock lock(&CupStackingActionMutex);
+    const Policies &policies = fgPolicies;
+    std::ostringstream os;
+    if (command == fWavelengthCmd) {
+        os << policies.minWavelength / nm << " " << policies.maxWavelength / nm << " nm";
+    } else if (command == fTimeCmd) {
+        os << policies.minTime / ns << " " << policies.maxTime / ns << " ns";
+    } else if (command == fKillRegionCmd) {
+        for (size_t i = 0; i < policies.killRegions.size(); i++)
+            os << (i ? " " : "") << policies.killRegions[i];
+    } else if (command == fKillVolumeCmd) {
+        for (size_t i = 0; i < policies.killVolumes.size(); i++)
+            os << (i ? " " : "") << policies.killVolumes[i];
+    } else if (command == fDeferCmd) {
+        return fDeferCmd->ConvertToString(policies.deferOptical);
+    } else if (command == fMinEdepCmd) {
+        return fMinEdepCmd->ConvertToString(policies.minTargetEdep, "keV");
+    } else {
+        return G4String("invalid CupStackingAction \"get\" command");
+    }
+    return G4String(os.str());
+}
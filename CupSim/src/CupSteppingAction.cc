@@ -5,6 +5,8 @@
 #include "CupSim/CupRecorderBase.hh" // EJ
 #include "CupSim/CupScintillation.hh"
 #include "G4OpticalPhoton.hh"
+#include "G4ProcessManager.hh"
+#include "G4ProcessVector.hh"
 #include "G4Step.hh"
 #include "G4StepPoint.hh"
 #include "G4SteppingManager.hh"
@@ -16,14 +18,23 @@
 #include "globals.hh"
 
 CupSteppingAction::CupSteppingAction(CupRecorderBase *r, CupPrimaryGeneratorAction *p)
-    : recorder(r), myGenerator(p) {
+    : recorder(r), myGenerator(p), fLastParticle(nullptr), fScintillation(nullptr),
+      fZeroStepsInARow(0) {
+#ifdef G4DEBUG
+    fDebugZeroStepsInARow = 0;
+#endif
     if (myGenerator == nullptr) {
         G4Exception(" ", " ", JustWarning,
                     "CupSim/CupSteppingAction:: no CupPrimaryGeneratorAction instance.");
     }
 }
 
-CupSteppingAction::CupSteppingAction(CupRecorderBase *r) : recorder(r), myGenerator(nullptr) {
+CupSteppingAction::CupSteppingAction(CupRecorderBase *r)
+    : recorder(r), myGenerator(nullptr), fLastParticle(nullptr), fScintillation(nullptr),
+      fZeroStepsInARow(0) {
+#ifdef G4DEBUG
+    fDebugZeroStepsInARow = 0;
+#endif
     myGenerator = CupPrimaryGeneratorAction::GetTheCupPrimaryGeneratorAction();
     if (myGenerator == nullptr) {
         G4Exception(" ", " ", JustWarning,
@@ -32,6 +43,7 @@ CupSteppingAction::CupSteppingAction(CupRecorderBase *r) : recorder(r), myGenera
 }
 
 #ifdef G4DEBUG
+#include "G4AutoLock.hh"
 #include "G4Timer.hh"
 #include "map"
 
@@ -51,10 +63,13 @@ struct CupSteppingAction_time_s {
 typedef std::map<G4String, CupSteppingAction_time_s> CupSteppingAction_time_map;
 typedef std::map<G4String, CupSteppingAction_time_s>::iterator CupSteppingAction_time_map_iterator;
 
+// shared by the threads, under the lock
 CupSteppingAction_time_map CupSteppingAction_times;
+G4Mutex CupSteppingAction_timesMutex     = G4MUTEX_INITIALIZER;
 G4double CupSteppingAction_internal_time = 0.0;
 
 int CupSteppingAction_dump_times(void) {
+    G4AutoLock lock(&CupSteppingAction_timesMutex);
     for (CupSteppingAction_time_map_iterator i = CupSteppingAction_times.begin();
          i != CupSteppingAction_times.end(); i++) {
         G4cout << i->first << ' ' << i->second.sumtime << ' ' << i->second.stepcount << G4endl;
@@ -126,8 +141,8 @@ int CupSteppingAction_dump_IlluminationMap(void) {
     return 1;
 }
 
-G4double CupSteppingAction_totEdep    = 0.0;
-G4int CupSteppingAction_MaxStepNumber = 100000;
+G4ThreadLocal G4double CupSteppingAction_totEdep = 0.0;
+G4int CupSteppingAction_MaxStepNumber            = 100000;
 #endif /* G4DEBUG */
 
 void CupSteppingAction::UserSteppingAction(const G4Step *aStep) {
@@ -140,12 +155,9 @@ void CupSteppingAction::UserSteppingAction(const G4Step *aStep) {
         recorder->RecordStep(aStep); // EJ
 
 #ifdef G4DEBUG
-    static G4Timer timer;
-    static G4int num_zero_steps_in_a_row = 0;
-
-    timer.Stop();
-    G4double dut = timer.GetUserElapsed();
-    timer.Start();
+    fTimer.Stop();
+    G4double dut = fTimer.GetUserElapsed();
+    fTimer.Start();
 
     // check for NULL world volume
     if (track->GetVolume() == NULL) {
@@ -174,23 +186,24 @@ void CupSteppingAction::UserSteppingAction(const G4Step *aStep) {
         track->SetTrackStatus(fStopAndKill);
     }
 
-    // check for too many zero steps in a row
-    if (aStep->GetStepLength() <= 0.0 && track->GetCurrentStepNumber() > 1) {
-        ++num_zero_steps_in_a_row;
-        if (num_zero_steps_in_a_row >= 4) {
+    // check for too many zero steps in a row (but chunked emission, see below)
+    if (aStep->GetStepLength() <= 0.0 && track->GetCurrentStepNumber() > 1 &&
+        aStep->GetPostStepPoint()->GetProcessDefinedStep() !=
+            GetScintillation(track->GetDefinition())) {
+        ++fDebugZeroStepsInARow;
+        if (fDebugZeroStepsInARow >= 4) {
             G4cerr << "CupSim/CupSteppingAction: Too many zero steps for this track, terminating!"
                    << G4endl;
             track->SetTrackStatus(fStopAndKill);
-            num_zero_steps_in_a_row = 0;
+            fDebugZeroStepsInARow = 0;
         }
     } else
-        num_zero_steps_in_a_row = 0;
+        fDebugZeroStepsInARow = 0;
 
     // check total energy deposit
     CupSteppingAction_totEdep += aStep->GetTotalEnergyDeposit();
 
     // debugging (timing) info
-    static G4String lastParticleName;
     if (dut > 0.0) {
         G4String key;
         G4String particleName         = track->GetDefinition()->GetParticleName();
@@ -199,12 +212,13 @@ void CupSteppingAction::UserSteppingAction(const G4Step *aStep) {
         if (preProcess) key += preProcess->GetProcessName();
         key += "_";
         if (postProcess) key += postProcess->GetProcessName();
+        G4AutoLock lock(&CupSteppingAction_timesMutex);
         CupSteppingAction_times[key].sum(dut);
         CupSteppingAction_times[particleName].sum(dut);
         key += "_" + particleName;
-        if (particleName != lastParticleName) {
-            key += "_" + lastParticleName;
-            lastParticleName = particleName;
+        if (particleName != fLastParticleName) {
+            key += "_" + fLastParticleName;
+            fLastParticleName = particleName;
         }
         CupSteppingAction_times[key].sum(dut);
     }
@@ -239,18 +253,26 @@ void CupSteppingAction::UserSteppingAction(const G4Step *aStep) {
         track->SetTrackStatus(fStopAndKill);
     }
 
-    // check for too many zero steps in a row
-    static G4int num_zero_steps_in_a_row = 0;
-    if (aStep->GetStepLength() <= 0.0 && track->GetCurrentStepNumber() > 1) {
-        ++num_zero_steps_in_a_row;
-        if (num_zero_steps_in_a_row >= 4) {
+    // check for too many zero steps in a row; the zero steps in which
+    // CupScintillation emits the photons of an earlier step in chunks
+    // (/cupscint/maxPhotonsPerStep) are not stuck tracks
+    CupScintillation *scintillation = GetScintillation(track->GetDefinition());
+    if (aStep->GetStepLength() <= 0.0 && track->GetCurrentStepNumber() > 1 &&
+        (scintillation == nullptr ||
+         aStep->GetPostStepPoint()->GetProcessDefinedStep() != scintillation)) {
+        ++fZeroStepsInARow;
+        if (fZeroStepsInARow >= 4) {
             G4cerr << "CupSim/CupSteppingAction: Too many zero steps for this track, terminating!"
                    << G4endl;
             track->SetTrackStatus(fStopAndKill);
-            num_zero_steps_in_a_row = 0;
+            fZeroStepsInARow = 0;
         }
     } else
-        num_zero_steps_in_a_row = 0;
+        fZeroStepsInARow = 0;
+
+    // photons the track still had to emit in chunks are not lost with it
+    if (scintillation != nullptr && track->GetTrackStatus() == fStopAndKill)
+        scintillation->FlushPendingPhotons(*track, fpSteppingManager->GetfSecondary());
 
         /*
         // if end step time since start of event is past event window, kill all tracks
@@ -348,3 +370,15 @@ void CupSteppingAction::UserSteppingAction(const G4Step *aStep) {
     timer.Start();
 #endif
 }
+
+CupScintillation *CupSteppingAction::GetScintillation(const G4ParticleDefinition *particle) {
+    if (particle == fLastParticle) return fScintillation;
+    fLastParticle  = particle;
+    fScintillation = nullptr;
+    G4ProcessManager *pmanager = particle->GetProcessManager();
+    if (pmanager == nullptr) return fScintillation;
+    G4ProcessVector *processes = pmanager->GetProcessList();
+    for (G4int i = 0; i < processes->entries() && fScintillation == nullptr; i++)
+        fScintillation = dynamic_cast<CupScintillation *>((*processes)[i]);
+    return fScintillation;
+}
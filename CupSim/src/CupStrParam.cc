@@ -6,6 +6,15 @@
 #include <fstream>
 #include <sstream>
 
+#if G4VERSION_NUMBER >= 1000
+#include "G4AutoLock.hh"
+#include "G4Threading.hh"
+
+namespace {
+G4Mutex CupStrParamMutex = G4MUTEX_INITIALIZER;
+}
+#endif
+
 #if G4VERSION_NUMBER >= 1000
 G4ThreadLocal CupStrParam *CupStrParam::theCupStrParam = nullptr;
 CupStrParam *CupStrParam::theMasterCupStrParam = nullptr;
@@ -17,6 +26,21 @@ CupStrParam *CupStrParam::theMasterCupStrParam = nullptr;
 // Constructor
 CupStrParam::CupStrParam() {}
 
+// Create the instance for the calling thread.  The master instance is the
+// one filled by ReadFile() in main(); each worker thread gets its own copy
+// of it, so that GetWithDefault() on a worker never writes to the shared map.
+CupStrParam *CupStrParam::CreateDBPtr() {
+#if G4VERSION_NUMBER >= 1000
+    G4AutoLock lock(&CupStrParamMutex);
+    if (theMasterCupStrParam == nullptr) theMasterCupStrParam = new CupStrParam();
+    if (G4Threading::IsMasterThread()) return theMasterCupStrParam;
+    return new CupStrParam(*theMasterCupStrParam);
+#else
+    if (theMasterCupStrParam == nullptr) theMasterCupStrParam = new CupStrParam();
+    return theMasterCupStrParam;
+#endif
+}
+
 // ReadFile
 void CupStrParam::ReadFile(std::istream &is, EOverride oflag) {
     while (is.good()) {
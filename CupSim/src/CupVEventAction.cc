@@ -20,10 +20,18 @@
 
 #include "CupSim/CupScintillation.hh" // for doScintilllation and total energy deposition info
 
+#include "CupSim/CupCylinderOpticalModel.hh"
+#include "CupSim/CupOpticalMap.hh"
+#include "CupSim/CupOpticsReplay.hh"
 #include "CupSim/CupRecorderBase.hh"
 
-CupHitPMTCollection CupVEventAction ::theHitPMTCollection = CupHitPMTCollection();
-G4bool CupVEventAction ::flagFullOutputMode               = false;
+G4ThreadLocal CupHitPMTCollection *CupVEventAction ::theHitPMTCollection = nullptr;
+G4bool CupVEventAction ::flagFullOutputMode                              = false;
+
+CupHitPMTCollection *CupVEventAction::GetTheHitPMTCollection() {
+    if (theHitPMTCollection == nullptr) theHitPMTCollection = new CupHitPMTCollection();
+    return theHitPMTCollection;
+}
 
 CupVEventAction::CupVEventAction(CupRecorderBase *r) : recorder(r), drawFlag("all") {
     fDrawCmd = new G4UIcmdWithAString("/event/drawTracks", this);
@@ -70,7 +78,7 @@ void CupVEventAction::BeginOfEventAction(const G4Event *evt) {
     // EJ:
     CupScintillation::ResetTotEdep();
     // clearing theHitPMTCollection clears away the HitPhotons and HitPMTs
-    theHitPMTCollection.Clear();
+    GetTheHitPMTCollection()->Clear();
 }
 
 void CupVEventAction::EndOfEventAction(const G4Event *evt) {
@@ -98,5 +106,11 @@ void CupVEventAction::EndOfEventAction(const G4Event *evt) {
         }
     }
     // Do any necessary record-keeping.
+    if (CupOpticalMap::GetMode() == CupOpticalMap::kModeGenerate)
+        CupOpticalMap::GetInstance()->RecordEvent(evt, GetTheHitPMTCollection());
+    if (CupOpticsReplay::GetMode() == CupOpticsReplay::kModeRecord)
+        CupOpticsReplay::GetInstance()->EndOfEvent();
+    if (CupCylinderOpticalModel::IsRecordingHitMap())
+        CupCylinderOpticalModel::RecordHitMap(GetTheHitPMTCollection());
     if (recorder != 0) recorder->RecordEndOfEvent(evt); // EJ
 }
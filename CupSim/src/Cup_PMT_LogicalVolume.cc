@@ -22,7 +22,8 @@ Cup_PMT_LogicalVolume::Cup_PMT_LogicalVolume(
     G4Material *ExteriorMat // material which fills the bounding cylinder
     )
     : G4LogicalVolume(new G4Tubs(plabel + "_envelope_solid", 0.0, r_bound, hh_bound, 0., 2. * M_PI),
-                      ExteriorMat, plabel) {
+                      ExteriorMat, plabel),
+      fOpticalModelEnvelope(NULL) {
     if (our_Mirror_opsurf == NULL) {
         // construct a static mirror surface with idealized properties
         our_Mirror_opsurf = new G4OpticalSurface("Mirror_opsurf");
@@ -46,6 +47,19 @@ Cup_PMT_LogicalVolume::Cup_PMT_LogicalVolume(
     }
 }
 
+////////////////////////////////////////////////////////////////
+// ConstructSDandField
+//  -- hooks the sensitive detector on the glass and vacuum volumes
+//     recorded while building the tube, and creates the PMT optical
+//     model.  Both are per-thread objects in Geant4 MT.
+//
+void Cup_PMT_LogicalVolume::ConstructSDandField(G4VSensitiveDetector *detector) {
+    for (size_t i = 0; i < fSensitiveLogicals.size(); i++)
+        fSensitiveLogicals[i]->SetSensitiveDetector(detector);
+    if (fOpticalModelEnvelope != NULL)
+        new CupPMTOpticalModel(GetName() + "_optical_model", fOpticalModelEnvelope);
+}
+
 ////////////////////////////////////////////////////////////////
 // constants defining the (fixed by manufacturer) dimensions of the
 // phototubes:
@@ -694,11 +708,11 @@ void Cup_PMT_LogicalVolume::ConstructPMT_UsingTorusStack(
     ////
 
     G4LogicalVolume *body_log = new G4LogicalVolume(body_solid, Glass, GetName() + "_body_log");
-    body_log->SetSensitiveDetector(detector);
+    fSensitiveLogicals.push_back(body_log);
 
     G4LogicalVolume *inner1_log =
         new G4LogicalVolume(inner1_solid, PMT_Vac, GetName() + "_inner1_log");
-    inner1_log->SetSensitiveDetector(detector);
+    fSensitiveLogicals.push_back(inner1_log);
 
     G4LogicalVolume *inner2_log =
         new G4LogicalVolume(inner2_solid, PMT_Vac, GetName() + "_inner2_log");
@@ -765,10 +779,10 @@ void Cup_PMT_LogicalVolume::ConstructPMT_UsingTorusStack(
     ////////////////////////////////////////////////////////////////
     // FastSimulationModel
     ////
-    /**  CupPMTOpticalModel * pmtOpticalModel =  **/
     G4Region *PmtRegion = new G4Region(GetName());
     PmtRegion->AddRootLogicalVolume(body_log);
-    new CupPMTOpticalModel(GetName() + "_optical_model", body_phys);
+    fOpticalModelEnvelope = body_phys;
+    if (detector) ConstructSDandField(detector);
 
     ////////////////////////////////////////////////////////////////
     // Set colors and visibility
@@ -873,12 +887,12 @@ void Cup_PMT_LogicalVolume::ConstructPMT_UsingEllipsoid(
     ////
 
     G4LogicalVolume *face_log = new G4LogicalVolume(face_solid, Glass, GetName() + "_face_log");
-    face_log->SetSensitiveDetector(detector);
+    fSensitiveLogicals.push_back(face_log);
     G4LogicalVolume *back_log = new G4LogicalVolume(back_solid, Glass, GetName() + "_back_log");
     G4LogicalVolume *stem_log = new G4LogicalVolume(stem_solid, Glass, GetName() + "_stem_log");
     G4LogicalVolume *face_interior_log =
         new G4LogicalVolume(face_interior_solid, PMT_Vac, GetName() + "_face_interior_log");
-    face_interior_log->SetSensitiveDetector(detector);
+    fSensitiveLogicals.push_back(face_interior_log);
     G4LogicalVolume *back_interior_log =
         new G4LogicalVolume(back_interior_solid, PMT_Vac, GetName() + "_back_interior_log");
     G4LogicalVolume *stem_interior_log =
@@ -979,8 +993,8 @@ void Cup_PMT_LogicalVolume::ConstructPMT_UsingEllipsoid(
     ////////////////////////////////////////////////////////////////
     // FastSimulationModel
     ////
-    /**  CupPMTOpticalModel * pmtOpticalModel =  **/
-    new CupPMTOpticalModel(GetName() + "_optical_model", face_phys);
+    fOpticalModelEnvelope = face_phys;
+    if (detector) ConstructSDandField(detector);
 
     ////////////////////////////////////////////////////////////////
     // Set colors and visibility
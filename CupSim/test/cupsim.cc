@@ -20,6 +20,7 @@
 #include "CupSim/CupRootNtuple.hh"   // EJ
 #include "CupSim/CupRunAction.hh"    // EJ
 #include "CupSim/CupSimGitRevision.hh"
+#include "CupSim/CupStackingAction.hh"
 #include "CupSim/CupSteppingAction.hh" // EJ
 #include "CupSim/CupTrackingAction.hh" // EJ
 #include "CupSim/CupVEventAction.hh"   // EJ
@@ -88,6 +89,7 @@ int main(int argc, char **argv) {
     theRunManager->SetUserAction(eventAction);
     theRunManager->SetUserAction(new CupTrackingAction(myRecords));
     theRunManager->SetUserAction(new CupSteppingAction(myRecords));
+    theRunManager->SetUserAction(new CupStackingAction);
 #endif
 
     // an additional "messenger" class for user diagnostics
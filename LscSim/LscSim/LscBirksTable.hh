@@ -0,0 +1,89 @@
+#ifndef LscBirksTable_h
+#define LscBirksTable_h 1
+
+#include "globals.hh"
+
+#include <map>
+#include <utility>
+
+class G4Step;
+class G4Material;
+class G4ParticleDefinition;
+class G4PhysicsLogVector;
+class G4EmSaturation;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
+
+// Tabulated Birks quenching (/detGeometry/quenchingModel 2).
+//
+// For each material with a Birks constant kB and each of e-, proton, alpha
+// and the recoil ions of the material's elements the quenching factor
+//   q(E) = 1 / (1 + kB dE/dx(E))
+// and the visible energy of a particle slowing down from E to rest,
+//   L(E) = integral_0^E q(E') dE',
+// are tabulated on a log grid in kinetic energy, using the unrestricted
+// electronic dE/dx.  The visible energy of a step from E0 to E1 is then the
+// ionizing deposit times the mean of q over [E1, E0], i.e.
+//   eloss * (L(E0) - L(E1)) / (E0 - E1),
+// instead of G4EmSaturation's eloss / (1 + kB eloss / steplength).
+// Deuterons and tritons share the proton tables and He3 the alpha ones, at
+// the kinetic energy of the same velocity.  The recoil ions are tabulated
+// for the most abundant isotope of each element heavier than helium in a
+// scintillator; every ion of that Z shares its tables in the same way.
+//
+// Tables are built per thread from LscScintillation::BuildPhysicsTable, the
+// ions' with GenericIon's.  Steps the tables do not cover (gammas,
+// neutrons, non-ionizing deposits, ions of other Z, other particle types)
+// are passed to G4EmSaturation.
+
+class LscBirksTable {
+  public:
+    // the instance of the calling thread
+    static LscBirksTable *GetInstance();
+
+    // (re)builds the tables of a tabulated particle in all materials
+    void BuildPhysicsTable(const G4ParticleDefinition &aParticleType);
+
+    G4double VisibleEnergyDepositionAtAStep(const G4Step *aStep);
+
+    // q(E) and L(E) of a particle in a material (0 if not tabulated)
+    G4double GetQuenchingFactor(const G4Material *aMaterial, const G4ParticleDefinition *pDef,
+                                G4double kinEnergy);
+    G4double GetVisibleEnergy(const G4Material *aMaterial, const G4ParticleDefinition *pDef,
+                              G4double kinEnergy);
+
+  private:
+    LscBirksTable();
+    ~LscBirksTable();
+
+    struct Response {
+        G4PhysicsLogVector *differential; // q(E)
+        G4PhysicsLogVector *total;        // L(E)
+    };
+
+    // the tabulated particle whose tables pDef uses (NULL if none), and
+    // the factor converting pDef's kinetic energy to that particle's
+    const G4ParticleDefinition *GetTabulatedParticle(const G4ParticleDefinition *pDef,
+                                                     G4double &energyScale) const;
+    void BuildResponses(const G4ParticleDefinition *pDef);
+    void BuildIonResponses();
+    const Response *GetResponse(const G4Material *aMaterial, const G4ParticleDefinition *pDef,
+                                G4double &energyScale);
+    Response *BuildResponse(const G4Material *aMaterial, const G4ParticleDefinition *pDef) const;
+    static void DeleteResponse(Response *response);
+    static G4double Differential(const Response &response, G4double kinEnergy);
+    static G4double Total(const Response &response, G4double kinEnergy);
+
+    typedef std::pair<size_t, const G4ParticleDefinition *> ResponseKey;
+    std::map<ResponseKey, Response *> fResponses; // by tabulated particle
+    std::map<G4int, const G4ParticleDefinition *> fIons; // tabulated, by Z
+    ResponseKey fLastKey;                         // by particle of the step
+    const Response *fLastResponse;
+    G4double fLastEnergyScale;
+
+    G4EmSaturation *fEmSaturation;
+
+    static G4ThreadLocal LscBirksTable *fgInstance;
+};
+
+#endif
@@ -21,6 +21,7 @@ class LscDetectorConstruction : public CupDetectorConstruction {
     virtual ~LscDetectorConstruction(); // destructor
 
     virtual G4VPhysicalVolume *Construct(); // make the volumes, return ptr to world
+    virtual void ConstructSDandField();     // per-thread sensitive detectors and PMT models
 
     virtual int GetNumDetectorTypes() { return kNumDetectors; }
     virtual G4String GetDetectorTypeName(int i);
@@ -44,6 +45,11 @@ class LscDetectorConstruction : public CupDetectorConstruction {
     G4Material *LS_LAB;
     G4Material *UGF;
 
+    // kept by Construct() for ConstructSDandField()
+    G4LogicalVolume *fLogicTarget;
+    Cup_PMT_LogicalVolume *fLogiInnerPMT;
+    G4int fMaxIDPMTNo;
+
     static eDetGeometry whichDetGeometry;
     static int quenchingmodel;
 
@@ -3,6 +3,8 @@
 
 #include "CupSim/CupScintillation.hh"
 
+class LscBirksTable;
+
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
 
 class LscScintillation : public CupScintillation {
@@ -14,10 +16,42 @@ class LscScintillation : public CupScintillation {
   public:
     G4VParticleChange *PostStepDoIt(const G4Track &aTrack, const G4Step &aStep);
 
+    // builds the tabulated Birks response of the particle, if any
+    void BuildPhysicsTable(const G4ParticleDefinition &aParticleType);
+
+    // quench with the tabulated Birks response instead of emSaturation
+    void AddBirksTable(LscBirksTable *table) { birksTable = table; }
+
     static G4double GetTotEdepQuenched() { return TotalEnergyDepositQuenched; }
 
+    // values of /detGeometry/quenchingModel
+    enum { kQuenchingByParticleType = 0, kQuenchingBirks = 1, kQuenchingBirksTable = 2 };
+
+    // Quenched energy deposit of the current step, shared between this
+    // process and LscScintSD so that whichever sees the step first does the
+    // evaluation with the given quenching model.  Get returns false if the
+    // step has not been seen yet.
+    static G4bool GetStepVisibleEnergy(const G4Step *aStep, G4int quenchingModel,
+                                       G4double &visibleEnergy);
+    static void SetStepVisibleEnergy(const G4Step *aStep, G4int quenchingModel,
+                                     G4double visibleEnergy);
+
   private:
-    static G4double TotalEnergyDepositQuenched;
+    LscBirksTable *birksTable;
+
+    static G4ThreadLocal G4double TotalEnergyDepositQuenched;
+
+    // the step is identified by its track, step number and deposit, since
+    // the G4Step object itself is reused for every step
+    struct StepVisibleEnergy {
+        const G4Track *track;
+        G4int trackID;
+        G4int stepNumber;
+        G4double edep;
+        G4int quenchingModel;
+        G4double visibleEnergy;
+    };
+    static G4ThreadLocal StepVisibleEnergy fgStepVisibleEnergy;
 };
 
 #endif
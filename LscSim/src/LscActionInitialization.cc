@@ -2,8 +2,11 @@
 
 #if G4VERSION_NUMBER >= 1000
 
+#include "G4Threading.hh"
+
 #include "CupSim/CupPrimaryGeneratorAction.hh"
 #include "CupSim/CupRunAction.hh"
+#include "CupSim/CupStackingAction.hh"
 #include "CupSim/CupSteppingAction.hh"
 #include "CupSim/CupTrackingAction.hh"
 #include "CupSim/CupVEventAction.hh"
@@ -14,15 +17,28 @@
 
 void LscActionInitialization::BuildForMaster() const {
     SetUserAction(new CupRunAction(fRecorders));
+    CupStackingAction::CreateMessenger();
 }
 
 void LscActionInitialization::Build() const {
+    // Each MT worker records into its own LscRootNtuple (own trees, hit
+    // arrays and output file), owned by the worker's run action.  In
+    // sequential mode the recorder given to the constructor is used.
+    LscRootNtuple *recorder = fRecorders;
+    G4bool ownRecorder      = false;
+    if (G4Threading::IsWorkerThread()) {
+        recorder    = new LscRootNtuple;
+        ownRecorder = true;
+        recorder->CopyNtupleStatus(fRecorders);
+    }
+
     auto p = new CupPrimaryGeneratorAction(fDetConstruction);
     SetUserAction(p);
-    SetUserAction(new CupRunAction(fRecorders));
-    SetUserAction(new CupVEventAction(fRecorders));
-    SetUserAction(new CupTrackingAction(fRecorders));
-    SetUserAction(new CupSteppingAction(fRecorders, p));
+    SetUserAction(new CupRunAction(recorder, ownRecorder));
+    SetUserAction(new CupVEventAction(recorder));
+    SetUserAction(new CupTrackingAction(recorder));
+    SetUserAction(new CupSteppingAction(recorder, p));
+    SetUserAction(new CupStackingAction);
 }
 
 #endif
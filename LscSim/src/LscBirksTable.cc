@@ -0,0 +1,238 @@
+#include "LscSim/LscBirksTable.hh"
+
+#include "G4Element.hh"
+#include "G4EmCalculator.hh"
+#include "G4EmSaturation.hh"
+#include "G4IonTable.hh"
+#include "G4LossTableManager.hh"
+#include "G4Material.hh"
+#include "G4ParticleTypes.hh"
+#include "G4PhysicsLogVector.hh"
+#include "G4Step.hh"
+#include "G4SystemOfUnits.hh"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// table range and density; outside it q(E) is taken as constant
+const G4double kTableMinEnergy   = 100. * eV;
+const G4double kTableMaxEnergy   = 1. * GeV;
+const size_t kTableBinsPerDecade = 20;
+// steps losing less than this fraction of their energy use q(E) directly
+const G4double kMinRelativeLoss = 1.e-3;
+
+// q(E), from the unrestricted electronic dE/dx as in Birks' law
+G4double QuenchingFactor(G4EmCalculator &calc, const G4ParticleDefinition *pDef,
+                         const G4Material *aMaterial, G4double birks, G4double kinEnergy) {
+    return 1. / (1. + birks * calc.ComputeElectronicDEDX(kinEnergy, pDef, aMaterial));
+}
+} // namespace
+
+G4ThreadLocal LscBirksTable *LscBirksTable::fgInstance = NULL;
+
+LscBirksTable *LscBirksTable::GetInstance() {
+    if (!fgInstance) fgInstance = new LscBirksTable();
+    return fgInstance;
+}
+
+// Constructor /////////////////////////////////////////////////////////////
+LscBirksTable::LscBirksTable()
+    : fLastKey(size_t(-1), NULL), fLastResponse(NULL), fLastEnergyScale(1.),
+      fEmSaturation(G4LossTableManager::Instance()->EmSaturation()) {}
+
+// Destructor //////////////////////////////////////////////////////////////
+LscBirksTable::~LscBirksTable() {
+    std::map<ResponseKey, Response *>::iterator it;
+    for (it = fResponses.begin(); it != fResponses.end(); ++it)
+        DeleteResponse(it->second);
+}
+
+void LscBirksTable::BuildPhysicsTable(const G4ParticleDefinition &aParticleType) {
+    G4double energyScale;
+    if (&aParticleType == G4GenericIon::GenericIonDefinition())
+        BuildIonResponses();
+    else if (GetTabulatedParticle(&aParticleType, energyScale) == &aParticleType)
+        BuildResponses(&aParticleType);
+    fLastKey      = ResponseKey(size_t(-1), NULL);
+    fLastResponse = NULL;
+}
+
+void LscBirksTable::BuildIonResponses() {
+    // the most abundant isotope of each element heavier than helium in a
+    // scintillator, as its nuclei recoil from neutrons and alphas
+    const G4MaterialTable *materials = G4Material::GetMaterialTable();
+    for (size_t i = 0; i < materials->size(); i++) {
+        const G4Material *aMaterial = (*materials)[i];
+        if (aMaterial->GetIonisation()->GetBirksConstant() <= 0.) continue;
+        for (size_t j = 0; j < aMaterial->GetNumberOfElements(); j++) {
+            const G4Element *element = aMaterial->GetElement(j);
+            G4int Z                  = element->GetZasInt();
+            if (Z <= 2 || fIons.count(Z)) continue;
+            G4int A            = G4lrint(element->GetN());
+            G4double abundance = 0.;
+            for (size_t k = 0; k < element->GetNumberOfIsotopes(); k++) {
+                if (element->GetRelativeAbundanceVector()[k] <= abundance) continue;
+                abundance = element->GetRelativeAbundanceVector()[k];
+                A         = element->GetIsotope(k)->GetN();
+            }
+            const G4ParticleDefinition *ion = G4IonTable::GetIonTable()->GetIon(Z, A);
+            if (ion) fIons[Z] = ion;
+        }
+    }
+    std::map<G4int, const G4ParticleDefinition *>::const_iterator it;
+    for (it = fIons.begin(); it != fIons.end(); ++it)
+        BuildResponses(it->second);
+}
+
+void LscBirksTable::BuildResponses(const G4ParticleDefinition *pDef) {
+    // the EM models are initialized by now, for all particles
+    const G4MaterialTable *materials = G4Material::GetMaterialTable();
+    for (size_t i = 0; i < materials->size(); i++) {
+        const G4Material *aMaterial = (*materials)[i];
+        ResponseKey key(aMaterial->GetIndex(), pDef);
+        std::map<ResponseKey, Response *>::iterator it = fResponses.find(key);
+        if (it != fResponses.end()) {
+            DeleteResponse(it->second);
+            fResponses.erase(it);
+        }
+        if (aMaterial->GetIonisation()->GetBirksConstant() > 0.)
+            fResponses[key] = BuildResponse(aMaterial, pDef);
+    }
+}
+
+G4double LscBirksTable::VisibleEnergyDepositionAtAStep(const G4Step *aStep) {
+    G4double edep = aStep->GetTotalEnergyDeposit();
+    if (edep <= 0.) return 0.;
+
+    const G4Track *aTrack = aStep->GetTrack();
+    G4double length       = aStep->GetStepLength();
+    G4double energyScale  = 1.;
+    const Response *response =
+        (length > 0.) ? GetResponse(aTrack->GetMaterial(), aTrack->GetDefinition(), energyScale)
+                      : NULL;
+    if (!response) return fEmSaturation->VisibleEnergyDepositionAtAStep(aStep);
+
+    // the non-ionizing part is quenched as G4EmSaturation does it
+    G4double niel    = std::max(aStep->GetNonIonizingEnergyDeposit(), 0.);
+    G4double eloss   = edep - niel;
+    G4double visible = 0.;
+    if (niel > 0.) {
+        if (eloss < 0.) return fEmSaturation->VisibleEnergyDepositionAtAStep(aStep);
+        visible = fEmSaturation->VisibleEnergyDeposition(
+            aTrack->GetDefinition(), aStep->GetPreStepPoint()->GetMaterialCutsCouple(), length,
+            niel, niel);
+    }
+
+    G4double e0 = energyScale * aStep->GetPreStepPoint()->GetKineticEnergy();
+    G4double e1 = energyScale * aStep->GetPostStepPoint()->GetKineticEnergy();
+    if (e0 - e1 > kMinRelativeLoss * e0)
+        visible += eloss * (Total(*response, e0) - Total(*response, e1)) / (e0 - e1);
+    else
+        visible += eloss * Differential(*response, 0.5 * (e0 + e1));
+    return visible;
+}
+
+G4double LscBirksTable::GetQuenchingFactor(const G4Material *aMaterial,
+                                           const G4ParticleDefinition *pDef,
+                                           G4double kinEnergy) {
+    G4double energyScale;
+    const Response *response = GetResponse(aMaterial, pDef, energyScale);
+    return response ? Differential(*response, energyScale * kinEnergy) : 0.;
+}
+
+G4double LscBirksTable::GetVisibleEnergy(const G4Material *aMaterial,
+                                         const G4ParticleDefinition *pDef, G4double kinEnergy) {
+    G4double energyScale;
+    const Response *response = GetResponse(aMaterial, pDef, energyScale);
+    return response ? Total(*response, energyScale * kinEnergy) / energyScale : 0.;
+}
+
+const G4ParticleDefinition *LscBirksTable::GetTabulatedParticle(const G4ParticleDefinition *pDef,
+                                                                G4double &energyScale) const {
+    const G4ParticleDefinition *tabulated = NULL;
+    if (pDef == G4Electron::ElectronDefinition() || pDef == G4Proton::ProtonDefinition() ||
+        pDef == G4Alpha::AlphaDefinition())
+        tabulated = pDef;
+    else if (pDef == G4Deuteron::DeuteronDefinition() || pDef == G4Triton::TritonDefinition())
+        tabulated = G4Proton::ProtonDefinition();
+    else if (pDef == G4He3::He3Definition())
+        tabulated = G4Alpha::AlphaDefinition();
+    else if (pDef->IsGeneralIon()) {
+        std::map<G4int, const G4ParticleDefinition *>::const_iterator it =
+            fIons.find(pDef->GetAtomicNumber());
+        if (it != fIons.end()) tabulated = it->second;
+    }
+    // dE/dx depends on the velocity, i.e. on the kinetic energy per mass
+    energyScale = tabulated ? tabulated->GetPDGMass() / pDef->GetPDGMass() : 1.;
+    return tabulated;
+}
+
+const LscBirksTable::Response *LscBirksTable::GetResponse(const G4Material *aMaterial,
+                                                          const G4ParticleDefinition *pDef,
+                                                          G4double &energyScale) {
+    ResponseKey key(aMaterial->GetIndex(), pDef);
+    if (key != fLastKey) {
+        const G4ParticleDefinition *tabulated = GetTabulatedParticle(pDef, fLastEnergyScale);
+        std::map<ResponseKey, Response *>::const_iterator it =
+            fResponses.find(ResponseKey(key.first, tabulated));
+        fLastKey      = key;
+        fLastResponse = (tabulated && it != fResponses.end()) ? it->second : NULL;
+    }
+    energyScale = fLastEnergyScale;
+    return fLastResponse;
+}
+
+LscBirksTable::Response *LscBirksTable::BuildResponse(const G4Material *aMaterial,
+                                                      const G4ParticleDefinition *pDef) const {
+    G4double birks = aMaterial->GetIonisation()->GetBirksConstant();
+
+    size_t nbins =
+        size_t(kTableBinsPerDecade * std::log10(kTableMaxEnergy / kTableMinEnergy) + 0.5);
+    Response *response     = new Response;
+    response->differential = new G4PhysicsLogVector(kTableMinEnergy, kTableMaxEnergy, nbins);
+    response->total        = new G4PhysicsLogVector(kTableMinEnergy, kTableMaxEnergy, nbins);
+
+    G4EmCalculator calc;
+
+    // L(E) by Simpson's rule on each bin; below the table q is constant
+    G4double eLow  = kTableMinEnergy;
+    G4double qLow  = QuenchingFactor(calc, pDef, aMaterial, birks, eLow);
+    G4double total = eLow * qLow;
+    response->differential->PutValue(0, qLow);
+    response->total->PutValue(0, total);
+    for (size_t i = 1; i <= nbins; i++) {
+        G4double eHigh = response->differential->Energy(i);
+        G4double qMid  = QuenchingFactor(calc, pDef, aMaterial, birks, 0.5 * (eLow + eHigh));
+        G4double qHigh = QuenchingFactor(calc, pDef, aMaterial, birks, eHigh);
+        total += (eHigh - eLow) * (qLow + 4. * qMid + qHigh) / 6.;
+        response->differential->PutValue(i, qHigh);
+        response->total->PutValue(i, total);
+        eLow = eHigh;
+        qLow = qHigh;
+    }
+    return response;
+}
+
+void LscBirksTable::DeleteResponse(Response *response) {
+    delete response->differential;
+    delete response->total;
+    delete response;
+}
+
+G4double LscBirksTable::Differential(const Response &response, G4double kinEnergy) {
+    G4PhysicsLogVector *q = response.differential;
+    if (kinEnergy <= kTableMinEnergy) return (*q)[0];
+    if (kinEnergy >= kTableMaxEnergy) return (*q)[q->GetVectorLength() - 1];
+    return q->Value(kinEnergy);
+}
+
+G4double LscBirksTable::Total(const Response &response, G4double kinEnergy) {
+    G4PhysicsLogVector *q = response.differential;
+    G4PhysicsLogVector *L = response.total;
+    if (kinEnergy <= kTableMinEnergy) return kinEnergy * (*q)[0];
+    size_t last = L->GetVectorLength() - 1;
+    if (kinEnergy >= kTableMaxEnergy)
+        return (*L)[last] + (kinEnergy - kTableMaxEnergy) * (*q)[last];
+    return L->Value(kinEnergy);
+}
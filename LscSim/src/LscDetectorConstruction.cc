@@ -2,8 +2,11 @@
 
 #include "LscSim/LscDetectorConstruction.hh"
 #include "LscSim/LscDetectorMessenger.hh"
+#include "LscSim/LscScintSD.hh"
 
+#include "CupSim/CupCylinderOpticalModel.hh"
 #include "CupSim/CupInputDataReader.hh"
+#include "CupSim/CupPMTSD.hh"
 #include "CupSim/CupParam.hh"
 
 #include "G4Box.hh"
@@ -41,7 +44,8 @@ using namespace std;
 LscDetectorConstruction::eDetGeometry LscDetectorConstruction::whichDetGeometry = kNumDetGeometries;
 int LscDetectorConstruction::quenchingmodel   = 1;
 
-LscDetectorConstruction::LscDetectorConstruction() : CupDetectorConstruction() {
+LscDetectorConstruction::LscDetectorConstruction()
+    : CupDetectorConstruction(), fLogicTarget(nullptr), fLogiInnerPMT(nullptr), fMaxIDPMTNo(0) {
     whichDetector = kDetector_LscDetector;
     LscMessenger = new LscDetectorMessenger(this);
 }
@@ -74,6 +78,34 @@ G4VPhysicalVolume *LscDetectorConstruction::Construct() {
 }
 // end of LscDetectorConstruction::Construct()
 
+// ----------------------------------------------------------------
+// Sensitive detectors and fast-simulation models are thread-local in
+// Geant4 MT, so they are made here (on every worker, and on the master)
+// rather than in Construct(), which only runs on the master.
+void LscDetectorConstruction::ConstructSDandField() {
+    if (whichDetector != kDetector_LscDetector) return;
+
+    G4SDManager *SDman = G4SDManager::GetSDMpointer();
+
+    if (fLogicTarget) {
+        LscScintSD *TGSD = new LscScintSD("/lsc/TGSD", 1);
+        SDman->AddNewDetector(TGSD);
+        fLogicTarget->SetSensitiveDetector(TGSD);
+    }
+
+    if (fLogiInnerPMT) {
+        CupPMTSD *pmtSDInner = new CupPMTSD("/cupdet/pmt/inner", fMaxIDPMTNo, 0, 10);
+        SDman->AddNewDetector(pmtSDInner);
+        fLogiInnerPMT->ConstructSDandField(pmtSDInner);
+    }
+
+    // analytic photon transport in the target and buffer (/cupcyl/enable)
+    if (fLogicTarget && fLogicTarget->IsRootRegion()) {
+        G4VPhysicalVolume *physTarget = GetPhysicalVolumeByName("physTarget");
+        if (physTarget) new CupCylinderOpticalModel("TargetCylinderOpticalModel", physTarget);
+    }
+}
+
 // ----------------------------------------------------------------
 G4String LscDetectorConstruction::GetDetectorTypeName(int i) {
     if (i < kNumGenericDetectors)
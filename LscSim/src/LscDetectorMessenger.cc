@@ -29,6 +29,8 @@ LscDetectorMessenger::LscDetectorMessenger(LscDetectorConstruction *Lscdetector)
     // quenching by Birks
     DetGeometryQuenchingCmd = new G4UIcommand("/detGeometry/quenchingModel", this);
     DetGeometryQuenchingCmd->SetGuidance("Set quenching type: 0 by particle type, 1 by Birks");
+    DetGeometryQuenchingCmd->SetGuidance(
+        "  2 by Birks, from per-material response tables of e-, p, alpha and ions");
     DetGeometryQuenchingCmd->AvailableForStates(G4State_PreInit);
     DetGeometryQuenchingCmd->SetParameter(new G4UIparameter("quenching", 's', true));
 }
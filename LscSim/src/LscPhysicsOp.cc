@@ -1,13 +1,14 @@
 #include "LscSim/LscPhysicsOp.hh"
+#include "CupSim/CupCerenkov.hh"
 #include "CupSim/CupOpAttenuation.hh"
 #include "CupSim/CupOpBoundaryProcess.hh"
+#include "LscSim/LscBirksTable.hh"
 #include "LscSim/LscDetectorConstruction.hh"
 #include "LscSim/LscScintillation.hh"
 
 #include "G4LossTableManager.hh"
 #include "G4ProcessManager.hh"
 
-#include "G4Cerenkov.hh"
 #include "G4EmSaturation.hh"
 //#include "G4OpBoundaryProcess.hh"
 
@@ -30,12 +31,23 @@ void LscPhysicsOp::ConstructProcess() {
         theScintProcessDef->SetVerboseLevel(OpVerbLevel);
         G4EmSaturation *emSaturation = G4LossTableManager::Instance()->EmSaturation();
         theScintProcessDef->AddSaturation(emSaturation);
-    } else {
+    } else if (quenchingModel == 2) { // for tabulated Birks
+        theScintProcessDef->SetTrackSecondariesFirst(true);
+        theScintProcessDef->SetScintillationYieldFactor(1.0);     //
+        theScintProcessDef->SetScintillationExcitationRatio(1.0); //0.0
+        theScintProcessDef->SetVerboseLevel(OpVerbLevel);
+        theScintProcessDef->AddBirksTable(LscBirksTable::GetInstance());
+    } else if (quenchingModel == 0) { // by particle type
         theScintProcessDef->SetTrackSecondariesFirst(true);
         theScintProcessDef->SetScintillationYieldFactor(1.0);     //
         theScintProcessDef->SetScintillationExcitationRatio(1.0); //0.0
         theScintProcessDef->SetVerboseLevel(OpVerbLevel);
         theScintProcessDef->SetScintillationByParticleType(true); // for by particle type
+    } else {
+        G4ExceptionDescription ed;
+        ed << "unknown quenching model " << quenchingModel
+           << " (/detGeometry/quenchingModel 0, 1 or 2)";
+        G4Exception("LscSim/LscPhysicsOp::ConstructProcess", "LscPhys01", FatalException, ed);
     }
 
     // Optical processes
@@ -48,7 +60,7 @@ void LscPhysicsOp::ConstructProcess() {
     theBoundaryProcess->SetVerboseLevel(OpVerbLevel);
 
     // Cerenkov
-    G4Cerenkov *theCerenkovProcess = new G4Cerenkov();
+    CupCerenkov *theCerenkovProcess = new CupCerenkov();
     theCerenkovProcess->SetTrackSecondariesFirst(true);
 
     auto theParticleIterator = GetParticleIterator();
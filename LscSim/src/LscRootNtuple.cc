@@ -1,6 +1,7 @@
 #include <sstream>
 #include <string>
 
+#include "CupSim/CupLogger.hh"
 #include "CupSim/CupParam.hh"
 #include "CupSim/CupPrimaryGeneratorAction.hh"
 #include "CupSim/CupScintHit.hh"
@@ -151,10 +152,10 @@ void LscRootNtuple::SetTGSD(const G4Event *a_event) {
 
     eDetGeometry DetGeometryType;
     DetGeometryType = LscDetectorConstruction::GetDetGeometryType();
-    G4cout << "Ntuple DetGeometryType= " << DetGeometryType << G4endl;
+    CUPLOG(CupLogger::kLogDetail, "Ntuple DetGeometryType= " << DetGeometryType);
     switch (DetGeometryType) {
         case eDetGeometry::kDetector_LscYemilab: {
-            G4cout << "###  LSC detector at Yemilab  " << G4endl;
+            CUPLOG(CupLogger::kLogDetail, "###  LSC detector at Yemilab  ");
             for (int i = 0; i < nTotCell; i++) {
                 tgcellEdep[i]         = 0.;
                 tgcellEdepQuenched[i] = 0.;
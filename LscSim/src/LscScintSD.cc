@@ -3,6 +3,7 @@
 
 #include "G4EmSaturation.hh"
 #include "G4LossTableManager.hh"
+#include "LscSim/LscBirksTable.hh"
 #include "LscSim/LscDetectorConstruction.hh"
 #include "LscSim/LscDetectorMessenger.hh"
 #include "LscSim/LscScintillation.hh"
@@ -24,54 +25,39 @@ G4bool LscScintSD::ProcessHits(G4Step *aStep, G4TouchableHistory * /*ROhist*/) {
     G4int quenchingModel = LscDetectorConstruction::GetQuenchingModel();
     // G4cout << "quenchingModel= " << quenchingModel << G4endl;
     const G4Material *aMaterial = aStep->GetTrack()->GetMaterial();
-    if (quenchingModel == 1) { // using Birks
-        G4EmSaturation *emSaturation = G4LossTableManager::Instance()->EmSaturation();
-        // edep_quenched = emSaturation->VisibleEnergyDeposition(aStep);
-        edep_quenched = emSaturation->VisibleEnergyDepositionAtAStep(aStep);
-    } else { // by particle type
-        G4MaterialPropertiesTable *aMaterialPropertiesTable =
-            aMaterial->GetMaterialPropertiesTable();
-        G4MaterialPropertyVector *Scint_Yield_Vector = NULL;
-        G4double ScintillationYield                  = 0.;
-        if (!aMaterialPropertiesTable) {
-            edep_quenched = 0.;
-            G4cout << "EJ: No material properties in table" << G4endl;
-        } else {
-            // Protons
-            if (particleType == G4Proton::ProtonDefinition())
-                Scint_Yield_Vector =
-                    aMaterialPropertiesTable->GetProperty("PROTONSCINTILLATIONYIELD");
-            // Deuterons
-            else if (particleType == G4Deuteron::DeuteronDefinition())
-                Scint_Yield_Vector =
-                    aMaterialPropertiesTable->GetProperty("DEUTERONSCINTILLATIONYIELD");
-            // Tritons
-            else if (particleType == G4Triton::TritonDefinition())
-                Scint_Yield_Vector =
-                    aMaterialPropertiesTable->GetProperty("TRITONSCINTILLATIONYIELD");
-            // Alphas
-            else if (particleType == G4Alpha::AlphaDefinition())
-                Scint_Yield_Vector =
-                    aMaterialPropertiesTable->GetProperty("ALPHASCINTILLATIONYIELD");
-            else if (particleType->GetParticleType() == "nucleus" ||
-                     particleType == G4Neutron::NeutronDefinition())
-                Scint_Yield_Vector = aMaterialPropertiesTable->GetProperty("IONSCINTILLATIONYIELD");
-            else if (particleType == G4Electron::ElectronDefinition() ||
-                     particleType == G4Gamma::GammaDefinition())
-                Scint_Yield_Vector =
-                    aMaterialPropertiesTable->GetProperty("ELECTRONSCINTILLATIONYIELD");
-            else
-                Scint_Yield_Vector =
-                    aMaterialPropertiesTable->GetProperty("ELECTRONSCINTILLATIONYIELD");
-            if (!Scint_Yield_Vector) {
-                Scint_Yield_Vector =
-                    aMaterialPropertiesTable->GetProperty("ELECTRONSCINTILLATIONYIELD");
+    // normally already evaluated by LscScintillation for this step
+    if (!LscScintillation::GetStepVisibleEnergy(aStep, quenchingModel, edep_quenched)) {
+        if (quenchingModel == LscScintillation::kQuenchingBirks) {
+            G4EmSaturation *emSaturation = G4LossTableManager::Instance()->EmSaturation();
+            // edep_quenched = emSaturation->VisibleEnergyDeposition(aStep);
+            edep_quenched = emSaturation->VisibleEnergyDepositionAtAStep(aStep);
+            LscScintillation::SetStepVisibleEnergy(aStep, quenchingModel, edep_quenched);
+        } else if (quenchingModel == LscScintillation::kQuenchingBirksTable) {
+            edep_quenched = LscBirksTable::GetInstance()->VisibleEnergyDepositionAtAStep(aStep);
+            LscScintillation::SetStepVisibleEnergy(aStep, quenchingModel, edep_quenched);
+        } else { // by particle type
+            const CupScintillation::ScintMaterial &scintMaterial =
+                CupScintillation::GetScintMaterial(aMaterial);
+            if (!scintMaterial.table) {
+                edep_quenched = 0.;
+                static G4ThreadLocal G4bool warned = false;
+                if (!warned) {
+                    G4cerr << "LscScintSD: no scintillation properties for "
+                           << aMaterial->GetName() << ", no visible energy" << G4endl;
+                    warned = true;
+                }
+            } else {
+                // yield vector of this particle type (electron's by default)
+                G4int particleClass = CupScintillation::GetScintParticleClass(particleType);
+                G4MaterialPropertyVector *Scint_Yield_Vector =
+                    scintMaterial.yieldVector[particleClass];
+                G4double ScintillationYield = Scint_Yield_Vector->Value(edep);
+                edep_quenched               = ScintillationYield * edep;
+                LscScintillation::SetStepVisibleEnergy(aStep, quenchingModel, edep_quenched);
             }
-            ScintillationYield = Scint_Yield_Vector->Value(edep);
-            edep_quenched      = ScintillationYield * edep;
+            // G4cout << "particleName= " << particleName << ", particleType= " <<
+            // particleType->GetParticleType() << G4endl;
         }
-        // G4cout << "particleName= " << particleName << ", particleType= " <<
-        // particleType->GetParticleType() << G4endl;
     }
 
     //if(edep==0.) return true;
@@ -1,19 +1,51 @@
 #include "LscSim/LscScintillation.hh"
+#include "CupSim/CupOpticsReplay.hh"
 #include "CupSim/CupScintillation.hh"
+#include "LscSim/LscBirksTable.hh"
 
 #include "G4ParticleTypes.hh"
 
 using namespace CLHEP;
 
-G4double LscScintillation::TotalEnergyDepositQuenched = 0.0;
+G4ThreadLocal G4double LscScintillation::TotalEnergyDepositQuenched = 0.0;
+G4ThreadLocal LscScintillation::StepVisibleEnergy LscScintillation::fgStepVisibleEnergy = {
+    NULL, -1, -1, 0., -1, 0.};
 
 // Constructor /////////////////////////////////////////////////////////////
 LscScintillation::LscScintillation(const G4String &processName, G4ProcessType type)
-    : CupScintillation(processName, type) {}
+    : CupScintillation(processName, type), birksTable(NULL) {}
 
 // Destructor //////////////////////////////////////////////////////////////
 LscScintillation::~LscScintillation() {}
 
+void LscScintillation::BuildPhysicsTable(const G4ParticleDefinition &aParticleType) {
+    CupScintillation::BuildPhysicsTable(aParticleType);
+    if (birksTable) birksTable->BuildPhysicsTable(aParticleType);
+}
+
+G4bool LscScintillation::GetStepVisibleEnergy(const G4Step *aStep, G4int quenchingModel,
+                                              G4double &visibleEnergy) {
+    const G4Track *aTrack          = aStep->GetTrack();
+    const StepVisibleEnergy &cache = fgStepVisibleEnergy;
+    if (cache.track != aTrack || cache.stepNumber != aTrack->GetCurrentStepNumber() ||
+        cache.trackID != aTrack->GetTrackID() || cache.quenchingModel != quenchingModel ||
+        cache.edep != aStep->GetTotalEnergyDeposit())
+        return false;
+    visibleEnergy = cache.visibleEnergy;
+    return true;
+}
+
+void LscScintillation::SetStepVisibleEnergy(const G4Step *aStep, G4int quenchingModel,
+                                            G4double visibleEnergy) {
+    const G4Track *aTrack              = aStep->GetTrack();
+    fgStepVisibleEnergy.track          = aTrack;
+    fgStepVisibleEnergy.trackID        = aTrack->GetTrackID();
+    fgStepVisibleEnergy.stepNumber     = aTrack->GetCurrentStepNumber();
+    fgStepVisibleEnergy.edep           = aStep->GetTotalEnergyDeposit();
+    fgStepVisibleEnergy.quenchingModel = quenchingModel;
+    fgStepVisibleEnergy.visibleEnergy  = visibleEnergy;
+}
+
 // PostStepDoIt
 // -------------
 //
@@ -25,32 +57,22 @@ G4VParticleChange *LscScintillation::PostStepDoIt(const G4Track &aTrack, const G
 {
     aParticleChange.Initialize(aTrack);
 
+    if (EmitPendingPhotons(aTrack)) return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
+
     const G4DynamicParticle *aParticle = aTrack.GetDynamicParticle();
     const G4Material *aMaterial        = aTrack.GetMaterial();
 
-    G4StepPoint *pPreStepPoint  = aStep.GetPreStepPoint();
-    G4StepPoint *pPostStepPoint = aStep.GetPostStepPoint();
-
-    G4ThreeVector x0 = pPreStepPoint->GetPosition();
-    G4ThreeVector p0 = aStep.GetDeltaPosition().unit();
-    G4double t0      = pPreStepPoint->GetGlobalTime();
-
     G4double TotalEnergyDeposit = aStep.GetTotalEnergyDeposit();
 
-    G4MaterialPropertiesTable *aMaterialPropertiesTable = aMaterial->GetMaterialPropertiesTable();
-    if (!aMaterialPropertiesTable) return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
+    const ScintMaterial &scintMaterial = GetScintMaterial(aMaterial);
+    if (!scintMaterial.table) return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
 
-    G4MaterialPropertyVector *Fast_Intensity =
-        aMaterialPropertiesTable->GetProperty("FASTCOMPONENT");
-    G4MaterialPropertyVector *Slow_Intensity =
-        aMaterialPropertiesTable->GetProperty("SLOWCOMPONENT");
+    G4MaterialPropertyVector *Fast_Intensity = scintMaterial.fastIntensity;
+    G4MaterialPropertyVector *Slow_Intensity = scintMaterial.slowIntensity;
 
     if (!Fast_Intensity && !Slow_Intensity)
         return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
 
-    G4int nscnt = 1;
-    if (Fast_Intensity && Slow_Intensity) nscnt = 2;
-
     G4double ScintillationYield = 0.;
 
     if (scintillationByParticleType) {
@@ -58,53 +80,13 @@ G4VParticleChange *LscScintillation::PostStepDoIt(const G4Track &aTrack, const G
         // deposited by particle types.
 
         // Get the definition of the current particle
-        G4ParticleDefinition *pDef                   = aParticle->GetDefinition();
-        G4MaterialPropertyVector *Scint_Yield_Vector = NULL;
-
-        // Obtain the G4MaterialPropertyVectory containing the
-        // scintillation light yield as a function of the deposited
-        // energy for the current particle type
-
-        // Protons
-        if (pDef == G4Proton::ProtonDefinition())
-            Scint_Yield_Vector = aMaterialPropertiesTable->GetProperty("PROTONSCINTILLATIONYIELD");
-
-        // Deuterons
-        else if (pDef == G4Deuteron::DeuteronDefinition())
-            Scint_Yield_Vector =
-                aMaterialPropertiesTable->GetProperty("DEUTERONSCINTILLATIONYIELD");
-
-        // Tritons
-        else if (pDef == G4Triton::TritonDefinition())
-            Scint_Yield_Vector = aMaterialPropertiesTable->GetProperty("TRITONSCINTILLATIONYIELD");
-
-        // Alphas
-        else if (pDef == G4Alpha::AlphaDefinition())
-            Scint_Yield_Vector = aMaterialPropertiesTable->GetProperty("ALPHASCINTILLATIONYIELD");
-
-        // Ions (particles derived from G4VIon and G4Ions)
-        // and recoil ions below tracking cut from neutrons after hElastic
-        else if (pDef->GetParticleType() == "nucleus" || pDef == G4Neutron::NeutronDefinition())
-            Scint_Yield_Vector = aMaterialPropertiesTable->GetProperty("IONSCINTILLATIONYIELD");
-
-        // Electrons (must also account for shell-binding energy
-        // attributed to gamma from standard PhotoElectricEffect)
-        else if (pDef == G4Electron::ElectronDefinition() || pDef == G4Gamma::GammaDefinition())
-            Scint_Yield_Vector =
-                aMaterialPropertiesTable->GetProperty("ELECTRONSCINTILLATIONYIELD");
-
-        // Default for particles not enumerated/listed above
-        else
-            Scint_Yield_Vector =
-                aMaterialPropertiesTable->GetProperty("ELECTRONSCINTILLATIONYIELD");
-
-        // If the user has not specified yields for (p,d,t,a,carbon)
-        // then these unspecified particles will default to the
-        // electron's scintillation yield
-        if (!Scint_Yield_Vector) {
-            Scint_Yield_Vector =
-                aMaterialPropertiesTable->GetProperty("ELECTRONSCINTILLATIONYIELD");
-        }
+        G4ParticleDefinition *pDef = aParticle->GetDefinition();
+
+        // The G4MaterialPropertyVector containing the scintillation light
+        // yield as a function of the deposited energy for the current
+        // particle type, with the electron's yield as default
+        G4MaterialPropertyVector *Scint_Yield_Vector =
+            scintMaterial.yieldVector[GetScintParticleClass(pDef)];
 
         // Throw an exception if no scintillation yield is found
         if (!Scint_Yield_Vector) {
@@ -137,13 +119,13 @@ G4VParticleChange *LscScintillation::PostStepDoIt(const G4Track &aTrack, const G
         ScintillationYield = Scint_Yield_Vector->Value(TotalEnergyDeposit);
     } else {
         // The default linear scintillation process
-        ScintillationYield = aMaterialPropertiesTable->GetConstProperty("SCINTILLATIONYIELD");
+        ScintillationYield = scintMaterial.scintillationYield;
 
         // Units: [# scintillation photons / MeV]
         ScintillationYield *= YieldFactor;
     }
 
-    G4double ResolutionScale = aMaterialPropertiesTable->GetConstProperty("RESOLUTIONSCALE");
+    G4double ResolutionScale = scintMaterial.resolutionScale;
 
     // Birks law saturation:
 
@@ -161,18 +143,27 @@ G4VParticleChange *LscScintillation::PostStepDoIt(const G4Track &aTrack, const G
     if (scintillationByParticleType) {
         // EJ: start
         TotalEnergyDepositQuenched = ScintillationYield * TotalEnergyDeposit;
+        SetStepVisibleEnergy(&aStep, kQuenchingByParticleType, TotalEnergyDepositQuenched);
         // MeanNumberOfPhotons = TotalEnergyDepositQuenched*40000.; // EJ: 40000pe/MeV
-        MeanNumberOfPhotons = TotalEnergyDepositQuenched *
-                              (aMaterialPropertiesTable->GetConstProperty("SCINTILLATIONYIELD"));
+        MeanNumberOfPhotons = TotalEnergyDepositQuenched * scintMaterial.scintillationYield;
         // EJ: end
+    } else if (birksTable) {
+        if (!GetReplayVisibleEnergy(aStep, TotalEnergyDepositQuenched) &&
+            !GetStepVisibleEnergy(&aStep, kQuenchingBirksTable, TotalEnergyDepositQuenched)) {
+            TotalEnergyDepositQuenched = birksTable->VisibleEnergyDepositionAtAStep(&aStep);
+            SetStepVisibleEnergy(&aStep, kQuenchingBirksTable, TotalEnergyDepositQuenched);
+        }
+        MeanNumberOfPhotons = ScintillationYield * TotalEnergyDepositQuenched;
     } else if (emSaturation) {
         // EJ: start
         // TotalEnergyDepositQuenched = emSaturation->VisibleEnergyDeposition(&aStep);
-        TotalEnergyDepositQuenched = emSaturation->VisibleEnergyDepositionAtAStep(&aStep);
+        if (!GetReplayVisibleEnergy(aStep, TotalEnergyDepositQuenched) &&
+            !GetStepVisibleEnergy(&aStep, kQuenchingBirks, TotalEnergyDepositQuenched)) {
+            TotalEnergyDepositQuenched = emSaturation->VisibleEnergyDepositionAtAStep(&aStep);
+            SetStepVisibleEnergy(&aStep, kQuenchingBirks, TotalEnergyDepositQuenched);
+        }
         // EJ: end
-        MeanNumberOfPhotons = ScintillationYield *
-                              //   (emSaturation->VisibleEnergyDeposition(&aStep));
-                              (emSaturation->VisibleEnergyDepositionAtAStep(&aStep));
+        MeanNumberOfPhotons = ScintillationYield * TotalEnergyDepositQuenched;
     } else {
         MeanNumberOfPhotons = ScintillationYield * TotalEnergyDeposit;
     }
@@ -203,6 +194,13 @@ G4VParticleChange *LscScintillation::PostStepDoIt(const G4Track &aTrack, const G
     }
     // EJ: end
 
+    // recording the steps for an optics replay: no photons now
+    if (CupOpticsReplay::GetMode() == CupOpticsReplay::kModeRecord) {
+        if (TotalEnergyDeposit > 0.)
+            CupOpticsReplay::GetInstance()->RecordStep(aStep, TotalEnergyDepositQuenched);
+        return G4VRestDiscreteProcess::PostStepDoIt(aTrack, aStep);
+    }
+
     if (NumPhotons <= 0) {
         // return unchanged particle and no secondaries
 
@@ -221,173 +219,7 @@ G4VParticleChange *LscScintillation::PostStepDoIt(const G4Track &aTrack, const G
 
     ////////////////////////////////////////////////////////////////
 
-    aParticleChange.SetNumberOfSecondaries(NumPhotons);
-
-    if (fTrackSecondariesFirst) {
-        if (aTrack.GetTrackStatus() == fAlive) aParticleChange.ProposeTrackStatus(fSuspend);
-    }
-
-    ////////////////////////////////////////////////////////////////
-
-    G4int materialIndex = aMaterial->GetIndex();
-
-    // Retrieve the Scintillation Integral for this material
-    // new G4PhysicsOrderedFreeVector allocated to hold CII's
-
-    G4int Num = NumPhotons;
-
-    for (G4int scnt = 1; scnt <= nscnt; scnt++) {
-
-        G4double ScintillationTime                        = 0. * ns;
-        G4double ScintillationRiseTime                    = 0. * ns;
-        G4PhysicsOrderedFreeVector *ScintillationIntegral = NULL;
-
-        if (scnt == 1) {
-            if (nscnt == 1) {
-                if (Fast_Intensity) {
-                    ScintillationTime =
-                        aMaterialPropertiesTable->GetConstProperty("FASTTIMECONSTANT");
-                    if (fFiniteRiseTime) {
-                        ScintillationRiseTime =
-                            aMaterialPropertiesTable->GetConstProperty("FASTSCINTILLATIONRISETIME");
-                    }
-                    ScintillationIntegral =
-                        (G4PhysicsOrderedFreeVector *)((*theFastIntegralTable)(materialIndex));
-                }
-                if (Slow_Intensity) {
-                    ScintillationTime =
-                        aMaterialPropertiesTable->GetConstProperty("SLOWTIMECONSTANT");
-                    if (fFiniteRiseTime) {
-                        ScintillationRiseTime =
-                            aMaterialPropertiesTable->GetConstProperty("SLOWSCINTILLATIONRISETIME");
-                    }
-                    ScintillationIntegral =
-                        (G4PhysicsOrderedFreeVector *)((*theSlowIntegralTable)(materialIndex));
-                }
-            } else {
-                G4double YieldRatio = aMaterialPropertiesTable->GetConstProperty("YIELDRATIO");
-                if (ExcitationRatio == 1.0) {
-                    Num = G4int(std::min(YieldRatio, 1.0) * NumPhotons);
-                } else {
-                    Num = G4int(std::min(ExcitationRatio, 1.0) * NumPhotons);
-                }
-                ScintillationTime = aMaterialPropertiesTable->GetConstProperty("FASTTIMECONSTANT");
-                if (fFiniteRiseTime) {
-                    ScintillationRiseTime =
-                        aMaterialPropertiesTable->GetConstProperty("FASTSCINTILLATIONRISETIME");
-                }
-                ScintillationIntegral =
-                    (G4PhysicsOrderedFreeVector *)((*theFastIntegralTable)(materialIndex));
-            }
-        } else {
-            Num               = NumPhotons - Num;
-            ScintillationTime = aMaterialPropertiesTable->GetConstProperty("SLOWTIMECONSTANT");
-            if (fFiniteRiseTime) {
-                ScintillationRiseTime =
-                    aMaterialPropertiesTable->GetConstProperty("SLOWSCINTILLATIONRISETIME");
-            }
-            ScintillationIntegral =
-                (G4PhysicsOrderedFreeVector *)((*theSlowIntegralTable)(materialIndex));
-        }
-
-        if (!ScintillationIntegral) continue;
-
-        // Max Scintillation Integral
-
-        G4double CIImax = ScintillationIntegral->GetMaxValue();
-
-        for (G4int i = 0; i < Num; i++) {
-
-            // Determine photon energy
-
-            G4double CIIvalue      = G4UniformRand() * CIImax;
-            G4double sampledEnergy = ScintillationIntegral->GetEnergy(CIIvalue);
-
-            if (verboseLevel > 1) {
-                G4cout << "sampledEnergy = " << sampledEnergy << G4endl;
-                G4cout << "CIIvalue =        " << CIIvalue << G4endl;
-            }
-
-            // Generate random photon direction
-
-            G4double cost = 1. - 2. * G4UniformRand();
-            G4double sint = std::sqrt((1. - cost) * (1. + cost));
-
-            G4double phi  = twopi * G4UniformRand();
-            G4double sinp = std::sin(phi);
-            G4double cosp = std::cos(phi);
-
-            G4double px = sint * cosp;
-            G4double py = sint * sinp;
-            G4double pz = cost;
-
-            // Create photon momentum direction vector
-
-            G4ParticleMomentum photonMomentum(px, py, pz);
-
-            // Determine polarization of new photon
-
-            G4double sx = cost * cosp;
-            G4double sy = cost * sinp;
-            G4double sz = -sint;
-
-            G4ThreeVector photonPolarization(sx, sy, sz);
-
-            G4ThreeVector perp = photonMomentum.cross(photonPolarization);
-
-            phi  = twopi * G4UniformRand();
-            sinp = std::sin(phi);
-            cosp = std::cos(phi);
-
-            photonPolarization = cosp * photonPolarization + sinp * perp;
-
-            photonPolarization = photonPolarization.unit();
-
-            // Generate a new photon:
-
-            G4DynamicParticle *aScintillationPhoton =
-                new G4DynamicParticle(G4OpticalPhoton::OpticalPhoton(), photonMomentum);
-            aScintillationPhoton->SetPolarization(photonPolarization.x(), photonPolarization.y(),
-                                                  photonPolarization.z());
-
-            aScintillationPhoton->SetKineticEnergy(sampledEnergy);
-
-            // Generate new G4Track object:
-
-            G4double rand;
-
-            if (aParticle->GetDefinition()->GetPDGCharge() != 0) {
-                rand = G4UniformRand();
-            } else {
-                rand = 1.0;
-            }
-
-            G4double delta = rand * aStep.GetStepLength();
-            G4double deltaTime =
-                delta / ((pPreStepPoint->GetVelocity() + pPostStepPoint->GetVelocity()) / 2.);
-
-            // emission time distribution
-            if (ScintillationRiseTime == 0.0) {
-                deltaTime = deltaTime - ScintillationTime * std::log(G4UniformRand());
-            } else {
-                deltaTime = deltaTime + sample_time(ScintillationRiseTime, ScintillationTime);
-            }
-
-            G4double aSecondaryTime = t0 + deltaTime;
-
-            G4ThreeVector aSecondaryPosition = x0 + rand * aStep.GetDeltaPosition();
-
-            G4Track *aSecondaryTrack =
-                new G4Track(aScintillationPhoton, aSecondaryTime, aSecondaryPosition);
-
-            aSecondaryTrack->SetTouchableHandle(aStep.GetPreStepPoint()->GetTouchableHandle());
-            // aSecondaryTrack->SetTouchableHandle((G4VTouchable*)0);
-
-            aSecondaryTrack->SetParentID(aTrack.GetTrackID());
-
-            aParticleChange.AddSecondary(aSecondaryTrack);
-        }
-    }
+    EmitComponents(aTrack, aStep, scintMaterial, NumPhotons);
 
     if (verboseLevel > 0) {
         G4cout << "\n Exiting from LscScintillation::DoIt -- NumberOfSecondaries = "
@@ -237,16 +237,8 @@ void LscDetectorConstruction::ConstructLscYemilab() {
 
 
     ///////////////////////
-    // Sensitive detector
-    G4cout << "Setting Sensitive detectors for detectors..." << G4endl;
-    G4cout << G4endl;
-
-    G4String SDname;
-    LscScintSD *TGSD  = new LscScintSD(SDname = "/lsc/TGSD", 1);
-    G4SDManager *SDman = G4SDManager::GetSDMpointer();
-
-    SDman->AddNewDetector(TGSD);
-    logicTarget->SetSensitiveDetector(TGSD);
+    // Sensitive detector: attached per thread in ConstructSDandField()
+    fLogicTarget = logicTarget;
     G4cout << "Geometry setting is done..." << G4endl;
     G4cout << G4endl;
 
@@ -86,10 +86,8 @@ void LscDetectorConstruction::ConstructLscYemilab_ID()
     G4Exception(" ", " ", JustWarning, "Error, initial integer could not be read from pmt coordinates file.\n");
   }
   
-  // --- PMT sensitive detector
-  G4SDManager* fSDman = G4SDManager::GetSDMpointer();  
-  CupPMTSD* pmtSDInner= new CupPMTSD("/cupdet/pmt/inner", maxIDPMTNo, 0, 10);
-  fSDman->AddNewDetector(pmtSDInner);
+  // --- PMT sensitive detector: made per thread in ConstructSDandField()
+  fMaxIDPMTNo = maxIDPMTNo;
 
 
   // --- make the fundamental inner  PMT assembly
@@ -106,8 +104,9 @@ void LscDetectorConstruction::ConstructLscYemilab_ID()
 	NULL :       // no mask
 	_blackAcryl // physical mask on tubes to block non-sensitive areas
 	),
-      pmtSDInner,  // sensitive detector hook
+      NULL,        // sensitive detector hook, see ConstructSDandField()
       whichPmtStyle);
+  fLogiInnerPMT = _logiInnerPMT10;
   MakeID_PMT_Support(_logiInnerPMT10,
 		     _water,     // support material
 		     _water);   // external material
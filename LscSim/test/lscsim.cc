@@ -1,6 +1,10 @@
 
+#include "G4Version.hh"
+#ifdef G4MULTITHREADED
 #include "G4MTRunManager.hh"
+#else
 #include "G4RunManager.hh"
+#endif
 #include "G4UIExecutive.hh"
 #include "G4UImanager.hh"
 #include "G4UIterminal.hh"
@@ -12,6 +16,7 @@
 #include "CupSim/CupPhysicsList.hh" 
 #include "CupSim/CupVEventAction.hh" 
 #include "CupSim/CupTrackingAction.hh" 
+#include "CupSim/CupStackingAction.hh"
 #include "CupSim/CupSteppingAction.hh"
 #include "CupSim/CupDebugMessenger.hh"
 #include "CupSim/CupParam.hh"
@@ -21,27 +26,46 @@
 #include "G4VisExecutive.hh"
 #endif
 #include <cstdlib>
+#include <cstring>
+#include <vector>
 #include "G4Run.hh"
+#include "TROOT.h"
 
 #include "LscSim/LscRootNtuple.hh"
 #include "LscSim/LscPhysicsList.hh"
 #include "CupSim/CupRecorderBase.hh"
 #include "CupSim/CupRunAction.hh"
 
+#if G4VERSION_NUMBER >= 1000
+#include "LscSim/LscActionInitialization.hh"
+#endif
+
 int main (int argc,char** argv)
 {
     G4cout << "This is Lscsim, version tag $Name:  $" << G4endl;
 
+    // "-t N" (or "--threads N") anywhere on the command line sets the number
+    // of worker threads; everything else is a macro file.  The default of one
+    // thread can also be changed by /run/numberOfThreads before /run/initialize.
+    G4int nThreads = 1;
+    std::vector<G4String> macroFiles;
+    for (int iarg = 1; iarg < argc; iarg++) {
+        if ((strcmp(argv[iarg], "-t") == 0 || strcmp(argv[iarg], "--threads") == 0) &&
+            iarg + 1 < argc) {
+            nThreads = atoi(argv[++iarg]);
+        } else {
+            macroFiles.push_back(argv[iarg]);
+        }
+    }
+
     // Run manager
-/*
 #ifdef G4MULTITHREADED
+    ROOT::EnableThreadSafety();
     G4MTRunManager *theRunManager = new G4MTRunManager;
-    theRunManager->SetNumberOfThreads(1);
+    theRunManager->SetNumberOfThreads(nThreads > 0 ? nThreads : 1);
 #else
     G4RunManager *theRunManager = new G4RunManager;
 #endif
-*/
-    G4RunManager *theRunManager = new G4RunManager;
 
     // -- database
     CupParam &db ( CupParam::GetDB() );
@@ -61,8 +85,13 @@ int main (int argc,char** argv)
     //  theRunManager -> Initialize();
 
     // Create the LscRecorderBase object
-    CupRecorderBase* myRecords = new LscRootNtuple; 
+    // (in MT this one belongs to the master; workers make their own)
+    LscRootNtuple* myRecords = new LscRootNtuple; 
 
+#if G4VERSION_NUMBER >= 1000
+    theRunManager->SetUserInitialization(
+        new LscActionInitialization(myRecords, theLscDetectorConstruction));
+#else
     // UserAction classes
     theRunManager->SetUserAction(new CupPrimaryGeneratorAction( theLscDetectorConstruction ));
     theRunManager->SetUserAction(new CupRunAction(myRecords));
@@ -70,6 +99,8 @@ int main (int argc,char** argv)
     theRunManager->SetUserAction(eventAction);
     theRunManager->SetUserAction(new CupTrackingAction(myRecords));
     theRunManager->SetUserAction(new CupSteppingAction(myRecords));
+    theRunManager->SetUserAction(new CupStackingAction);
+#endif
 
     // an additional "messenger" class for user diagnostics
     CupDebugMessenger theDebugMessenger( theLscDetectorConstruction );
@@ -84,14 +115,14 @@ int main (int argc,char** argv)
     G4UImanager *theUI = G4UImanager::GetUIpointer();
 
     // interactive or batch according to command-line args
-    if (argc == 1) {
+    if (macroFiles.empty()) {
         // G4UIterminal is a (dumb) terminal.
         // ..but it can be made smart by adding a "shell" to it
         G4UIsession *theSession = new G4UIterminal(new G4UItcsh);
         theSession->SessionStart();
         delete theSession;
     } else { // Batch mode, with optional user interaction
-        if (strcmp(argv[1], "gui.mac") == 0 || strcmp(argv[1], "gui") == 0) {
+        if (macroFiles[0] == "gui.mac" || macroFiles[0] == "gui") {
             G4UIExecutive *theSession = new G4UIExecutive(argc, argv);
             theUI->ApplyCommand("/control/execute init_vis.mac");
             if (theSession->IsGUI()) {
@@ -102,10 +133,9 @@ int main (int argc,char** argv)
             delete theSession;
         } else {
             G4String command = "/control/execute ";
-            for (int iarg = 1; iarg < argc; iarg++)
+            for (size_t imac = 0; imac < macroFiles.size(); imac++)
             {
-                G4String fileName = argv[iarg];
-                theUI->ApplyCommand(command + fileName);
+                theUI->ApplyCommand(command + macroFiles[imac]);
             }
         }
     }
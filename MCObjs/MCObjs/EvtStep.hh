@@ -22,8 +22,6 @@ class EvtStep : public TObject {
     Int_t fNstep;        // Number of tracks
     TClonesArray *fStep; //->array with all tracks
 
-    static TClonesArray *fgStep;
-
   public:
     EvtStep();
     virtual ~EvtStep();
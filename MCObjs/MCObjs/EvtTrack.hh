@@ -21,8 +21,6 @@ class EvtTrack : public TObject {
     Int_t fNtrack;        // Number of tracks
     TClonesArray *fTrack; //->array with all tracks
 
-    static TClonesArray *fgTrack;
-
   public:
     EvtTrack();
     virtual ~EvtTrack();
@@ -24,8 +24,6 @@ class MuonSD : public TObject {
     Int_t nTotCell;
     TClonesArray *fMuCell; //->array with all hits
 
-    static TClonesArray *fgCell;
-
   public:
     MuonSD();
     virtual ~MuonSD();
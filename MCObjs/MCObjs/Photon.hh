@@ -26,8 +26,6 @@ class Photon : public TObject {
     Int_t fNop_reem;
     TClonesArray *fHit; //->array with all hits
 
-    static TClonesArray *fgHit;
-
   public:
     Photon();
     virtual ~Photon();
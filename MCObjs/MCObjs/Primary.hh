@@ -26,8 +26,6 @@ class Primary : public TObject {
     Double_t centroid_y; // Vertex centroid y
     Double_t centroid_z; // Vertex centroid z
 
-    static TClonesArray *fgVertex;
-
   public:
     Primary();
     virtual ~Primary();
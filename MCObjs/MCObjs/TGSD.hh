@@ -24,8 +24,6 @@ class TGSD : public TObject {
     Int_t nTotCell;
     TClonesArray *fCell; //->array with all hits
 
-    static TClonesArray *fgCell;
-
   public:
     TGSD();
     virtual ~TGSD();
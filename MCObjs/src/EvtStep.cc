@@ -6,16 +6,13 @@
 
 ClassImp(EvtStep);
 
-TClonesArray *EvtStep::fgStep = nullptr;
-
 //______________________________________________________________________________
 EvtStep::EvtStep() : TObject() {
     // Create an Step object.
-    // When the constructor is invoked for the first time, the class static
-    // variable fgSteps is 0 and the TClonesArray fgSteps is created.
+    // The TClonesArray is owned by this object (not shared between
+    // instances), so recorders on different threads can fill their own.
 
-    if (fgStep == nullptr) fgStep = new TClonesArray("TStep", 1000000);
-    fStep = fgStep;
+    fStep = new TClonesArray("TStep", 1000);
 
     fNstep = 0;
 }
@@ -23,8 +20,7 @@ EvtStep::EvtStep() : TObject() {
 //______________________________________________________________________________
 EvtStep::~EvtStep() {
     Clear();
-    delete fgStep;
-    fgStep = nullptr;
+    delete fStep;
 }
 
 //______________________________________________________________________________
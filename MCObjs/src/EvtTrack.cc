@@ -2,12 +2,9 @@
 
 ClassImp(EvtTrack);
 
-TClonesArray *EvtTrack::fgTrack = nullptr;
-
 //______________________________________________________________________________
 EvtTrack::EvtTrack() : TObject() {
-    if (fgTrack == nullptr) fgTrack = new TClonesArray("TTrack", 1000000);
-    fTrack = fgTrack;
+    fTrack = new TClonesArray("TTrack", 1000);
 
     fNtrack = 0;
 }
@@ -15,8 +12,7 @@ EvtTrack::EvtTrack() : TObject() {
 //______________________________________________________________________________
 EvtTrack::~EvtTrack() {
     Clear();
-    delete fgTrack;
-    fgTrack = nullptr;
+    delete fTrack;
 }
 //______________________________________________________________________________
 void EvtTrack::Clear(Option_t * /*option*/) { fTrack->Delete(); }
@@ -2,16 +2,13 @@
 
 ClassImp(MuonSD);
 
-TClonesArray *MuonSD::fgCell = nullptr;
-
 //______________________________________________________________________________
 MuonSD::MuonSD() : TObject() {
     // Create an Track object.
-    // When the constructor is invoked for the first time, the class static
-    // variable fgTracks is 0 and the TClonesArray fgTracks is created.
+    // The TClonesArray is owned by this object (not shared between
+    // instances), so recorders on different threads can fill their own.
 
-    if (fgCell == nullptr) fgCell = new TClonesArray("TCell", 300);
-    fMuCell = fgCell;
+    fMuCell = new TClonesArray("TCell", 300);
 
     nTotCell = 0;
 }
@@ -19,8 +16,7 @@ MuonSD::MuonSD() : TObject() {
 //______________________________________________________________________________
 MuonSD::~MuonSD() {
     Clear();
-    delete fgCell;
-    fgCell = nullptr;
+    delete fMuCell;
 }
 //______________________________________________________________________________
 void MuonSD::Clear(Option_t * /*option*/) { fMuCell->Delete(); }
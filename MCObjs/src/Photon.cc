@@ -4,13 +4,10 @@
 
 ClassImp(Photon);
 
-TClonesArray *Photon::fgHit = nullptr;
-
 //______________________________________________________________________________
 Photon::Photon() : TObject() {
 
-    if (fgHit == nullptr) fgHit = new TClonesArray("THit", 200000);
-    fHit = fgHit;
+    fHit = new TClonesArray("THit", 1000);
 
     fNhitPmts = 0;
 }
@@ -18,8 +15,7 @@ Photon::Photon() : TObject() {
 //______________________________________________________________________________
 Photon::~Photon() {
     Clear();
-    delete fgHit;
-    fgHit = nullptr;
+    delete fHit;
 }
 //______________________________________________________________________________
 void Photon::Clear(Option_t * /*option*/) {
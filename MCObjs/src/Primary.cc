@@ -2,16 +2,13 @@
 
 ClassImp(Primary);
 
-TClonesArray *Primary::fgVertex = nullptr;
-
 //______________________________________________________________________________
 Primary::Primary() : TObject() {
     // Create an Primary object.
-    // When the constructor is invoked for the first time, the class static
-    // variable fgTracks is 0 and the TClonesArray fgTracks is created.
+    // The TClonesArray is owned by this object (not shared between
+    // instances), so recorders on different threads can fill their own.
 
-    if (fgVertex == nullptr) fgVertex = new TClonesArray("Vertex", 100);
-    fVertex = fgVertex;
+    fVertex = new TClonesArray("Vertex", 100);
 
     fNvertex = 0;
 }
@@ -19,8 +16,7 @@ Primary::Primary() : TObject() {
 //______________________________________________________________________________
 Primary::~Primary() {
     Clear();
-    delete fgVertex;
-    fgVertex = nullptr;
+    delete fVertex;
 }
 //______________________________________________________________________________
 void Primary::Clear(Option_t * /*option*/) {
@@ -2,16 +2,13 @@
 
 ClassImp(TGSD);
 
-TClonesArray *TGSD::fgCell = nullptr;
-
 //______________________________________________________________________________
 TGSD::TGSD() : TObject() {
     // Create an Track object.
-    // When the constructor is invoked for the first time, the class static
-    // variable fgTracks is 0 and the TClonesArray fgTracks is created.
+    // The TClonesArray is owned by this object (not shared between
+    // instances), so recorders on different threads can fill their own.
 
-    if (fgCell == nullptr) fgCell = new TClonesArray("TCell", 1000);
-    fCell = fgCell;
+    fCell = new TClonesArray("TCell", 1000);
 
     nTotCell = 0;
 }
@@ -19,8 +16,7 @@ TGSD::TGSD() : TObject() {
 //______________________________________________________________________________
 TGSD::~TGSD() {
     Clear();
-    delete fgCell;
-    fgCell = nullptr;
+    delete fCell;
 }
 void TGSD::Clear(Option_t * /*option*/) {
     //   fCell->Clear("C"); //will also call Track::Clear